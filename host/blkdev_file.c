@@ -0,0 +1,44 @@
+#define _XOPEN_SOURCE 700
+#include "blkdev_file.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int file_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    int fd = (int)(intptr_t)dev->priv;
+    size_t len = (size_t)count * BLKDEV_BLOCK_SIZE;
+    ssize_t n = pread(fd, buf, len, (off_t)lba * BLKDEV_BLOCK_SIZE);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+static int file_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    int fd = (int)(intptr_t)dev->priv;
+    size_t len = (size_t)count * BLKDEV_BLOCK_SIZE;
+    ssize_t n = pwrite(fd, buf, len, (off_t)lba * BLKDEV_BLOCK_SIZE);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+static int file_flush(blkdev_t *dev) {
+    return fsync((int)(intptr_t)dev->priv);
+}
+
+static const blkdev_ops_t file_ops = {
+    .read_blocks  = file_read,
+    .write_blocks = file_write,
+    .flush        = file_flush,
+};
+
+blkdev_t *blkdev_file_open(const char *name, const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    blkdev_t *dev = blkdev_register(name, &file_ops, (void *)(intptr_t)fd,
+                                    (uint32_t)(st.st_size / BLKDEV_BLOCK_SIZE));
+    if (!dev) close(fd);
+    return dev;
+}
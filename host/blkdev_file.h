@@ -0,0 +1,12 @@
+#ifndef BLKDEV_FILE_H
+#define BLKDEV_FILE_H
+
+#include "blkdev.h"
+
+// Host-only (Linux) block device backed by a disk image file, for
+// building and exercising the filesystem code in user space.
+// Opens `path` read-write and registers it as `name`; the capacity is
+// the file size in sectors. Returns NULL if the file cannot be opened.
+blkdev_t *blkdev_file_open(const char *name, const char *path);
+
+#endif /* BLKDEV_FILE_H */
@@ -0,0 +1,178 @@
+/* Host-side FAT benchmark: replays create/append/read/ls/delete
+ * workloads against an image file and reports the block I/O each
+ * phase costs. Build and run with `make bench`. */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fs.h"
+#include "fat.h"
+#include "bcache.h"
+#include "blkdev_file.h"
+
+typedef struct {
+    uint64_t rd_sectors, wr_sectors;
+    uint64_t rd_cmds, wr_cmds;
+} io_count_t;
+
+static io_count_t io;
+static const blkdev_ops_t *file_ops;
+static blkdev_ops_t counting_ops;
+
+static int count_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    io.rd_cmds++;
+    io.rd_sectors += count;
+    return file_ops->read_blocks(dev, lba, count, buf);
+}
+
+static int count_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    io.wr_cmds++;
+    io.wr_sectors += count;
+    return file_ops->write_blocks(dev, lba, count, buf);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t    ops;
+    uint32_t    failed;
+    io_count_t  start;
+    double      t0;
+} phase_t;
+
+static int warm;     /* keep the sector cache across phases */
+
+static void phase_begin(phase_t *p, const char *name) {
+    if (!warm) bcache_init();
+    p->name = name;
+    p->ops = p->failed = 0;
+    p->start = io;
+    p->t0 = now();
+}
+
+static void phase_end(phase_t *p) {
+    double dt = now() - p->t0;
+    uint32_t ops = p->ops ? p->ops : 1;
+    printf("%-8s %6u %8.1f %8.1f %8.1f %8.1f %10.3f %12.0f",
+           p->name, p->ops,
+           (double)(io.rd_sectors - p->start.rd_sectors) / ops,
+           (double)(io.wr_sectors - p->start.wr_sectors) / ops,
+           (double)(io.rd_cmds - p->start.rd_cmds) / ops,
+           (double)(io.wr_cmds - p->start.wr_cmds) / ops,
+           dt * 1e3, dt > 0 ? p->ops / dt : 0.0);
+    if (p->failed) printf("  (%u failed)", p->failed);
+    printf("\n");
+}
+
+static void count_entry(const char *name, uint32_t size) {
+    (void)name; (void)size;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n files] [-s bytes] [-a appends] [-c chunk] [-r reps] [-w] IMAGE\n"
+            "  IMAGE is modified in place; run it on a copy of fs.img.\n"
+            "  The sector cache is dropped before each phase unless -w is given.\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t files = 32, size = 4096, appends = 64, chunk = 512, reps = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:a:c:r:w")) != -1) {
+        switch (opt) {
+        case 'n': files   = (uint32_t)atoi(optarg); break;
+        case 's': size    = (uint32_t)atoi(optarg); break;
+        case 'a': appends = (uint32_t)atoi(optarg); break;
+        case 'c': chunk   = (uint32_t)atoi(optarg); break;
+        case 'r': reps    = (uint32_t)atoi(optarg); break;
+        case 'w': warm    = 1; break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || files > 9999) usage(argv[0]);
+
+    blkdev_t *dev = blkdev_file_open("hda", argv[optind]);
+    if (!dev) {
+        perror(argv[optind]);
+        return 1;
+    }
+    file_ops = dev->ops;
+    counting_ops = *file_ops;
+    counting_ops.read_blocks  = count_read;
+    counting_ops.write_blocks = count_write;
+    dev->ops = &counting_ops;
+
+    bcache_init();
+    fs_init("hda");
+    if (fat_type() == FAT_NONE) {
+        fprintf(stderr, "%s: no FAT volume\n", argv[optind]);
+        return 1;
+    }
+    printf("FAT%d, %u bytes free; %u files x %u bytes, %u appends x %u bytes\n\n",
+           fat_type(), fs_free_space(), files, size, appends, chunk);
+
+    uint8_t *data = malloc(size > chunk ? size : chunk);
+    uint8_t *buf  = malloc(size + appends * chunk);
+    if (!data || !buf) return 1;
+    for (uint32_t i = 0; i < size || i < chunk; i++) data[i] = (uint8_t)(i * 7 + 3);
+
+    char name[16];
+    phase_t p;
+    printf("%-8s %6s %8s %8s %8s %8s %10s %12s\n",
+           "phase", "ops", "rd/op", "wr/op", "rcmd/op", "wcmd/op", "ms", "ops/s");
+
+    phase_begin(&p, "create");
+    for (uint32_t i = 0; i < files; i++, p.ops++) {
+        snprintf(name, sizeof(name), "B%04u.DAT", i);
+        if (fs_write(name, data, size) < 0) p.failed++;
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "append");
+    for (uint32_t i = 0; i < appends; i++, p.ops++) {
+        if (fs_append("BAPPEND.DAT", data, chunk) < 0) p.failed++;
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "read");
+    for (uint32_t r = 0; r < reps; r++) {
+        for (uint32_t i = 0; i < files; i++, p.ops++) {
+            snprintf(name, sizeof(name), "B%04u.DAT", i);
+            if (fs_read(name, buf, size) != (int)size || memcmp(buf, data, size)) p.failed++;
+        }
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "ls");
+    for (uint32_t r = 0; r < reps; r++, p.ops++) fs_ls(count_entry);
+    phase_end(&p);
+
+    phase_begin(&p, "delete");
+    for (uint32_t i = 0; i < files; i++, p.ops++) {
+        snprintf(name, sizeof(name), "B%04u.DAT", i);
+        if (fs_delete(name) < 0) p.failed++;
+    }
+    if (fs_delete("BAPPEND.DAT") < 0) p.failed++;
+    p.ops++;
+    phase_end(&p);
+
+    printf("\ntotal: %llu sectors read in %llu cmds, %llu written in %llu cmds\n",
+           (unsigned long long)io.rd_sectors, (unsigned long long)io.rd_cmds,
+           (unsigned long long)io.wr_sectors, (unsigned long long)io.wr_cmds);
+    if (warm) {
+        bcache_stats_t st;
+        bcache_get_stats(&st);
+        printf("cache: %u hits / %u misses\n", st.hits, st.misses);
+    }
+    blkdev_flush(dev);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/* Host-side filesystem regression checks, run against scratch image
+ * files: a FAT root and, when given, an ext2 volume mounted at /X2.
+ * Each check builds its files, exercises the driver and compares what
+ * reads back with what was written. Build and run with `make test`. */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fs.h"
+#include "fat.h"
+#include "ext2.h"
+#include "bcache.h"
+#include "blkdev_file.h"
+
+#define SECTOR 512
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) failures++;
+}
+
+/* Text-like data that LZ4 shrinks well */
+static void fill_text(uint8_t *buf, uint32_t len) {
+    static const char *words[] = { "block ", "sector ", "cluster ", "chain ", "entry ",
+                                   "extent ", "volume ", "cache\n" };
+    uint32_t seed = 12345, n = 0;
+    while (n < len) {
+        seed = seed * 1103515245u + 12345u;
+        const char *w = words[(seed >> 16) % 8];
+        while (*w && n < len) buf[n++] = (uint8_t)*w++;
+    }
+}
+
+/* A compressed file that defrag relocates keeps its compressed flag:
+ * fs_stat and reads still give the original bytes. Its chain is made
+ * fragmented by compressing into the one-cluster holes left between
+ * two interleaved files, with the rest of the volume taken by a
+ * filler; dropping the filler then gives defrag room to move it. */
+static void test_compress_defrag(void) {
+    const uint32_t size = 90103;
+    uint8_t *data = malloc(size), *buf = malloc(size);
+    uint8_t one[SECTOR];
+    memset(one, 0xA5, sizeof(one));
+    fill_text(data, size);
+
+    for (int i = 0; i < 200; i++) {
+        if (fs_append("TODD.DAT", one, sizeof(one)) < 0 ||
+            fs_append("TEVEN.DAT", one, sizeof(one)) < 0) break;
+    }
+    check(fs_write("TPLAIN.TXT", data, size) == 0, "write TPLAIN.TXT");
+    uint32_t fill = fs_free_space();
+    uint8_t *filler = calloc(1, fill);
+    while (fill >= SECTOR && fs_write("TFILL.DAT", filler, fill) < 0) fill -= 32 * SECTOR;
+    free(filler);
+    fs_delete("TEVEN.DAT");
+
+    uint32_t stored = 0;
+    check(fs_compress("TPLAIN.TXT", &stored) == 0 && stored < size, "compress TPLAIN.TXT");
+    fs_delete("TFILL.DAT");
+
+    fs_frag_stats_t before, after;
+    int moved = fs_defrag(&before, &after);
+    check(moved > 0, "defrag moves the compressed file");
+
+    bcache_init();   /* read back from disk, not from the cache */
+    uint32_t st = 0;
+    check(fs_stat("TPLAIN.TXT", &st) == 0 && st == size, "stat size after defrag");
+    memset(buf, 0, size);
+    check(fs_read("TPLAIN.TXT", buf, size) == (int)size && memcmp(buf, data, size) == 0,
+          "content after defrag");
+
+    fs_delete("TPLAIN.TXT");
+    fs_delete("TODD.DAT");
+    free(data);
+    free(buf);
+}
+
+/* A write larger than the free space fails cleanly: the clusters it
+ * took are handed back, and the volume still reports and accepts the
+ * space it has left. */
+static void test_alloc_failure(void) {
+    uint32_t free_before = fs_free_space();
+    uint32_t len = free_before + 64 * 1024;
+    uint8_t *big = calloc(1, len);
+    uint8_t small[SECTOR];
+    memset(small, 0x5A, sizeof(small));
+
+    check(fs_write("TBIG.DAT", big, len) < 0, "write past free space fails");
+    check(fs_free_space() == free_before, "free space unchanged after failure");
+    check(fs_write("TSMALL.DAT", small, sizeof(small)) == 0, "small write after failure");
+    fs_delete("TSMALL.DAT");
+    fs_delete("TBIG.DAT");
+    free(big);
+}
+
+/* Threads writing and reading back their own files while all of them
+ * append to one shared file: the path, allocation and cache locks keep
+ * every file intact and no append is lost. */
+#define CONC_THREADS 4
+#define CONC_ROUNDS  40
+#define CONC_RECORD  64
+
+static int conc_errors;
+
+static void *conc_worker(void *arg) {
+    int id = (int)(intptr_t)arg;
+    char name[16];
+    uint8_t data[3 * SECTOR + 17], buf[sizeof(data)], rec[CONC_RECORD];
+    snprintf(name, sizeof(name), "TCONC%d.DAT", id);
+    memset(rec, 'a' + id, sizeof(rec));
+    for (int round = 0; round < CONC_ROUNDS; round++) {
+        for (uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(id * 31 + round + i);
+        if (fs_write(name, data, sizeof(data)) < 0 ||
+            fs_read(name, buf, sizeof(buf)) != (int)sizeof(buf) ||
+            memcmp(buf, data, sizeof(data)) != 0 ||
+            fs_append("TSHARED.LOG", rec, sizeof(rec)) < 0)
+            __sync_fetch_and_add(&conc_errors, 1);
+    }
+    return NULL;
+}
+
+static void test_concurrent(void) {
+    pthread_t th[CONC_THREADS];
+    for (int i = 0; i < CONC_THREADS; i++)
+        pthread_create(&th[i], NULL, conc_worker, (void *)(intptr_t)i);
+    for (int i = 0; i < CONC_THREADS; i++) pthread_join(th[i], NULL);
+    check(conc_errors == 0, "concurrent write/read/append");
+
+    uint32_t size = 0;
+    check(fs_stat("TSHARED.LOG", &size) == 0 &&
+          size == CONC_THREADS * CONC_ROUNDS * CONC_RECORD, "no append lost");
+    fs_delete("TSHARED.LOG");
+    for (int i = 0; i < CONC_THREADS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "TCONC%d.DAT", i);
+        fs_delete(name);
+    }
+}
+
+/* Enough entries with long names to turn one directory block into a
+ * hash tree and split its leaves many times over; every name must
+ * still be found, and deleted ones gone, afterwards. */
+#define HTREE_FILES 400
+
+static int htree_listed;
+
+static void count_entry(const char *name, uint32_t size) {
+    (void)name;
+    (void)size;
+    htree_listed++;
+}
+
+static void htree_name(char *out, uint32_t size, int i) {
+    snprintf(out, size, "X2/HT/entry-%03d-with-a-long-name.txt", i);
+}
+
+static void test_ext2_htree(void) {
+    char name[64];
+    int bad = 0;
+    check(fs_mkdir("X2/HT") == 0, "ext2 mkdir");
+    for (int i = 0; i < HTREE_FILES; i++) {
+        htree_name(name, sizeof(name), i);
+        if (fs_write(name, (const uint8_t *)name, (uint32_t)strlen(name)) < 0) bad++;
+    }
+    check(!bad, "ext2 create entries past a split");
+
+    bcache_init();   /* look up through the tree on disk */
+    for (int i = 0; i < HTREE_FILES; i++) {
+        uint8_t buf[64];
+        uint32_t size = 0;
+        htree_name(name, sizeof(name), i);
+        if (fs_stat(name, &size) < 0 || size != strlen(name) ||
+            fs_read(name, buf, sizeof(buf)) != (int)size || memcmp(buf, name, size) != 0)
+            bad++;
+    }
+    check(!bad, "ext2 htree lookup of every entry");
+
+    for (int i = 0; i < HTREE_FILES; i += 3) {
+        htree_name(name, sizeof(name), i);
+        if (fs_delete(name) < 0) bad++;
+    }
+    for (int i = 0; i < HTREE_FILES; i++) {
+        uint32_t size;
+        htree_name(name, sizeof(name), i);
+        if ((fs_stat(name, &size) == 0) != (i % 3 != 0)) bad++;
+    }
+    check(!bad, "ext2 htree lookup after deletes");
+    htree_listed = 0;
+    fs_ls_dir("X2/HT", count_entry);
+    check(htree_listed == HTREE_FILES - (HTREE_FILES + 2) / 3, "ext2 listing matches");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s FAT-IMAGE [EXT2-IMAGE]\n"
+                        "  Images are modified in place; run on scratch copies.\n", argv[0]);
+        return 2;
+    }
+    if (!blkdev_file_open("hda", argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+    bcache_init();
+    fs_init("hda");
+    if (fat_type() == FAT_NONE) {
+        fprintf(stderr, "%s: no FAT volume\n", argv[1]);
+        return 1;
+    }
+
+    test_compress_defrag();
+    test_alloc_failure();
+    test_concurrent();
+
+    if (argc == 3) {
+        ext2_t *x = blkdev_file_open("hdb", argv[2]) ? ext2_create(blkdev_find("hdb")) : NULL;
+        if (!x || fs_mount("X2", &ext2_ops, x) < 0) {
+            fprintf(stderr, "%s: no ext2 volume\n", argv[2]);
+            return 1;
+        }
+        test_ext2_htree();
+    }
+
+    printf("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
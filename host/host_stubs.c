@@ -0,0 +1,120 @@
+/* Kernel services the filesystem code links against, provided from
+ * libc for the host build. */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "lock.h"
+
+void *kmalloc(uint32_t size) {
+    return malloc(size ? size : 1);
+}
+
+/* No physical frames on the host: the page cache never gets populated,
+ * only its invalidation hooks run. */
+uint32_t pmm_alloc_frame(void) {
+    return (uint32_t)-1;
+}
+
+void pmm_free_frame(uint32_t frame) {
+    (void)frame;
+}
+
+/* Not in an interrupt handler, ever */
+int irq_context(void) {
+    return 0;
+}
+
+/* Kernel locks on top of pthreads, with the same recursion rules as
+ * src/lock.c; owners are small per-thread ids instead of task pids. */
+static pthread_mutex_t lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  lock_cond  = PTHREAD_COND_INITIALIZER;
+static __thread int    thread_id;
+static int             next_thread_id;
+
+static int self(void) {
+    if (!thread_id) thread_id = __sync_add_and_fetch(&next_thread_id, 1);
+    return thread_id;
+}
+
+void kmutex_init(kmutex_t *m) {
+    m->owner = LOCK_FREE;
+    m->depth = 0;
+}
+
+int kmutex_trylock(kmutex_t *m) {
+    int me = self(), r = -1;
+    pthread_mutex_lock(&lock_mutex);
+    if (m->owner == LOCK_FREE || m->owner == me) {
+        m->owner = me;
+        m->depth++;
+        r = 0;
+    }
+    pthread_mutex_unlock(&lock_mutex);
+    return r;
+}
+
+void kmutex_lock(kmutex_t *m) {
+    int me = self();
+    pthread_mutex_lock(&lock_mutex);
+    while (m->owner != LOCK_FREE && m->owner != me) pthread_cond_wait(&lock_cond, &lock_mutex);
+    m->owner = me;
+    m->depth++;
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void kmutex_unlock(kmutex_t *m) {
+    pthread_mutex_lock(&lock_mutex);
+    if (m->depth && --m->depth == 0) {
+        m->owner = LOCK_FREE;
+        pthread_cond_broadcast(&lock_cond);
+    }
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void krw_init(krwlock_t *l) {
+    l->readers = 0;
+    l->writer = LOCK_FREE;
+    l->depth = 0;
+}
+
+void krw_read_lock(krwlock_t *l) {
+    int me = self();
+    pthread_mutex_lock(&lock_mutex);
+    if (l->writer == me) {
+        l->depth++;
+    } else {
+        while (l->writer != LOCK_FREE) pthread_cond_wait(&lock_cond, &lock_mutex);
+        l->readers++;
+    }
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void krw_read_unlock(krwlock_t *l) {
+    pthread_mutex_lock(&lock_mutex);
+    if (l->writer == self()) {
+        if (l->depth && --l->depth == 0) l->writer = LOCK_FREE;
+    } else if (l->readers) {
+        l->readers--;
+    }
+    pthread_cond_broadcast(&lock_cond);
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void krw_write_lock(krwlock_t *l) {
+    int me = self();
+    pthread_mutex_lock(&lock_mutex);
+    while (l->writer != me && (l->writer != LOCK_FREE || l->readers))
+        pthread_cond_wait(&lock_cond, &lock_mutex);
+    l->writer = me;
+    l->depth++;
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void krw_write_unlock(krwlock_t *l) {
+    pthread_mutex_lock(&lock_mutex);
+    if (l->depth && --l->depth == 0) {
+        l->writer = LOCK_FREE;
+        pthread_cond_broadcast(&lock_cond);
+    }
+    pthread_mutex_unlock(&lock_mutex);
+}
@@ -0,0 +1,491 @@
+#include "ahci.h"
+#include "blkdev.h"
+#include "irq.h"
+#include "paging.h"
+#include "pci.h"
+#include "util.h"
+#include <stddef.h>
+
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_SATA  0x06
+#define PCI_PROGIF_AHCI    0x01
+
+/* HBA registers (dword index into ABAR) */
+#define HBA_CAP            (0x00 / 4)
+#define HBA_GHC            (0x04 / 4)
+#define HBA_IS             (0x08 / 4)
+#define HBA_PI             (0x0C / 4)
+
+#define HBA_CAP_SNCQ       (1u << 30)
+#define HBA_GHC_IE         (1u << 1)
+#define HBA_GHC_AE         (1u << 31)
+
+/* Port registers (dword index from the port's base) */
+#define PORT_CLB           (0x00 / 4)
+#define PORT_CLBU          (0x04 / 4)
+#define PORT_FB            (0x08 / 4)
+#define PORT_FBU           (0x0C / 4)
+#define PORT_IS            (0x10 / 4)
+#define PORT_IE            (0x14 / 4)
+#define PORT_CMD           (0x18 / 4)
+#define PORT_TFD           (0x20 / 4)
+#define PORT_SIG           (0x24 / 4)
+#define PORT_SSTS          (0x28 / 4)
+#define PORT_SERR          (0x30 / 4)
+#define PORT_SACT          (0x34 / 4)
+#define PORT_CI            (0x38 / 4)
+
+#define PORT_CMD_ST        (1u << 0)
+#define PORT_CMD_FRE       (1u << 4)
+#define PORT_CMD_FR        (1u << 14)
+#define PORT_CMD_CR        (1u << 15)
+
+/* Interrupts we take: D2H register FIS, PIO setup, set device bits
+ * (NCQ completions) and the error causes */
+#define PORT_IS_TFES       (1u << 30)
+#define PORT_IS_ERRORS     (PORT_IS_TFES | (1u << 29) | (1u << 28) | (1u << 27))
+#define PORT_IE_MASK       (PORT_IS_ERRORS | 0x0B)
+
+#define PORT_TFD_BSY_DRQ   0x88
+#define SATA_SIG_DISK      0x00000101
+#define SSTS_DET_PRESENT   3
+
+#define FIS_TYPE_REG_H2D   0x27
+
+#define ATA_CMD_IDENTIFY      0xEC
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_READ_FPDMA    0x60
+#define ATA_CMD_WRITE_FPDMA   0x61
+
+#define AHCI_MAX_HBAS      2
+#define AHCI_MAX_PORTS     4        /* disks across all HBAs */
+#define AHCI_SLOTS         32
+#define AHCI_MAX_PRDS      16       /* scatter-gather entries per command */
+#define AHCI_CHUNK_SECTORS 256      /* synchronous transfers: sectors per command */
+#define AHCI_SPINS         1000000  /* polls before a port or command is given up */
+
+typedef struct {
+    uint32_t flags;                 /* CFL | W | PRDTL << 16 */
+    volatile uint32_t prdbc;        /* bytes transferred */
+    uint32_t ctba, ctbau;
+    uint32_t reserved[4];
+} ahci_cmd_hdr_t;
+
+typedef struct {
+    uint32_t dba, dbau;
+    uint32_t reserved;
+    uint32_t dbc;                   /* byte count - 1 (bit 31: interrupt) */
+} ahci_prd_t;
+
+typedef struct {
+    uint8_t    cfis[64];
+    uint8_t    acmd[16];
+    uint8_t    reserved[48];
+    ahci_prd_t prdt[AHCI_MAX_PRDS];
+} ahci_cmd_tbl_t;
+
+/* Everything the HBA reads or writes for one port; the layout keeps each
+ * part at its required alignment (1 KiB, 256 B, 128 B). */
+typedef struct {
+    ahci_cmd_hdr_t cl[AHCI_SLOTS];
+    uint8_t        fis[256];
+    ahci_cmd_tbl_t tbl[AHCI_SLOTS];
+} __attribute__((aligned(1024))) ahci_mem_t;
+
+typedef struct {
+    volatile uint32_t *regs;
+    uint8_t            ncq;         /* READ/WRITE FPDMA QUEUED usable */
+    uint32_t           slots;       /* mask of command slots we may use */
+    uint32_t           active;      /* slots issued and not yet completed */
+    blk_request_t     *req[AHCI_SLOTS];
+    blkdev_t          *dev;
+    ahci_mem_t        *mem;
+} ahci_port_t;
+
+/* Waiter for the commands of one synchronous transfer */
+typedef struct {
+    volatile uint32_t pending;
+    volatile int      status;
+} ahci_wait_t;
+
+static volatile uint32_t *hbas[AHCI_MAX_HBAS];
+static int                nhbas;
+static ahci_port_t        ports[AHCI_MAX_PORTS];
+static int                nports;
+static ahci_mem_t         port_mem[AHCI_MAX_PORTS];
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Command slots are also completed from the HBA interrupt */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+static uint32_t phys(const void *p) {
+    return paging_phys((uint32_t)(uintptr_t)p);
+}
+
+/* Fill the slot's PRDT for [buf, buf+len), merging physically adjacent
+ * pages. Returns the entry count, or –1 if unmapped or too scattered. */
+static int map_prdt(ahci_cmd_tbl_t *t, const uint8_t *buf, uint32_t len) {
+    int n = 0;
+    uint32_t va = (uint32_t)(uintptr_t)buf;
+    uint32_t start = 0, bytes = 0;
+    while (len) {
+        uint32_t chunk = 4096 - (va & 0xFFF);
+        if (chunk > len) chunk = len;
+        uint32_t pa = paging_phys(va);
+        if (pa == (uint32_t)-1) return -1;
+        if (!bytes || start + bytes != pa || bytes + chunk > 0x400000) {
+            if (bytes) {
+                if (n == AHCI_MAX_PRDS) return -1;
+                t->prdt[n++] = (ahci_prd_t){ start, 0, 0, bytes - 1 };
+            }
+            start = pa;
+            bytes = 0;
+        }
+        bytes += chunk;
+        va += chunk;
+        len -= chunk;
+    }
+    if (bytes) {
+        if (n == AHCI_MAX_PRDS) return -1;
+        t->prdt[n++] = (ahci_prd_t){ start, 0, 0, bytes - 1 };
+    }
+    return n;
+}
+
+/* Build the command in `slot`: an H2D register FIS plus the PRDT.
+ * Returns 0, or –1 if the buffer cannot be described. */
+static int build(ahci_port_t *p, int slot, uint8_t cmd, uint32_t lba, uint32_t count,
+                 uint8_t *buf, uint32_t bytes, int write) {
+    ahci_cmd_tbl_t *t = &p->mem->tbl[slot];
+    int prds = bytes ? map_prdt(t, buf, bytes) : 0;
+    if (prds < 0) return -1;
+
+    uint8_t *f = t->cfis;
+    memset(f, 0, 20);
+    f[0] = FIS_TYPE_REG_H2D;
+    f[1] = 0x80;                                /* command, not control */
+    f[2] = cmd;
+    f[4] = (uint8_t)lba;
+    f[5] = (uint8_t)(lba >> 8);
+    f[6] = (uint8_t)(lba >> 16);
+    f[7] = (cmd == ATA_CMD_IDENTIFY) ? 0 : 0x40; /* LBA mode */
+    f[8] = (uint8_t)(lba >> 24);
+    if (cmd == ATA_CMD_READ_FPDMA || cmd == ATA_CMD_WRITE_FPDMA) {
+        f[3]  = (uint8_t)count;                 /* FPDMA: count in FEATURES */
+        f[11] = (uint8_t)(count >> 8);
+        f[12] = (uint8_t)(slot << 3);           /* tag */
+    } else {
+        f[12] = (uint8_t)count;
+        f[13] = (uint8_t)(count >> 8);
+    }
+
+    ahci_cmd_hdr_t *h = &p->mem->cl[slot];
+    h->flags = 5 | (write ? (1u << 6) : 0) | ((uint32_t)prds << 16);   /* CFL = 5 dwords */
+    h->prdbc = 0;
+    h->ctba  = phys(t);
+    h->ctbau = 0;
+    return 0;
+}
+
+/* Hand the slots in `mask` to the HBA with one register write each */
+static void issue(ahci_port_t *p, uint32_t mask, int queued) {
+    p->active |= mask;
+    if (queued) p->regs[PORT_SACT] = mask;
+    p->regs[PORT_CI] = mask;
+}
+
+static void stop_port(volatile uint32_t *r) {
+    r[PORT_CMD] &= ~PORT_CMD_ST;
+    for (int i = 0; i < AHCI_SPINS && (r[PORT_CMD] & PORT_CMD_CR); i++) { }
+    r[PORT_CMD] &= ~PORT_CMD_FRE;
+    for (int i = 0; i < AHCI_SPINS && (r[PORT_CMD] & PORT_CMD_FR); i++) { }
+}
+
+static void start_port(volatile uint32_t *r) {
+    r[PORT_SERR] = 0xFFFFFFFF;
+    r[PORT_IS]   = 0xFFFFFFFF;
+    r[PORT_CMD] |= PORT_CMD_FRE;
+    r[PORT_CMD] |= PORT_CMD_ST;
+}
+
+static void finish(ahci_port_t *p, int slot, int status) {
+    blk_request_t *req = p->req[slot];
+    p->active &= ~(1u << slot);
+    p->req[slot] = NULL;
+    if (!req) return;
+    req->status = status;
+    if (status < 0 && p->dev) p->dev->stats.errors++;
+    if (req->done) req->done(req);   /* may issue more work */
+}
+
+/* Complete every slot the HBA has cleared. A task-file error stops the
+ * port: everything outstanding fails and the port is restarted. IRQs off. */
+static void service(ahci_port_t *p) {
+    uint32_t is = p->regs[PORT_IS];
+    p->regs[PORT_IS] = is;
+    if (is & PORT_IS_ERRORS) {
+        uint32_t failed = p->active;
+        stop_port(p->regs);
+        start_port(p->regs);
+        for (int s = 0; s < AHCI_SLOTS; s++)
+            if (failed & (1u << s)) finish(p, s, -1);
+        return;
+    }
+    uint32_t busy = p->regs[PORT_CI] | p->regs[PORT_SACT];
+    uint32_t done = p->active & ~busy;
+    for (int s = 0; done; s++) {
+        if (done & (1u << s)) {
+            done &= ~(1u << s);
+            finish(p, s, 0);
+        }
+    }
+}
+
+/* Port status must be cleared before the HBA's, or the line stays up */
+static void ahci_irq(void) {
+    for (int h = 0; h < nhbas; h++) {
+        uint32_t is = hbas[h][HBA_IS];
+        if (!is) continue;
+        for (int i = 0; i < nports; i++) service(&ports[i]);
+        hbas[h][HBA_IS] = is;
+    }
+}
+
+static int free_slot(const ahci_port_t *p) {
+    uint32_t avail = p->slots & ~p->active;
+    for (int s = 0; s < AHCI_SLOTS; s++)
+        if (avail & (1u << s)) return s;
+    return -1;
+}
+
+static void sync_done(blk_request_t *req) {
+    ahci_wait_t *w = req->ctx;
+    if (req->status < 0) w->status = -1;
+    w->pending--;
+}
+
+static uint8_t rw_command(const ahci_port_t *p, int write) {
+    if (p->ncq) return write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    return write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+}
+
+/* Synchronous transfer: fill every free slot with a chunk, issue them
+ * together, poll until they are done (the shell calls in with interrupts
+ * off). Queued asynchronous commands are completed on the way. */
+static int ahci_transfer(blkdev_t *dev, int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    ahci_port_t *p = dev->priv;
+    blk_request_t reqs[AHCI_SLOTS];
+    ahci_wait_t w = { 0, 0 };
+    uint64_t start = rdtsc();
+    uint32_t flags = irq_save();
+    while (count && w.status == 0) {
+        uint32_t mask = 0;
+        int s;
+        while (count && (s = free_slot(p)) >= 0) {
+            uint32_t k = (count < AHCI_CHUNK_SECTORS) ? count : AHCI_CHUNK_SECTORS;
+            if (build(p, s, rw_command(p, write), lba, k, buf, k * BLKDEV_BLOCK_SIZE, write) < 0)
+                break;
+            blk_request_t *r = &reqs[s];
+            r->write = (uint8_t)write;
+            r->lba   = lba;
+            r->count = k;
+            r->buf   = buf;
+            r->done  = sync_done;
+            r->ctx   = &w;
+            p->req[s] = r;
+            p->active |= 1u << s;                /* reserve until issued */
+            mask |= 1u << s;
+            w.pending++;
+            lba += k;
+            count -= k;
+            buf += k * BLKDEV_BLOCK_SIZE;
+        }
+        if (!mask) {
+            /* slots busy with other work: wait; all idle: unmappable buffer */
+            if (!p->active) w.status = -1;
+            else service(p);
+            continue;
+        }
+        issue(p, mask, p->ncq);
+        while (w.pending) {
+            service(p);
+            asm volatile("pause");
+        }
+    }
+    irq_restore(flags);
+    dev->stats.busy_cycles += rdtsc() - start;
+    return w.status;
+}
+
+static int ahci_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    return ahci_transfer(dev, 0, lba, count, buf);
+}
+
+static int ahci_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    return ahci_transfer(dev, 1, lba, count, (uint8_t *)buf);
+}
+
+/* Run one non-queued command to completion in slot 0 once the port is
+ * idle (non-NCQ commands must not overlap queued ones). IRQs off. */
+static int run_polled(ahci_port_t *p, uint8_t cmd, uint8_t *buf, uint32_t bytes) {
+    while (p->active) service(p);
+    if (build(p, 0, cmd, 0, 0, buf, bytes, 0) < 0) return -1;
+    blk_request_t r = { 0 };
+    ahci_wait_t w = { 1, 0 };
+    r.done = sync_done;
+    r.ctx  = &w;
+    p->req[0] = &r;
+    issue(p, 1, 0);
+    for (int spins = 0; w.pending; spins++) {
+        if (spins == AHCI_SPINS) {
+            /* dead port: take the slot back */
+            stop_port(p->regs);
+            start_port(p->regs);
+            finish(p, 0, -1);
+            break;
+        }
+        service(p);
+    }
+    return w.status;
+}
+
+static int ahci_flush(blkdev_t *dev) {
+    ahci_port_t *p = dev->priv;
+    uint64_t start = rdtsc();
+    uint32_t flags = irq_save();
+    int r = run_polled(p, ATA_CMD_FLUSH_EXT, NULL, 0);
+    irq_restore(flags);
+    dev->stats.busy_cycles += rdtsc() - start;
+    return r;
+}
+
+static int ahci_submit(blkdev_t *dev, blk_request_t *req) {
+    ahci_port_t *p = dev->priv;
+    if (!req->count) {
+        req->status = 0;
+        if (req->done) req->done(req);
+        return 0;
+    }
+    if (req->count > 0xFFFF) return -1;          /* 16-bit sector count */
+    uint32_t flags = irq_save();
+    int s = free_slot(p);
+    int r = -1;
+    if (s >= 0 && build(p, s, rw_command(p, req->write), req->lba, req->count, req->buf,
+                        req->count * BLKDEV_BLOCK_SIZE, req->write) == 0) {
+        p->req[s] = req;
+        issue(p, 1u << s, p->ncq);
+        r = 0;
+    }
+    irq_restore(flags);
+    return r;
+}
+
+static void ahci_poll(blkdev_t *dev) {
+    uint32_t flags = irq_save();
+    service(dev->priv);
+    irq_restore(flags);
+}
+
+static const blkdev_ops_t ahci_ops = {
+    .read_blocks  = ahci_read,
+    .write_blocks = ahci_write,
+    .flush        = ahci_flush,
+    .submit       = ahci_submit,
+    .poll         = ahci_poll,
+};
+
+/* Point the port at its memory, start it and IDENTIFY the disk. Returns
+ * the LBA48 capacity in sectors (clamped to 32 bits), 0 if unusable. */
+static uint32_t port_setup(ahci_port_t *p, volatile uint32_t *regs, ahci_mem_t *mem,
+                           uint32_t hba_slots, int hba_ncq) {
+    p->regs = regs;
+    p->mem  = mem;
+    stop_port(regs);
+    memset(mem, 0, sizeof(*mem));
+    regs[PORT_CLB]  = phys(mem->cl);
+    regs[PORT_CLBU] = 0;
+    regs[PORT_FB]   = phys(mem->fis);
+    regs[PORT_FBU]  = 0;
+    for (int i = 0; i < AHCI_SPINS && (regs[PORT_TFD] & PORT_TFD_BSY_DRQ); i++) { }
+    start_port(regs);
+    regs[PORT_IE] = PORT_IE_MASK;
+
+    p->slots = (hba_slots >= 32) ? 0xFFFFFFFFu : (1u << hba_slots) - 1;
+    static uint16_t id[256];
+    if (run_polled(p, ATA_CMD_IDENTIFY, (uint8_t *)id, sizeof(id)) < 0) return 0;
+
+    /* NCQ needs both ends; the drive may queue fewer than 32 */
+    if (hba_ncq && (id[76] & (1u << 8))) {
+        uint32_t depth = (id[75] & 0x1F) + 1;
+        if (depth < hba_slots) p->slots = (1u << depth) - 1;
+        p->ncq = 1;
+    }
+    uint32_t lo = ((uint32_t)id[101] << 16) | id[100];
+    uint32_t hi = ((uint32_t)id[103] << 16) | id[102];
+    if (!(id[83] & (1u << 10))) {                 /* no LBA48: use the LBA28 count */
+        lo = ((uint32_t)id[61] << 16) | id[60];
+        hi = 0;
+    }
+    return hi ? 0xFFFFFFFFu : lo;
+}
+
+static void hba_init(const pci_dev_t *d) {
+    static const char *names[AHCI_MAX_PORTS] = { "sda", "sdb", "sdc", "sdd" };
+    if (nhbas == AHCI_MAX_HBAS || (d->bar[5] & 1) || !(d->bar[5] & ~0xFu)) return;
+    pci_enable(d);
+    volatile uint32_t *hba = (volatile uint32_t *)(uintptr_t)(d->bar[5] & ~0xFu);
+    hba[HBA_GHC] |= HBA_GHC_AE;
+    uint32_t cap = hba[HBA_CAP];
+    uint32_t slots = ((cap >> 8) & 0x1F) + 1;
+    uint32_t pi = hba[HBA_PI];
+
+    int found = 0;
+    for (int i = 0; i < 32 && nports < AHCI_MAX_PORTS; i++) {
+        if (!(pi & (1u << i))) continue;
+        volatile uint32_t *regs = hba + (0x100 + 0x80 * i) / 4;
+        if ((regs[PORT_SSTS] & 0xF) != SSTS_DET_PRESENT || regs[PORT_SIG] != SATA_SIG_DISK)
+            continue;
+        ahci_port_t *p = &ports[nports];
+        uint32_t sectors = port_setup(p, regs, &port_mem[nports], slots, (cap & HBA_CAP_SNCQ) != 0);
+        if (!sectors) {
+            stop_port(regs);
+            continue;
+        }
+        p->dev = blkdev_register(names[nports], &ahci_ops, p, sectors);
+        if (!p->dev) {
+            stop_port(regs);
+            continue;
+        }
+        nports++;
+        found = 1;
+    }
+    if (!found) return;
+    hbas[nhbas++] = hba;
+    hba[HBA_IS] = 0xFFFFFFFF;
+    hba[HBA_GHC] |= HBA_GHC_IE;
+    if (d->irq < 16) irq_install_handler(d->irq, ahci_irq);
+}
+
+void ahci_init(void) {
+    const pci_dev_t *d;
+    for (int i = 0; (d = pci_get(i)) != NULL; i++) {
+        if (d->class_code == PCI_CLASS_STORAGE && d->subclass == PCI_SUBCLASS_SATA &&
+            d->prog_if == PCI_PROGIF_AHCI)
+            hba_init(d);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+
+// AHCI (SATA) host bus adapters, e.g. QEMU's ich9-ahci. Each port with a
+// disk gets its command list, FIS receive area and one command table per
+// slot; data moves by DMA through PRDT scatter-gather entries. Drives
+// that support NCQ take up to 32 READ/WRITE FPDMA QUEUED commands at
+// once; completions are picked up from the HBA interrupt.
+
+// Must be called once at boot, after pci_init(). Registers every SATA
+// disk found as block device "sda", "sdb", ...
+void ahci_init(void);
+
+#endif /* AHCI_H */
@@ -0,0 +1,287 @@
+#include "aio.h"
+#include "blkdev.h"
+#include "fs.h"
+#include "pmm.h"
+#include "task.h"
+#include "util.h"
+#include "vfs.h"
+#include <stddef.h>
+
+typedef struct aio_ctx aio_ctx_t;
+
+/* A read handed to the block layer; completes from the driver's IRQ.
+ *
+ * The driver lands the data in `bounce`, a kernel frame, never in the
+ * task's buffer: each task has its own address space, and when the IRQ
+ * comes another one (or none) is loaded, so the user address would
+ * name someone else's memory; a PIO driver writes through it as is. A
+ * DMA driver would keep writing to the frames after a killed task gave
+ * them back. The data reaches `user` from aio_enter(), in the task's
+ * own context, and only then is the completion posted. */
+typedef struct {
+    blk_request_t req;
+    aio_ctx_t    *ctx;
+    uint32_t      user_data;
+    int32_t       res;          /* bytes to report on success */
+    uint8_t      *user;         /* where the task wants the sectors */
+    uint8_t      *bounce;       /* one frame, kept with the slot */
+    uint8_t       busy;
+    volatile uint8_t ready;     /* completed, not yet copied out */
+} aio_req_t;
+
+#define AIO_BOUNCE_BLOCKS  (PMM_FRAME_SIZE / BLKDEV_BLOCK_SIZE)
+
+struct aio_ctx {
+    aio_ring_t        *ring;    /* NULL = free slot */
+    int                pid;
+    uint8_t            dying;   /* owner exited, reads still in flight */
+    volatile uint32_t  inflight;
+    uint32_t           carry;   /* submitted by an enter that went to sleep */
+    aio_req_t          reqs[AIO_SQ_ENTRIES];
+};
+
+static aio_ctx_t rings[AIO_MAX_RINGS];
+
+/* Completions are posted both from syscalls and from IRQ14 */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+static void ctx_free(aio_ctx_t *c) {
+    for (int i = 0; i < AIO_SQ_ENTRIES; i++) {
+        if (c->reqs[i].bounce) pmm_free_frame((uint32_t)(uintptr_t)c->reqs[i].bounce / PMM_FRAME_SIZE);
+    }
+    pmm_free_frame((uint32_t)(uintptr_t)c->ring / PMM_FRAME_SIZE);
+    memset(c, 0, sizeof(*c));
+}
+
+static uint32_t cq_pending(const aio_ctx_t *c) {
+    uint32_t n = c->ring->cq_tail - c->ring->cq_head;
+    return n > AIO_CQ_ENTRIES ? AIO_CQ_ENTRIES : n;   /* a bogus cq_head */
+}
+
+static void post(aio_ctx_t *c, uint32_t user_data, int32_t res) {
+    uint32_t flags = irq_save();
+    aio_ring_t *r = c->ring;
+    aio_cqe_t *cqe = &r->cq[r->cq_tail % AIO_CQ_ENTRIES];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    r->cq_tail++;
+    irq_restore(flags);
+}
+
+/* IRQ side: the data is in the bounce frame, the owner copies it out */
+static void read_done(blk_request_t *req) {
+    aio_req_t *r = req->ctx;
+    aio_ctx_t *c = r->ctx;
+    if (c->dying) {
+        r->busy = 0;
+        c->inflight--;
+        if (!c->inflight) ctx_free(c);
+        return;
+    }
+    r->ready = 1;
+    task_wakeup(c);
+}
+
+static int any_ready(const aio_ctx_t *c) {
+    for (int i = 0; i < AIO_SQ_ENTRIES; i++) {
+        if (c->reqs[i].busy && c->reqs[i].ready) return 1;
+    }
+    return 0;
+}
+
+/* Task side, inside aio_enter(): copy finished reads to their buffers
+ * and post them. They stay in flight, holding their CQ slot, till now. */
+static void deliver(aio_ctx_t *c) {
+    for (int i = 0; i < AIO_SQ_ENTRIES; i++) {
+        aio_req_t *r = &c->reqs[i];
+        if (!r->busy || !r->ready) continue;
+        if (r->req.status >= 0) memcpy(r->user, r->bounce, r->req.count * BLKDEV_BLOCK_SIZE);
+        post(c, r->user_data, r->req.status < 0 ? -1 : r->res);
+        uint32_t flags = irq_save();
+        r->ready = 0;
+        r->busy = 0;
+        c->inflight--;
+        irq_restore(flags);
+    }
+}
+
+static int op_open(aio_ctx_t *c, const aio_sqe_t *e) {
+    int flags = O_RDWR;
+    if (e->flags & AIO_OPEN_CREATE) flags |= O_CREAT;
+    return vfs_open(c->pid, (const char *)(uintptr_t)e->addr, flags);
+}
+
+/* Whole sectors that sit in one contiguous run on disk go to the block
+ * layer and complete from its interrupt; a sub-sector tail at EOF is
+ * copied here, and anything the filesystem cannot map (RAM mounts,
+ * unaligned offsets) is served synchronously through vfs_pread(), which
+ * bounces it like read(). A read that crosses a
+ * fragment boundary comes back short, like read() on a pipe. */
+static void op_read(aio_ctx_t *c, const aio_sqe_t *e) {
+    const char *path = vfs_path(c->pid, e->fd, 0);
+    uint8_t *buf = (uint8_t *)(uintptr_t)e->addr;
+    uint32_t size;
+    if (!path || fs_stat(path, &size) < 0) { post(c, e->user_data, -1); return; }
+    if (e->off >= size || !e->len) { post(c, e->user_data, 0); return; }
+    uint32_t want = (e->len < size - e->off) ? e->len : size - e->off;
+
+    blkdev_t *dev;
+    uint32_t lba;
+    int n = fs_bmap(path, e->off, want, &dev, &lba);
+    aio_req_t *r = NULL;
+    for (int i = 0; i < AIO_SQ_ENTRIES && n > 0 && !r; i++) {
+        if (!c->reqs[i].busy) r = &c->reqs[i];
+    }
+    if (r && !r->bounce) {
+        uint32_t fr = pmm_alloc_frame();
+        if (fr != (uint32_t)-1) r->bounce = (uint8_t *)(uintptr_t)(fr * PMM_FRAME_SIZE);
+        else r = NULL;
+    }
+    if (!r) {
+        post(c, e->user_data, vfs_pread(c->pid, e->fd, e->off, buf, want));
+        return;
+    }
+
+    if (n > AIO_BOUNCE_BLOCKS) n = AIO_BOUNCE_BLOCKS;   /* one bounce frame: short read */
+    uint32_t direct = (uint32_t)n * BLKDEV_BLOCK_SIZE;
+    uint32_t tail = want - direct;
+    if (tail >= BLKDEV_BLOCK_SIZE) tail = 0;          /* next fragment: short read */
+    if (tail && vfs_pread(c->pid, e->fd, e->off + direct, buf + direct, tail) != (int)tail) tail = 0;
+
+    r->ctx         = c;
+    r->user_data   = e->user_data;
+    r->res         = (int32_t)(direct + tail);
+    r->user        = buf;
+    r->busy        = 1;
+    r->ready       = 0;
+    r->req.write   = 0;
+    r->req.lba     = lba;
+    r->req.count   = (uint32_t)n;
+    r->req.buf     = r->bounce;
+    r->req.done    = read_done;
+    r->req.ctx     = r;
+    uint32_t flags = irq_save();
+    c->inflight++;
+    irq_restore(flags);
+    if (blkdev_submit(dev, &r->req) < 0) {
+        flags = irq_save();
+        c->inflight--;
+        r->busy = 0;
+        irq_restore(flags);
+        post(c, e->user_data, vfs_pread(c->pid, e->fd, e->off, buf, want));
+    }
+}
+
+static void dispatch(aio_ctx_t *c, const aio_sqe_t *e) {
+    int32_t res = -1;
+    switch (e->opcode) {
+    case AIO_OP_NOP:
+        res = 0;
+        break;
+    case AIO_OP_OPEN:
+        res = op_open(c, e);
+        break;
+    case AIO_OP_READ:
+        op_read(c, e);
+        return;
+    case AIO_OP_WRITE:
+        res = vfs_pwrite(c->pid, e->fd, e->off, (const uint8_t *)(uintptr_t)e->addr, e->len);
+        break;
+    case AIO_OP_FSYNC:
+        res = vfs_fsync(c->pid, e->fd);
+        break;
+    case AIO_OP_CLOSE:
+        res = vfs_close(c->pid, e->fd);
+        break;
+    }
+    post(c, e->user_data, res);
+}
+
+static aio_ctx_t *lookup(int pid, uint32_t ring) {
+    for (int i = 0; i < AIO_MAX_RINGS; i++) {
+        aio_ctx_t *c = &rings[i];
+        if (c->ring && !c->dying && c->pid == pid && (uint32_t)(uintptr_t)c->ring == ring)
+            return c;
+    }
+    return NULL;
+}
+
+uint32_t aio_setup(int pid) {
+    for (int i = 0; i < AIO_MAX_RINGS; i++) {
+        aio_ctx_t *c = &rings[i];
+        if (c->ring) continue;
+        uint32_t fr = pmm_alloc_frame();
+        if (fr == (uint32_t)-1) return 0;
+        memset(c, 0, sizeof(*c));
+        c->ring = (aio_ring_t *)(uintptr_t)(fr * PMM_FRAME_SIZE);
+        c->pid  = pid;
+        memset(c->ring, 0, PMM_FRAME_SIZE);
+        c->ring->sq_entries = AIO_SQ_ENTRIES;
+        c->ring->cq_entries = AIO_CQ_ENTRIES;
+        return (uint32_t)(uintptr_t)c->ring;
+    }
+    return 0;
+}
+
+int aio_enter(int pid, uint32_t ring, uint32_t to_submit, uint32_t min_complete) {
+    aio_ctx_t *c = lookup(pid, ring);
+    if (!c) return -1;
+    aio_ring_t *r = c->ring;
+    uint32_t submitted = c->carry;
+    c->carry = 0;
+    deliver(c);
+    while (submitted < to_submit && r->sq_head != r->sq_tail) {
+        /* every request in flight or waiting to be reaped owns a CQ slot */
+        if (cq_pending(c) + c->inflight >= AIO_CQ_ENTRIES) break;
+        aio_sqe_t e = r->sq[r->sq_head % AIO_SQ_ENTRIES];
+        r->sq_head++;
+        dispatch(c, &e);
+        submitted++;
+    }
+    if (min_complete > AIO_CQ_ENTRIES) min_complete = AIO_CQ_ENTRIES;
+    /* off the CPU until a completion; checked and slept on with the
+     * disk IRQ held off, so its wakeup cannot come in between. One that
+     * landed after deliver() is copied out first. */
+    for (;;) {
+        deliver(c);
+        uint32_t flags = irq_save();
+        if (cq_pending(c) >= min_complete || !c->inflight) {
+            irq_restore(flags);
+            return (int)submitted;
+        }
+        if (!any_ready(c)) {
+            c->carry = submitted;
+            task_sleep(c);
+            irq_restore(flags);
+            return AIO_RESTART;
+        }
+        irq_restore(flags);
+    }
+}
+
+void aio_release(int pid) {
+    for (int i = 0; i < AIO_MAX_RINGS; i++) {
+        aio_ctx_t *c = &rings[i];
+        if (!c->ring || c->dying || c->pid != pid) continue;
+        uint32_t flags = irq_save();
+        c->dying = 1;
+        /* completed reads nobody will copy out now */
+        for (int j = 0; j < AIO_SQ_ENTRIES; j++) {
+            aio_req_t *r = &c->reqs[j];
+            if (r->busy && r->ready) {
+                r->busy = r->ready = 0;
+                c->inflight--;
+            }
+        }
+        if (!c->inflight) ctx_free(c);
+        irq_restore(flags);
+    }
+}
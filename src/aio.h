@@ -0,0 +1,79 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+
+// Asynchronous I/O rings shared with user space. A task sets up a ring
+// (one page, mapped at the same address for the task and the kernel),
+// queues requests in the submission ring and hands a whole batch to the
+// kernel with one SYS_AIO_ENTER. Results show up in the completion ring;
+// sector-aligned reads of disk files finish from the disk interrupt into
+// a kernel page and are copied to the task's buffer and posted by its
+// next SYS_AIO_ENTER (min_complete 0 just collects them). Such a read
+// moves at most one page; a longer one comes back short.
+//
+// User side protocol:
+//   sqe = &r->sq[r->sq_tail % r->sq_entries]; fill it; r->sq_tail++;
+//   io_ring_enter(r, n, wait);
+//   while (r->cq_head != r->cq_tail) { use r->cq[r->cq_head % r->cq_entries]; r->cq_head++; }
+
+#define AIO_SQ_ENTRIES  64
+#define AIO_CQ_ENTRIES  128
+#define AIO_MAX_RINGS   4
+
+enum {
+    AIO_OP_NOP,
+    AIO_OP_OPEN,     // addr = path; res = fd in the task's table (vfs.h)
+    AIO_OP_READ,     // fd, off, addr, len; res = bytes read (may be short)
+    AIO_OP_WRITE,    // fd, off, addr, len; res = bytes written
+    AIO_OP_FSYNC,    // fd; res = 0
+    AIO_OP_CLOSE,    // fd; res = 0
+};
+
+#define AIO_OPEN_CREATE 0x01    // flags for AIO_OP_OPEN: create if missing
+
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  flags;
+    int16_t  fd;
+    uint32_t off;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t user_data;         // copied to the completion
+} aio_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t  res;               // result, –1 on error
+} aio_cqe_t;
+
+typedef struct {
+    volatile uint32_t sq_head;  // kernel consumes
+    volatile uint32_t sq_tail;  // user produces
+    volatile uint32_t cq_head;  // user consumes
+    volatile uint32_t cq_tail;  // kernel produces
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    aio_sqe_t sq[AIO_SQ_ENTRIES];
+    aio_cqe_t cq[AIO_CQ_ENTRIES];
+} aio_ring_t;
+
+// Allocate a ring for task `pid`. Returns its address, 0 on failure.
+uint32_t aio_setup(int pid);
+
+// Submit up to `to_submit` queued entries, then wait until at least
+// `min_complete` completions are waiting in the ring. Entries are only
+// taken while their completions are guaranteed a CQ slot. Returns the
+// number submitted, or –1 if `ring` is not one of `pid`'s rings.
+// Waiting puts the task to sleep (task_sleep()) and returns
+// AIO_RESTART: the caller issues the same call again once woken, and
+// the entries already taken count towards that call's `to_submit` and
+// result.
+#define AIO_RESTART  (-2)
+int aio_enter(int pid, uint32_t ring, uint32_t to_submit, uint32_t min_complete);
+
+// Tear down every ring of `pid` (task exit). A ring with reads still in
+// flight is freed by its last completion.
+void aio_release(int pid);
+
+#endif /* AIO_H */
@@ -1,76 +1,398 @@
 #include "ata.h"
+#include "blkdev.h"
+#include "irq.h"
 #include "util.h"
+#include <stddef.h>
 
-// I/O ports for primary ATA
-#define ATA_DATA      0x1F0
-#define ATA_ERROR     0x1F1
-#define ATA_SECTOR_CNT 0x1F2
-#define ATA_LBA_LOW   0x1F3
-#define ATA_LBA_MID   0x1F4
-#define ATA_LBA_HIGH  0x1F5
-#define ATA_DRIVE     0x1F6
-#define ATA_COMMAND   0x1F7
-#define ATA_CONTROL   0x3F6
+// Task-file registers, as offsets from the channel's I/O base
+#define ATA_DATA      0
+#define ATA_ERROR     1
+#define ATA_SECTOR_CNT 2
+#define ATA_LBA_LOW   3
+#define ATA_LBA_MID   4
+#define ATA_LBA_HIGH  5
+#define ATA_DRIVE     6
+#define ATA_COMMAND   7
 
 #define ATA_CMD_READ  0x20
 #define ATA_CMD_WRITE 0x30
+#define ATA_CMD_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
 
-void ata_init(void) {
-    // nothing to do for PIO‑only
+#define ATA_CTL_NIEN  0x02   /* mask INTRQ: polled commands */
+
+#define ATA_SR_ERR    0x01
+#define ATA_SR_DRQ    0x08
+#define ATA_SR_BSY    0x80
+
+/* Polls before giving up on a drive that never answers IDENTIFY */
+#define ATA_PROBE_SPINS 100000
+
+/* 32 deep: one aio ring's worth of reads per channel */
+#define ATA_QUEUE_DEPTH 32
+
+typedef struct {
+    blkdev_t      *dev;
+    blk_request_t *req;
+} ata_slot_t;
+
+/* One IDE channel: two drives sharing a task file, so at most one
+ * command runs per channel while both channels work in parallel. */
+typedef struct {
+    uint16_t    io;                  /* task file base */
+    uint16_t    ctl;                 /* device control register */
+    uint8_t     irq;
+    ata_slot_t  queue[ATA_QUEUE_DEPTH];
+    uint32_t    q_head, q_tail;      /* FIFO of pending requests */
+    int         active;              /* queue[q_head] is on the bus */
+    uint8_t    *xfer_buf;            /* next sector of the active request */
+    uint32_t    xfer_lba, xfer_left; /* sectors not yet moved */
+    uint32_t    xfer_burst;          /* sectors left in the current command */
+} ata_channel_t;
+
+static ata_channel_t channels[ATA_CHANNELS] = {
+    { .io = 0x1F0, .ctl = 0x3F6, .irq = 14 },
+    { .io = 0x170, .ctl = 0x376, .irq = 15 },
+};
+
+static ata_stats_t stats[ATA_MAX_DRIVES];
+
+static inline ata_channel_t *chan(uint8_t drive) {
+    return &channels[(drive >> 1) & 1];
 }
 
-int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer) {
-    // 1) Select drive & LBA
-    outb(ATA_CONTROL, 0);
-    outb(ATA_DRIVE, 0xE0 | ((drive & 1) << 4) | ((lba >> 24) & 0x0F));
-    outb(ATA_SECTOR_CNT, 1);
-    outb(ATA_LBA_LOW,  (uint8_t)(lba & 0xFF));
-    outb(ATA_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
-    // 2) Issue READ command
-    outb(ATA_COMMAND, ATA_CMD_READ);
-    // 3) Wait for BSY=0
-    uint8_t status;
-    do { status = inb(ATA_COMMAND); } while (status & 0x80);
-    // 4) Wait for DRQ=1
-    while (!(inb(ATA_COMMAND) & 0x08));
-    // 5) Read 256 words
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Polled transfers run with interrupts off so IRQ14 cannot interleave */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+static void pio_in(const ata_channel_t *c, uint8_t *buf) {
+    for (int i = 0; i < 256; i++) {
+        uint16_t w = inw(c->io + ATA_DATA);
+        buf[2*i + 0] = w & 0xFF;
+        buf[2*i + 1] = w >> 8;
+    }
+}
+
+static void pio_out(const ata_channel_t *c, const uint8_t *buf) {
     for (int i = 0; i < 256; i++) {
-        uint16_t w = inw(ATA_DATA);
-        buffer[2*i + 0] = w & 0xFF;
-        buffer[2*i + 1] = w >> 8;
+        uint16_t w = ((uint16_t)buf[2*i + 1] << 8) | buf[2*i];
+        asm volatile("outw %%ax, %%dx" :: "a"(w), "d"(c->io + ATA_DATA));
     }
+}
+
+/* 8-bit sector count register; 0 encodes 256 */
+#define ATA_MAX_SECTORS 256
+
+/* Program drive/LBA/count registers and issue `cmd` (count 0 = 256).
+ * `irq` selects whether the drive raises the channel's IRQ for it. */
+static void ata_issue(uint8_t drive, uint32_t lba, uint8_t count, uint8_t cmd, int irq) {
+    ata_channel_t *c = chan(drive);
+    outb(c->ctl, irq ? 0 : ATA_CTL_NIEN);
+    outb(c->io + ATA_DRIVE, 0xE0 | ((drive & 1) << 4) | ((lba >> 24) & 0x0F));
+    outb(c->io + ATA_SECTOR_CNT, count);
+    outb(c->io + ATA_LBA_LOW,  (uint8_t)(lba & 0xFF));
+    outb(c->io + ATA_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
+    outb(c->io + ATA_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
+    outb(c->io + ATA_COMMAND, cmd);
+}
+
+/* Wait for BSY=0 then DRQ=1 before each 512-byte data block */
+static void ata_wait_drq(uint8_t drive) {
+    uint16_t port = chan(drive)->io + ATA_COMMAND;
+    uint64_t t0 = rdtsc();
+    uint8_t status;
+    do { status = inb(port); } while (status & 0x80);
+    while (!(inb(port) & 0x08));
+    stats[drive].busy_cycles += rdtsc() - t0;
+}
+
+/* Wait for the drive to go idle (BSY and DRQ clear) after a write */
+static uint8_t ata_wait_idle(uint8_t drive) {
+    uint16_t port = chan(drive)->io + ATA_COMMAND;
+    uint64_t t0 = rdtsc();
+    uint8_t status;
+    do { status = inb(port); } while (status & 0x80);
+    while ((status = inb(port)) & 0x08);
+    stats[drive].busy_cycles += rdtsc() - t0;
+    return status;
+}
+
+static void ata_drain(ata_channel_t *c);
+
+int ata_read_sectors(uint8_t drive, uint32_t lba, uint32_t count, uint8_t *buffer) {
+    if (drive >= ATA_MAX_DRIVES) return -1;
+    ata_channel_t *c = chan(drive);
+    uint32_t flags = irq_save();
+    ata_drain(c);
+    while (count) {
+        uint32_t n = (count > ATA_MAX_SECTORS) ? ATA_MAX_SECTORS : count;
+        // 1) Select drive & LBA, issue one READ for the whole burst
+        ata_issue(drive, lba, (uint8_t)n, ATA_CMD_READ, 0);
+        stats[drive].rd_cmds++;
+        stats[drive].rd_sectors += n;
+        for (uint32_t s = 0; s < n; s++) {
+            // 2) Device raises DRQ once per sector
+            ata_wait_drq(drive);
+            // 3) Read 256 words
+            pio_in(c, buffer);
+            buffer += 512;
+        }
+        lba += n;
+        count -= n;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+int ata_write_sectors(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t *buffer) {
+    if (drive >= ATA_MAX_DRIVES) return -1;
+    ata_channel_t *c = chan(drive);
+    uint32_t flags = irq_save();
+    ata_drain(c);
+    while (count) {
+        uint32_t n = (count > ATA_MAX_SECTORS) ? ATA_MAX_SECTORS : count;
+        // Issue WRITE SECTORS command for the whole burst
+        ata_issue(drive, lba, (uint8_t)n, ATA_CMD_WRITE, 0);
+        stats[drive].wr_cmds++;
+        stats[drive].wr_sectors += n;
+        for (uint32_t s = 0; s < n; s++) {
+            // Wait for DRQ set (device ready to accept data)
+            ata_wait_drq(drive);
+            // Write 256 words (512 bytes)
+            pio_out(c, buffer);
+            buffer += 512;
+        }
+        // Final wait for device to finish write (BSY clear, DRQ clear)
+        ata_wait_idle(drive);
+        lba += n;
+        count -= n;
+    }
+    irq_restore(flags);
     return 0;
 }
 
+int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer) {
+    return ata_read_sectors(drive, lba, 1, buffer);
+}
+
 int ata_write_sector(uint8_t drive, uint32_t lba, const uint8_t *buffer) {
-    // Select drive & LBA
-    outb(ATA_CONTROL, 0);
-    outb(ATA_DRIVE, 0xE0 | ((drive & 1) << 4) | ((lba >> 24) & 0x0F));
-    outb(ATA_SECTOR_CNT, 1);
-    outb(ATA_LBA_LOW,  (uint8_t)(lba & 0xFF));
-    outb(ATA_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
-
-    // Issue WRITE SECTORS command
-    outb(ATA_COMMAND, ATA_CMD_WRITE);
-
-    // Wait for BSY clear
-    uint8_t status;
-    do { status = inb(ATA_COMMAND); } while (status & 0x80);
+    return ata_write_sectors(drive, lba, 1, buffer);
+}
 
-    // Wait for DRQ set (device ready to accept data)
-    while (!(inb(ATA_COMMAND) & 0x08));
+int ata_flush(uint8_t drive) {
+    if (drive >= ATA_MAX_DRIVES) return -1;
+    ata_channel_t *c = chan(drive);
+    uint32_t flags = irq_save();
+    ata_drain(c);
+    outb(c->ctl, ATA_CTL_NIEN);
+    outb(c->io + ATA_DRIVE, 0xE0 | ((drive & 1) << 4));
+    outb(c->io + ATA_COMMAND, ATA_CMD_FLUSH);
+    stats[drive].flushes++;
+    int r = (ata_wait_idle(drive) & ATA_SR_ERR) ? -1 : 0;
+    irq_restore(flags);
+    return r;
+}
 
-    // Write 256 words (512 bytes)
-    for (int i = 0; i < 256; i++) {
-        uint16_t w = ((uint16_t)buffer[2*i + 1] << 8) | buffer[2*i];
-        asm volatile("outw %%ax, %%dx" :: "a"(w), "d"(ATA_DATA));
+void ata_get_stats(uint8_t drive, ata_stats_t *out) {
+    *out = stats[drive % ATA_MAX_DRIVES];
+}
+
+/* ── interrupt-driven queue ──────────────────────────────────────
+ * Submitted requests wait in their channel's FIFO and are run one
+ * command at a time by the channel's IRQ (14 or 15): the handler moves
+ * each sector as the drive raises DRQ and completes the request after
+ * the last one. Polled transfers first drain that channel's queue with
+ * interrupts off, so both paths share the channel and a request never
+ * overlaps a polled command. The two channels run independently. */
+
+/* Issue the next command of the active request. A write hands over its
+ * first sector right away; every later step is driven by the IRQ. */
+static void start_burst(ata_channel_t *c) {
+    ata_slot_t *s = &c->queue[c->q_head % ATA_QUEUE_DEPTH];
+    uint8_t drive = *(uint8_t *)s->dev->priv;
+    uint32_t n = (c->xfer_left > ATA_MAX_SECTORS) ? ATA_MAX_SECTORS : c->xfer_left;
+    c->xfer_burst = n;
+    if (s->req->write) {
+        ata_issue(drive, c->xfer_lba, (uint8_t)n, ATA_CMD_WRITE, 1);
+        stats[drive].wr_cmds++;
+        stats[drive].wr_sectors += n;
+        ata_wait_drq(drive);
+        pio_out(c, c->xfer_buf);
+        c->xfer_buf += 512; c->xfer_burst--; c->xfer_left--;
+    } else {
+        ata_issue(drive, c->xfer_lba, (uint8_t)n, ATA_CMD_READ, 1);
+        stats[drive].rd_cmds++;
+        stats[drive].rd_sectors += n;
     }
+    c->xfer_lba += n;
+}
 
-    // Final wait for device to finish write (BSY clear, DRQ clear)
-    do { status = inb(ATA_COMMAND); } while (status & 0x80);
-    while (inb(ATA_COMMAND) & 0x08);
+static void start_next(ata_channel_t *c) {
+    while (!c->active && c->q_head != c->q_tail) {
+        blk_request_t *req = c->queue[c->q_head % ATA_QUEUE_DEPTH].req;
+        c->active    = 1;
+        c->xfer_buf  = req->buf;
+        c->xfer_lba  = req->lba;
+        c->xfer_left = req->count;
+        if (c->xfer_left) { start_burst(c); return; }
+        /* nothing to move: complete on the spot */
+        c->active = 0;
+        c->q_head++;
+        req->status = 0;
+        if (req->done) req->done(req);
+    }
+}
+
+static void complete(ata_channel_t *c, int status) {
+    ata_slot_t s = c->queue[c->q_head % ATA_QUEUE_DEPTH];
+    c->q_head++;
+    c->active = 0;
+    s.req->status = status;
+    if (status < 0) s.dev->stats.errors++;
+    if (s.req->done) s.req->done(s.req);   /* may queue more work */
+    start_next(c);
+}
+
+/* Advance the channel's active request by one step if the drive is
+ * ready for it. Reading STATUS also acknowledges the drive's interrupt,
+ * so stale or early calls are harmless. */
+static void ata_service(ata_channel_t *c) {
+    uint8_t status = inb(c->io + ATA_COMMAND);
+    if (!c->active) return;
+    if (status & ATA_SR_BSY) return;
+    if (status & ATA_SR_ERR) { complete(c, -1); return; }
+
+    blk_request_t *req = c->queue[c->q_head % ATA_QUEUE_DEPTH].req;
+    if (c->xfer_burst) {
+        if (!(status & ATA_SR_DRQ)) return;
+        if (req->write) pio_out(c, c->xfer_buf);
+        else            pio_in(c, c->xfer_buf);
+        c->xfer_buf += 512; c->xfer_burst--; c->xfer_left--;
+        /* a write's command ends with one more IRQ once the drive is idle */
+        if (req->write || c->xfer_burst) return;
+    } else if (status & ATA_SR_DRQ) {
+        return;
+    }
+    if (c->xfer_left) start_burst(c);
+    else              complete(c, 0);
+}
+
+static void ata_irq_primary(void) {
+    ata_service(&channels[0]);
+}
+
+static void ata_irq_secondary(void) {
+    ata_service(&channels[1]);
+}
+
+/* Busy-wait until every queued request has completed (interrupts off) */
+static void ata_drain(ata_channel_t *c) {
+    while (c->active) ata_service(c);
+}
 
+static int ata_submit(blkdev_t *dev, blk_request_t *req) {
+    ata_channel_t *c = chan(*(uint8_t *)dev->priv);
+    uint32_t flags = irq_save();
+    if (c->q_tail - c->q_head >= ATA_QUEUE_DEPTH) {
+        irq_restore(flags);
+        return -1;
+    }
+    c->queue[c->q_tail % ATA_QUEUE_DEPTH].dev = dev;
+    c->queue[c->q_tail % ATA_QUEUE_DEPTH].req = req;
+    c->q_tail++;
+    start_next(c);
+    irq_restore(flags);
     return 0;
 }
+
+/* One step of the device's channel without waiting for its IRQ */
+static void ata_poll(blkdev_t *dev) {
+    uint32_t flags = irq_save();
+    ata_service(chan(*(uint8_t *)dev->priv));
+    irq_restore(flags);
+}
+
+/* IDENTIFY DEVICE; returns the LBA28 sector count, 0 if no ATA disk answers */
+static uint32_t ata_identify(uint8_t drive) {
+    uint16_t io = chan(drive)->io;
+    outb(io + ATA_DRIVE, 0xA0 | ((drive & 1) << 4));
+    outb(io + ATA_SECTOR_CNT, 0);
+    outb(io + ATA_LBA_LOW, 0);
+    outb(io + ATA_LBA_MID, 0);
+    outb(io + ATA_LBA_HIGH, 0);
+    outb(io + ATA_COMMAND, ATA_CMD_IDENTIFY);
+
+    uint8_t status = inb(io + ATA_COMMAND);
+    if (status == 0 || status == 0xFF) return 0;      /* nothing on the bus */
+    int spins = ATA_PROBE_SPINS;
+    while ((status & ATA_SR_BSY) && --spins) status = inb(io + ATA_COMMAND);
+    if (!spins) return 0;
+    /* ATAPI and SATA bridges put a signature here instead of answering */
+    if (inb(io + ATA_LBA_MID) || inb(io + ATA_LBA_HIGH)) return 0;
+    while (!(status & (ATA_SR_DRQ | ATA_SR_ERR)) && --spins) status = inb(io + ATA_COMMAND);
+    if (!spins || (status & ATA_SR_ERR)) return 0;
+
+    uint16_t id[256];
+    for (int i = 0; i < 256; i++) id[i] = inw(io + ATA_DATA);
+    return ((uint32_t)id[61] << 16) | id[60];
+}
+
+/* ── block device glue ─────────────────────────────────────────── */
+
+static uint8_t drive_ids[ATA_MAX_DRIVES] = { 0, 1, 2, 3 };
+
+/* Each op charges the polling time it caused to the device's counters */
+static int ata_blk_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    uint8_t drive = *(uint8_t *)dev->priv;
+    uint64_t busy = stats[drive].busy_cycles;
+    int r = ata_read_sectors(drive, lba, count, buf);
+    dev->stats.busy_cycles += stats[drive].busy_cycles - busy;
+    return r;
+}
+
+static int ata_blk_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    uint8_t drive = *(uint8_t *)dev->priv;
+    uint64_t busy = stats[drive].busy_cycles;
+    int r = ata_write_sectors(drive, lba, count, buf);
+    dev->stats.busy_cycles += stats[drive].busy_cycles - busy;
+    return r;
+}
+
+static int ata_blk_flush(blkdev_t *dev) {
+    uint8_t drive = *(uint8_t *)dev->priv;
+    uint64_t busy = stats[drive].busy_cycles;
+    int r = ata_flush(drive);
+    dev->stats.busy_cycles += stats[drive].busy_cycles - busy;
+    return r;
+}
+
+static const blkdev_ops_t ata_blk_ops = {
+    .read_blocks  = ata_blk_read,
+    .write_blocks = ata_blk_write,
+    .flush        = ata_blk_flush,
+    .submit       = ata_submit,
+    .poll         = ata_poll,
+};
+
+void ata_init(void) {
+    static const char *names[ATA_MAX_DRIVES] = { "hda", "hdb", "hdc", "hdd" };
+    for (uint8_t d = 0; d < ATA_MAX_DRIVES; d++) {
+        uint32_t sectors = ata_identify(d);
+        if (sectors) blkdev_register(names[d], &ata_blk_ops, &drive_ids[d], sectors);
+    }
+    irq_install_handler(channels[0].irq, ata_irq_primary);
+    irq_install_handler(channels[1].irq, ata_irq_secondary);
+}
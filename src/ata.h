@@ -3,14 +3,38 @@
 
 #include <stdint.h>
 
-// Must be called once at boot
+// Drives are numbered across both IDE channels: 0/1 = primary master/
+// slave (0x1F0, IRQ14), 2/3 = secondary master/slave (0x170, IRQ15).
+#define ATA_CHANNELS    2
+#define ATA_MAX_DRIVES  4
+
+// Must be called once at boot. Probes all four drive positions and
+// registers each disk found as block device "hda".."hdd".
 void ata_init(void);
 
-// Read exactly one 512‑byte sector from 'drive' (0=master, 1=slave),
-// at absolute LBA.  Returns 0 on success, –1 on error.
+// Read exactly one 512‑byte sector from 'drive' (0..3), at absolute LBA.
+// Returns 0 on success, –1 on error.
 int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer);
 
 // Write exactly one 512-byte sector.
 int ata_write_sector(uint8_t drive, uint32_t lba, const uint8_t *buffer);
 
+// Multi-sector transfers: `count` consecutive sectors starting at `lba`,
+// issued as one command per 256 sectors.
+int ata_read_sectors(uint8_t drive, uint32_t lba, uint32_t count, uint8_t *buffer);
+int ata_write_sectors(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t *buffer);
+
+// FLUSH CACHE: returns once the drive's write cache is on the media.
+int ata_flush(uint8_t drive);
+
+// Per-drive counters since boot.
+typedef struct {
+    uint32_t rd_sectors, wr_sectors;
+    uint32_t rd_cmds, wr_cmds;      // ATA commands (≤ 256 sectors each)
+    uint32_t flushes;
+    uint64_t busy_cycles;           // TSC cycles spent polling BSY/DRQ
+} ata_stats_t;
+
+void ata_get_stats(uint8_t drive, ata_stats_t *out);
+
 #endif /* ATA_H */
@@ -0,0 +1,189 @@
+#include "bcache.h"
+#include "lock.h"
+#include "util.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE   512
+#define BCACHE_SETS   128          /* power of two */
+#define BCACHE_WAYS   4
+#define BCACHE_BURST  128          /* max sectors per prefetch command */
+
+typedef struct {
+    uint32_t lba;
+    uint32_t last_use;
+    uint8_t  dev;                  /* blkdev id */
+    uint8_t  valid;
+    uint8_t  prefetched;           /* filled by read-ahead, not yet used */
+} bcache_entry_t;
+
+static bcache_entry_t entries[BCACHE_SETS][BCACHE_WAYS];
+static uint8_t        blocks[BCACHE_SETS][BCACHE_WAYS][SECTOR_SIZE];
+static uint8_t        staging[BCACHE_BURST * SECTOR_SIZE];
+static kmutex_t       staging_lock = KMUTEX_INIT;
+static uint32_t       use_clock;
+static bcache_stats_t stats;
+
+/* Each set has a reader/writer lock: hits copy out under the shared
+ * lock, fills and writes take it exclusive. Disk reads happen with no
+ * lock held, so a fill is only installed if no write reached the set in
+ * the meantime (its generation is unchanged); otherwise the sector just
+ * stays uncached. LRU stamps, the prefetched flag and the counters are
+ * hints and are updated by readers too. */
+static krwlock_t set_lock[BCACHE_SETS];
+static uint32_t  set_gen[BCACHE_SETS];
+
+void bcache_init(void) {
+    memset(entries, 0, sizeof(entries));
+    memset(&stats, 0, sizeof(stats));
+    memset(set_gen, 0, sizeof(set_gen));
+    for (int i = 0; i < BCACHE_SETS; i++) krw_init(&set_lock[i]);
+    use_clock = 0;
+}
+
+/* Consecutive LBAs land in consecutive sets, so a streaming run
+ * spreads across the whole cache instead of thrashing one set. */
+static inline uint32_t set_of(blkdev_t *dev, uint32_t lba) {
+    return (lba + dev->id * 7919u) & (BCACHE_SETS - 1);
+}
+
+/* The caller holds the set's lock */
+static bcache_entry_t *lookup(blkdev_t *dev, uint32_t lba, uint8_t **data) {
+    uint32_t set = set_of(dev, lba);
+    for (int w = 0; w < BCACHE_WAYS; w++) {
+        bcache_entry_t *e = &entries[set][w];
+        if (e->valid && e->lba == lba && e->dev == dev->id) {
+            *data = blocks[set][w];
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Claim the least recently used way of the sector's set; the caller
+ * holds the set's lock exclusive */
+static uint8_t *insert(blkdev_t *dev, uint32_t lba, const uint8_t *src, int prefetched) {
+    uint32_t set = set_of(dev, lba);
+    int victim = 0;
+    for (int w = 0; w < BCACHE_WAYS; w++) {
+        bcache_entry_t *e = &entries[set][w];
+        if (e->valid && e->lba == lba && e->dev == dev->id) { victim = w; break; }
+        if (!e->valid) { victim = w; break; }
+        if (e->last_use < entries[set][victim].last_use) victim = w;
+    }
+    bcache_entry_t *e = &entries[set][victim];
+    if (e->valid && e->prefetched && !(e->lba == lba && e->dev == dev->id))
+        __sync_fetch_and_add(&stats.ra_wasted, 1);
+    e->lba = lba;
+    e->dev = dev->id;
+    e->valid = 1;
+    e->prefetched = (uint8_t)prefetched;
+    e->last_use = ++use_clock;
+    memcpy(blocks[set][victim], src, SECTOR_SIZE);
+    return blocks[set][victim];
+}
+
+static int cached(blkdev_t *dev, uint32_t lba) {
+    krwlock_t *l = &set_lock[set_of(dev, lba)];
+    uint8_t *unused;
+    krw_read_lock(l);
+    int r = lookup(dev, lba, &unused) != NULL;
+    krw_read_unlock(l);
+    return r;
+}
+
+/* Copy a cached sector out, crediting read-ahead on first use */
+static int take(blkdev_t *dev, uint32_t lba, uint8_t *buffer) {
+    krwlock_t *l = &set_lock[set_of(dev, lba)];
+    uint8_t *data;
+    krw_read_lock(l);
+    bcache_entry_t *e = lookup(dev, lba, &data);
+    if (e) {
+        if (e->prefetched && __sync_bool_compare_and_swap(&e->prefetched, 1, 0))
+            __sync_fetch_and_add(&stats.ra_hits, 1);   /* once, however many readers */
+        e->last_use = ++use_clock;
+        memcpy(buffer, data, SECTOR_SIZE);
+        __sync_fetch_and_add(&stats.hits, 1);
+    }
+    krw_read_unlock(l);
+    return e != NULL;
+}
+
+/* Install a sector read from disk while the set's generation was `gen` */
+static void fill(blkdev_t *dev, uint32_t lba, const uint8_t *src, int prefetched, uint32_t gen) {
+    uint32_t set = set_of(dev, lba);
+    krw_write_lock(&set_lock[set]);
+    if (set_gen[set] == gen) insert(dev, lba, src, prefetched);
+    krw_write_unlock(&set_lock[set]);
+}
+
+int bcache_read(blkdev_t *dev, uint32_t lba, uint8_t *buffer) {
+    return bcache_read_run(dev, lba, 1, buffer);
+}
+
+int bcache_read_run(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buffer) {
+    uint32_t i = 0;
+    while (i < count) {
+        if (take(dev, lba + i, buffer + i * SECTOR_SIZE)) {
+            i++;
+            continue;
+        }
+        /* gather the run of misses and fetch it straight into the caller's buffer */
+        uint32_t gen[BCACHE_BURST];
+        uint32_t n = 1;
+        while (i + n < count && n < BCACHE_BURST && !cached(dev, lba + i + n)) n++;
+        for (uint32_t k = 0; k < n; k++) gen[k] = set_gen[set_of(dev, lba + i + k)];
+        if (blkdev_read(dev, lba + i, n, buffer + i * SECTOR_SIZE) < 0) return -1;
+        for (uint32_t k = 0; k < n; k++)
+            fill(dev, lba + i + k, buffer + (i + k) * SECTOR_SIZE, 0, gen[k]);
+        __sync_fetch_and_add(&stats.misses, n);
+        i += n;
+    }
+    return 0;
+}
+
+int bcache_write(blkdev_t *dev, uint32_t lba, const uint8_t *buffer) {
+    return bcache_write_run(dev, lba, 1, buffer);
+}
+
+int bcache_write_run(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buffer) {
+    if (blkdev_write(dev, lba, count, buffer) < 0) return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *src = buffer + i * SECTOR_SIZE;
+        uint32_t set = set_of(dev, lba + i);
+        uint8_t *data;
+        krw_write_lock(&set_lock[set]);
+        set_gen[set]++;
+        bcache_entry_t *e = lookup(dev, lba + i, &data);
+        if (e) {
+            memcpy(data, src, SECTOR_SIZE);
+            e->last_use = ++use_clock;
+        } else {
+            insert(dev, lba + i, src, 0);
+        }
+        krw_write_unlock(&set_lock[set]);
+    }
+    return 0;
+}
+
+void bcache_prefetch(blkdev_t *dev, uint32_t lba, uint32_t count) {
+    if (count > BCACHE_BURST) count = BCACHE_BURST;
+    uint32_t gen[BCACHE_BURST];
+    uint32_t i = 0;
+    kmutex_lock(&staging_lock);
+    while (i < count) {
+        if (cached(dev, lba + i)) { i++; continue; }
+        uint32_t n = 1;
+        while (i + n < count && !cached(dev, lba + i + n)) n++;
+        for (uint32_t k = 0; k < n; k++) gen[k] = set_gen[set_of(dev, lba + i + k)];
+        if (blkdev_read(dev, lba + i, n, staging) < 0) break;
+        for (uint32_t k = 0; k < n; k++)
+            fill(dev, lba + i + k, staging + k * SECTOR_SIZE, 1, gen[k]);
+        __sync_fetch_and_add(&stats.ra_sectors, n);
+        i += n;
+    }
+    kmutex_unlock(&staging_lock);
+}
+
+void bcache_get_stats(bcache_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,41 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+// Sector cache in front of the block devices. All filesystem I/O goes
+// through here; writes are write-through so the disk is always current.
+
+typedef struct {
+    uint32_t hits;          // sector reads served from the cache
+    uint32_t misses;        // sector reads that went to the disk
+    uint32_t ra_sectors;    // sectors fetched by read-ahead
+    uint32_t ra_hits;       // read-ahead sectors that were later used
+    uint32_t ra_wasted;     // read-ahead sectors evicted unused
+} bcache_stats_t;
+
+// Drop every cached sector and reset statistics
+void bcache_init(void);
+
+// Read one sector, from the cache if present.
+int bcache_read(blkdev_t *dev, uint32_t lba, uint8_t *buffer);
+
+// Read `count` consecutive sectors. Cached sectors are copied, each run
+// of misses is fetched with a single multi-sector command.
+int bcache_read_run(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buffer);
+
+// Write one sector through to disk and keep the cached copy current.
+int bcache_write(blkdev_t *dev, uint32_t lba, const uint8_t *buffer);
+
+// Write `count` consecutive sectors with one multi-sector command.
+int bcache_write_run(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buffer);
+
+// Pull up to `count` sectors into the cache ahead of use; sectors that
+// are already cached are skipped.
+void bcache_prefetch(blkdev_t *dev, uint32_t lba, uint32_t count);
+
+// Snapshot of the counters above.
+void bcache_get_stats(bcache_stats_t *out);
+
+#endif /* BCACHE_H */
@@ -0,0 +1,105 @@
+#include "blkdev.h"
+#include "util.h"
+#include <stddef.h>
+
+static blkdev_t devices[BLKDEV_MAX];
+static int      ndevices;
+
+blkdev_t *blkdev_register(const char *name, const blkdev_ops_t *ops, void *priv, uint32_t blocks) {
+    if (ndevices >= BLKDEV_MAX || strlen(name) >= BLKDEV_NAME_LEN || blkdev_find(name))
+        return NULL;
+    blkdev_t *dev = &devices[ndevices];
+    strcpy(dev->name, name);
+    dev->id         = (uint8_t)ndevices;
+    dev->block_size = BLKDEV_BLOCK_SIZE;
+    dev->blocks     = blocks;
+    dev->ops        = ops;
+    dev->priv       = priv;
+    dev->stacked    = 0;
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    ndevices++;
+    return dev;
+}
+
+blkdev_t *blkdev_find(const char *name) {
+    for (int i = 0; i < ndevices; i++) {
+        if (strcmp(devices[i].name, name) == 0) return &devices[i];
+    }
+    return NULL;
+}
+
+blkdev_t *blkdev_get(int i) {
+    return (i >= 0 && i < ndevices) ? &devices[i] : NULL;
+}
+
+static int in_range(const blkdev_t *dev, uint32_t lba, uint32_t count) {
+    if (!dev->blocks) return 1;
+    return lba <= dev->blocks && count <= dev->blocks - lba;
+}
+
+/* Callers on different files reach the same device at once */
+static void account(blkdev_t *dev, int write, uint32_t count, int status) {
+    if (write) {
+        __sync_fetch_and_add(&dev->stats.wr_cmds, 1);
+        __sync_fetch_and_add(&dev->stats.wr_sectors, count);
+    } else {
+        __sync_fetch_and_add(&dev->stats.rd_cmds, 1);
+        __sync_fetch_and_add(&dev->stats.rd_sectors, count);
+    }
+    if (status < 0) __sync_fetch_and_add(&dev->stats.errors, 1);
+}
+
+int blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    if (!dev || !in_range(dev, lba, count)) return -1;
+    int r = dev->ops->read_blocks(dev, lba, count, buf);
+    account(dev, 0, count, r);
+    return r;
+}
+
+int blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    if (!dev || !in_range(dev, lba, count)) return -1;
+    int r = dev->ops->write_blocks(dev, lba, count, buf);
+    account(dev, 1, count, r);
+    return r;
+}
+
+int blkdev_flush(blkdev_t *dev) {
+    if (!dev) return -1;
+    dev->stats.flushes++;
+    return dev->ops->flush ? dev->ops->flush(dev) : 0;
+}
+
+int blkdev_submit(blkdev_t *dev, blk_request_t *req) {
+    if (!dev || !in_range(dev, req->lba, req->count)) return -1;
+    if (dev->ops->submit) {
+        /* a full queue refuses the request; callers retry, count it once */
+        int r = dev->ops->submit(dev, req);
+        if (r == 0) account(dev, req->write, req->count, 0);
+        return r;
+    }
+    account(dev, req->write, req->count, 0);
+    req->status = req->write ? dev->ops->write_blocks(dev, req->lba, req->count, req->buf)
+                             : dev->ops->read_blocks(dev, req->lba, req->count, req->buf);
+    if (req->status < 0) dev->stats.errors++;
+    if (req->done) req->done(req);
+    return 0;
+}
+
+void blkdev_poll(blkdev_t *dev) {
+    if (dev && dev->ops->poll) dev->ops->poll(dev);
+}
+
+void blkdev_totals(blkdev_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < ndevices; i++) {
+        if (devices[i].stacked) continue;
+        const blkdev_stats_t *s = &devices[i].stats;
+        out->rd_sectors  += s->rd_sectors;
+        out->wr_sectors  += s->wr_sectors;
+        out->rd_cmds     += s->rd_cmds;
+        out->wr_cmds     += s->wr_cmds;
+        out->flushes     += s->flushes;
+        out->errors      += s->errors;
+        out->busy_cycles += s->busy_cycles;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+// Block device layer: filesystems and the sector cache talk to a
+// blkdev_t, never to a driver directly. Drivers register one device per
+// disk (ATA master/slave, RAM disk, host image file, ...).
+
+#define BLKDEV_BLOCK_SIZE  512
+#define BLKDEV_MAX         8
+#define BLKDEV_NAME_LEN    8
+
+typedef struct blkdev blkdev_t;
+typedef struct blk_request blk_request_t;
+
+// Completion callback of an asynchronous request; req->status holds the
+// result (0 or –1). May run in interrupt context.
+typedef void (*blk_done_fn)(blk_request_t *req);
+
+struct blk_request {
+    uint8_t     write;      // 0 = read, 1 = write
+    uint32_t    lba;
+    uint32_t    count;      // blocks
+    uint8_t    *buf;
+    int         status;
+    blk_done_fn done;
+    void       *ctx;        // caller's cookie
+};
+
+typedef struct {
+    // Transfer `count` blocks at `lba`. Return 0 on success, –1 on error.
+    int (*read_blocks)(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf);
+    int (*write_blocks)(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf);
+    // Make completed writes durable (optional; NULL = nothing to flush).
+    int (*flush)(blkdev_t *dev);
+    // Queue `req` and return; req->done fires when it completes
+    // (optional; NULL = requests are served synchronously).
+    int (*submit)(blkdev_t *dev, blk_request_t *req);
+    // Advance queued requests without waiting for the device's IRQ, so
+    // submitters can wait with interrupts off (optional).
+    void (*poll)(blkdev_t *dev);
+} blkdev_ops_t;
+
+// Traffic through the block layer since boot. busy_cycles is filled by
+// drivers that poll (ATA PIO): TSC cycles spent waiting on the device.
+typedef struct {
+    uint32_t rd_sectors, wr_sectors;
+    uint32_t rd_cmds, wr_cmds;      // read_blocks/write_blocks calls
+    uint32_t flushes;
+    uint32_t errors;
+    uint64_t busy_cycles;
+} blkdev_stats_t;
+
+struct blkdev {
+    char                name[BLKDEV_NAME_LEN];
+    uint8_t             id;          // registry slot, used as the cache key
+    uint32_t            block_size;  // bytes, always BLKDEV_BLOCK_SIZE for now
+    uint32_t            blocks;      // capacity; 0 if the driver cannot tell
+    const blkdev_ops_t *ops;
+    void               *priv;        // driver data
+    uint8_t             stacked;     // passes its I/O on to other devices (stripe)
+    blkdev_stats_t      stats;
+};
+
+// Register a device under `name` (e.g. "hda", "vdb"). Returns the
+// device, or NULL if the table is full or the name is taken.
+blkdev_t *blkdev_register(const char *name, const blkdev_ops_t *ops, void *priv, uint32_t blocks);
+
+// Look a device up by name; NULL if none.
+blkdev_t *blkdev_find(const char *name);
+
+// Registered device number `i` (0-based), NULL past the last one.
+blkdev_t *blkdev_get(int i);
+
+// Range-checked wrappers around the device ops.
+int blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf);
+int blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf);
+int blkdev_flush(blkdev_t *dev);
+
+// Start `req`. Devices without a queue run it to completion first and
+// then call req->done, so callers can use one code path for both.
+int blkdev_submit(blkdev_t *dev, blk_request_t *req);
+
+// Give `dev` a chance to complete submitted requests by polling (a
+// no-op for devices without a queue or a poll hook).
+void blkdev_poll(blkdev_t *dev);
+
+// Counters summed over the devices that do the I/O; a stacked device
+// is left out, as its traffic is already counted on its members.
+void blkdev_totals(blkdev_stats_t *out);
+
+#endif /* BLKDEV_H */
@@ -18,6 +18,10 @@ extern kernel_main
 global _start
 _start:
     cli
+    ; kernel_main(magic, mbi): the loader's EAX and the multiboot2
+    ; information address in EBX, saved before EAX is reused below
+    push ebx
+    push eax
     ; initialize FPU: clear TS (bit3) and EM (bit2), set MP (bit1) and NE (bit5)
     fninit
     mov eax, cr0
@@ -0,0 +1,281 @@
+#include "execcache.h"
+#include "elf.h"
+#include "fs.h"
+#include "lock.h"
+#include "pagecache.h"
+#include "paging.h"
+#include "pmm.h"
+#include "util.h"
+#include "vm.h"
+#include <stddef.h>
+
+#define PAGE_SIZE        PMM_FRAME_SIZE
+#define PT_LOAD          1
+#define PF_W             2
+
+/* Segments get page tables of their own in the task's space and so hide
+ * whatever the identity map has there. Keep them clear of what the
+ * kernel reaches through it: video memory and BIOS, the kernel image,
+ * heap and frame pool (first 16 MiB), and the shared mmap window. */
+#define USER_LOW_END     0x000A0000u
+#define USER_HIGH_BASE   0x01000000u
+
+typedef struct {
+    uint32_t vaddr, offset, filesz, memsz;
+    int      flags;            /* MAP_SHARED (text) or MAP_PRIVATE (data) */
+} exec_seg_t;
+
+typedef struct {
+    char       path[EXEC_PATH_LEN];   /* normalised; "" = free slot */
+    uint32_t   size;                  /* file size when read */
+    uint32_t   entry;
+    uint32_t   last_use;
+    pc_file_t *file;
+    uint32_t   nsegs;
+    exec_seg_t seg[EXEC_MAX_SEGS];
+} exec_image_t;
+
+/* Startup trace: the pages a program needed first, in that order */
+typedef struct {
+    char     path[EXEC_PATH_LEN];     /* normalised; "" = free slot */
+    uint32_t size;                    /* file size the trace belongs to */
+    uint32_t last_use;
+    uint16_t count;
+    uint16_t page[EXEC_TRACE_PAGES];
+} exec_trace_t;
+
+/* EXEC_TRACE_FILE holds this structure as is */
+typedef struct {
+    uint32_t     magic;
+    uint32_t     version;
+    exec_trace_t trace[EXEC_MAX_TRACES];
+} exec_trace_file_t;
+
+#define TRACE_MAGIC    0x43525458u    /* "XTRC" */
+#define TRACE_VERSION  1
+
+static exec_image_t      images[EXEC_MAX_IMAGES];
+static exec_trace_file_t traces;
+static int               traces_loaded, traces_dirty;
+static uint32_t          use_clock;
+static kmutex_t          cache_lock = KMUTEX_INIT;   /* images and traces */
+
+/* "/bin/ls" and "BIN/LS" name the same file */
+static int norm_path(const char *path, char out[EXEC_PATH_LEN]) {
+    if (*path == '/') path++;
+    uint32_t i = 0;
+    for (; path[i]; i++) {
+        if (i + 1 >= EXEC_PATH_LEN) return -1;
+        char c = path[i];
+        out[i] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+    }
+    out[i] = '\0';
+    return i ? 0 : -1;
+}
+
+static void release(exec_image_t *img) {
+    if (img->file) pc_put(img->file);
+    memset(img, 0, sizeof(*img));
+}
+
+/* A file written, deleted or renamed since leaves a stale page-cache copy */
+static int usable(const exec_image_t *img) {
+    return img->path[0] && !pc_stale(img->file);
+}
+
+/* The cached image of `key`, if the file at `path` still has its size.
+ * pc_stale() only sees changes made through fs_*; this also catches a
+ * file replaced behind the cache's back (another mount, a new disk). */
+static exec_image_t *find(const char *key, const char *path) {
+    for (int i = 0; i < EXEC_MAX_IMAGES; i++) {
+        exec_image_t *img = &images[i];
+        if (!usable(img) || strcmp(img->path, key) != 0) continue;
+        uint32_t size;
+        if (fs_stat(path, &size) == 0 && size == img->size) return img;
+        release(img);
+        return NULL;
+    }
+    return NULL;
+}
+
+/* Traces of earlier boots. A missing or unreadable file starts empty. */
+static void load_traces(void) {
+    if (traces_loaded) return;
+    traces_loaded = 1;
+    if (fs_read(EXEC_TRACE_FILE, (uint8_t *)&traces, sizeof(traces)) != (int)sizeof(traces) ||
+        traces.magic != TRACE_MAGIC || traces.version != TRACE_VERSION) {
+        memset(&traces, 0, sizeof(traces));
+        return;
+    }
+    for (int i = 0; i < EXEC_MAX_TRACES; i++) {
+        exec_trace_t *t = &traces.trace[i];
+        t->path[EXEC_PATH_LEN - 1] = '\0';
+        if (t->count > EXEC_TRACE_PAGES) t->count = EXEC_TRACE_PAGES;
+        if (t->last_use > use_clock) use_clock = t->last_use;
+    }
+}
+
+/* Best effort: the root may be read-only, or busy if we are the shell.
+ * A failed save is retried with the next change. */
+static void save_traces(void) {
+    if (!traces_dirty) return;
+    traces.magic = TRACE_MAGIC;
+    traces.version = TRACE_VERSION;
+    if (fs_write(EXEC_TRACE_FILE, (const uint8_t *)&traces, sizeof(traces)) == 0) traces_dirty = 0;
+}
+
+static exec_trace_t *trace_of(const exec_image_t *img, int create) {
+    exec_trace_t *victim = NULL;
+    for (int i = 0; i < EXEC_MAX_TRACES; i++) {
+        exec_trace_t *t = &traces.trace[i];
+        if (t->path[0] && strcmp(t->path, img->path) == 0) {
+            if (t->size == img->size) return t;
+            victim = t;                /* the program changed: start over */
+            break;
+        }
+        if (!victim || (victim->path[0] && (!t->path[0] || t->last_use < victim->last_use)))
+            victim = t;
+    }
+    if (!create) return NULL;
+    memset(victim, 0, sizeof(*victim));
+    strcpy(victim->path, img->path);
+    victim->size = img->size;
+    return victim;
+}
+
+/* Add the pages `img` has read on demand since it was cached. Pages a
+ * prefetch brought in are not logged, so a known trace only grows by
+ * what the program needed beyond it. Returns nonzero if it grew. */
+static int record_trace(const exec_image_t *img) {
+    uint16_t log[EXEC_TRACE_PAGES];
+    uint32_t n = pc_fill_log(img->file, log, EXEC_TRACE_PAGES);
+    if (!n) return 0;
+    exec_trace_t *t = trace_of(img, 1);
+    int grew = 0;
+    for (uint32_t i = 0; i < n && t->count < EXEC_TRACE_PAGES; i++) {
+        uint32_t j = 0;
+        while (j < t->count && t->page[j] != log[i]) j++;
+        if (j == t->count) {
+            t->page[t->count++] = log[i];
+            grew = 1;
+        }
+    }
+    if (grew) traces_dirty = 1;
+    return grew;
+}
+
+/* One batched read of the pages the program needed last time */
+static void prefetch(exec_image_t *img) {
+    exec_trace_t *t = trace_of(img, 0);
+    if (!t) return;
+    t->last_use = ++use_clock;
+    pc_prefetch(img->file, t->page, t->count);
+}
+
+/* Header checks: everything exec_load() later trusts is inside the file,
+ * program headers included, which must sit in the first page */
+static int validate(const Elf32_Ehdr *eh, uint32_t size) {
+    if (memcmp(eh->e_ident, "\x7F""ELF", 4) != 0) return -1;
+    if (eh->e_ident[4] != 1 || eh->e_ident[5] != 1) return -1;   /* ELF32, LSB */
+    if (eh->e_type != 2 || eh->e_machine != 3) return -1;         /* ET_EXEC, i386 */
+    if (eh->e_phentsize != sizeof(Elf32_Phdr)) return -1;
+    if (!eh->e_phnum || eh->e_phnum > EXEC_MAX_SEGS * 2) return -1;
+    uint32_t end = eh->e_phoff + eh->e_phnum * sizeof(Elf32_Phdr);
+    if (eh->e_phoff > PAGE_SIZE || end > PAGE_SIZE || end > size) return -1;
+    return 0;
+}
+
+static int user_range(uint32_t start, uint32_t end) {
+    if (end < start) return 0;
+    if (start < USER_HIGH_BASE && end > USER_LOW_END) return 0;
+    return end <= PAGING_WINDOW_BASE || start >= PAGING_WINDOW_END;
+}
+
+/* Program headers into `img`, checked against the file and the rules of
+ * vm_map_fixed(): file offset and address agree modulo the page size */
+static int add_segments(exec_image_t *img, const Elf32_Phdr *ph, uint32_t phnum) {
+    for (uint32_t i = 0; i < phnum; i++, ph++) {
+        if (ph->p_type != PT_LOAD || !ph->p_memsz) continue;
+        if (img->nsegs == EXEC_MAX_SEGS) return -1;
+        if (ph->p_filesz > ph->p_memsz) return -1;
+        if (ph->p_offset > img->size || ph->p_filesz > img->size - ph->p_offset) return -1;
+        if ((ph->p_vaddr - ph->p_offset) & (PAGE_SIZE - 1)) return -1;
+        if (!user_range(ph->p_vaddr, ph->p_vaddr + ph->p_memsz)) return -1;
+        exec_seg_t *s = &img->seg[img->nsegs++];
+        s->vaddr  = ph->p_vaddr;
+        s->offset = ph->p_offset;
+        s->filesz = ph->p_filesz;
+        s->memsz  = ph->p_memsz;
+        s->flags  = (ph->p_flags & PF_W) ? MAP_PRIVATE : MAP_SHARED;
+    }
+    return img->nsegs ? 0 : -1;
+}
+
+/* Validate `path` into `img`, filed under `key`. The headers are read
+ * through the page cache, whose first page is usually text as well.
+ * Returns 0, –1 or –2 as exec_load(). */
+static int fill(exec_image_t *img, const char *key, const char *path) {
+    strcpy(img->path, key);
+    img->file = pc_get(path);
+    if (!img->file) return -1;
+    img->size = pc_size(img->file);
+    if (img->size < sizeof(Elf32_Ehdr)) return -2;
+    prefetch(img);
+    uint32_t page = pc_page(img->file, 0);
+    if (!page) return -1;
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)(uintptr_t)page;
+    if (validate(eh, img->size) < 0) return -2;
+    if (add_segments(img, (const Elf32_Phdr *)(uintptr_t)(page + eh->e_phoff), eh->e_phnum) < 0)
+        return -2;
+    img->entry = eh->e_entry;
+    return 0;
+}
+
+static int map_segments(const exec_image_t *img, uint32_t space) {
+    for (uint32_t i = 0; i < img->nsegs; i++) {
+        const exec_seg_t *s = &img->seg[i];
+        uint32_t head = s->vaddr & (PAGE_SIZE - 1);
+        if (vm_map_fixed(space, img->file, s->vaddr - head, head + s->memsz,
+                         s->offset - head, head + s->filesz, s->flags) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int exec_load(const char *path, uint32_t space, uint32_t *entry) {
+    char key[EXEC_PATH_LEN];
+    if (norm_path(path, key) < 0) return -1;
+    /* the shell runs in an IRQ handler and must not wait for a task */
+    if (kmutex_trylock(&cache_lock) < 0) return -1;
+    load_traces();
+    /* what the programs started so far have needed is their trace */
+    int grew = 0;
+    for (int i = 0; i < EXEC_MAX_IMAGES; i++) {
+        if (usable(&images[i]) && record_trace(&images[i])) grew = 1;
+    }
+    exec_image_t *img = find(key, path);
+    if (img) {
+        prefetch(img);                 /* pages of a run cut short */
+    } else {
+        /* a free or stale slot, else the least recently used image */
+        for (int i = 0; i < EXEC_MAX_IMAGES; i++) {
+            exec_image_t *c = &images[i];
+            if (!usable(c)) { img = c; break; }
+            if (!img || c->last_use < img->last_use) img = c;
+        }
+        release(img);
+        int r = fill(img, key, path);
+        if (r < 0) {
+            release(img);
+            kmutex_unlock(&cache_lock);
+            return r;
+        }
+    }
+    img->last_use = ++use_clock;
+    int r = map_segments(img, space);
+    if (r < 0) vm_release_space(space);
+    else *entry = img->entry;
+    if (grew) save_traces();   /* a warm start leaves the disk alone */
+    kmutex_unlock(&cache_lock);
+    return r;
+}
@@ -0,0 +1,36 @@
+#ifndef EXECCACHE_H
+#define EXECCACHE_H
+
+#include <stdint.h>
+
+// Executable image cache: the validated program headers of recently run
+// ELF files, each holding a reference to the file in the page cache so
+// its pages stay resident. Entries are keyed by the normalised path and
+// remember the file size; one whose file changed (the page cache copy
+// went stale, or fs_stat gives another size) is never used again, so a
+// hit is current. Starting it costs one fs_stat and no disk reads.
+
+#define EXEC_MAX_IMAGES  8
+#define EXEC_MAX_SEGS    8      /* PT_LOAD entries per image */
+#define EXEC_PATH_LEN    40
+
+// Startup traces: the order in which a program's pages were first read
+// in is kept per executable (path and size) in EXEC_TRACE_FILE on the
+// root volume. A later start that finds them uncached reads exactly
+// those pages in one batched pass before the program runs. The file is
+// read on the first exec and rewritten only when a trace gained pages.
+#define EXEC_TRACE_FILE   "PREFETCH.DAT"
+#define EXEC_MAX_TRACES   16
+#define EXEC_TRACE_PAGES  32     /* what the page cache logs (PC_LOG_MAX) */
+
+// Map the PT_LOAD segments of `path` into address space `space` and
+// store the entry point in `*entry`. Read-only segments are the file's
+// page-cache pages, shared by every task running it; writable ones are
+// copy-on-write and their BSS zero-filled, so each task pays only for
+// the data pages it touches. Pages come in on first access. Returns 0,
+// –1 if the file cannot be read (or the cache is busy, or the space has
+// no room), –2 if it is not a 32-bit x86 ELF executable that can be
+// mapped this way.
+int exec_load(const char *path, uint32_t space, uint32_t *entry);
+
+#endif /* EXECCACHE_H */
@@ -0,0 +1,1723 @@
+#include "ext2.h"
+#include "bcache.h"
+#include "kheap.h"
+#include "lock.h"
+#include "util.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE   512
+#define EXT2_MAGIC    0xEF53
+#define EXT2_ROOT_INO 2
+
+/* i_block[]: 12 direct pointers, then single, double, triple indirect */
+#define EXT2_NDIR  12
+#define EXT2_IND   12
+#define EXT2_DIND  13
+#define EXT2_TIND  14
+#define EXT2_N_BLOCKS 15
+
+/* Superblock feature bits this driver knows */
+#define COMPAT_DIR_INDEX    0x0020
+#define INCOMPAT_FILETYPE   0x0002
+#define RO_COMPAT_SPARSE    0x0001
+#define RO_COMPAT_LARGE     0x0002
+#define RO_COMPAT_BTREE     0x0004
+#define FLAGS_UNSIGNED_HASH 0x0002
+
+#define S_IFMT   0xF000
+#define S_IFREG  0x8000
+#define S_IFDIR  0x4000
+#define INDEX_FL 0x00001000        /* directory has a hash tree */
+
+#define FT_REG 1
+#define FT_DIR 2
+
+/* Directory hash tree: hash functions and on-disk layout */
+#define DX_HASH_LEGACY   0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA      2
+#define DX_BLOCK_MASK    0x0FFFFFFF
+#define DX_ROOT_ENTRIES  32        /* "." (12) + ".." header (12) + root info (8) */
+#define DX_NODE_ENTRIES  8         /* empty dirent header spanning the block */
+#define DX_MAX_LEVELS    2
+
+#define DIRENT_LEN(n) ((8u + (n) + 3) & ~3u)
+#define EXT2_NAME_MAX 255
+
+/* Natural alignment gives the on-disk layout; the 128 bytes are the
+ * revision 0 inode, larger inodes only add fields behind them. */
+typedef struct {
+    uint16_t mode;
+    uint16_t uid;
+    uint32_t size;
+    uint32_t atime;
+    uint32_t ctime;
+    uint32_t mtime;
+    uint32_t dtime;
+    uint16_t gid;
+    uint16_t links;
+    uint32_t sectors;              /* i_blocks, in 512-byte units */
+    uint32_t flags;
+    uint32_t osd1;
+    uint32_t block[EXT2_N_BLOCKS];
+    uint32_t generation;
+    uint32_t file_acl;
+    uint32_t size_high;
+    uint32_t faddr;
+    uint8_t  osd2[12];
+} ext2_inode_t;
+
+
+typedef struct __attribute__((packed)) {
+    uint32_t block_bitmap;
+    uint32_t inode_bitmap;
+    uint32_t inode_table;
+    uint16_t free_blocks;
+    uint16_t free_inodes;
+    uint16_t used_dirs;
+    uint16_t pad;
+    uint8_t  reserved[12];
+} ext2_group_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t inode;                /* 0 = unused record */
+    uint16_t rec_len;
+    uint8_t  name_len;
+    uint8_t  file_type;
+    char     name[];
+} ext2_dirent_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t reserved;
+    uint8_t  hash_version;
+    uint8_t  info_length;
+    uint8_t  levels;               /* index levels below the root */
+    uint8_t  flags;
+} dx_root_info_t;
+
+/* Index entry; in entry 0 the hash field holds limit and count */
+typedef struct __attribute__((packed)) {
+    uint32_t hash;
+    uint32_t block;                /* directory-relative block number */
+} dx_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint16_t count;
+} dx_countlimit_t;
+
+/* Metadata blocks (bitmaps, inode tables, indirect and directory blocks)
+ * are staged in these slots.  An operation edits the staged copies and
+ * commit() writes each dirty block once at its end; a dirty slot only
+ * goes out early when it is the least recently used one. */
+#define META_SLOTS 16
+
+enum { M_READ, M_WRITE, M_ZERO };
+
+typedef struct {
+    uint32_t block;
+    uint32_t last_use;
+    uint8_t  valid;
+    uint8_t  dirty;
+    uint8_t *data;
+} meta_slot_t;
+
+/* Sequential read-ahead, same policy as the FAT driver, one stream */
+#define RA_MIN_SECTORS   8
+#define RA_MAX_SECTORS 128
+
+struct ext2 {
+    blkdev_t     *dev;
+    uint32_t      block_size;
+    uint32_t      spb;             /* sectors per block */
+    uint32_t      ppb;             /* block pointers per indirect block */
+    uint32_t      blocks_count;
+    uint32_t      inodes_count;
+    uint32_t      first_data_block;
+    uint32_t      blocks_per_group;
+    uint32_t      inodes_per_group;
+    uint32_t      inode_size;
+    uint32_t      first_ino;
+    uint32_t      groups;
+    uint32_t      free_blocks;
+    uint32_t      free_inodes;
+    uint32_t      now;             /* timestamp for changes */
+    uint32_t      hash_seed[4];
+    uint8_t       def_hash;        /* hash for directories indexed here */
+    uint8_t       hash_unsigned;   /* 3 if names hash as unsigned chars */
+    uint8_t       filetype;        /* dirents carry a file type */
+    uint8_t       dir_index;       /* volume may index directories */
+    uint8_t       read_only;
+    uint8_t       sb_dirty;
+    ext2_group_t *gd;              /* whole descriptor table */
+    uint8_t      *gd_dirty;        /* one flag per descriptor-table block */
+    uint32_t      gd_blocks;
+    meta_slot_t   meta[META_SLOTS];
+    uint32_t      clock;
+    uint8_t      *buf;             /* one block: partial data blocks, split maps */
+    uint8_t      *tmp;             /* one block: directory rebuilds */
+    uint32_t      ra_ino, ra_next, ra_window, ra_end;
+    kmutex_t      lock;            /* held by every fs_* entry point */
+};
+
+static inline uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint16_t rd16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline void wr32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Metadata staging                                             */
+/* ──────────────────────────────────────────────────────────── */
+
+static void meta_write(ext2_t *e, meta_slot_t *s) {
+    bcache_write_run(e->dev, s->block * e->spb, e->spb, s->data);
+    s->dirty = 0;
+}
+
+/* Staged copy of `block`. M_WRITE marks it dirty (the caller is about to
+ * change it), M_ZERO hands out a zero-filled dirty block without reading
+ * it (freshly allocated). A pointer stays valid until META_SLOTS other
+ * blocks have been fetched. */
+static uint8_t *meta_get(ext2_t *e, uint32_t block, int mode) {
+    meta_slot_t *victim = NULL;
+    for (int i = 0; i < META_SLOTS; i++) {
+        meta_slot_t *s = &e->meta[i];
+        if (s->valid && s->block == block) {
+            victim = s;
+            break;
+        }
+        if (!s->valid) {
+            if (!victim || victim->valid) victim = s;
+        } else if (!victim || (victim->valid && s->last_use < victim->last_use)) {
+            victim = s;
+        }
+    }
+    if (!victim->valid || victim->block != block) {
+        if (victim->valid && victim->dirty) meta_write(e, victim);
+        victim->block = block;
+        victim->valid = 1;
+        victim->dirty = 0;
+        if (mode != M_ZERO) bcache_read_run(e->dev, block * e->spb, e->spb, victim->data);
+    }
+    if (mode == M_ZERO) memset(victim->data, 0, e->block_size);
+    if (mode != M_READ) victim->dirty = 1;
+    victim->last_use = ++e->clock;
+    return victim->data;
+}
+
+/* Forget a freed block so a stale copy is never written over its reuse */
+static void meta_drop(ext2_t *e, uint32_t block) {
+    for (int i = 0; i < META_SLOTS; i++)
+        if (e->meta[i].valid && e->meta[i].block == block) e->meta[i].valid = 0;
+}
+
+/* End of an operation: dirty metadata blocks in ascending order, then
+ * the group descriptors and superblock counters that changed. */
+static void commit(ext2_t *e) {
+    for (;;) {
+        meta_slot_t *next = NULL;
+        for (int i = 0; i < META_SLOTS; i++) {
+            meta_slot_t *s = &e->meta[i];
+            if (s->valid && s->dirty && (!next || s->block < next->block)) next = s;
+        }
+        if (!next) break;
+        meta_write(e, next);
+    }
+    for (uint32_t i = 0; i < e->gd_blocks; i++) {
+        if (!e->gd_dirty[i]) continue;
+        bcache_write_run(e->dev, (e->first_data_block + 1 + i) * e->spb, e->spb,
+                         (const uint8_t *)e->gd + i * e->block_size);
+        e->gd_dirty[i] = 0;
+    }
+    if (e->sb_dirty) {
+        uint8_t sb[1024];
+        bcache_read_run(e->dev, 2, 2, sb);
+        wr32(&sb[12], e->free_blocks);
+        wr32(&sb[16], e->free_inodes);
+        bcache_write_run(e->dev, 2, 2, sb);
+        e->sb_dirty = 0;
+    }
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Groups, bitmaps and inodes                                   */
+/* ──────────────────────────────────────────────────────────── */
+
+static inline uint32_t group_first(const ext2_t *e, uint32_t g) {
+    return e->first_data_block + g * e->blocks_per_group;
+}
+
+static void group_changed(ext2_t *e, uint32_t g) {
+    e->gd_dirty[g * sizeof(ext2_group_t) / e->block_size] = 1;
+    e->sb_dirty = 1;
+}
+
+/* First clear bit in [from, nbits), or -1; full words are skipped whole */
+static int find_zero(const uint8_t *map, uint32_t from, uint32_t nbits) {
+    for (uint32_t i = from; i < nbits; ) {
+        if (!(i & 31) && i + 32 <= nbits && ((const uint32_t *)map)[i >> 5] == 0xFFFFFFFFu) {
+            i += 32;
+            continue;
+        }
+        if (!(map[i >> 3] & (1 << (i & 7)))) return (int)i;
+        i++;
+    }
+    return -1;
+}
+
+/* Claim a free block: the first at or after `goal` in goal's group, so
+ * files grow contiguously, else the first free one in the next group
+ * that has any. Returns 0 when the volume is full. */
+static uint32_t alloc_block(ext2_t *e, uint32_t goal) {
+    if (!e->free_blocks) return 0;
+    if (goal < e->first_data_block || goal >= e->blocks_count) goal = e->first_data_block;
+    uint32_t g0 = (goal - e->first_data_block) / e->blocks_per_group;
+    for (uint32_t k = 0; k <= e->groups; k++) {
+        uint32_t g = (g0 + k) % e->groups;
+        ext2_group_t *gd = &e->gd[g];
+        if (!gd->free_blocks) continue;
+        uint32_t first = group_first(e, g);
+        uint32_t nbits = e->blocks_count - first;
+        if (nbits > e->blocks_per_group) nbits = e->blocks_per_group;
+        int bit = find_zero(meta_get(e, gd->block_bitmap, M_READ), k ? 0 : goal - first, nbits);
+        if (bit < 0) continue;
+        uint8_t *map = meta_get(e, gd->block_bitmap, M_WRITE);
+        map[bit >> 3] |= 1 << (bit & 7);
+        gd->free_blocks--;
+        e->free_blocks--;
+        group_changed(e, g);
+        return first + (uint32_t)bit;
+    }
+    return 0;
+}
+
+static void free_block(ext2_t *e, uint32_t b) {
+    if (b < e->first_data_block || b >= e->blocks_count) return;
+    meta_drop(e, b);
+    uint32_t g = (b - e->first_data_block) / e->blocks_per_group;
+    uint32_t bit = (b - e->first_data_block) % e->blocks_per_group;
+    uint8_t *map = meta_get(e, e->gd[g].block_bitmap, M_WRITE);
+    if (!(map[bit >> 3] & (1 << (bit & 7)))) return;
+    map[bit >> 3] &= ~(1 << (bit & 7));
+    e->gd[g].free_blocks++;
+    e->free_blocks++;
+    group_changed(e, g);
+}
+
+/* Claim an inode. Files go to their parent's group; directories are
+ * spread to the group with the fewest directories among those with an
+ * average share of free blocks. Returns 0 when none are left. */
+static uint32_t alloc_inode(ext2_t *e, uint32_t parent, int dir) {
+    if (!e->free_inodes) return 0;
+    uint32_t start = (parent - 1) / e->inodes_per_group;
+    if (dir) {
+        uint32_t avg = e->free_blocks / e->groups, best = e->groups;
+        for (uint32_t g = 0; g < e->groups; g++) {
+            ext2_group_t *gd = &e->gd[g];
+            if (!gd->free_inodes || gd->free_blocks < avg) continue;
+            if (best == e->groups || gd->used_dirs < e->gd[best].used_dirs) best = g;
+        }
+        if (best < e->groups) start = best;
+    }
+    for (uint32_t k = 0; k < e->groups; k++) {
+        uint32_t g = (start + k) % e->groups;
+        ext2_group_t *gd = &e->gd[g];
+        if (!gd->free_inodes) continue;
+        uint32_t from = g ? 0 : e->first_ino - 1;   /* never hand out reserved inodes */
+        int bit = find_zero(meta_get(e, gd->inode_bitmap, M_READ), from, e->inodes_per_group);
+        if (bit < 0) continue;
+        uint8_t *map = meta_get(e, gd->inode_bitmap, M_WRITE);
+        map[bit >> 3] |= 1 << (bit & 7);
+        gd->free_inodes--;
+        if (dir) gd->used_dirs++;
+        e->free_inodes--;
+        group_changed(e, g);
+        return g * e->inodes_per_group + (uint32_t)bit + 1;
+    }
+    return 0;
+}
+
+static void free_inode(ext2_t *e, uint32_t ino, int dir) {
+    uint32_t g = (ino - 1) / e->inodes_per_group;
+    uint32_t bit = (ino - 1) % e->inodes_per_group;
+    uint8_t *map = meta_get(e, e->gd[g].inode_bitmap, M_WRITE);
+    if (!(map[bit >> 3] & (1 << (bit & 7)))) return;
+    map[bit >> 3] &= ~(1 << (bit & 7));
+    e->gd[g].free_inodes++;
+    if (dir && e->gd[g].used_dirs) e->gd[g].used_dirs--;
+    e->free_inodes++;
+    group_changed(e, g);
+}
+
+static inline int inode_valid(const ext2_t *e, uint32_t ino) {
+    return ino >= 1 && ino <= e->inodes_count;
+}
+
+static uint8_t *inode_slot(ext2_t *e, uint32_t ino, int mode) {
+    uint32_t g = (ino - 1) / e->inodes_per_group;
+    uint32_t byte = (ino - 1) % e->inodes_per_group * e->inode_size;
+    return meta_get(e, e->gd[g].inode_table + byte / e->block_size, mode) + byte % e->block_size;
+}
+
+static void inode_load(ext2_t *e, uint32_t ino, ext2_inode_t *in) {
+    memcpy(in, inode_slot(e, ino, M_READ), sizeof(*in));
+}
+
+static void inode_store(ext2_t *e, uint32_t ino, const ext2_inode_t *in) {
+    memcpy(inode_slot(e, ino, M_WRITE), in, sizeof(*in));
+}
+
+static inline int is_dir(const ext2_inode_t *in) { return (in->mode & S_IFMT) == S_IFDIR; }
+static inline int is_reg(const ext2_inode_t *in) { return (in->mode & S_IFMT) == S_IFREG; }
+
+/* ──────────────────────────────────────────────────────────── */
+/* Block maps                                                   */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Physical block behind file block `fb`, 0 for a hole. With `alloc`
+ * holes are filled near `goal` (indirect blocks first, zeroed) and
+ * *fresh reports a data block that holds nothing yet. in->sectors is
+ * kept current; the caller stores the inode. */
+static uint32_t bmap(ext2_t *e, ext2_inode_t *in, uint32_t fb, int alloc, uint32_t goal, int *fresh) {
+    uint32_t ppb = e->ppb;
+    uint32_t *slot;
+    int depth;
+    if (fresh) *fresh = 0;
+    if (fb < EXT2_NDIR) {
+        slot = &in->block[fb];
+        depth = 0;
+    } else if ((fb -= EXT2_NDIR) < ppb) {
+        slot = &in->block[EXT2_IND];
+        depth = 1;
+    } else if ((fb -= ppb) < ppb * ppb) {
+        slot = &in->block[EXT2_DIND];
+        depth = 2;
+    } else {
+        fb -= ppb * ppb;
+        if (fb / ppb / ppb >= ppb) return 0;
+        slot = &in->block[EXT2_TIND];
+        depth = 3;
+    }
+
+    uint32_t b = *slot;
+    if (!b) {
+        if (!alloc || !(b = alloc_block(e, goal))) return 0;
+        in->sectors += e->spb;
+        if (depth) meta_get(e, b, M_ZERO);
+        else if (fresh) *fresh = 1;
+        *slot = b;
+    }
+    while (depth--) {
+        if (b >= e->blocks_count) return 0;         /* corrupt pointer */
+        uint32_t span = 1;
+        for (int i = 0; i < depth; i++) span *= ppb;
+        uint32_t idx = fb / span % ppb;
+        uint32_t next = ((uint32_t *)meta_get(e, b, M_READ))[idx];
+        if (!next) {
+            if (!alloc || !(next = alloc_block(e, goal))) return 0;
+            in->sectors += e->spb;
+            if (depth) meta_get(e, next, M_ZERO);
+            else if (fresh) *fresh = 1;
+            ((uint32_t *)meta_get(e, b, M_WRITE))[idx] = next;
+        }
+        b = next;
+    }
+    return b < e->blocks_count ? b : 0;
+}
+
+/* Blocks, indirect ones included, that a file of `n` blocks owns */
+static uint32_t blocks_for(const ext2_t *e, uint32_t n) {
+    uint32_t ppb = e->ppb, total = n;
+    if (n <= EXT2_NDIR) return total;
+    n -= EXT2_NDIR;
+    total += 1;
+    if (n <= ppb) return total;
+    n -= ppb;
+    uint32_t n2 = n < ppb * ppb ? n : ppb * ppb;
+    total += 1 + (n2 + ppb - 1) / ppb;
+    if (n <= ppb * ppb) return total;
+    n -= ppb * ppb;
+    return total + 1 + (n + ppb * ppb - 1) / (ppb * ppb) + (n + ppb - 1) / ppb;
+}
+
+/* Free what the tree under `b` (`depth` levels of indirection, first file
+ * block `base`) maps at file blocks >= `keep`. Returns 1 when nothing
+ * below `b` is left and `b` itself was freed. */
+static int free_tree(ext2_t *e, ext2_inode_t *in, uint32_t b, int depth, uint32_t base, uint32_t keep) {
+    if (b >= e->blocks_count) return 1;
+    if (depth == 0) {
+        if (base < keep) return 0;
+        free_block(e, b);
+        in->sectors -= e->spb;
+        return 1;
+    }
+    uint32_t span = 1;
+    for (int i = 1; i < depth; i++) span *= e->ppb;
+    int empty = 1;
+    for (uint32_t i = 0; i < e->ppb; i++) {
+        uint32_t c = ((uint32_t *)meta_get(e, b, M_READ))[i];
+        if (!c) continue;
+        if (base + (i + 1) * span <= keep) {
+            empty = 0;
+            continue;
+        }
+        if (free_tree(e, in, c, depth - 1, base + i * span, keep))
+            ((uint32_t *)meta_get(e, b, M_WRITE))[i] = 0;
+        else
+            empty = 0;
+    }
+    if (!empty) return 0;
+    free_block(e, b);
+    in->sectors -= e->spb;
+    return 1;
+}
+
+/* Release every block that maps file blocks >= `keep` */
+static void truncate_blocks(ext2_t *e, ext2_inode_t *in, uint32_t keep) {
+    for (uint32_t i = keep; i < EXT2_NDIR; i++) {
+        if (!in->block[i]) continue;
+        free_block(e, in->block[i]);
+        in->sectors -= e->spb;
+        in->block[i] = 0;
+    }
+    uint32_t base = EXT2_NDIR, span = e->ppb;
+    for (int d = 1; d <= 3; d++) {
+        uint32_t *slot = &in->block[EXT2_NDIR + d - 1];
+        if (*slot && free_tree(e, in, *slot, d, base, keep)) *slot = 0;
+        base += span;
+        span *= e->ppb;
+    }
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* File data                                                    */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Copy [off, off+len) of `in` (inside the file) to `out`. Whole blocks
+ * that sit back to back on disk move as one bcache run; partial blocks
+ * read only the sectors they touch; holes read as zeros. */
+static void read_data(ext2_t *e, ext2_inode_t *in, uint32_t off, uint8_t *out, uint32_t len) {
+    uint32_t bs = e->block_size;
+    while (len) {
+        uint32_t fb = off / bs, within = off % bs;
+        uint32_t b = bmap(e, in, fb, 0, 0, NULL);
+        uint32_t n;
+        if (within || len < bs) {
+            n = bs - within;
+            if (n > len) n = len;
+            if (b) {
+                uint32_t s0 = within / SECTOR_SIZE;
+                uint32_t s1 = (within + n + SECTOR_SIZE - 1) / SECTOR_SIZE;
+                bcache_read_run(e->dev, b * e->spb + s0, s1 - s0, e->buf);
+                memcpy(out, e->buf + within % SECTOR_SIZE, n);
+            } else {
+                memset(out, 0, n);
+            }
+        } else {
+            uint32_t run = 1;
+            while (b && (run + 1) * bs <= len && bmap(e, in, fb + run, 0, 0, NULL) == b + run) run++;
+            n = run * bs;
+            if (b) bcache_read_run(e->dev, b * e->spb, run * e->spb, out);
+            else memset(out, 0, n);
+        }
+        off += n;
+        out += n;
+        len -= n;
+    }
+}
+
+/* Called after serving [off, off+len) of inode `ino`: a read that starts
+ * where the previous one ended doubles the window, any other halves it;
+ * the sectors that follow are pulled into the block cache run by run. */
+static void readahead(ext2_t *e, uint32_t ino, ext2_inode_t *in, uint32_t off, uint32_t len) {
+    uint32_t end = off + len;
+    if (ino == e->ra_ino && off == e->ra_next) {
+        e->ra_window = e->ra_window ? e->ra_window * 2 : RA_MIN_SECTORS;
+        if (e->ra_window > RA_MAX_SECTORS) e->ra_window = RA_MAX_SECTORS;
+    } else {
+        e->ra_window = ino == e->ra_ino ? e->ra_window / 2 : 0;
+        if (e->ra_window < RA_MIN_SECTORS) e->ra_window = 0;
+        e->ra_end = end;
+    }
+    e->ra_ino = ino;
+    e->ra_next = end;
+    if (!e->ra_window || end >= in->size) return;
+
+    uint32_t window = e->ra_window * SECTOR_SIZE;
+    if (e->ra_end > end + window / 2) return;
+    uint32_t from = e->ra_end > end ? e->ra_end : end;
+    uint32_t to = end + window;
+    if (to > in->size) to = in->size;
+    e->ra_end = to;
+
+    uint32_t bs = e->block_size;
+    from -= from % SECTOR_SIZE;
+    while (from < to) {
+        uint32_t b = bmap(e, in, from / bs, 0, 0, NULL);
+        if (!b) return;
+        uint32_t within = from % bs;
+        uint32_t run = 1;
+        while (from - within + run * bs < to && bmap(e, in, from / bs + run, 0, 0, NULL) == b + run) run++;
+        uint32_t avail = run * bs - within;
+        if (avail > to - from) avail = to - from;
+        uint32_t nsec = (avail + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        bcache_prefetch(e->dev, b * e->spb + within / SECTOR_SIZE, nsec);
+        from += nsec * SECTOR_SIZE;
+    }
+}
+
+/* Write [off, off+len) of inode `ino`, claiming blocks as it goes; each
+ * new block is placed right after the previous one when it is free.
+ * Returns -1 if the volume fills up (blocks claimed so far stay mapped). */
+static int write_data(ext2_t *e, uint32_t ino, ext2_inode_t *in, uint32_t off,
+                      const uint8_t *data, uint32_t len) {
+    uint32_t bs = e->block_size;
+    uint32_t goal = off >= bs ? bmap(e, in, off / bs - 1, 0, 0, NULL) : 0;
+    goal = goal ? goal + 1 : group_first(e, (ino - 1) / e->inodes_per_group);
+    while (len) {
+        uint32_t fb = off / bs, within = off % bs;
+        int fresh;
+        uint32_t b = bmap(e, in, fb, 1, goal, &fresh);
+        if (!b) return -1;
+        goal = b + 1;
+        uint32_t n;
+        if (within || len < bs) {
+            n = bs - within;
+            if (n > len) n = len;
+            if (fresh) {
+                memset(e->buf, 0, bs);
+                memcpy(e->buf + within, data, n);
+                bcache_write_run(e->dev, b * e->spb, e->spb, e->buf);
+            } else {
+                uint32_t s0 = within / SECTOR_SIZE;
+                uint32_t s1 = (within + n + SECTOR_SIZE - 1) / SECTOR_SIZE;
+                bcache_read_run(e->dev, b * e->spb + s0, s1 - s0, e->buf);
+                memcpy(e->buf + within % SECTOR_SIZE, data, n);
+                bcache_write_run(e->dev, b * e->spb + s0, s1 - s0, e->buf);
+            }
+        } else {
+            uint32_t run = 1;
+            while ((run + 1) * bs <= len) {
+                uint32_t next = bmap(e, in, fb + run, 1, goal, NULL);
+                if (!next) break;
+                goal = next + 1;
+                if (next != b + run) break;
+                run++;
+            }
+            n = run * bs;
+            bcache_write_run(e->dev, b * e->spb, run * e->spb, data);
+        }
+        off += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Would growing `in` to `bytes` fit in the free blocks? */
+static int space_for(const ext2_t *e, const ext2_inode_t *in, uint32_t bytes) {
+    uint32_t want = blocks_for(e, (bytes + e->block_size - 1) / e->block_size);
+    uint32_t have = in->sectors / e->spb;
+    return want <= have || want - have <= e->free_blocks;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Directory hashing                                            */
+/* ──────────────────────────────────────────────────────────── */
+
+static inline uint32_t rol32(uint32_t x, int s) { return (x << s) | (x >> (32 - s)); }
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = rol32(a, s))
+#define K2 0x5A827999u
+#define K3 0x6ED9EBA1u
+
+static void half_md4(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+    ROUND(F, a, b, c, d, in[0], 3);
+    ROUND(F, d, a, b, c, in[1], 7);
+    ROUND(F, c, d, a, b, in[2], 11);
+    ROUND(F, b, c, d, a, in[3], 19);
+    ROUND(F, a, b, c, d, in[4], 3);
+    ROUND(F, d, a, b, c, in[5], 7);
+    ROUND(F, c, d, a, b, in[6], 11);
+    ROUND(F, b, c, d, a, in[7], 19);
+    ROUND(G, a, b, c, d, in[1] + K2, 3);
+    ROUND(G, d, a, b, c, in[3] + K2, 5);
+    ROUND(G, c, d, a, b, in[5] + K2, 9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2, 3);
+    ROUND(G, d, a, b, c, in[2] + K2, 5);
+    ROUND(G, c, d, a, b, in[4] + K2, 9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+    ROUND(H, a, b, c, d, in[3] + K3, 3);
+    ROUND(H, d, a, b, c, in[7] + K3, 9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3, 3);
+    ROUND(H, d, a, b, c, in[5] + K3, 9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void tea(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9u;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static inline int name_char(const char *s, int i, int unsig) {
+    return unsig ? (int)(unsigned char)s[i] : (int)(signed char)s[i];
+}
+
+/* Pack up to num*4 name bytes into words, padded with the length */
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num, int unsig) {
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+    uint32_t val = pad;
+    if (len > num * 4) len = num * 4;
+    for (int i = 0; i < len; i++) {
+        val = (uint32_t)name_char(msg, i, unsig) + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) *buf++ = val;
+    while (--num >= 0) *buf++ = pad;
+}
+
+/* Hash of a name as the directory index stores it (bit 0 clear).
+ * `version` already includes the unsigned-char offset of 3. */
+static uint32_t dx_hash(const ext2_t *e, int version, const char *name, int len) {
+    uint32_t buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    uint32_t in[8], hash = 0;
+    if (e->hash_seed[0] | e->hash_seed[1] | e->hash_seed[2] | e->hash_seed[3])
+        memcpy(buf, e->hash_seed, sizeof(buf));
+    int unsig = version > DX_HASH_TEA;
+    if (unsig) version -= 3;
+    if (version == DX_HASH_LEGACY) {
+        uint32_t h0 = 0x12A3FE2D, h1 = 0x37ABE8F9;
+        for (int i = 0; i < len; i++) {
+            uint32_t h = h1 + (h0 ^ (uint32_t)(name_char(name, i, unsig) * 7152373));
+            if (h & 0x80000000u) h -= 0x7FFFFFFF;
+            h1 = h0;
+            h0 = h;
+        }
+        hash = h0 << 1;
+    } else if (version == DX_HASH_HALF_MD4) {
+        for (const char *p = name; len > 0; len -= 32, p += 32) {
+            str2hashbuf(p, len, in, 8, unsig);
+            half_md4(buf, in);
+        }
+        hash = buf[1];
+    } else {
+        for (const char *p = name; len > 0; len -= 16, p += 16) {
+            str2hashbuf(p, len, in, 4, unsig);
+            tea(buf, in);
+        }
+        hash = buf[0];
+    }
+    hash &= ~1u;
+    if (hash == 0xFFFFFFFEu) hash = 0xFFFFFFFCu;   /* reserved end-of-directory value */
+    return hash;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Directories                                                  */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Where a directory entry lives */
+typedef struct {
+    uint32_t ino;          /* inode it names */
+    uint32_t block;        /* physical directory block */
+    uint32_t pos;          /* byte offset of the entry */
+    uint32_t prev;         /* offset of the entry before it, == pos if first */
+} dir_slot_t;
+
+static inline int dirent_ok(const ext2_t *e, const ext2_dirent_t *d, uint32_t pos) {
+    return d->rec_len >= 8 && !(d->rec_len & 3) && pos + d->rec_len <= e->block_size &&
+           DIRENT_LEN(d->name_len) <= d->rec_len;
+}
+
+static inline uint32_t dir_blocks(const ext2_t *e, const ext2_inode_t *dir) {
+    return dir->size / e->block_size;
+}
+
+/* Look for `name` in directory block `lb` */
+static int block_find(ext2_t *e, ext2_inode_t *dir, uint32_t lb, const char *name, uint32_t len,
+                      dir_slot_t *out) {
+    uint32_t b = bmap(e, dir, lb, 0, 0, NULL);
+    if (!b) return -1;
+    const uint8_t *blk = meta_get(e, b, M_READ);
+    uint32_t prev = 0;
+    for (uint32_t pos = 0; pos < e->block_size; ) {
+        const ext2_dirent_t *d = (const ext2_dirent_t *)(blk + pos);
+        if (!dirent_ok(e, d, pos)) return -1;
+        if (d->inode && d->name_len == len && !memcmp(d->name, name, len) && inode_valid(e, d->inode)) {
+            out->ino = d->inode;
+            out->block = b;
+            out->pos = pos;
+            out->prev = prev;
+            return 0;
+        }
+        prev = pos;
+        pos += d->rec_len;
+    }
+    return -1;
+}
+
+/* Fill in a free record big enough for the new entry in block `lb`:
+ * an unused record or the slack behind a live one. */
+static int block_insert(ext2_t *e, ext2_inode_t *dir, uint32_t lb, const char *name, uint32_t len,
+                        uint32_t ino, uint8_t ft) {
+    uint32_t b = bmap(e, dir, lb, 0, 0, NULL);
+    if (!b) return -1;
+    uint8_t *blk = meta_get(e, b, M_READ);
+    uint32_t need = DIRENT_LEN(len);
+    for (uint32_t pos = 0; pos < e->block_size; ) {
+        ext2_dirent_t *d = (ext2_dirent_t *)(blk + pos);
+        if (!dirent_ok(e, d, pos)) return -1;
+        uint32_t used = d->inode ? DIRENT_LEN(d->name_len) : 0;
+        if (d->rec_len - used >= need) {
+            meta_get(e, b, M_WRITE);
+            if (used) {
+                ext2_dirent_t *n = (ext2_dirent_t *)(blk + pos + used);
+                n->rec_len = d->rec_len - used;
+                d->rec_len = used;
+                d = n;
+            }
+            d->inode = ino;
+            d->name_len = len;
+            d->file_type = e->filetype ? ft : 0;
+            memcpy(d->name, name, len);
+            return 0;
+        }
+        pos += d->rec_len;
+    }
+    return -1;
+}
+
+/* Append a block holding one empty record to directory `dir`. Returns
+ * its physical number, 0 if the volume is full. */
+static uint32_t dir_grow(ext2_t *e, uint32_t dino, ext2_inode_t *dir) {
+    uint32_t lb = dir_blocks(e, dir);
+    uint32_t goal = lb ? bmap(e, dir, lb - 1, 0, 0, NULL) : 0;
+    goal = goal ? goal + 1 : group_first(e, (dino - 1) / e->inodes_per_group);
+    uint32_t b = bmap(e, dir, lb, 1, goal, NULL);
+    if (!b) return 0;
+    ext2_dirent_t *d = (ext2_dirent_t *)meta_get(e, b, M_ZERO);
+    d->rec_len = e->block_size;
+    dir->size += e->block_size;
+    return b;
+}
+
+/* Path from the index root to a leaf */
+typedef struct {
+    uint32_t hash;
+    int      version;                  /* hash function, unsigned offset applied */
+    int      levels;                   /* index nodes on the path */
+    uint32_t node[DX_MAX_LEVELS];      /* directory block of each node */
+    uint32_t at[DX_MAX_LEVELS];        /* entry followed in each node */
+} dx_path_t;
+
+static inline int is_indexed(const ext2_t *e, const ext2_inode_t *dir) {
+    return e->dir_index && (dir->flags & INDEX_FL);
+}
+
+/* Entries of index node `lb` (0 = root) */
+static dx_entry_t *dx_node(ext2_t *e, ext2_inode_t *dir, uint32_t lb, int mode) {
+    uint32_t b = bmap(e, dir, lb, 0, 0, NULL);
+    if (!b) return NULL;
+    return (dx_entry_t *)(meta_get(e, b, mode) + (lb ? DX_NODE_ENTRIES : DX_ROOT_ENTRIES));
+}
+
+static inline dx_countlimit_t *dx_cl(dx_entry_t *ent) {
+    return (dx_countlimit_t *)ent;
+}
+
+/* Walk the index from the root towards the leaf that holds `name`.
+ * Returns its directory block, or -1 if the index cannot be used (the
+ * directory is then treated as a plain one). */
+static int dx_probe(ext2_t *e, ext2_inode_t *dir, const char *name, uint32_t len, dx_path_t *path) {
+    uint32_t b = bmap(e, dir, 0, 0, 0, NULL);
+    if (!b) return -1;
+    const dx_root_info_t *ri = (const dx_root_info_t *)(meta_get(e, b, M_READ) + 24);
+    if (ri->reserved || ri->info_length != 8 || ri->hash_version > DX_HASH_TEA ||
+        ri->levels >= DX_MAX_LEVELS)
+        return -1;
+    path->version = ri->hash_version + e->hash_unsigned;
+    path->levels = ri->levels + 1;
+    path->hash = dx_hash(e, path->version, name, len);
+
+    uint32_t lb = 0, nblocks = dir_blocks(e, dir);
+    for (int l = 0; l < path->levels; l++) {
+        dx_entry_t *ent = dx_node(e, dir, lb, M_READ);
+        if (!ent) return -1;
+        uint32_t count = dx_cl(ent)->count, limit = dx_cl(ent)->limit;
+        uint32_t max = (e->block_size - (lb ? DX_NODE_ENTRIES : DX_ROOT_ENTRIES)) / sizeof(dx_entry_t);
+        if (!count || count > limit || limit > max) return -1;
+        /* last entry whose hash is <= ours; entry 0 covers everything below entry 1 */
+        uint32_t lo = 1, hi = count;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (ent[mid].hash > path->hash) hi = mid;
+            else lo = mid + 1;
+        }
+        path->node[l] = lb;
+        path->at[l] = lo - 1;
+        lb = ent[lo - 1].block & DX_BLOCK_MASK;
+        if (!lb || lb >= nblocks) return -1;
+    }
+    return (int)lb;
+}
+
+/* Step to the next leaf if the name's hash continues into it (hash
+ * collisions spill over leaf boundaries). Returns its block, or -1. */
+static int dx_next_leaf(ext2_t *e, ext2_inode_t *dir, dx_path_t *path) {
+    int l = path->levels - 1;
+    for (;;) {
+        dx_entry_t *ent = dx_node(e, dir, path->node[l], M_READ);
+        if (!ent) return -1;
+        if (path->at[l] + 1 < dx_cl(ent)->count) break;
+        if (l == 0) return -1;
+        l--;
+    }
+    dx_entry_t *ent = dx_node(e, dir, path->node[l], M_READ);
+    path->at[l]++;
+    if ((ent[path->at[l]].hash & ~1u) != path->hash) return -1;
+    uint32_t lb = ent[path->at[l]].block & DX_BLOCK_MASK;
+    while (++l < path->levels) {
+        path->node[l] = lb;
+        path->at[l] = 0;
+        if (!(ent = dx_node(e, dir, lb, M_READ))) return -1;
+        lb = ent[0].block & DX_BLOCK_MASK;
+    }
+    return lb < dir_blocks(e, dir) ? (int)lb : -1;
+}
+
+static int dir_find(ext2_t *e, ext2_inode_t *dir, const char *name, uint32_t len, dir_slot_t *out) {
+    if (is_indexed(e, dir)) {
+        dx_path_t path;
+        int lb = dx_probe(e, dir, name, len, &path);
+        if (lb >= 0) {
+            do {
+                if (block_find(e, dir, (uint32_t)lb, name, len, out) == 0) return 0;
+            } while ((lb = dx_next_leaf(e, dir, &path)) >= 0);
+            return -1;
+        }
+    }
+    uint32_t n = dir_blocks(e, dir);
+    for (uint32_t lb = 0; lb < n; lb++)
+        if (block_find(e, dir, lb, name, len, out) == 0) return 0;
+    return -1;
+}
+
+/* Sorting key of one entry while a leaf is split */
+typedef struct {
+    uint32_t hash;
+    uint16_t pos;
+    uint16_t len;          /* DIRENT_LEN of the entry */
+} dx_map_t;
+
+/* Copy entries map[from..to) of the block image `src` into `dst` packed
+ * tight, the last one stretched to the end of the block. */
+static void pack_entries(ext2_t *e, uint8_t *dst, const uint8_t *src, const dx_map_t *map,
+                         uint32_t from, uint32_t to) {
+    uint32_t out = 0;
+    ext2_dirent_t *last = NULL;
+    for (uint32_t i = from; i < to; i++) {
+        last = (ext2_dirent_t *)(dst + out);
+        memcpy(last, src + map[i].pos, map[i].len);
+        last->rec_len = map[i].len;
+        out += map[i].len;
+    }
+    if (last) {
+        last->rec_len += e->block_size - out;
+    } else {
+        memset(dst, 0, 8);
+        ((ext2_dirent_t *)dst)->rec_len = e->block_size;
+    }
+}
+
+/* Insert {hash, lb} after entry `at` of an index node with room left */
+static void dx_insert(dx_entry_t *ent, uint32_t at, uint32_t hash, uint32_t lb) {
+    uint32_t count = dx_cl(ent)->count;
+    for (uint32_t i = count; i > at + 1; i--) ent[i] = ent[i - 1];
+    ent[at + 1].hash = hash;
+    ent[at + 1].block = lb;
+    dx_cl(ent)->count = count + 1;
+}
+
+/* Make room for one more entry along `path`: split the full leaf in two
+ * by hash, or when its index node is full, split that node or add a
+ * level under the root. Returns 0 (retry the insert), -1 if the volume
+ * is full, -2 if the tree cannot grow (fall back to a plain directory). */
+static int dx_split(ext2_t *e, uint32_t dino, ext2_inode_t *dir, dx_path_t *path, uint32_t leaf) {
+    uint32_t bs = e->block_size;
+    int l = path->levels - 1;
+    dx_entry_t *ent = dx_node(e, dir, path->node[l], M_READ);
+    if (!ent) return -2;
+    uint32_t count = dx_cl(ent)->count;
+
+    if (count == dx_cl(ent)->limit) {
+        if (l == 0 && path->levels < DX_MAX_LEVELS) {
+            /* root full: its entries move to a new node one level down */
+            uint32_t lb = dir_blocks(e, dir);
+            uint32_t b = dir_grow(e, dino, dir);
+            if (!b) return -1;
+            dx_entry_t *node = (dx_entry_t *)(meta_get(e, b, M_WRITE) + DX_NODE_ENTRIES);
+            ent = dx_node(e, dir, 0, M_WRITE);
+            memcpy(node, ent, count * sizeof(dx_entry_t));
+            dx_cl(node)->limit = (bs - DX_NODE_ENTRIES) / sizeof(dx_entry_t);
+            dx_cl(ent)->count = 1;
+            ent[0].block = lb;
+            ((dx_root_info_t *)((uint8_t *)ent - 8))->levels = 1;
+            return 0;
+        }
+        if (l == 0) return -2;
+        dx_entry_t *root = dx_node(e, dir, 0, M_READ);
+        if (dx_cl(root)->count == dx_cl(root)->limit) return -2;
+        /* index node full: its upper half moves to a new sibling */
+        uint32_t lb = dir_blocks(e, dir);
+        uint32_t b = dir_grow(e, dino, dir);
+        if (!b) return -1;
+        dx_entry_t *node = (dx_entry_t *)(meta_get(e, b, M_WRITE) + DX_NODE_ENTRIES);
+        ent = dx_node(e, dir, path->node[l], M_WRITE);
+        uint32_t half = count / 2;
+        uint32_t sep = ent[half].hash;
+        memcpy(&node[0], &ent[half], (count - half) * sizeof(dx_entry_t));
+        dx_cl(node)->limit = (bs - DX_NODE_ENTRIES) / sizeof(dx_entry_t);
+        dx_cl(node)->count = count - half;
+        dx_cl(ent)->count = half;
+        dx_insert(dx_node(e, dir, 0, M_WRITE), path->at[0], sep, lb);
+        return 0;
+    }
+
+    /* split the leaf: sort its entries by hash, move the upper half */
+    uint32_t b = bmap(e, dir, leaf, 0, 0, NULL);
+    if (!b) return -2;
+    memcpy(e->tmp, meta_get(e, b, M_READ), bs);
+    dx_map_t *map = (dx_map_t *)e->buf;
+    uint32_t n = 0;
+    for (uint32_t pos = 0; pos < bs; ) {
+        const ext2_dirent_t *d = (const ext2_dirent_t *)(e->tmp + pos);
+        if (!dirent_ok(e, d, pos)) return -2;
+        if (d->inode) {
+            dx_map_t m = { dx_hash(e, path->version, d->name, d->name_len), (uint16_t)pos,
+                           (uint16_t)DIRENT_LEN(d->name_len) };
+            uint32_t j = n++;
+            while (j > 0 && map[j - 1].hash > m.hash) {
+                map[j] = map[j - 1];
+                j--;
+            }
+            map[j] = m;
+        }
+        pos += d->rec_len;
+    }
+    if (n < 2) return -2;
+    uint32_t split = n, moved = 0;
+    while (split > 1 && moved + map[split - 1].len <= bs / 2) moved += map[--split].len;
+    if (split == n) split = n - 1;
+    uint32_t hash2 = map[split].hash;
+    uint32_t continued = hash2 == map[split - 1].hash;
+
+    uint32_t lb = dir_blocks(e, dir);
+    uint32_t nb = dir_grow(e, dino, dir);
+    if (!nb) return -1;
+    pack_entries(e, meta_get(e, nb, M_WRITE), e->tmp, map, split, n);
+    pack_entries(e, meta_get(e, b, M_WRITE), e->tmp, map, 0, split);
+    dx_insert(dx_node(e, dir, path->node[l], M_WRITE), path->at[l], hash2 | continued, lb);
+    return 0;
+}
+
+/* Insert through the index. Returns 0, -1 (volume full) or -2 (index
+ * unusable). */
+static int dx_add(ext2_t *e, uint32_t dino, ext2_inode_t *dir, const char *name, uint32_t len,
+                  uint32_t ino, uint8_t ft) {
+    for (int tries = 0; tries < 4; tries++) {
+        dx_path_t path;
+        int leaf = dx_probe(e, dir, name, len, &path);
+        if (leaf < 0) return -2;
+        if (block_insert(e, dir, (uint32_t)leaf, name, len, ino, ft) == 0) return 0;
+        int r = dx_split(e, dino, dir, &path, (uint32_t)leaf);
+        if (r < 0) return r;
+    }
+    return -2;
+}
+
+/* Turn a full one-block directory into an indexed one: its entries move
+ * to a new leaf and block 0 becomes the index root. */
+static int dx_create(ext2_t *e, uint32_t dino, ext2_inode_t *dir) {
+    uint32_t bs = e->block_size;
+    uint32_t b0 = bmap(e, dir, 0, 0, 0, NULL);
+    if (!b0) return -1;
+    memcpy(e->tmp, meta_get(e, b0, M_READ), bs);
+    const ext2_dirent_t *dot = (const ext2_dirent_t *)e->tmp;
+    if (!dirent_ok(e, dot, 0) || dot->name_len != 1 || dot->name[0] != '.') return -1;
+    const ext2_dirent_t *dotdot = (const ext2_dirent_t *)(e->tmp + dot->rec_len);
+    if (!dirent_ok(e, dotdot, dot->rec_len) || dotdot->name_len != 2 || dotdot->name[1] != '.')
+        return -1;
+
+    dx_map_t *map = (dx_map_t *)e->buf;
+    uint32_t n = 0;
+    for (uint32_t pos = dot->rec_len + dotdot->rec_len; pos < bs; ) {
+        const ext2_dirent_t *d = (const ext2_dirent_t *)(e->tmp + pos);
+        if (!dirent_ok(e, d, pos)) return -1;
+        if (d->inode) {
+            map[n].pos = (uint16_t)pos;
+            map[n].len = (uint16_t)DIRENT_LEN(d->name_len);
+            n++;
+        }
+        pos += d->rec_len;
+    }
+    uint32_t b1 = dir_grow(e, dino, dir);
+    if (!b1) return -1;
+    pack_entries(e, meta_get(e, b1, M_WRITE), e->tmp, map, 0, n);
+
+    uint8_t *blk = meta_get(e, b0, M_WRITE);
+    memset(blk, 0, bs);
+    memcpy(blk, dot, 12);
+    ((ext2_dirent_t *)blk)->rec_len = 12;
+    memcpy(blk + 12, dotdot, 12);
+    ((ext2_dirent_t *)(blk + 12))->rec_len = bs - 12;
+    dx_root_info_t *ri = (dx_root_info_t *)(blk + 24);
+    ri->hash_version = e->def_hash;
+    ri->info_length = 8;
+    dx_entry_t *ent = (dx_entry_t *)(blk + DX_ROOT_ENTRIES);
+    dx_cl(ent)->limit = (bs - DX_ROOT_ENTRIES) / sizeof(dx_entry_t);
+    dx_cl(ent)->count = 1;
+    ent[0].block = 1;
+    dir->flags |= INDEX_FL;
+    return 0;
+}
+
+/* Link `name` to inode `ino` in directory `dino`. The caller stores the
+ * directory inode. Returns 0, or -1 if the volume is full. */
+static int dir_add(ext2_t *e, uint32_t dino, ext2_inode_t *dir, const char *name, uint32_t len,
+                   uint32_t ino, uint8_t ft) {
+    if (is_indexed(e, dir)) {
+        int r = dx_add(e, dino, dir, name, len, ino, ft);
+        if (r != -2) return r;
+    }
+    /* plain directory from here on; a stale index must not be trusted */
+    dir->flags &= ~INDEX_FL;
+    uint32_t n = dir_blocks(e, dir);
+    for (uint32_t lb = 0; lb < n; lb++)
+        if (block_insert(e, dir, lb, name, len, ino, ft) == 0) return 0;
+    if (n == 1 && e->dir_index && dx_create(e, dino, dir) == 0)
+        return dx_add(e, dino, dir, name, len, ino, ft) == 0 ? 0 : -1;
+    if (!dir_grow(e, dino, dir)) return -1;
+    return block_insert(e, dir, n, name, len, ino, ft);
+}
+
+static void dir_unlink(ext2_t *e, const dir_slot_t *s) {
+    uint8_t *blk = meta_get(e, s->block, M_WRITE);
+    ext2_dirent_t *d = (ext2_dirent_t *)(blk + s->pos);
+    if (s->prev != s->pos) ((ext2_dirent_t *)(blk + s->prev))->rec_len += d->rec_len;
+    else d->inode = 0;
+}
+
+typedef void (*dir_visit_fn)(ext2_t *e, const ext2_dirent_t *d, void *ctx);
+
+/* Every live entry of `dir` except "." and "..", in on-disk order */
+static void dir_walk(ext2_t *e, ext2_inode_t *dir, dir_visit_fn fn, void *ctx) {
+    uint32_t n = dir_blocks(e, dir);
+    for (uint32_t lb = 0; lb < n; lb++) {
+        uint32_t b = bmap(e, dir, lb, 0, 0, NULL);
+        if (!b) continue;
+        for (uint32_t pos = 0; pos < e->block_size; ) {
+            const ext2_dirent_t *d = (const ext2_dirent_t *)(meta_get(e, b, M_READ) + pos);
+            if (!dirent_ok(e, d, pos)) break;
+            pos += d->rec_len;
+            if (!d->inode || !inode_valid(e, d->inode)) continue;
+            if (d->name[0] == '.' && (d->name_len == 1 || (d->name_len == 2 && d->name[1] == '.')))
+                continue;
+            fn(e, d, ctx);
+        }
+    }
+}
+
+static void count_entry(ext2_t *e, const ext2_dirent_t *d, void *ctx) {
+    (void)e; (void)d;
+    (*(uint32_t *)ctx)++;
+}
+
+/* The ".." entry of directory `dir`, second record of block 0 (also
+ * in indexed directories, where a hash lookup would not find it) */
+static ext2_dirent_t *dotdot_entry(ext2_t *e, ext2_inode_t *dir, uint32_t *block) {
+    uint32_t b = bmap(e, dir, 0, 0, 0, NULL);
+    if (!b) return NULL;
+    uint8_t *blk = meta_get(e, b, M_READ);
+    const ext2_dirent_t *dot = (const ext2_dirent_t *)blk;
+    if (!dirent_ok(e, dot, 0) || dot->rec_len + 12u > e->block_size) return NULL;
+    ext2_dirent_t *dotdot = (ext2_dirent_t *)(blk + dot->rec_len);
+    if (dotdot->name_len != 2 || dotdot->name[0] != '.' || dotdot->name[1] != '.') return NULL;
+    *block = b;
+    return dotdot;
+}
+
+static void set_dotdot(ext2_t *e, ext2_inode_t *dir, uint32_t parent) {
+    uint32_t b;
+    ext2_dirent_t *dotdot = dotdot_entry(e, dir, &b);
+    if (!dotdot) return;
+    meta_get(e, b, M_WRITE);
+    dotdot->inode = parent;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Path lookup                                                  */
+/* ──────────────────────────────────────────────────────────── */
+
+typedef struct {
+    uint32_t    ino;       /* inode the path names, 0 if missing */
+    uint32_t    parent;    /* directory holding the last component, 0 if unreachable */
+    const char *leaf;      /* last component */
+    uint32_t    len;
+} lookup_t;
+
+/* Walk "A/B/C" from the root directory */
+static void namei(ext2_t *e, const char *path, lookup_t *out) {
+    uint32_t dino = EXT2_ROOT_INO;
+    out->ino = EXT2_ROOT_INO;
+    out->parent = 0;
+    out->leaf = "";
+    out->len = 0;
+    while (*path == '/') path++;
+    while (*path) {
+        const char *s = path;
+        while (*path && *path != '/') path++;
+        uint32_t n = (uint32_t)(path - s);
+        while (*path == '/') path++;
+        ext2_inode_t dir;
+        inode_load(e, dino, &dir);
+        out->ino = 0;
+        if (!is_dir(&dir) || n > EXT2_NAME_MAX) {
+            out->parent = 0;
+            return;
+        }
+        out->parent = dino;
+        out->leaf = s;
+        out->len = n;
+        dir_slot_t slot;
+        if (dir_find(e, &dir, s, n, &slot) == 0) out->ino = slot.ino;
+        if (!*path) return;
+        if (!out->ino) {
+            out->parent = 0;
+            return;
+        }
+        dino = out->ino;
+    }
+}
+
+static int name_ok(const lookup_t *l) {
+    if (!l->parent || !l->len) return 0;
+    if (l->leaf[0] == '.' && (l->len == 1 || (l->len == 2 && l->leaf[1] == '.'))) return 0;
+    return 1;
+}
+
+/* New inode linked as `l->leaf` into `l->parent`; *in receives it. */
+static uint32_t create_node(ext2_t *e, const lookup_t *l, uint16_t mode, ext2_inode_t *in) {
+    int dir = (mode & S_IFMT) == S_IFDIR;
+    uint32_t ino = alloc_inode(e, l->parent, dir);
+    if (!ino) return 0;
+    memset(inode_slot(e, ino, M_WRITE), 0, e->inode_size);
+    memset(in, 0, sizeof(*in));
+    in->mode = mode;
+    in->links = dir ? 2 : 1;
+    in->atime = in->ctime = in->mtime = e->now;
+    if (dir) {
+        uint32_t b = bmap(e, in, 0, 1, group_first(e, (ino - 1) / e->inodes_per_group), NULL);
+        if (!b) {
+            free_inode(e, ino, dir);
+            return 0;
+        }
+        uint8_t *blk = meta_get(e, b, M_ZERO);
+        ext2_dirent_t *d = (ext2_dirent_t *)blk;
+        d->inode = ino;
+        d->rec_len = 12;
+        d->name_len = 1;
+        d->file_type = e->filetype ? FT_DIR : 0;
+        d->name[0] = '.';
+        d = (ext2_dirent_t *)(blk + 12);
+        d->inode = l->parent;
+        d->rec_len = e->block_size - 12;
+        d->name_len = 2;
+        d->file_type = e->filetype ? FT_DIR : 0;
+        d->name[0] = d->name[1] = '.';
+        in->size = e->block_size;
+    }
+    ext2_inode_t parent;
+    inode_load(e, l->parent, &parent);
+    if (dir_add(e, l->parent, &parent, l->leaf, l->len, ino, dir ? FT_DIR : FT_REG) < 0) {
+        truncate_blocks(e, in, 0);
+        free_inode(e, ino, dir);
+        inode_store(e, l->parent, &parent);
+        return 0;
+    }
+    if (dir) parent.links++;
+    parent.mtime = parent.ctime = e->now;
+    inode_store(e, l->parent, &parent);
+    inode_store(e, ino, in);
+    return ino;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Mount                                                        */
+/* ──────────────────────────────────────────────────────────── */
+
+ext2_t *ext2_create(blkdev_t *dev) {
+    uint8_t sb[1024];
+    if (!dev || bcache_read_run(dev, 2, 2, sb) < 0) return NULL;
+    if (rd16(&sb[56]) != EXT2_MAGIC) return NULL;
+
+    uint32_t log_bs = rd32(&sb[24]);
+    uint32_t rev = rd32(&sb[76]);
+    uint32_t incompat = rev ? rd32(&sb[96]) : 0;
+    uint32_t ro_compat = rev ? rd32(&sb[100]) : 0;
+    if (log_bs > 2 || (incompat & ~INCOMPAT_FILETYPE)) return NULL;
+
+    ext2_t tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    ext2_t *e = &tmp;
+    e->dev              = dev;
+    e->block_size       = 1024u << log_bs;
+    e->spb              = e->block_size / SECTOR_SIZE;
+    e->ppb              = e->block_size / 4;
+    e->inodes_count     = rd32(&sb[0]);
+    e->blocks_count     = rd32(&sb[4]);
+    e->first_data_block = rd32(&sb[20]);
+    e->blocks_per_group = rd32(&sb[32]);
+    e->inodes_per_group = rd32(&sb[40]);
+    e->now              = rd32(&sb[48]);
+    e->inode_size       = rev ? rd16(&sb[88]) : 128;
+    e->first_ino        = rev ? rd32(&sb[84]) : 11;
+    e->filetype         = (incompat & INCOMPAT_FILETYPE) != 0;
+    e->dir_index        = rev && (rd32(&sb[92]) & COMPAT_DIR_INDEX);
+    e->read_only        = (ro_compat & ~(RO_COMPAT_SPARSE | RO_COMPAT_LARGE | RO_COMPAT_BTREE)) != 0;
+    for (int i = 0; i < 4; i++) e->hash_seed[i] = rd32(&sb[236 + 4 * i]);
+    e->def_hash         = sb[252] <= DX_HASH_TEA ? sb[252] : DX_HASH_HALF_MD4;
+    e->hash_unsigned    = (rd32(&sb[352]) & FLAGS_UNSIGNED_HASH) ? 3 : 0;
+
+    if (!e->blocks_per_group || !e->inodes_per_group || e->blocks_per_group > 8 * e->block_size ||
+        e->inodes_per_group > 8 * e->block_size || e->inode_size < 128 ||
+        e->inode_size > e->block_size || (e->inode_size & (e->inode_size - 1)) ||
+        e->first_data_block >= e->blocks_count || e->first_ino < EXT2_ROOT_INO + 1 ||
+        (uint64_t)e->blocks_count * e->spb > dev->blocks)
+        return NULL;
+    e->groups = (e->blocks_count - e->first_data_block + e->blocks_per_group - 1) / e->blocks_per_group;
+    if ((uint64_t)e->groups * e->inodes_per_group < e->inodes_count) return NULL;
+    e->gd_blocks = (e->groups * sizeof(ext2_group_t) + e->block_size - 1) / e->block_size;
+
+    e = kmalloc(sizeof(ext2_t));
+    if (!e) return NULL;
+    *e = tmp;
+    kmutex_init(&e->lock);
+    e->gd       = kmalloc(e->gd_blocks * e->block_size);
+    e->gd_dirty = kmalloc(e->gd_blocks);
+    e->buf      = kmalloc(e->block_size);
+    e->tmp      = kmalloc(e->block_size);
+    uint8_t *slots = kmalloc(META_SLOTS * e->block_size);
+    if (!e->gd || !e->gd_dirty || !e->buf || !e->tmp || !slots) return NULL;
+    for (int i = 0; i < META_SLOTS; i++) e->meta[i].data = slots + i * e->block_size;
+    memset(e->gd_dirty, 0, e->gd_blocks);
+    if (bcache_read_run(dev, (e->first_data_block + 1) * e->spb, e->gd_blocks * e->spb,
+                        (uint8_t *)e->gd) < 0)
+        return NULL;
+
+    /* the descriptors are authoritative; the superblock totals may lag */
+    for (uint32_t g = 0; g < e->groups; g++) {
+        ext2_group_t *gd = &e->gd[g];
+        if (gd->block_bitmap >= e->blocks_count || gd->inode_bitmap >= e->blocks_count ||
+            gd->inode_table >= e->blocks_count)
+            return NULL;
+        e->free_blocks += gd->free_blocks;
+        e->free_inodes += gd->free_inodes;
+    }
+    ext2_inode_t root;
+    inode_load(e, EXT2_ROOT_INO, &root);
+    if (!is_dir(&root)) return NULL;
+    return e;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* fs_* operations                                              */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Regular file `name`, 0 if there is none */
+static uint32_t open_file(ext2_t *e, const char *name, ext2_inode_t *in) {
+    lookup_t l;
+    namei(e, name, &l);
+    if (!l.ino) return 0;
+    inode_load(e, l.ino, in);
+    return is_reg(in) ? l.ino : 0;
+}
+
+static int ext2_read_at(void *fs, const char *name, uint32_t offset, uint8_t *buf, uint32_t len) {
+    ext2_t *e = fs;
+    ext2_inode_t in;
+    uint32_t ino = open_file(e, name, &in);
+    if (!ino) return -1;
+    if (offset >= in.size) return 0;
+    if (len > in.size - offset) len = in.size - offset;
+    read_data(e, &in, offset, buf, len);
+    readahead(e, ino, &in, offset, len);
+    return (int)len;
+}
+
+static int ext2_stat(void *fs, const char *name, uint32_t *size) {
+    ext2_inode_t in;
+    if (!open_file(fs, name, &in)) return -1;
+    *size = in.size;
+    return 0;
+}
+
+/* An existing file keeps the blocks it still needs, so rewriting a file
+ * of the same size allocates nothing. */
+static int ext2_write(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    ext2_t *e = fs;
+    if (e->read_only) return -1;
+    lookup_t l;
+    namei(e, name, &l);
+    ext2_inode_t in;
+    uint32_t ino = l.ino;
+    if (ino) {
+        inode_load(e, ino, &in);
+        if (!is_reg(&in)) return -1;
+    } else {
+        if (!name_ok(&l)) return -1;
+        memset(&in, 0, sizeof(in));
+        if (!space_for(e, &in, len) || !(ino = create_node(e, &l, S_IFREG | 0644, &in))) {
+            commit(e);
+            return -1;
+        }
+    }
+    if (!space_for(e, &in, len)) return -1;
+    truncate_blocks(e, &in, (len + e->block_size - 1) / e->block_size);
+    int r = write_data(e, ino, &in, 0, data, len);
+    in.size = r == 0 ? len : 0;
+    if (r < 0) truncate_blocks(e, &in, 0);
+    in.mtime = in.ctime = e->now;
+    inode_store(e, ino, &in);
+    commit(e);
+    return r;
+}
+
+static int ext2_write_at(void *fs, const char *name, uint32_t offset, const uint8_t *data, uint32_t len) {
+    ext2_t *e = fs;
+    if (e->read_only) return -1;
+    ext2_inode_t in;
+    uint32_t ino = open_file(e, name, &in);
+    if (!ino) return offset ? -1 : ext2_write(fs, name, data, len);
+    if (offset > in.size || offset + len < offset) return -1;
+    uint32_t end = offset + len;
+    if (!space_for(e, &in, end > in.size ? end : in.size)) return -1;
+    int r = write_data(e, ino, &in, offset, data, len);
+    if (r == 0 && end > in.size) in.size = end;
+    if (r < 0) truncate_blocks(e, &in, (in.size + e->block_size - 1) / e->block_size);
+    in.mtime = in.ctime = e->now;
+    inode_store(e, ino, &in);
+    commit(e);
+    return r;
+}
+
+static int ext2_append(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    ext2_inode_t in;
+    if (!open_file(fs, name, &in)) return ext2_write(fs, name, data, len);
+    return ext2_write_at(fs, name, in.size, data, len);
+}
+
+/* Files and empty directories */
+static int ext2_remove(void *fs, const char *name) {
+    ext2_t *e = fs;
+    if (e->read_only) return -1;
+    lookup_t l;
+    namei(e, name, &l);
+    if (!l.ino || !l.parent) return -1;
+    ext2_inode_t in, parent;
+    inode_load(e, l.ino, &in);
+    int dir = is_dir(&in);
+    if (dir) {
+        uint32_t entries = 0;
+        dir_walk(e, &in, count_entry, &entries);
+        if (entries) return -1;
+    }
+    inode_load(e, l.parent, &parent);
+    dir_slot_t slot;
+    if (dir_find(e, &parent, l.leaf, l.len, &slot) < 0) return -1;
+    dir_unlink(e, &slot);
+    if (dir && parent.links > 1) parent.links--;
+    parent.mtime = parent.ctime = e->now;
+    inode_store(e, l.parent, &parent);
+
+    if (dir || in.links <= 1) {
+        truncate_blocks(e, &in, 0);
+        in.links = 0;
+        in.size = 0;
+        in.dtime = e->now ? e->now : 1;
+        free_inode(e, l.ino, dir);
+    } else {
+        in.links--;
+    }
+    in.ctime = e->now;
+    inode_store(e, l.ino, &in);
+    commit(e);
+    return 0;
+}
+
+/* The new name is linked before the old one goes, so an interrupted
+ * rename leaves two names rather than none. Directories may move to
+ * another parent but not below themselves. */
+static int ext2_rename(void *fs, const char *oldname, const char *newname) {
+    ext2_t *e = fs;
+    if (e->read_only) return -1;
+    lookup_t from, to;
+    namei(e, oldname, &from);
+    namei(e, newname, &to);
+    if (!from.ino || !from.parent || to.ino || !name_ok(&to)) return -1;
+
+    ext2_inode_t in, opdir, npdir;
+    inode_load(e, from.ino, &in);
+    int dir = is_dir(&in);
+    int moved = to.parent != from.parent;
+    if (dir && moved) {
+        /* refuse to move a directory into its own subtree */
+        for (uint32_t p = to.parent; p != EXT2_ROOT_INO; ) {
+            if (p == from.ino) return -1;
+            ext2_inode_t pi;
+            inode_load(e, p, &pi);
+            uint32_t b;
+            ext2_dirent_t *up = dotdot_entry(e, &pi, &b);
+            if (!up || up->inode == p || !inode_valid(e, up->inode)) break;
+            p = up->inode;
+        }
+    }
+    ext2_inode_t *np = moved ? &npdir : &opdir;
+    inode_load(e, from.parent, &opdir);
+    if (moved) inode_load(e, to.parent, &npdir);
+    if (dir_add(e, to.parent, np, to.leaf, to.len, from.ino, dir ? FT_DIR : FT_REG) < 0) {
+        inode_store(e, to.parent, np);
+        commit(e);
+        return -1;
+    }
+    dir_slot_t slot;
+    if (dir_find(e, &opdir, from.leaf, from.len, &slot) == 0) dir_unlink(e, &slot);
+    if (dir && moved) {
+        set_dotdot(e, &in, to.parent);
+        if (opdir.links > 1) opdir.links--;
+        npdir.links++;
+    }
+    opdir.mtime = opdir.ctime = e->now;
+    np->mtime = np->ctime = e->now;
+    inode_store(e, from.parent, &opdir);
+    if (moved) inode_store(e, to.parent, &npdir);
+    in.ctime = e->now;
+    inode_store(e, from.ino, &in);
+    commit(e);
+    return 0;
+}
+
+static void list_entry(ext2_t *e, const ext2_dirent_t *d, void *ctx) {
+    char name[EXT2_NAME_MAX + 2];
+    ext2_inode_t in;
+    inode_load(e, d->inode, &in);
+    memcpy(name, d->name, d->name_len);
+    uint32_t n = d->name_len;
+    if (is_dir(&in)) name[n++] = '/';
+    name[n] = '\0';
+    ((fs_ls_callback)ctx)(name, is_dir(&in) ? 0 : in.size);
+}
+
+/* Directories are listed with a trailing '/' and size 0 */
+static int ext2_ls_dir(void *fs, const char *name, fs_ls_callback cb) {
+    ext2_t *e = fs;
+    lookup_t l;
+    namei(e, name, &l);
+    if (!l.ino) return -1;
+    ext2_inode_t dir;
+    inode_load(e, l.ino, &dir);
+    if (!is_dir(&dir)) return -1;
+    if (cb) dir_walk(e, &dir, list_entry, (void *)cb);
+    return 0;
+}
+
+static int ext2_mkdir(void *fs, const char *name) {
+    ext2_t *e = fs;
+    if (e->read_only) return -1;
+    lookup_t l;
+    namei(e, name, &l);
+    if (l.ino || !name_ok(&l)) return -1;
+    ext2_inode_t in;
+    uint32_t ino = create_node(e, &l, S_IFDIR | 0755, &in);
+    commit(e);
+    return ino ? 0 : -1;
+}
+
+static uint32_t ext2_free_space(void *fs) {
+    ext2_t *e = fs;
+    uint64_t bytes = (uint64_t)e->free_blocks * e->block_size;
+    return bytes > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)bytes;
+}
+
+static const char *ext2_type_name(void *fs) {
+    return ((ext2_t *)fs)->read_only ? "ext2 (ro)" : "ext2";
+}
+
+/* Whole sectors from `offset` that lie inside the file and inside one
+ * run of physically consecutive blocks. */
+static int ext2_bmap(void *fs, const char *name, uint32_t offset, uint32_t len,
+                     blkdev_t **out_dev, uint32_t *out_lba) {
+    ext2_t *e = fs;
+    ext2_inode_t in;
+    if (!open_file(e, name, &in)) return -1;
+    if (offset % SECTOR_SIZE || offset >= in.size) return 0;
+    if (len > in.size - offset) len = in.size - offset;
+    uint32_t bs = e->block_size, fb = offset / bs, within = offset % bs;
+    uint32_t b = bmap(e, &in, fb, 0, 0, NULL);
+    if (!b) return 0;
+    uint32_t run = 1;
+    while (run * bs - within < len && bmap(e, &in, fb + run, 0, 0, NULL) == b + run) run++;
+    if (len > run * bs - within) len = run * bs - within;
+    *out_dev = e->dev;
+    *out_lba = b * e->spb + within / SECTOR_SIZE;
+    return (int)(len / SECTOR_SIZE);
+}
+
+static int ext2_sync(void *fs) {
+    ext2_t *e = fs;
+    commit(e);
+    return blkdev_flush(e->dev);
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Volume lock                                                  */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Bitmaps, descriptors, the staged metadata blocks and the scratch
+ * buffers are per volume, and lookups stage blocks too, so each call
+ * holds the volume lock throughout. fs.c's file and directory locks
+ * still let calls on other volumes run alongside. */
+static int locked_read_at(void *fs, const char *name, uint32_t offset, uint8_t *buf, uint32_t len) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_read_at(fs, name, offset, buf, len);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_stat(void *fs, const char *name, uint32_t *size) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_stat(fs, name, size);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_write(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_write(fs, name, data, len);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_append(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_append(fs, name, data, len);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_write_at(void *fs, const char *name, uint32_t offset, const uint8_t *data, uint32_t len) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_write_at(fs, name, offset, data, len);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_remove(void *fs, const char *name) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_remove(fs, name);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_rename(void *fs, const char *oldname, const char *newname) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_rename(fs, oldname, newname);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_ls_dir(void *fs, const char *name, fs_ls_callback cb) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_ls_dir(fs, name, cb);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static void locked_ls(void *fs, fs_ls_callback cb) {
+    locked_ls_dir(fs, "", cb);
+}
+
+static int locked_mkdir(void *fs, const char *name) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_mkdir(fs, name);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_bmap(void *fs, const char *name, uint32_t offset, uint32_t len,
+                       blkdev_t **out_dev, uint32_t *out_lba) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_bmap(fs, name, offset, len, out_dev, out_lba);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+static int locked_sync(void *fs) {
+    ext2_t *e = fs;
+    kmutex_lock(&e->lock);
+    int r = ext2_sync(fs);
+    kmutex_unlock(&e->lock);
+    return r;
+}
+
+const fs_ops_t ext2_ops = {
+    .read_at    = locked_read_at,
+    .stat       = locked_stat,
+    .write      = locked_write,
+    .append     = locked_append,
+    .remove     = locked_remove,
+    .rename     = locked_rename,
+    .ls         = locked_ls,
+    .free_space = ext2_free_space,
+    .type_name  = ext2_type_name,
+    .write_at   = locked_write_at,
+    .bmap       = locked_bmap,
+    .sync       = locked_sync,
+    .mkdir      = locked_mkdir,
+    .ls_dir     = locked_ls_dir,
+};
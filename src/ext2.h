@@ -0,0 +1,30 @@
+#ifndef EXT2_H
+#define EXT2_H
+
+#include <stdint.h>
+#include "fs.h"
+#include "blkdev.h"
+
+// Second extended filesystem (revision 0 and 1, 1-4 KiB blocks). Files
+// map their blocks through 12 direct, one single, one double and one
+// triple indirect pointer; free space and inodes are tracked in one
+// bitmap each per block group. Directories nest ("DIR/SUB/FILE") and
+// use the on-disk hash tree (dir_index) when the volume has it: a
+// lookup reads the index root, one index node at most and a single leaf
+// block, whatever the directory size. Directories that outgrow one block
+// are indexed on the fly.
+//
+// Volumes with incompatible features beyond FILETYPE (extents, 64-bit,
+// a journal that needs recovery, ...) are refused; unknown read-only
+// features mount read-only. Without an RTC, timestamps are the
+// volume's last write time.
+typedef struct ext2 ext2_t;
+
+// Read the superblock of `dev` and mount it. Returns the instance (from
+// the kernel heap), or NULL if `dev` carries no ext2 volume this driver
+// can use. Mount it with fs_mount(prefix, &ext2_ops, instance).
+ext2_t *ext2_create(blkdev_t *dev);
+
+extern const fs_ops_t ext2_ops;
+
+#endif /* EXT2_H */
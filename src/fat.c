@@ -0,0 +1,1721 @@
+#include "fat.h"
+#include "bcache.h"
+#include "lock.h"
+#include "lz4.h"
+#include "util.h"
+#include "kheap.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+
+/* Cluster-count thresholds from the Microsoft FAT specification */
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+/* Directory entry NTRes bit marking a file whose chain was reserved
+ * beyond its size by fs_preallocate(); Windows only uses 0x08/0x10. */
+#define NTRES_PREALLOC 0x40
+
+/* NTRes bit marking a file stored as LZ4 chunks (fs_compress()). Its
+ * directory size is the stored size; the header below holds the real one:
+ *   0  "LZ4C"   4  logical size   8  chunk size   12  chunk count
+ *   16 uint32 offsets[count + 1], bit 31 set = chunk stored uncompressed */
+#define NTRES_LZ4      0x20
+#define LZ4_MAGIC      0x43345A4C          /* "LZ4C" */
+#define LZ4_HDR_SIZE   16
+#define LZ4_CHUNK      4096
+#define LZ4_RAW        0x80000000u
+#define LZ4_MAX_CHUNKS 1024                 /* files up to 4 MiB */
+
+/* FSInfo signatures (FAT32 only) */
+#define FSINFO_LEAD_SIG   0x41615252
+#define FSINFO_STRUCT_SIG 0x61417272
+#define FSINFO_UNKNOWN    0xFFFFFFFF
+
+typedef struct {
+    uint16_t bytes_per_sector;
+    uint8_t  sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t  num_fats;
+    uint16_t root_entries;
+    uint32_t fat_size;          /* sectors per FAT copy */
+    uint32_t total_sectors;
+    uint32_t fat_start;
+    uint32_t root_dir_start;    /* fixed root region (FAT12/16) */
+    uint32_t root_dir_sectors;  /* 0 on FAT32 */
+    uint32_t root_cluster;      /* first root cluster (FAT32), else 0 */
+    uint32_t data_start;
+    uint32_t cluster_count;     /* valid clusters are 2..cluster_count+1 */
+    uint32_t eoc_min;           /* values >= this terminate a chain */
+    uint32_t eoc;               /* end-of-chain marker written on alloc */
+    uint16_t fsinfo_sector;     /* 0 if absent */
+    uint32_t free_count;        /* FSINFO_UNKNOWN until counted */
+    uint32_t next_free;         /* allocation hint */
+    fat_type_t type;            /* FAT_NONE if mount failed */
+    /* entry codec selected at mount time */
+    uint32_t (*get)(uint32_t cluster);
+    void     (*set)(uint32_t cluster, uint32_t value);
+} fat_info_t;
+
+static fat_info_t info;
+static blkdev_t  *dev;          /* device the volume lives on */
+static int fsinfo_dirty;
+
+/* fs.c keeps calls on one file apart; what files share is locked here.
+ * alloc_lock guards the FAT (staged sectors, free count, hints), the
+ * extent maps and their read-ahead state; dir_lock the root directory
+ * sectors, shared for walks and exclusive for read-modify-writes of an
+ * entry. File data moves with neither held. Order: lz4_lock, dir_lock,
+ * move_lock, alloc_lock. */
+static kmutex_t  alloc_lock = KMUTEX_INIT;
+static krwlock_t dir_lock   = KRWLOCK_INIT;
+
+/* ──────────────────────────────────────────────────────────── */
+/* Utility helpers                                              */
+/* ──────────────────────────────────────────────────────────── */
+
+#define SECTOR_BUF() uint8_t sector[SECTOR_SIZE];
+
+static inline uint16_t rd16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline void wr16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static inline void wr32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+
+/* Read a raw sector into `sector` (through the block cache) */
+static void read_sector(uint32_t lba, uint8_t *sector) {
+    bcache_read(dev, lba, sector);
+}
+
+static void write_sector(uint32_t lba, const uint8_t *sector) {
+    bcache_write(dev, lba, sector);
+}
+
+/* Read `count` consecutive sectors; uncached spans become single
+ * multi-sector commands */
+static void read_sectors(uint32_t lba, uint32_t count, uint8_t *buf) {
+    bcache_read_run(dev, lba, count, buf);
+}
+
+static void write_sectors(uint32_t lba, uint32_t count, const uint8_t *buf) {
+    bcache_write_run(dev, lba, count, buf);
+}
+
+/* One past the highest valid cluster number */
+static uint32_t max_clusters(void) {
+    return info.cluster_count + 2;
+}
+
+static inline uint32_t cluster_lba(uint32_t cluster) {
+    return info.data_start + (cluster - 2) * info.sectors_per_cluster;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* FAT transactions                                             */
+/* ──────────────────────────────────────────────────────────── */
+
+/* FAT sectors are staged here instead of being read-modify-written on
+ * every entry change.  Codecs edit the staged copy; fat_commit() at the
+ * end of an operation writes each dirty sector once to every FAT copy,
+ * coalescing adjacent sectors into multi-sector commands.  Transactions
+ * nest, so only the outermost commit flushes. */
+#define FAT_TXN_SECTORS 32
+
+typedef struct {
+    uint32_t index;         /* sector index within one FAT copy */
+    uint32_t last_use;
+    uint8_t  valid;
+    uint8_t  dirty;
+    uint8_t  data[SECTOR_SIZE];
+} fat_slot_t;
+
+static fat_slot_t fat_slots[FAT_TXN_SECTORS];
+static uint8_t    fat_gather[FAT_TXN_SECTORS * SECTOR_SIZE];
+static uint32_t   fat_clock;
+static int        fat_depth;
+
+static void fsinfo_flush(void);
+
+/* Write every dirty staged sector to all FAT copies */
+static void fat_flush(void) {
+    fat_slot_t *dirty[FAT_TXN_SECTORS];
+    int n = 0;
+    for (int i = 0; i < FAT_TXN_SECTORS; i++) {
+        if (!fat_slots[i].valid || !fat_slots[i].dirty) continue;
+        /* insertion sort by sector index */
+        int j = n++;
+        while (j > 0 && dirty[j - 1]->index > fat_slots[i].index) {
+            dirty[j] = dirty[j - 1];
+            j--;
+        }
+        dirty[j] = &fat_slots[i];
+    }
+    for (int i = 0; i < n; ) {
+        int run = 1;
+        while (i + run < n && dirty[i + run]->index == dirty[i]->index + run) run++;
+        for (int k = 0; k < run; k++) {
+            memcpy(fat_gather + k * SECTOR_SIZE, dirty[i + k]->data, SECTOR_SIZE);
+            dirty[i + k]->dirty = 0;
+        }
+        for (int fat = 0; fat < info.num_fats; fat++)
+            write_sectors(info.fat_start + fat * info.fat_size + dirty[i]->index, run, fat_gather);
+        i += run;
+    }
+}
+
+/* Return the staged copy of FAT sector `index`, loading it on first use.
+ * Clean slots are recycled LRU-first; if every slot is dirty the
+ * transaction is flushed early. */
+static fat_slot_t *fat_sector(uint32_t index) {
+    fat_slot_t *victim = NULL;
+    for (int i = 0; i < FAT_TXN_SECTORS; i++) {
+        fat_slot_t *sl = &fat_slots[i];
+        if (sl->valid && sl->index == index) {
+            sl->last_use = ++fat_clock;
+            return sl;
+        }
+        if (!sl->valid) {
+            if (!victim || victim->valid) victim = sl;
+        } else if (!sl->dirty && (!victim || (victim->valid && sl->last_use < victim->last_use))) {
+            victim = sl;
+        }
+    }
+    if (!victim) {
+        fat_flush();
+        victim = &fat_slots[0];
+        for (int i = 1; i < FAT_TXN_SECTORS; i++)
+            if (fat_slots[i].last_use < victim->last_use) victim = &fat_slots[i];
+    }
+    read_sector(info.fat_start + index, victim->data);
+    victim->index = index;
+    victim->valid = 1;
+    victim->dirty = 0;
+    victim->last_use = ++fat_clock;
+    return victim;
+}
+
+/* FAT reads outside a transaction (chain walks) */
+static void fat_lock(void) {
+    kmutex_lock(&alloc_lock);
+}
+
+static void fat_unlock(void) {
+    kmutex_unlock(&alloc_lock);
+}
+
+/* A transaction holds the allocation lock until its outermost commit */
+static void fat_begin(void) {
+    fat_lock();
+    fat_depth++;
+}
+
+static void fat_commit(void) {
+    if (fat_depth > 0 && --fat_depth == 0) {
+        fat_flush();
+        fsinfo_flush();
+    }
+    fat_unlock();
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* FAT entry codecs                                             */
+/* ──────────────────────────────────────────────────────────── */
+
+/* FAT12: 1.5 bytes per entry; an entry may straddle two sectors. */
+static uint32_t fat12_get(uint32_t cluster) {
+    uint32_t byte_offset = cluster + (cluster / 2); /* 1.5 * cluster */
+    uint32_t index = byte_offset / SECTOR_SIZE;
+    uint32_t idx = byte_offset % SECTOR_SIZE;
+    uint8_t low = fat_sector(index)->data[idx];
+    uint8_t high = (idx == SECTOR_SIZE - 1) ? fat_sector(index + 1)->data[0]
+                                            : fat_sector(index)->data[idx + 1];
+
+    if (cluster & 1) {
+        /* odd cluster */
+        return ((low >> 4) | (high << 4)) & 0x0FFF;
+    }
+    /* even cluster */
+    return (low | ((high & 0x0F) << 8)) & 0x0FFF;
+}
+
+static void fat12_set(uint32_t cluster, uint32_t value) {
+    value &= 0x0FFF;
+    uint32_t byte_offset = cluster + (cluster / 2);
+    uint32_t index = byte_offset / SECTOR_SIZE;
+    uint32_t idx = byte_offset % SECTOR_SIZE;
+    fat_slot_t *a = fat_sector(index);
+    fat_slot_t *b = (idx == SECTOR_SIZE - 1) ? fat_sector(index + 1) : a;
+    uint8_t *lo = &a->data[idx];
+    uint8_t *hi = (b == a) ? &a->data[idx + 1] : &b->data[0];
+    if (cluster & 1) {
+        /* odd cluster: low nibble of the first byte belongs to the neighbour */
+        *lo = (*lo & 0x0F) | ((value & 0x00F) << 4);
+        *hi = (value >> 4) & 0xFF;
+    } else {
+        /* even cluster */
+        *lo = value & 0xFF;
+        *hi = (*hi & 0xF0) | ((value >> 8) & 0x0F);
+    }
+    a->dirty = 1;
+    b->dirty = 1;
+}
+
+static uint32_t fat16_get(uint32_t cluster) {
+    uint32_t byte_offset = cluster * 2;
+    return rd16(&fat_sector(byte_offset / SECTOR_SIZE)->data[byte_offset % SECTOR_SIZE]);
+}
+
+static void fat16_set(uint32_t cluster, uint32_t value) {
+    uint32_t byte_offset = cluster * 2;
+    fat_slot_t *sl = fat_sector(byte_offset / SECTOR_SIZE);
+    wr16(&sl->data[byte_offset % SECTOR_SIZE], (uint16_t)value);
+    sl->dirty = 1;
+}
+
+/* FAT32: only the low 28 bits are the entry; the top nibble is reserved. */
+static uint32_t fat32_get(uint32_t cluster) {
+    uint32_t byte_offset = cluster * 4;
+    return rd32(&fat_sector(byte_offset / SECTOR_SIZE)->data[byte_offset % SECTOR_SIZE]) & 0x0FFFFFFF;
+}
+
+static void fat32_set(uint32_t cluster, uint32_t value) {
+    uint32_t byte_offset = cluster * 4;
+    fat_slot_t *sl = fat_sector(byte_offset / SECTOR_SIZE);
+    uint8_t *e = &sl->data[byte_offset % SECTOR_SIZE];
+    wr32(e, (rd32(e) & 0xF0000000) | (value & 0x0FFFFFFF));
+    sl->dirty = 1;
+}
+
+static inline uint32_t fat_get(uint32_t cluster) { return info.get(cluster); }
+static inline void fat_set(uint32_t cluster, uint32_t value) { info.set(cluster, value); }
+
+static inline int is_eoc(uint32_t value) { return value >= info.eoc_min; }
+
+/* ──────────────────────────────────────────────────────────── */
+/* Cluster allocation                                           */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Write back the FSInfo free-count / next-free hints if they changed */
+static void fsinfo_flush(void) {
+    if (!fsinfo_dirty || !info.fsinfo_sector) return;
+    SECTOR_BUF();
+    read_sector(info.fsinfo_sector, sector);
+    if (rd32(&sector[0]) == FSINFO_LEAD_SIG && rd32(&sector[484]) == FSINFO_STRUCT_SIG) {
+        wr32(&sector[488], info.free_count);
+        wr32(&sector[492], info.next_free);
+        write_sector(info.fsinfo_sector, sector);
+    }
+    fsinfo_dirty = 0;
+}
+
+static void free_cluster_chain(uint32_t start);
+
+/* First-fit search for `want` contiguous free clusters, starting at
+ * `hint` and wrapping once.  If no run is that long the longest one seen
+ * is returned instead; *len receives the run length (capped at `want`).
+ * Returns 0 if there is no free cluster at all. */
+static uint32_t find_free_run(uint32_t hint, uint32_t want, uint32_t *len) {
+    uint32_t max = max_clusters();
+    if (hint < 2 || hint >= max) hint = 2;
+    uint32_t best = 0, best_len = 0;
+    uint32_t run_start = 0, run_len = 0;
+    uint32_t c = hint;
+    for (uint32_t n = 2; n < max; n++) {
+        if (fat_get(c) == 0) {
+            if (!run_len) run_start = c;
+            if (++run_len >= want) {
+                *len = want;
+                return run_start;
+            }
+            if (run_len > best_len) {
+                best = run_start;
+                best_len = run_len;
+            }
+        } else {
+            run_len = 0;
+        }
+        /* a run cannot wrap from the last cluster back to cluster 2 */
+        if (++c >= max) {
+            c = 2;
+            run_len = 0;
+        }
+    }
+    *len = best_len;
+    return best;
+}
+
+/* Mark the free run [start, start+len) as one chain ending in EOC */
+static void claim_run(uint32_t start, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        fat_set(start + i, (i + 1 < len) ? start + i + 1 : info.eoc);
+    if (info.free_count != FSINFO_UNKNOWN) info.free_count -= len;
+    info.next_free = (start + len < max_clusters()) ? start + len : 2;
+    fsinfo_dirty = 1;
+}
+
+/* Allocate `count` clusters in as few contiguous runs as possible and
+ * link them after `tail` (0 starts a new chain).  The search starts just
+ * past `tail`, so a growing file tends to stay in one piece.  Returns the
+ * first new cluster, or 0 if the volume fills up (the partial allocation
+ * is released again and `tail` stays the end of its chain). */
+static uint32_t alloc_chain(uint32_t tail, uint32_t count) {
+    uint32_t first = 0, prev = tail;
+    uint32_t hint = tail ? tail + 1 : info.next_free;
+    while (count) {
+        uint32_t len = 0;
+        uint32_t start = info.free_count ? find_free_run(hint, count, &len) : 0;
+        if (!start) {
+            if (first) {
+                if (tail) fat_set(tail, info.eoc);
+                free_cluster_chain(first);
+            }
+            return 0; /* disk full */
+        }
+        claim_run(start, len);
+        if (prev) fat_set(prev, start);
+        if (!first) first = start;
+        prev = start + len - 1;
+        count -= len;
+        hint = prev + 1;
+    }
+    return first;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Extent map cache                                             */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Each recently used file keeps its cluster chain as a short list of
+ * contiguous runs, so a seek is a binary search instead of a FAT walk
+ * from the first cluster.  Maps are keyed by the file's first cluster,
+ * which is unique per file, and dropped when that chain is freed. */
+#define EXTENT_CACHE_FILES 8
+#define EXTENTS_PER_FILE   64
+
+typedef struct {
+    uint32_t file_cluster;  /* index of the run's first cluster within the file */
+    uint32_t cluster;       /* first disk cluster of the run */
+    uint32_t length;        /* clusters in the run */
+} extent_t;
+
+typedef struct {
+    uint32_t first_cluster; /* key; 0 = slot unused */
+    uint32_t count;         /* extents in use */
+    uint32_t mapped;        /* clusters covered by extents[] */
+    uint8_t  truncated;     /* chain continues past the last extent */
+    uint32_t last_use;
+    /* sequential read-ahead state */
+    uint32_t ra_next;       /* offset a sequential reader asks for next */
+    uint32_t ra_end;        /* file offset prefetched up to */
+    uint32_t ra_window;     /* current window in sectors, 0 = off */
+    extent_t extents[EXTENTS_PER_FILE];
+} extent_map_t;
+
+static extent_map_t extent_cache[EXTENT_CACHE_FILES];
+static uint32_t extent_clock;
+
+/* Most recently expanded chunk of a compressed file, keyed by the file's
+ * first cluster (0 = empty); dropped whenever that chain changes. The
+ * LZ4 buffers belong to whoever holds lz4_lock; the key may also be
+ * cleared under alloc_lock, by the writer of that one file. */
+static uint8_t  lz4_out[LZ4_CHUNK];
+static uint32_t lz4_out_first, lz4_out_index, lz4_out_len;
+static kmutex_t lz4_lock = KMUTEX_INIT;
+
+static void extent_invalidate(uint32_t first_cluster) {
+    if (lz4_out_first == first_cluster) lz4_out_first = 0;
+    for (int i = 0; i < EXTENT_CACHE_FILES; i++)
+        if (extent_cache[i].first_cluster == first_cluster)
+            extent_cache[i].first_cluster = 0;
+}
+
+/* Walk the chain once and record it as runs of adjacent clusters */
+static void extent_build(extent_map_t *m, uint32_t first_cluster) {
+    m->first_cluster = first_cluster;
+    m->count = 0;
+    m->mapped = 0;
+    m->truncated = 0;
+    m->ra_next = 0;
+    m->ra_end = 0;
+    m->ra_window = 0;
+    uint32_t c = first_cluster;
+    while (c >= 2 && c < max_clusters() && m->mapped < info.cluster_count) {
+        extent_t *last = m->count ? &m->extents[m->count - 1] : NULL;
+        if (last && c == last->cluster + last->length) {
+            last->length++;
+        } else if (m->count == EXTENTS_PER_FILE) {
+            m->truncated = 1;
+            break;
+        } else {
+            extent_t *e = &m->extents[m->count++];
+            e->file_cluster = m->mapped;
+            e->cluster = c;
+            e->length = 1;
+        }
+        m->mapped++;
+        uint32_t next = fat_get(c);
+        if (is_eoc(next)) break;
+        c = next;
+    }
+}
+
+/* Return the cached map for a file, building it (LRU eviction) if needed */
+static extent_map_t *extent_map_get(uint32_t first_cluster) {
+    extent_map_t *victim = &extent_cache[0];
+    for (int i = 0; i < EXTENT_CACHE_FILES; i++) {
+        extent_map_t *m = &extent_cache[i];
+        if (m->first_cluster == first_cluster) {
+            m->last_use = ++extent_clock;
+            return m;
+        }
+        if (!m->first_cluster) {
+            if (victim->first_cluster) victim = m;
+        } else if (victim->first_cluster && m->last_use < victim->last_use) {
+            victim = m;
+        }
+    }
+    extent_build(victim, first_cluster);
+    victim->last_use = ++extent_clock;
+    return victim;
+}
+
+/* Map cluster index `idx` of the file to a disk cluster.  `run` receives
+ * how many clusters from there on are physically contiguous.
+ * Returns 0 on success, -1 if the chain is shorter than `idx`.
+ * The caller holds alloc_lock. */
+static int extent_lookup(extent_map_t *m, uint32_t idx, uint32_t *cluster, uint32_t *run) {
+    if (idx < m->mapped) {
+        uint32_t lo = 0, hi = m->count;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (m->extents[mid].file_cluster <= idx) lo = mid; else hi = mid;
+        }
+        extent_t *e = &m->extents[lo];
+        *cluster = e->cluster + (idx - e->file_cluster);
+        *run = e->length - (idx - e->file_cluster);
+        return 0;
+    }
+    if (!m->truncated || !m->count) return -1;
+    /* beyond the cached runs: continue the walk from the last mapped cluster */
+    extent_t *e = &m->extents[m->count - 1];
+    uint32_t c = e->cluster + e->length - 1;
+    for (uint32_t i = m->mapped - 1; i < idx; i++) {
+        c = fat_get(c);
+        if (c < 2 || c >= max_clusters()) return -1;
+    }
+    *cluster = c;
+    *run = 1;
+    return 0;
+}
+
+/* extent_lookup() on the chain starting at `first`. The map may be
+ * rebuilt for another file once the lock is dropped, so data loops call
+ * this once per run instead of keeping the map. */
+static int chain_lookup(uint32_t first, uint32_t idx, uint32_t *cluster, uint32_t *run) {
+    fat_lock();
+    int r = extent_lookup(extent_map_get(first), idx, cluster, run);
+    fat_unlock();
+    return r;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Sequential read-ahead                                        */
+/* ──────────────────────────────────────────────────────────── */
+
+#define RA_MIN_SECTORS   8
+#define RA_MAX_SECTORS 128
+
+/* Called after serving [offset, offset+len).  A read that starts where
+ * the previous one ended doubles the window; any other read halves it.
+ * While the window is open the sectors following the request are pulled
+ * into the block cache along the file's extents, in as few commands as
+ * the layout allows.  The window is only refilled once the reader has
+ * consumed half of what was prefetched. */
+static void readahead(uint32_t first, uint32_t offset, uint32_t len, uint32_t filesize) {
+    uint32_t end = offset + len;
+    fat_lock();
+    extent_map_t *m = extent_map_get(first);
+    if (offset == m->ra_next) {
+        m->ra_window = m->ra_window ? m->ra_window * 2 : RA_MIN_SECTORS;
+        if (m->ra_window > RA_MAX_SECTORS) m->ra_window = RA_MAX_SECTORS;
+    } else {
+        m->ra_window /= 2;
+        if (m->ra_window < RA_MIN_SECTORS) m->ra_window = 0;
+        m->ra_end = end;
+    }
+    m->ra_next = end;
+    uint32_t window = m->ra_window * SECTOR_SIZE;
+    if (!window || end >= filesize || m->ra_end > end + window / 2) {
+        fat_unlock();
+        return;
+    }
+    uint32_t from = (m->ra_end > end) ? m->ra_end : end;
+    uint32_t to = end + window;
+    if (to > filesize) to = filesize;
+    m->ra_end = to;
+    fat_unlock();
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    from -= from % SECTOR_SIZE;
+    while (from < to) {
+        uint32_t within = from % cluster_bytes;
+        uint32_t cluster, run;
+        if (chain_lookup(first, from / cluster_bytes, &cluster, &run) < 0) return;
+        uint32_t avail = run * cluster_bytes - within;
+        if (avail > to - from) avail = to - from;
+        uint32_t nsec = (avail + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        bcache_prefetch(dev, cluster_lba(cluster) + within / SECTOR_SIZE, nsec);
+        from += nsec * SECTOR_SIZE;
+    }
+}
+
+static void free_cluster_chain(uint32_t start) {
+    fat_begin();
+    extent_invalidate(start);
+    uint32_t c = start;
+    while (c >= 2 && c < max_clusters()) {
+        uint32_t next = fat_get(c);
+        fat_set(c, 0);
+        if (info.free_count != FSINFO_UNKNOWN) info.free_count++;
+        if (c < info.next_free) info.next_free = c;
+        fsinfo_dirty = 1;
+        if (is_eoc(next)) break;
+        c = next;
+    }
+    fat_commit();
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* File data helpers                                            */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Length of the chain starting at `first` in clusters; *tail receives
+ * its last cluster.  Uses the cached extent map when it is complete.
+ * The caller holds alloc_lock. */
+static uint32_t chain_length(uint32_t first, uint32_t *tail) {
+    *tail = 0;
+    if (first < 2 || first >= max_clusters()) return 0;
+    extent_map_t *m = extent_map_get(first);
+    if (!m->truncated && m->count) {
+        extent_t *e = &m->extents[m->count - 1];
+        *tail = e->cluster + e->length - 1;
+        return m->mapped;
+    }
+    uint32_t n = 0, c = first;
+    while (c >= 2 && c < max_clusters() && n < info.cluster_count) {
+        *tail = c;
+        n++;
+        uint32_t next = fat_get(c);
+        if (is_eoc(next)) break;
+        c = next;
+    }
+    return n;
+}
+
+/* Keep the first `keep` clusters of a chain and release the rest */
+static void truncate_chain(uint32_t first, uint32_t keep) {
+    if (!keep) {
+        free_cluster_chain(first);
+        return;
+    }
+    uint32_t c = first;
+    for (uint32_t i = 1; i < keep; i++) c = fat_get(c);
+    uint32_t rest = fat_get(c);
+    fat_set(c, info.eoc);
+    if (rest >= 2 && !is_eoc(rest)) free_cluster_chain(rest);
+    extent_invalidate(first);
+}
+
+/* Store `len` bytes at byte `offset` of the chain starting at `first`,
+ * which must already be long enough.  Whole sectors of each contiguous
+ * run go out in one command; partial sectors are merged with the old
+ * contents when they lie below `valid` (the old file size) and zero
+ * padded otherwise. */
+static void write_range(uint32_t first, uint32_t offset, const uint8_t *data,
+                        uint32_t len, uint32_t valid) {
+    if (lz4_out_first == first) lz4_out_first = 0;
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t pos    = offset + done;
+        uint32_t within = pos % cluster_bytes;
+        uint32_t cluster, run;
+        if (chain_lookup(first, pos / cluster_bytes, &cluster, &run) < 0) return;
+
+        uint32_t slba    = cluster_lba(cluster) + within / SECTOR_SIZE;
+        uint32_t sec_off = within % SECTOR_SIZE;
+        uint32_t want    = run * cluster_bytes - within;
+        if (want > len - done) want = len - done;
+
+        if (sec_off || want < SECTOR_SIZE) {
+            SECTOR_BUF();
+            uint32_t n = SECTOR_SIZE - sec_off;
+            if (n > want) n = want;
+            if (pos - sec_off < valid) read_sector(slba, sector);
+            else memset(sector, 0, SECTOR_SIZE);
+            memcpy(sector + sec_off, data + done, n);
+            write_sector(slba, sector);
+            done += n;
+        } else {
+            uint32_t nsec = want / SECTOR_SIZE;
+            write_sectors(slba, nsec, data + done);
+            done += nsec * SECTOR_SIZE;
+        }
+    }
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Directory helpers                                            */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Walks the sectors of the root directory, which is a fixed region on
+ * FAT12/16 and an ordinary cluster chain on FAT32. */
+typedef struct {
+    uint32_t cluster;   /* current root cluster, 0 for the fixed region */
+    uint32_t index;     /* sector index within region / cluster */
+    uint32_t lba;       /* sector to process next */
+} dir_iter_t;
+
+static void dir_iter_begin(dir_iter_t *it) {
+    it->cluster = info.root_cluster;
+    it->index = 0;
+    it->lba = it->cluster ? cluster_lba(it->cluster) : info.root_dir_start;
+}
+
+/* Advance to the next directory sector. Returns 0 once the directory ends. */
+static int dir_iter_next(dir_iter_t *it) {
+    it->index++;
+    if (!it->cluster) {
+        if (it->index >= info.root_dir_sectors) return 0;
+        it->lba = info.root_dir_start + it->index;
+        return 1;
+    }
+    if (it->index >= info.sectors_per_cluster) {
+        fat_lock();
+        uint32_t next = fat_get(it->cluster);
+        fat_unlock();
+        if (next < 2 || is_eoc(next)) return 0;
+        it->cluster = next;
+        it->index = 0;
+    }
+    it->lba = cluster_lba(it->cluster) + it->index;
+    return 1;
+}
+
+static inline uint32_t entry_cluster(const uint8_t *e) {
+    uint32_t c = rd16(&e[26]);
+    if (info.type == FAT_32) c |= (uint32_t)rd16(&e[20]) << 16;
+    return c;
+}
+
+static inline uint32_t entry_size(const uint8_t *e) {
+    return rd32(&e[28]);
+}
+
+/* Search root directory for name. If found, outputs sector & offset;
+ * they stay valid while the caller holds the file's fs.c lock. */
+static int find_dir_entry(const char *fatname, uint32_t *out_lba, uint16_t *out_off) {
+    SECTOR_BUF();
+    dir_iter_t it;
+    int r = -1;
+    krw_read_lock(&dir_lock);
+    dir_iter_begin(&it);
+    do {
+        read_sector(it.lba, sector);
+        for (int off = 0; off < SECTOR_SIZE; off += 32) {
+            uint8_t first = sector[off];
+            if (first == 0x00) goto out;  /* end of dir */
+            if (first == 0xE5) continue;  /* deleted */
+            if (!memcmp(&sector[off], fatname, 11)) {
+                if (out_lba) *out_lba = it.lba;
+                if (out_off) *out_off = off;
+                r = 0;
+                goto out;
+            }
+        }
+    } while (dir_iter_next(&it));
+out:
+    krw_read_unlock(&dir_lock);
+    return r;
+}
+
+/* Grow the FAT32 root directory by one zeroed cluster chained after `last`. */
+static uint32_t extend_root_dir(uint32_t last) {
+    fat_begin();
+    uint32_t c = alloc_chain(last, 1);
+    fat_commit();
+    if (!c) return 0;
+    uint8_t zero[SECTOR_SIZE];
+    memset(zero, 0, SECTOR_SIZE);
+    for (int s = 0; s < info.sectors_per_cluster; s++)
+        write_sector(cluster_lba(c) + s, zero);
+    return c;
+}
+
+/* Create or overwrite an entry. Returns 0 on success, -1 if dir full. */
+static int create_dir_entry(const char *fatname, uint32_t first_cluster, uint32_t size) {
+    SECTOR_BUF();
+    dir_iter_t it;
+    int r = -1;
+    krw_write_lock(&dir_lock);
+    dir_iter_begin(&it);
+    for (;;) {
+        read_sector(it.lba, sector);
+        for (int off = 0; off < SECTOR_SIZE; off += 32) {
+            uint8_t first = sector[off];
+            if (first == 0x00 || first == 0xE5) {
+                /* fill entry */
+                memcpy(&sector[off], fatname, 11);
+                sector[off + 11] = 0x20; /* ATTR_ARCHIVE */
+                /* zero rest of fields */
+                memset(&sector[off + 12], 0, 20);
+                if (info.type == FAT_32) wr16(&sector[off + 20], first_cluster >> 16);
+                wr16(&sector[off + 26], first_cluster & 0xFFFF);
+                wr32(&sector[off + 28], size);
+                write_sector(it.lba, sector);
+                r = 0;
+                goto out;
+            }
+        }
+        uint32_t last = it.cluster;
+        if (dir_iter_next(&it)) continue;
+        /* fixed root region is full; a FAT32 root can grow */
+        if (!last) break;
+        uint32_t c = extend_root_dir(last);
+        if (!c) break;
+        it.cluster = c;
+        it.index = 0;
+        it.lba = cluster_lba(c);
+    }
+out:
+    krw_write_unlock(&dir_lock);
+    return r;
+}
+
+/* Point an existing entry at a new chain / size (overwrite in place).
+ * `lz4` (0 or NTRES_LZ4) says what the chain holds: writers store plain
+ * data, relocation and copies keep what was there. */
+static void update_dir_entry(uint32_t lba, uint16_t off, uint32_t first_cluster, uint32_t size,
+                             uint8_t lz4) {
+    SECTOR_BUF();
+    krw_write_lock(&dir_lock);
+    read_sector(lba, sector);
+    sector[off + 12] = (sector[off + 12] & ~NTRES_LZ4) | lz4;
+    if (info.type == FAT_32) wr16(&sector[off + 20], first_cluster >> 16);
+    wr16(&sector[off + 26], first_cluster & 0xFFFF);
+    wr32(&sector[off + 28], size);
+    write_sector(lba, sector);
+    krw_write_unlock(&dir_lock);
+}
+
+static void delete_entry_at(uint32_t lba, uint16_t off) {
+    SECTOR_BUF();
+    krw_write_lock(&dir_lock);
+    read_sector(lba, sector);
+    sector[off] = 0xE5;
+    write_sector(lba, sector);
+    krw_write_unlock(&dir_lock);
+}
+
+// Helper: uppercase & pad to 11 chars
+static void make_fat_name(const char *in, char out[11]) {
+    for (int i = 0; i < 11; i++) out[i] = ' ';
+    int p = 0;
+    // name up to dot or 8 chars
+    for (; *in && *in != '.' && p < 8; in++, p++)
+        out[p] = (*in >= 'a' && *in <= 'z') ? *in - 32 : *in;
+    if (*in == '.') {
+        in++;
+        for (int j = 0; j < 3 && *in; j++, in++)
+            out[8 + j] = (*in >= 'a' && *in <= 'z') ? *in - 32 : *in;
+    }
+}
+
+/* Invoke `fn` for every regular file in the root directory */
+typedef void (*dir_visit_fn)(uint32_t lba, uint16_t off, const uint8_t *entry, void *ctx);
+
+static void for_each_file(dir_visit_fn fn, void *ctx) {
+    SECTOR_BUF();
+    dir_iter_t it;
+    krw_read_lock(&dir_lock);
+    dir_iter_begin(&it);
+    do {
+        read_sector(it.lba, sector);
+        for (int off = 0; off < SECTOR_SIZE; off += 32) {
+            uint8_t first = sector[off];
+            if (first == 0x00) goto out;
+            if (first == 0xE5 || (sector[off + 11] & 0x18)) continue; /* deleted, label, LFN, dir */
+            fn(it.lba, off, &sector[off], ctx);
+        }
+    } while (dir_iter_next(&it));
+out:
+    krw_read_unlock(&dir_lock);
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Mount                                                        */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Pick up the FAT32 FSInfo hints so mounting never scans the whole FAT */
+static void load_fsinfo(void) {
+    if (!info.fsinfo_sector || info.fsinfo_sector >= info.reserved_sectors) {
+        info.fsinfo_sector = 0;
+        return;
+    }
+    SECTOR_BUF();
+    read_sector(info.fsinfo_sector, sector);
+    if (rd32(&sector[0]) != FSINFO_LEAD_SIG || rd32(&sector[484]) != FSINFO_STRUCT_SIG) {
+        info.fsinfo_sector = 0;
+        return;
+    }
+    uint32_t free_count = rd32(&sector[488]);
+    uint32_t next_free  = rd32(&sector[492]);
+    if (free_count <= info.cluster_count) info.free_count = free_count;
+    if (next_free >= 2 && next_free < max_clusters()) info.next_free = next_free;
+}
+
+int fat_init(blkdev_t *device) {
+    uint8_t bs[SECTOR_SIZE];
+    memset(&info, 0, sizeof(info));
+    memset(fat_slots, 0, sizeof(fat_slots));
+    memset(extent_cache, 0, sizeof(extent_cache));
+    fat_depth = 0;
+    fsinfo_dirty = 0;
+    dev = device;
+    if (blkdev_read(dev, 0, 1, bs) < 0) return -1;
+
+    info.bytes_per_sector    = rd16(&bs[11]);
+    info.sectors_per_cluster = bs[13];
+    info.reserved_sectors    = rd16(&bs[14]);
+    info.num_fats            = bs[16];
+    info.root_entries        = rd16(&bs[17]);
+    info.total_sectors       = rd16(&bs[19]) ? rd16(&bs[19]) : rd32(&bs[32]);
+    info.fat_size            = rd16(&bs[22]) ? rd16(&bs[22]) : rd32(&bs[36]);
+
+    if (info.bytes_per_sector != SECTOR_SIZE || info.sectors_per_cluster == 0 ||
+        info.num_fats == 0 || info.fat_size == 0) {
+        return -1; /* not a FAT volume we understand; info.type stays FAT_NONE */
+    }
+
+    info.root_dir_sectors    = (info.root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    info.fat_start           = info.reserved_sectors;
+    info.root_dir_start      = info.fat_start + info.num_fats * info.fat_size;
+    info.data_start          = info.root_dir_start + info.root_dir_sectors;
+    if (info.total_sectors <= info.data_start) return -1;
+    info.cluster_count       = (info.total_sectors - info.data_start) / info.sectors_per_cluster;
+
+    /* The FAT type is determined by the cluster count alone */
+    if (info.cluster_count < FAT12_MAX_CLUSTERS) {
+        info.type    = FAT_12;
+        info.eoc_min = 0xFF8;
+        info.eoc     = 0xFFF;
+        info.get     = fat12_get;
+        info.set     = fat12_set;
+    } else if (info.cluster_count < FAT16_MAX_CLUSTERS) {
+        info.type    = FAT_16;
+        info.eoc_min = 0xFFF8;
+        info.eoc     = 0xFFFF;
+        info.get     = fat16_get;
+        info.set     = fat16_set;
+    } else {
+        info.type    = FAT_32;
+        info.eoc_min = 0x0FFFFFF8;
+        info.eoc     = 0x0FFFFFFF;
+        info.get     = fat32_get;
+        info.set     = fat32_set;
+    }
+
+    /* Never trust the FAT beyond what fits in the on-disk table */
+    uint32_t fat_entries = (info.type == FAT_12) ? info.fat_size * SECTOR_SIZE * 2 / 3
+                                                 : info.fat_size * SECTOR_SIZE / (info.type / 8);
+    if (max_clusters() > fat_entries) info.cluster_count = fat_entries - 2;
+
+    info.free_count = FSINFO_UNKNOWN;
+    info.next_free  = 2;
+    if (info.type == FAT_32) {
+        info.root_cluster  = rd32(&bs[44]);
+        info.fsinfo_sector = rd16(&bs[48]);
+        if (info.root_cluster < 2 || info.root_cluster >= max_clusters()) {
+            info.type = FAT_NONE;
+            return -1;
+        }
+        load_fsinfo();
+    }
+    return 0;
+}
+
+fat_type_t fat_type(void) {
+    return info.type;
+}
+
+static const char *fat_type_name(void *fs) {
+    (void)fs;
+    switch (info.type) {
+    case FAT_12: return "FAT12";
+    case FAT_16: return "FAT16";
+    case FAT_32: return "FAT32";
+    default:     return "none";
+    }
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* File data                                                    */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Copy [offset, offset+len) of the chain starting at `first` into
+ * `buffer`; the caller keeps the range inside the file. Returns bytes
+ * copied. */
+static uint32_t read_range(uint32_t first, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    SECTOR_BUF();
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t pos    = offset + done;
+        uint32_t within = pos % cluster_bytes;
+        uint32_t cluster, run;
+        if (chain_lookup(first, pos / cluster_bytes, &cluster, &run) < 0) break;
+
+        uint32_t slba    = cluster_lba(cluster) + within / SECTOR_SIZE;
+        uint32_t sec_off = within % SECTOR_SIZE;
+        uint32_t want    = run * cluster_bytes - within;  /* bytes left in this run */
+        if (want > len - done) want = len - done;
+
+        if (sec_off || want < SECTOR_SIZE) {
+            /* partial sector: bounce through the scratch buffer */
+            read_sector(slba, sector);
+            uint32_t n = SECTOR_SIZE - sec_off;
+            if (n > want) n = want;
+            memcpy(buffer + done, sector + sec_off, n);
+            done += n;
+        } else {
+            /* whole sectors of a contiguous run: one multi-sector command */
+            uint32_t nsec = want / SECTOR_SIZE;
+            read_sectors(slba, nsec, buffer + done);
+            done += nsec * SECTOR_SIZE;
+        }
+    }
+    return done;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* LZ4 chunked files                                            */
+/* ──────────────────────────────────────────────────────────── */
+
+static uint8_t lz4_in[LZ4_BOUND(LZ4_CHUNK)];
+static uint8_t lz4_table[4 * (LZ4_MAX_CHUNKS + 1)];
+
+typedef struct {
+    uint32_t size;      /* logical bytes */
+    uint32_t chunks;
+} lz4_hdr_t;
+
+static int lz4_header(uint32_t first, uint32_t stored, lz4_hdr_t *h) {
+    uint8_t hdr[LZ4_HDR_SIZE];
+    if (first < 2 || stored < LZ4_HDR_SIZE ||
+        read_range(first, 0, hdr, LZ4_HDR_SIZE) != LZ4_HDR_SIZE) return -1;
+    if (rd32(&hdr[0]) != LZ4_MAGIC || rd32(&hdr[8]) != LZ4_CHUNK) return -1;
+    h->size   = rd32(&hdr[4]);
+    h->chunks = rd32(&hdr[12]);
+    if (h->chunks > LZ4_MAX_CHUNKS || h->chunks != (h->size + LZ4_CHUNK - 1) / LZ4_CHUNK) return -1;
+    return 0;
+}
+
+/* Expand chunk `index` into lz4_out, reading only its stored bytes.
+ * Returns the chunk's length, or -1 if the file is damaged. The caller
+ * holds lz4_lock. */
+static int lz4_load(uint32_t first, uint32_t stored, const lz4_hdr_t *h, uint32_t index) {
+    if (lz4_out_first == first && lz4_out_index == index) return (int)lz4_out_len;
+    uint8_t ent[8];
+    if (read_range(first, LZ4_HDR_SIZE + 4 * index, ent, 8) != 8) return -1;
+    uint32_t from = rd32(&ent[0]) & ~LZ4_RAW;
+    uint32_t to   = rd32(&ent[4]) & ~LZ4_RAW;
+    uint32_t want = (index + 1 == h->chunks) ? h->size - index * LZ4_CHUNK : LZ4_CHUNK;
+    if (to < from || to > stored || to - from > sizeof(lz4_in)) return -1;
+    uint32_t n = to - from;
+
+    lz4_out_first = 0;
+    int got;
+    if (rd32(&ent[0]) & LZ4_RAW) {
+        got = (n == want) ? (int)read_range(first, from, lz4_out, n) : -1;
+    } else {
+        got = (read_range(first, from, lz4_in, n) == n) ? lz4_decompress(lz4_in, n, lz4_out, LZ4_CHUNK) : -1;
+    }
+    readahead(first, from, n, stored);
+    if (got != (int)want) return -1;
+    lz4_out_first = first;
+    lz4_out_index = index;
+    lz4_out_len   = want;
+    return (int)want;
+}
+
+static int lz4_read(uint32_t first, uint32_t stored, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    lz4_hdr_t h;
+    if (lz4_header(first, stored, &h) < 0) return -1;
+    if (offset >= h.size) return 0;
+    if (len > h.size - offset) len = h.size - offset;
+    uint32_t done = 0;
+    int failed = 0;
+    kmutex_lock(&lz4_lock);
+    while (done < len) {
+        uint32_t pos = offset + done;
+        uint32_t in  = pos % LZ4_CHUNK;
+        int n = lz4_load(first, stored, &h, pos / LZ4_CHUNK);
+        if (n < 0) { failed = 1; break; }
+        uint32_t chunk = (uint32_t)n - in;
+        if (chunk > len - done) chunk = len - done;
+        memcpy(buffer + done, lz4_out + in, chunk);
+        done += chunk;
+    }
+    kmutex_unlock(&lz4_lock);
+    return (failed && !done) ? -1 : (int)done;
+}
+
+/* Size a reader sees: the header's for compressed files */
+static uint32_t logical_size(const uint8_t *entry) {
+    if (!(entry[12] & NTRES_LZ4)) return entry_size(entry);
+    lz4_hdr_t h;
+    if (lz4_header(entry_cluster(entry), entry_size(entry), &h) < 0) return 0;
+    return h.size;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Public API                                                   */
+/* ──────────────────────────────────────────────────────────── */
+
+static int fat_stat(void *fs, const char *filename, uint32_t *size) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    *size = logical_size(&sector[off]);
+    return 0;
+}
+
+static int fat_read_at(void *fs, const char *filename, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first_cluster = entry_cluster(&sector[off]);
+    uint32_t filesize      = entry_size(&sector[off]);
+    if (sector[off + 12] & NTRES_LZ4)
+        return lz4_read(first_cluster, filesize, offset, buffer, len);
+
+    if (offset >= filesize || first_cluster < 2) return 0;
+    if (len > filesize - offset) len = filesize - offset;
+
+    uint32_t done = read_range(first_cluster, offset, buffer, len);
+    readahead(first_cluster, offset, done, filesize);
+    return done;
+}
+
+static void fat_ls(void *fs, fs_ls_callback cb) {
+    (void)fs;
+    if (!cb || info.type == FAT_NONE) return;
+    SECTOR_BUF();
+    dir_iter_t it;
+    krw_read_lock(&dir_lock);
+    dir_iter_begin(&it);
+    do {
+        read_sector(it.lba, sector);
+        for (int off = 0; off < SECTOR_SIZE; off += 32) {
+            uint8_t first = sector[off];
+            if (first == 0x00) goto out; /* done */
+            if (first == 0xE5 || (sector[off+11] & 0x08)) continue; /* deleted, volume label or LFN */
+
+            char name[13];
+            int n = 0;
+            for (int i = 0; i < 11; i++) {
+                char c = sector[off + i];
+                if (i == 8) {
+                    /* insert dot if extension present */
+                    if (c != ' ') name[n++] = '.';
+                }
+                if (c != ' ') name[n++] = c;
+            }
+            name[n] = '\0';
+            cb(name, logical_size(&sector[off]));
+        }
+    } while (dir_iter_next(&it));
+out:
+    krw_read_unlock(&dir_lock);
+}
+
+static int fat_delete(void *fs, const char *filename) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+
+    /* fetch first cluster */
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first_cluster = entry_cluster(&sector[off]);
+
+    /* unlink first so a crash leaves lost clusters, never a dangling entry */
+    delete_entry_at(lba, off);
+    if (first_cluster >= 2)
+        free_cluster_chain(first_cluster);
+    return 0;
+}
+
+/* Resize the chain starting at *first to `needed` clusters inside the
+ * current FAT transaction; *first is updated if the chain is created or
+ * released.  Surplus clusters are kept when `keep_surplus` is set
+ * (preallocated files).  Returns -1 with the chain unchanged if the
+ * volume is full. */
+static int resize_chain(uint32_t *first, uint32_t needed, int keep_surplus) {
+    uint32_t tail;
+    uint32_t have = chain_length(*first, &tail);
+    if (!have) *first = 0;
+    if (have < needed) {
+        uint32_t c = alloc_chain(tail, needed - have);
+        if (!c) return -1;
+        if (!*first) *first = c;
+        extent_invalidate(*first);
+    } else if (have > needed && !keep_surplus) {
+        truncate_chain(*first, needed);
+        if (!needed) *first = 0;
+    }
+    return 0;
+}
+
+static int fat_write(void *fs, const char *filename, const uint8_t *data, uint32_t len) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+
+    /* An existing file keeps its entry and as much of its chain as it
+     * still needs, so rewriting a file of the same size touches no FAT
+     * sector at all. */
+    uint32_t lba = 0; uint16_t off = 0;
+    uint32_t first = 0;
+    uint8_t ntres = 0;
+    int exists = (find_dir_entry(fatname, &lba, &off) == 0);
+    if (exists) {
+        SECTOR_BUF();
+        read_sector(lba, sector);
+        first = entry_cluster(&sector[off]);
+        ntres = sector[off + 12];
+    }
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t needed = (len + cluster_bytes - 1) / cluster_bytes;
+
+    /* All FAT changes are staged and reach the disk in a single flush */
+    fat_begin();
+    int r = resize_chain(&first, needed, ntres & NTRES_PREALLOC);
+    fat_commit();
+    if (r < 0) return -1;
+
+    if (len) write_range(first, 0, data, len, 0);
+
+    /* directory entry */
+    if (exists) {
+        update_dir_entry(lba, off, first, len, 0);
+        return 0;
+    }
+    if (create_dir_entry(fatname, first, len) < 0) {
+        if (first) free_cluster_chain(first);
+        return -1;
+    }
+    return 0;
+}
+
+/* Rewrite a compressed file as plain data into a fresh chain so it can
+ * be modified in place; the compressed chain is freed afterwards.  A
+ * plain file is left alone. */
+static int lz4_expand(uint32_t lba, uint16_t off) {
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    if (!(sector[off + 12] & NTRES_LZ4)) return 0;
+    uint32_t first  = entry_cluster(&sector[off]);
+    uint32_t stored = entry_size(&sector[off]);
+    lz4_hdr_t h;
+    if (lz4_header(first, stored, &h) < 0) return -1;
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t plain = 0;
+    fat_begin();
+    int r = resize_chain(&plain, (h.size + cluster_bytes - 1) / cluster_bytes, 0);
+    fat_commit();
+    if (r < 0) return -1;
+    kmutex_lock(&lz4_lock);
+    for (uint32_t i = 0; i < h.chunks && r == 0; i++) {
+        int n = lz4_load(first, stored, &h, i);
+        if (n < 0) r = -1;
+        else write_range(plain, i * LZ4_CHUNK, lz4_out, (uint32_t)n, i * LZ4_CHUNK);
+    }
+    kmutex_unlock(&lz4_lock);
+    if (r < 0) {
+        if (plain) free_cluster_chain(plain);
+        return -1;
+    }
+    update_dir_entry(lba, off, plain, h.size, 0);
+    free_cluster_chain(first);
+    return 0;
+}
+
+/* Write `len` bytes at `offset` (at most the current size) into the file
+ * whose entry sits at lba/off.  The chain grows from its tail, so only
+ * the clusters the new bytes land in are written. */
+static int write_entry_at(uint32_t lba, uint16_t off, uint32_t offset,
+                          const uint8_t *data, uint32_t len) {
+    if (lz4_expand(lba, off) < 0) return -1;
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first    = entry_cluster(&sector[off]);
+    uint32_t old_size = entry_size(&sector[off]);
+    if (offset > old_size || offset + len < offset) return -1;
+    uint32_t new_size = (offset + len > old_size) ? offset + len : old_size;
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t needed = (new_size + cluster_bytes - 1) / cluster_bytes;
+
+    fat_begin();
+    int r = resize_chain(&first, needed, 1);
+    fat_commit();
+    if (r < 0) return -1;
+
+    if (len) write_range(first, offset, data, len, old_size);
+    update_dir_entry(lba, off, first, new_size, 0);
+    return 0;
+}
+
+/* Append: extend the chain past its tail (contiguously when the space
+ * behind it is free) and write only the new bytes. */
+static int fat_append(void *fs, const char *filename, const uint8_t *data, uint32_t len) {
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0)
+        return fat_write(fs, filename, data, len);
+
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    return write_entry_at(lba, off, logical_size(&sector[off]), data, len);
+}
+
+/* Overwrite in place; a write starting at the current size appends. */
+static int fat_write_at(void *fs, const char *filename, uint32_t offset,
+                        const uint8_t *data, uint32_t len) {
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0)
+        return offset ? -1 : fat_write(fs, filename, data, len);
+    return write_entry_at(lba, off, offset, data, len);
+}
+
+/* Whole sectors from `offset` on that lie inside the file and inside one
+ * contiguous run, so a caller can move them without the FAT code. */
+static int fat_bmap(void *fs, const char *filename, uint32_t offset, uint32_t len,
+                    blkdev_t **out_dev, uint32_t *out_lba) {
+    (void)fs;
+    if (info.type == FAT_NONE || offset % SECTOR_SIZE) return 0;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first    = entry_cluster(&sector[off]);
+    uint32_t filesize = entry_size(&sector[off]);
+    if (offset >= filesize || first < 2 || (sector[off + 12] & NTRES_LZ4)) return 0;
+    if (len > filesize - offset) len = filesize - offset;
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t within = offset % cluster_bytes;
+    uint32_t cluster, run;
+    if (chain_lookup(first, offset / cluster_bytes, &cluster, &run) < 0)
+        return 0;
+    uint32_t avail = run * cluster_bytes - within;
+    if (len > avail) len = avail;
+    *out_dev = dev;
+    *out_lba = cluster_lba(cluster) + within / SECTOR_SIZE;
+    return (int)(len / SECTOR_SIZE);
+}
+
+static int fat_sync(void *fs) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    fat_lock();
+    fsinfo_flush();
+    fat_unlock();
+    return blkdev_flush(dev);
+}
+
+static int fat_preallocate(void *fs, const char *filename, uint32_t size) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) {
+        if (create_dir_entry(fatname, 0, 0) < 0) return -1;
+        if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+    }
+    if (lz4_expand(lba, off) < 0) return -1;
+
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first     = entry_cluster(&sector[off]);
+    uint32_t file_size = entry_size(&sector[off]);
+
+    /* never release clusters that still hold file data */
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t in_use = (file_size + cluster_bytes - 1) / cluster_bytes;
+    uint32_t needed = (size + cluster_bytes - 1) / cluster_bytes;
+    if (needed < in_use) needed = in_use;
+
+    fat_begin();
+    int r = resize_chain(&first, needed, 0);
+    fat_commit();
+    if (r < 0) return -1;
+
+    krw_write_lock(&dir_lock);
+    read_sector(lba, sector);
+    if (needed > in_use) sector[off + 12] |= NTRES_PREALLOC;
+    else sector[off + 12] &= ~NTRES_PREALLOC;
+    if (info.type == FAT_32) wr16(&sector[off + 20], first >> 16);
+    wr16(&sector[off + 26], first & 0xFFFF);
+    write_sector(lba, sector);
+    krw_write_unlock(&dir_lock);
+    return 0;
+}
+
+/* Store the file as independently compressed LZ4 chunks in a new chain.
+ * Chunks that do not shrink are kept raw; if the whole file would not
+ * get smaller it is left as it is.  The FAT changes reach the disk in
+ * one flush after the new data, so a crash leaves the old file intact;
+ * that keeps the allocation lock held for the whole conversion. */
+static int fat_compress(void *fs, const char *filename, uint32_t *stored) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fatname[11];
+    make_fat_name(filename, fatname);
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
+
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first = entry_cluster(&sector[off]);
+    uint32_t size  = entry_size(&sector[off]);
+    if (stored) *stored = size;
+    if (sector[off + 12] & NTRES_LZ4) return 0;
+    if (first < 2 || !size) return 1;
+    uint32_t chunks = (size + LZ4_CHUNK - 1) / LZ4_CHUNK;
+    if (chunks > LZ4_MAX_CHUNKS) return -1;
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t hdr = LZ4_HDR_SIZE + 4 * (chunks + 1);
+    uint32_t pos = hdr;
+    uint32_t packed = 0;
+    int r = 0;
+    kmutex_lock(&lz4_lock);
+    fat_begin();
+    if (resize_chain(&packed, (hdr + cluster_bytes - 1) / cluster_bytes, 0) < 0) r = -1;
+    for (uint32_t i = 0; i < chunks && r == 0; i++) {
+        uint32_t n = (i + 1 == chunks) ? size - i * LZ4_CHUNK : LZ4_CHUNK;
+        lz4_out_first = 0;
+        if (read_range(first, i * LZ4_CHUNK, lz4_out, n) != n) { r = -1; break; }
+        uint32_t entry = pos;
+        const uint8_t *src = lz4_in;
+        uint32_t clen = lz4_compress(lz4_out, n, lz4_in, n - 1);
+        if (!clen) { clen = n; src = lz4_out; entry |= LZ4_RAW; }
+        if (pos + clen >= size) { r = 1; break; }           /* no gain */
+        if (resize_chain(&packed, (pos + clen + cluster_bytes - 1) / cluster_bytes, 0) < 0) {
+            r = -1;
+            break;
+        }
+        write_range(packed, pos, src, clen, pos);
+        wr32(&lz4_table[4 * i], entry);
+        pos += clen;
+    }
+    if (r == 0) {
+        uint8_t h[LZ4_HDR_SIZE];
+        wr32(&h[0], LZ4_MAGIC);
+        wr32(&h[4], size);
+        wr32(&h[8], LZ4_CHUNK);
+        wr32(&h[12], chunks);
+        wr32(&lz4_table[4 * chunks], pos);
+        write_range(packed, 0, h, LZ4_HDR_SIZE, pos);
+        write_range(packed, LZ4_HDR_SIZE, lz4_table, 4 * (chunks + 1), pos);
+    } else if (packed) {
+        free_cluster_chain(packed);
+    }
+    fat_commit();
+    kmutex_unlock(&lz4_lock);
+    if (r != 0) return r;
+
+    krw_write_lock(&dir_lock);
+    read_sector(lba, sector);
+    sector[off + 12] = (sector[off + 12] & ~NTRES_PREALLOC) | NTRES_LZ4;
+    if (info.type == FAT_32) wr16(&sector[off + 20], packed >> 16);
+    wr16(&sector[off + 26], packed & 0xFFFF);
+    wr32(&sector[off + 28], pos);
+    write_sector(lba, sector);
+    krw_write_unlock(&dir_lock);
+    free_cluster_chain(first);
+    if (stored) *stored = pos;
+    return 0;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Defragmentation                                              */
+/* ──────────────────────────────────────────────────────────── */
+
+#define DEFRAG_BURST 32     /* sectors copied per command pair */
+
+static uint8_t  move_buf[DEFRAG_BURST * SECTOR_SIZE];
+static kmutex_t move_lock = KMUTEX_INIT;
+
+/* Number of contiguous runs in the chain starting at `first` */
+static uint32_t count_runs(uint32_t first) {
+    uint32_t runs = 0, prev = 0, n = 0;
+    uint32_t c = first;
+    fat_lock();
+    while (c >= 2 && c < max_clusters() && n++ < info.cluster_count) {
+        if (c != prev + 1) runs++;
+        prev = c;
+        uint32_t next = fat_get(c);
+        if (is_eoc(next)) break;
+        c = next;
+    }
+    fat_unlock();
+    return runs;
+}
+
+static void frag_visit(uint32_t lba, uint16_t off, const uint8_t *entry, void *ctx) {
+    (void)lba; (void)off;
+    fs_frag_stats_t *st = ctx;
+    uint32_t first = entry_cluster(entry);
+    if (first < 2) return;
+    uint32_t runs = count_runs(first);
+    st->files++;
+    st->extents += runs;
+    if (runs > 1) st->fragmented++;
+}
+
+static void fat_frag_stats(void *fs, fs_frag_stats_t *out) {
+    (void)fs;
+    memset(out, 0, sizeof(*out));
+    if (info.type == FAT_NONE) return;
+    for_each_file(frag_visit, out);
+}
+
+/* Copy a fragmented file into one free run.  The new chain is committed
+ * and filled before the entry is switched over, and the old chain is
+ * only released afterwards, so a crash never loses data. */
+static void defrag_visit(uint32_t lba, uint16_t off, const uint8_t *entry, void *ctx) {
+    int *moved = ctx;
+    uint32_t first = entry_cluster(entry);
+    uint32_t size  = entry_size(entry);
+    uint8_t  lz4   = entry[12] & NTRES_LZ4;     /* moved as stored */
+    if (first < 2 || count_runs(first) < 2) return;
+
+    uint32_t tail, len;
+    fat_begin();
+    uint32_t n = chain_length(first, &tail);
+    uint32_t start = find_free_run(2, n, &len);
+    if (start && len >= n) claim_run(start, n);
+    fat_commit();
+    if (!start || len < n) return; /* no hole big enough */
+
+    uint32_t total = n * info.sectors_per_cluster;
+    uint32_t dst = cluster_lba(start);
+    kmutex_lock(&move_lock);
+    for (uint32_t sec = 0; sec < total; ) {
+        uint32_t cluster, run;
+        if (chain_lookup(first, sec / info.sectors_per_cluster, &cluster, &run) < 0) break;
+        uint32_t within = sec % info.sectors_per_cluster;
+        uint32_t count = run * info.sectors_per_cluster - within;
+        if (count > DEFRAG_BURST) count = DEFRAG_BURST;
+        read_sectors(cluster_lba(cluster) + within, count, move_buf);
+        write_sectors(dst + sec, count, move_buf);
+        sec += count;
+    }
+    kmutex_unlock(&move_lock);
+
+    update_dir_entry(lba, off, start, size, lz4);
+    free_cluster_chain(first);
+    (*moved)++;
+}
+
+static int fat_defrag(void *fs, fs_frag_stats_t *before, fs_frag_stats_t *after) {
+    if (info.type == FAT_NONE) return -1;
+    if (before) fat_frag_stats(fs, before);
+    int moved = 0;
+    /* entries are rewritten during the walk: hold the directory for it */
+    krw_write_lock(&dir_lock);
+    for_each_file(defrag_visit, &moved);
+    krw_write_unlock(&dir_lock);
+    if (after) fat_frag_stats(fs, after);
+    return moved;
+}
+
+/* ──────────────────────────────────────────────────────────── */
+/* Copy                                                         */
+/* ──────────────────────────────────────────────────────────── */
+
+/* Stream the source's sectors into a new chain, bursts of up to
+ * DEFRAG_BURST sectors bounded by the runs on both sides, so the data
+ * never passes through a caller's buffer.  The destination is claimed
+ * in one go before any data moves (a single run when a hole is large
+ * enough).  A compressed file is copied as stored and stays compressed.
+ * An existing destination is only switched over once its new chain is
+ * written, and its old chain is released last. */
+static int fat_copy(void *fs, const char *srcname, const char *dstname) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fat_src[11]; char fat_dst[11];
+    make_fat_name(srcname, fat_src);
+    make_fat_name(dstname, fat_dst);
+    if (memcmp(fat_src, fat_dst, 11) == 0) return -1;
+
+    uint32_t lba; uint16_t off;
+    if (find_dir_entry(fat_src, &lba, &off) < 0) return -1;
+    SECTOR_BUF();
+    read_sector(lba, sector);
+    uint32_t first = entry_cluster(&sector[off]);
+    uint32_t size  = entry_size(&sector[off]);
+    uint8_t  lz4   = sector[off + 12] & NTRES_LZ4;
+
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t needed = (size + cluster_bytes - 1) / cluster_bytes;
+    uint32_t copy = 0;
+    if (needed) {
+        if (first < 2) return -1;
+        fat_begin();
+        copy = alloc_chain(0, needed);
+        fat_commit();
+        if (!copy) return -1;
+
+        uint32_t total = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        int r = 0;
+        kmutex_lock(&move_lock);
+        for (uint32_t sec = 0; sec < total; ) {
+            uint32_t src_c, src_run, dst_c, dst_run;
+            uint32_t idx = sec / info.sectors_per_cluster;
+            uint32_t within = sec % info.sectors_per_cluster;
+            if (chain_lookup(first, idx, &src_c, &src_run) < 0 ||
+                chain_lookup(copy, idx, &dst_c, &dst_run) < 0) {
+                r = -1;
+                break;
+            }
+            uint32_t run = (src_run < dst_run) ? src_run : dst_run;
+            uint32_t count = run * info.sectors_per_cluster - within;
+            if (count > total - sec) count = total - sec;
+            if (count > DEFRAG_BURST) count = DEFRAG_BURST;
+            read_sectors(cluster_lba(src_c) + within, count, move_buf);
+            write_sectors(cluster_lba(dst_c) + within, count, move_buf);
+            sec += count;
+        }
+        kmutex_unlock(&move_lock);
+        if (r < 0) {
+            free_cluster_chain(copy);
+            return -1;
+        }
+    }
+
+    uint32_t old = 0;
+    if (find_dir_entry(fat_dst, &lba, &off) == 0) {
+        read_sector(lba, sector);
+        old = entry_cluster(&sector[off]);
+        update_dir_entry(lba, off, copy, size, lz4);
+    } else if (create_dir_entry(fat_dst, copy, size) < 0 ||
+               find_dir_entry(fat_dst, &lba, &off) < 0) {
+        if (copy) free_cluster_chain(copy);
+        return -1;
+    }
+    krw_write_lock(&dir_lock);
+    read_sector(lba, sector);
+    sector[off + 12] = (sector[off + 12] & ~NTRES_PREALLOC) | lz4;
+    write_sector(lba, sector);
+    krw_write_unlock(&dir_lock);
+    if (old >= 2) free_cluster_chain(old);
+    return 0;
+}
+
+static int fat_rename(void *fs, const char *oldname, const char *newname) {
+    (void)fs;
+    if (info.type == FAT_NONE) return -1;
+    char fat_old[11]; char fat_new[11];
+    make_fat_name(oldname, fat_old);
+    make_fat_name(newname, fat_new);
+
+    /* check and rename in one go, so no file of the new name can appear */
+    uint32_t lba; uint16_t off;
+    int r = -1;
+    krw_write_lock(&dir_lock);
+    if (find_dir_entry(fat_new, NULL, NULL) < 0 && find_dir_entry(fat_old, &lba, &off) == 0) {
+        SECTOR_BUF();
+        read_sector(lba, sector);
+        memcpy(&sector[off], fat_new, 11);
+        write_sector(lba, sector);
+        r = 0;
+    }
+    krw_write_unlock(&dir_lock);
+    return r;
+}
+
+/* Uses the cached free count (FSInfo on FAT32) and only scans the FAT
+ * the first time on volumes that do not carry one. */
+static uint32_t fat_free_space(void *fs) {
+    (void)fs;
+    if (info.type == FAT_NONE) return 0;
+    fat_lock();
+    if (info.free_count == FSINFO_UNKNOWN) {
+        uint32_t max = max_clusters();
+        uint32_t free_clusters = 0;
+        for (uint32_t c = 2; c < max; c++) {
+            if (fat_get(c) == 0) free_clusters++;
+        }
+        info.free_count = free_clusters;
+    }
+    uint32_t free_count = info.free_count;
+    fat_unlock();
+    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
+    if (free_count > 0xFFFFFFFFu / cluster_bytes) return 0xFFFFFFFFu;
+    return free_count * cluster_bytes;
+}
+
+const fs_ops_t fat_ops = {
+    .read_at     = fat_read_at,
+    .stat        = fat_stat,
+    .write       = fat_write,
+    .append      = fat_append,
+    .remove      = fat_delete,
+    .rename      = fat_rename,
+    .ls          = fat_ls,
+    .free_space  = fat_free_space,
+    .type_name   = fat_type_name,
+    .preallocate = fat_preallocate,
+    .frag_stats  = fat_frag_stats,
+    .defrag      = fat_defrag,
+    .write_at    = fat_write_at,
+    .bmap        = fat_bmap,
+    .sync        = fat_sync,
+    .compress    = fat_compress,
+    .copy        = fat_copy,
+};
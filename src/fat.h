@@ -0,0 +1,26 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include <stdint.h>
+#include "fs.h"
+#include "blkdev.h"
+
+// FAT variant detected at mount time (value = entry width in bits)
+typedef enum {
+    FAT_NONE = 0,
+    FAT_12   = 12,
+    FAT_16   = 16,
+    FAT_32   = 32
+} fat_type_t;
+
+// Read the BPB of `device`, detect FAT12/16/32 and compute offsets.
+// Returns 0 on success, –1 if the device carries no usable FAT volume.
+int fat_init(blkdev_t *device);
+
+// FAT variant of the mounted volume, FAT_NONE if the mount failed.
+fat_type_t fat_type(void);
+
+// fs_* operations of the FAT volume; the instance pointer is unused.
+extern const fs_ops_t fat_ops;
+
+#endif /* FAT_H */
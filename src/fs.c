@@ -1,400 +1,555 @@
 #include "fs.h"
-#include "ata.h"
+#include "fat.h"
+#include "ext2.h"
+#include "initrd.h"
+#include "irq.h"
+#include "lock.h"
+#include "pagecache.h"
 #include "util.h"
-#include "kheap.h"
 #include <stddef.h>
 
-#define SECTOR_SIZE 512
+/* Mount table: the fs_* API resolves each path to one of these and
+ * hands the remainder of the name to that filesystem's ops. */
+typedef struct {
+    char            prefix[FS_PREFIX_LEN];   /* "" for root */
+    const fs_ops_t *ops;
+    void           *fs;
+} fs_mount_t;
+
+static fs_mount_t mounts[FS_MAX_MOUNTS];
+
+/* Per-file and per-directory locks, hashed by mount and upper-cased
+ * path. A directory lock guards its namespace: lookups and in-place
+ * writes take it shared, remove/rename/mkdir take it exclusive. File
+ * locks are shared for reads and exclusive for anything that changes
+ * the contents. Each call takes its directory locks before its file
+ * locks, each kind in table order, so two calls never wait on each
+ * other in a cycle. Drivers lock their own shared structures (FAT,
+ * bitmaps, sector cache) underneath. */
+#define FS_LOCKS   64
+#define FS_HELD    4
+
+static krwlock_t path_locks[2 * FS_LOCKS];     /* directories, then files */
 
 typedef struct {
-    uint16_t bytes_per_sector;
-    uint8_t  sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t  num_fats;
-    uint16_t root_entries;
-    uint16_t fat_size;
-    uint32_t fat_start;
-    uint32_t root_dir_start;
-    uint32_t data_start;
-} fat12_info_t;
-
-static fat12_info_t info;
-
-/* ──────────────────────────────────────────────────────────── */
-/* Utility helpers for FAT-12                                    */
-/* ──────────────────────────────────────────────────────────── */
-
-#define SECTOR_BUF() uint8_t sector[SECTOR_SIZE];
-
-/* Read a raw sector into `sector` */
-static void read_sector(uint32_t lba, uint8_t *sector) {
-    ata_read_sector(0, lba, sector);
-}
-
-static void write_sector(uint32_t lba, const uint8_t *sector) {
-    ata_write_sector(0, lba, sector);
-}
-
-/* Compute maximum number of clusters */
-static uint16_t max_clusters(void) {
-    return (uint16_t)((info.fat_size * SECTOR_SIZE * 2) / 3);
-}
-
-/* Return 12-bit FAT entry value for `cluster` */
-static uint16_t fat_get(uint16_t cluster) {
-    uint32_t byte_offset = cluster + (cluster / 2); /* 1.5 * cluster */
-    uint32_t lba = info.fat_start + (byte_offset / SECTOR_SIZE);
-    SECTOR_BUF();
-    read_sector(lba, sector);
-    int idx = byte_offset % SECTOR_SIZE;
-    uint8_t low = sector[idx];
-    uint8_t high = sector[idx + 1];
-
-    uint16_t value;
-    if (cluster & 1) {
-        /* odd cluster */
-        value = ((low >> 4) | (high << 4)) & 0x0FFF;
-    } else {
-        /* even cluster */
-        value = (low | ((high & 0x0F) << 8)) & 0x0FFF;
-    }
-    return value;
-}
-
-/* Write 12-bit `value` into FAT entry `cluster` (updates both FATs) */
-static void fat_set(uint16_t cluster, uint16_t value) {
-    value &= 0x0FFF;
-    uint32_t byte_offset = cluster + (cluster / 2);
-    for (int fat = 0; fat < info.num_fats; fat++) {
-        uint32_t lba = info.fat_start + fat * info.fat_size + (byte_offset / SECTOR_SIZE);
-        SECTOR_BUF();
-        read_sector(lba, sector);
-        int idx = byte_offset % SECTOR_SIZE;
-        if (cluster & 1) {
-            /* odd cluster */
-            /* 12 bits: high 4 bits in first byte, low 8 bits in second */
-            sector[idx] = (sector[idx] & 0x0F) | ((value & 0x00F) << 4);
-            sector[idx + 1] = (value >> 4) & 0xFF;
-        } else {
-            /* even cluster */
-            sector[idx] = value & 0xFF;
-            sector[idx + 1] = (sector[idx + 1] & 0xF0) | ((value >> 8) & 0x0F);
-        }
-        write_sector(lba, sector);
-    }
+    uint16_t idx[FS_HELD];
+    uint8_t  excl[FS_HELD];
+    int      n;
+} held_t;
+
+/* Task-context calls in flight. The shell runs inside the keyboard
+ * IRQ and cannot wait for them, so it is refused while any is. */
+static volatile int fs_busy;
+
+static fs_op_stats_t op_stats[FS_OP_COUNT];
+static const char *const op_names[FS_OP_COUNT] = {
+    "read", "write", "append", "delete", "rename", "ls", "prealloc", "defrag", "sync", "compress", "copy", "mkdir"
+};
+
+/* Block-layer totals when an fs_* call started */
+typedef struct {
+    uint32_t rd, wr;
+} io_mark_t;
+
+static void op_begin(io_mark_t *m) {
+    blkdev_stats_t t;
+    blkdev_totals(&t);
+    m->rd = t.rd_sectors;
+    m->wr = t.wr_sectors;
 }
 
-/* Allocate a free cluster, mark it EOC (0xFFF), return number or 0 on full */
-static uint16_t alloc_cluster(void) {
-    uint16_t max = max_clusters();
-    for (uint16_t c = 2; c < max; c++) {
-        if (fat_get(c) == 0x000) {
-            fat_set(c, 0xFFF);
-            return c;
-        }
+static void op_end(fs_op_t op, const io_mark_t *m) {
+    blkdev_stats_t t;
+    blkdev_totals(&t);
+    __sync_fetch_and_add(&op_stats[op].calls, 1);
+    __sync_fetch_and_add(&op_stats[op].rd_sectors, t.rd_sectors - m->rd);
+    __sync_fetch_and_add(&op_stats[op].wr_sectors, t.wr_sectors - m->wr);
+}
+
+static char upper(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 32 : c;
+}
+
+/* Compare `n` characters of `a` to the NUL-terminated `prefix`, ignoring case. */
+static int prefix_eq(const char *a, uint32_t n, const char *prefix) {
+    uint32_t i = 0;
+    for (; i < n && prefix[i]; i++) {
+        if (upper(a[i]) != upper(prefix[i])) return 0;
     }
-    return 0; /* disk full */
+    return i == n && prefix[i] == '\0';
+}
+
+/* Hash `n` characters of `path` within mount `m` */
+static uint32_t path_hash(const fs_mount_t *m, const char *path, uint32_t n) {
+    uint32_t h = 2166136261u ^ (uint32_t)(m - mounts);
+    while (n && *path == '/') path++, n--;
+    while (n && path[n - 1] == '/') n--;
+    for (uint32_t i = 0; i < n; i++) h = (h ^ (uint8_t)upper(path[i])) * 16777619u;
+    return h % FS_LOCKS;
 }
 
-static void free_cluster_chain(uint16_t start) {
-    uint16_t c = start;
-    while (c >= 2 && c < 0xFF8) {
-        uint16_t next = fat_get(c);
-        fat_set(c, 0x000);
-        c = next;
+/* Add a lock to the set, keeping it sorted and taking the stronger
+ * mode when two names hash to the same lock */
+static void hold(held_t *h, uint32_t idx, int excl) {
+    int i = 0;
+    while (i < h->n && h->idx[i] < idx) i++;
+    if (i < h->n && h->idx[i] == idx) {
+        h->excl[i] |= (uint8_t)excl;
+        return;
     }
+    for (int j = h->n; j > i; j--) {
+        h->idx[j] = h->idx[j - 1];
+        h->excl[j] = h->excl[j - 1];
+    }
+    h->idx[i] = (uint16_t)idx;
+    h->excl[i] = (uint8_t)excl;
+    h->n++;
 }
 
-/* ──────────────────────────────────────────────────────────── */
-/* Directory helpers                                            */
-/* ──────────────────────────────────────────────────────────── */
-
-/* Search root directory for name. If found, outputs sector & offset. */
-static int find_dir_entry(const char *fatname, uint32_t *out_lba, uint16_t *out_off) {
-    SECTOR_BUF();
-    int root_sectors = (info.root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
-    for (int s = 0; s < root_sectors; s++) {
-        uint32_t lba = info.root_dir_start + s;
-        read_sector(lba, sector);
-        for (int off = 0; off < SECTOR_SIZE; off += 32) {
-            uint8_t first = sector[off];
-            if (first == 0x00) return -1; /* end of dir */
-            if (first == 0xE5) continue;  /* deleted */
-            if (!memcmp(&sector[off], fatname, 11)) {
-                if (out_lba) *out_lba = lba;
-                if (out_off) *out_off = off;
-                return 0;
-            }
-        }
+static void hold_file(held_t *h, const fs_mount_t *m, const char *name, int excl) {
+    hold(h, FS_LOCKS + path_hash(m, name, strlen(name)), excl);
+}
+
+/* The directory `name` lives in */
+static void hold_parent(held_t *h, const fs_mount_t *m, const char *name, int excl) {
+    const char *slash = strrchr(name, '/');
+    hold(h, path_hash(m, name, slash ? (uint32_t)(slash - name) : 0), excl);
+}
+
+static void hold_dir(held_t *h, const fs_mount_t *m, const char *dir, int excl) {
+    hold(h, path_hash(m, dir, strlen(dir)), excl);
+}
+
+/* An IRQ handler runs to completion before the task it interrupted
+ * resumes, so once it sees no call in flight it has the FS to itself */
+static int fs_enter(void) {
+    if (irq_context()) return fs_busy ? -1 : 0;
+    __sync_fetch_and_add(&fs_busy, 1);
+    return 0;
+}
+
+static void fs_leave(void) {
+    if (!irq_context()) __sync_fetch_and_sub(&fs_busy, 1);
+}
+
+static void take(uint32_t idx, int excl) {
+    if (excl) krw_write_lock(&path_locks[idx]);
+    else krw_read_lock(&path_locks[idx]);
+}
+
+static void drop(uint32_t idx, int excl) {
+    if (excl) krw_write_unlock(&path_locks[idx]);
+    else krw_read_unlock(&path_locks[idx]);
+}
+
+static int lock_all(held_t *h) {
+    if (fs_enter() < 0) return -1;
+    for (int i = 0; i < h->n; i++) take(h->idx[i], h->excl[i]);
+    return 0;
+}
+
+static void unlock_all(held_t *h) {
+    for (int i = h->n - 1; i >= 0; i--) drop(h->idx[i], h->excl[i]);
+    fs_leave();
+}
+
+/* Lock one file and its directory; the common case */
+static int lock_file(held_t *h, const fs_mount_t *m, const char *name, int excl) {
+    h->n = 0;
+    hold_parent(h, m, name, 0);
+    hold_file(h, m, name, excl);
+    return lock_all(h);
+}
+
+static fs_mount_t *find_mount(const char *dir, uint32_t n) {
+    for (int i = 0; i < FS_MAX_MOUNTS; i++) {
+        if (mounts[i].ops && prefix_eq(dir, n, mounts[i].prefix)) return &mounts[i];
     }
-    return -1;
+    return NULL;
 }
 
-/* Create or overwrite an entry. Returns pointer sector/out offset. */
-static int create_dir_entry(const char *fatname, uint16_t first_cluster, uint32_t size) {
-    SECTOR_BUF();
-    int root_sectors = (info.root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
-    for (int s = 0; s < root_sectors; s++) {
-        uint32_t lba = info.root_dir_start + s;
-        read_sector(lba, sector);
-        for (int off = 0; off < SECTOR_SIZE; off += 32) {
-            uint8_t first = sector[off];
-            if (first == 0x00 || first == 0xE5) {
-                /* fill entry */
-                memcpy(&sector[off], fatname, 11);
-                sector[off + 11] = 0x20; /* ATTR_ARCHIVE */
-                /* zero rest of fields */
-                memset(&sector[off + 12], 0, 20);
-                sector[off + 26] = first_cluster & 0xFF;
-                sector[off + 27] = first_cluster >> 8;
-                sector[off + 28] = size & 0xFF;
-                sector[off + 29] = (size >> 8) & 0xFF;
-                sector[off + 30] = (size >> 16) & 0xFF;
-                sector[off + 31] = (size >> 24) & 0xFF;
-                write_sector(lba, sector);
-                return 0;
-            }
+/* "TMP/A.TXT" and "/TMP/A.TXT" go to the TMP mount as "A.TXT"; a path
+ * without a matching first component goes to root unchanged. */
+static fs_mount_t *resolve(const char *path, const char **rest) {
+    if (*path == '/') path++;
+    const char *slash = path;
+    while (*slash && *slash != '/') slash++;
+    if (*slash == '/') {
+        fs_mount_t *m = find_mount(path, (uint32_t)(slash - path));
+        if (m && m->prefix[0]) {
+            *rest = slash + 1;
+            return m;
         }
     }
-    return -1; /* dir full */
-}
-
-static void delete_entry_at(uint32_t lba, uint16_t off) {
-    SECTOR_BUF();
-    read_sector(lba, sector);
-    sector[off] = 0xE5;
-    write_sector(lba, sector);
-}
-
-// Helper: uppercase & pad to 11 chars
-static void make_fat_name(const char *in, char out[11]) {
-    for (int i = 0; i < 11; i++) out[i] = ' ';
-    int p = 0;
-    // name up to dot or 8 chars
-    for (; *in && *in != '.' && p < 8; in++, p++)
-        out[p] = (*in >= 'a' && *in <= 'z') ? *in - 32 : *in;
-    if (*in == '.') {
-        in++;
-        for (int j = 0; j < 3 && *in; j++, in++)
-            out[8 + j] = (*in >= 'a' && *in <= 'z') ? *in - 32 : *in;
+    *rest = path;
+    return find_mount("", 0);
+}
+
+void fs_init(const char *root_dev) {
+    memset(mounts, 0, sizeof(mounts));
+    for (int i = 0; i < 2 * FS_LOCKS; i++) krw_init(&path_locks[i]);
+    const char *prefix = "";
+    initrd_t *rd = initrd_create();
+    if (rd && fs_mount("", &initrd_ops, rd) == 0) prefix = "HD";
+    blkdev_t *dev = blkdev_find(root_dev);
+    if (!dev) return;
+    if (fat_init(dev) == 0) {
+        fs_mount(prefix, &fat_ops, NULL);
+        return;
     }
+    ext2_t *x = ext2_create(dev);
+    if (x) fs_mount(prefix, &ext2_ops, x);
 }
 
-void fs_init(void) {
-    uint8_t bs[SECTOR_SIZE];
-    ata_read_sector(0, 0, bs);
-    info.bytes_per_sector    = bs[11] | (bs[12]<<8);
-    info.sectors_per_cluster = bs[13];
-    info.reserved_sectors    = bs[14] | (bs[15]<<8);
-    info.num_fats            = bs[16];
-    info.root_entries        = bs[17] | (bs[18]<<8);
-    info.fat_size            = bs[22] | (bs[23]<<8);
-    info.fat_start           = info.reserved_sectors;
-    info.root_dir_start      = info.fat_start + info.num_fats * info.fat_size;
-    info.data_start          = info.root_dir_start + ((info.root_entries * 32) + SECTOR_SIZE - 1)/SECTOR_SIZE;
+int fs_mount(const char *prefix, const fs_ops_t *ops, void *fs) {
+    if (strlen(prefix) >= FS_PREFIX_LEN) return -1;
+    if (find_mount(prefix, strlen(prefix))) return -1;
+    for (int i = 0; i < FS_MAX_MOUNTS; i++) {
+        if (mounts[i].ops) continue;
+        uint32_t j = 0;
+        for (; prefix[j]; j++) mounts[i].prefix[j] = upper(prefix[j]);
+        mounts[i].prefix[j] = '\0';
+        mounts[i].fs  = fs;
+        mounts[i].ops = ops;        /* last: lookups skip slots without ops */
+        return 0;
+    }
+    return -1;
 }
 
-int fs_read(const char *filename, uint8_t *buffer, uint32_t maxlen) {
-    char fatname[11];
-    make_fat_name(filename, fatname);
-
-    uint8_t sector[SECTOR_SIZE];
-    int root_sectors = (info.root_entries * 32 + SECTOR_SIZE - 1)/SECTOR_SIZE;
-
-    // Scan root directory
-    for (int s = 0; s < root_sectors; s++) {
-        ata_read_sector(0, info.root_dir_start + s, sector);
-        for (int off = 0; off < SECTOR_SIZE; off += 32) {
-            if (sector[off] == 0x00) return -1;   // no more entries
-            if ((sector[off] & 0xE5) == 0xE5) continue; // deleted
-            if (!memcmp(sector + off, fatname, 11)) {
-                uint16_t cluster = sector[off+26] | (sector[off+27]<<8);
-                uint32_t filesize = sector[off+28] | (sector[off+29]<<8) |
-                                    (sector[off+30]<<16)| (sector[off+31]<<24);
-                uint32_t read = 0;
-                while (cluster < 0xFF8 && read < filesize && read < maxlen) {
-                    uint32_t lba = info.data_start + (cluster - 2)*info.sectors_per_cluster;
-                    // read each sector of this cluster
-                    for (int i = 0; i < info.sectors_per_cluster; i++) {
-                        ata_read_sector(0, lba + i, sector);
-                        uint32_t tocopy = (filesize - read < SECTOR_SIZE) ? filesize - read : SECTOR_SIZE;
-                        memcpy(buffer + read, sector, tocopy);
-                        read += tocopy;
-                        if (read >= filesize || read >= maxlen) break;
-                    }
-                    // fetch next cluster from FAT
-                    uint32_t fat_offset = info.fat_start*SECTOR_SIZE + cluster*2;
-                    ata_read_sector(0, info.fat_start + (fat_offset/SECTOR_SIZE), sector);
-                    cluster = sector[fat_offset%SECTOR_SIZE] | (sector[(fat_offset%SECTOR_SIZE)+1]<<8);
-                }
-                return read;
+int fs_mount_info(int i, const char **prefix, const char **type, uint32_t *free_bytes) {
+    for (int slot = 0; slot < FS_MAX_MOUNTS; slot++) {
+        if (!mounts[slot].ops || i-- > 0) continue;
+        fs_mount_t *m = &mounts[slot];
+        if (prefix) *prefix = m->prefix;
+        if (type) *type = m->ops->type_name(m->fs);
+        if (free_bytes) {
+            *free_bytes = 0;                 /* unknown while tasks are inside */
+            if (fs_enter() == 0) {
+                *free_bytes = m->ops->free_space(m->fs);
+                fs_leave();
             }
         }
+        return 0;
     }
     return -1;
 }
 
-/* ──────────────────────────────────────────────────────────── */
-/* Public API                                                   */
-/* ──────────────────────────────────────────────────────────── */
+int fs_read_at(const char *filename, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || lock_file(&h, m, name, 0) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->read_at(m->fs, name, offset, buffer, len);
+    op_end(FS_OP_READ, &mark);
+    unlock_all(&h);
+    return r;
+}
 
-void fs_ls(fs_ls_callback cb) {
-    if (!cb) return;
-    SECTOR_BUF();
-    int root_sectors = (info.root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
-    for (int s = 0; s < root_sectors; s++) {
-        uint32_t lba = info.root_dir_start + s;
-        read_sector(lba, sector);
-        for (int off = 0; off < SECTOR_SIZE; off += 32) {
-            uint8_t first = sector[off];
-            if (first == 0x00) return; /* done */
-            if (first == 0xE5 || (sector[off+11] & 0x08)) continue; /* deleted or volume label */
-
-            char name[13];
-            int n = 0;
-            for (int i = 0; i < 11; i++) {
-                char c = sector[off + i];
-                if (i == 8) {
-                    /* insert dot if extension present */
-                    if (c != ' ') name[n++] = '.';
-                }
-                if (c != ' ') name[n++] = c;
-            }
-            name[n] = '\0';
-            uint32_t size = sector[off+28] | (sector[off+29]<<8) | (sector[off+30]<<16) | (sector[off+31]<<24);
-            cb(name, size);
-        }
-    }
+int fs_read(const char *filename, uint8_t *buffer, uint32_t maxlen) {
+    return fs_read_at(filename, 0, buffer, maxlen);
 }
 
-int fs_delete(const char *filename) {
-    char fatname[11];
-    make_fat_name(filename, fatname);
-    uint32_t lba; uint16_t off;
-    if (find_dir_entry(fatname, &lba, &off) < 0) return -1;
-
-    /* fetch first cluster */
-    SECTOR_BUF();
-    read_sector(lba, sector);
-    uint16_t first_cluster = sector[off+26] | (sector[off+27]<<8);
-    if (first_cluster >= 2)
-        free_cluster_chain(first_cluster);
-
-    delete_entry_at(lba, off);
-    return 0;
+int fs_stat(const char *filename, uint32_t *size) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || lock_file(&h, m, name, 0) < 0) return -1;
+    int r = m->ops->stat(m->fs, name, size);
+    unlock_all(&h);
+    return r;
 }
 
 int fs_write(const char *filename, const uint8_t *data, uint32_t len) {
-    char fatname[11];
-    make_fat_name(filename, fatname);
-
-    /* If file exists – delete it first */
-    fs_delete(filename);
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || lock_file(&h, m, name, 1) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->write(m->fs, name, data, len);
+    op_end(FS_OP_WRITE, &mark);
+    pc_invalidate(filename);
+    unlock_all(&h);
+    return r;
+}
 
-    if (len == 0) {
-        /* create zero-length entry with cluster = 0 */
-        return create_dir_entry(fatname, 0, 0);
-    }
+int fs_append(const char *filename, const uint8_t *data, uint32_t len) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || lock_file(&h, m, name, 1) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->append(m->fs, name, data, len);
+    op_end(FS_OP_APPEND, &mark);
+    pc_invalidate(filename);
+    unlock_all(&h);
+    return r;
+}
 
-    uint32_t cluster_bytes = info.sectors_per_cluster * SECTOR_SIZE;
-    uint32_t remaining = len;
+int fs_write_at(const char *filename, uint32_t offset, const uint8_t *data, uint32_t len) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || !m->ops->write_at || lock_file(&h, m, name, 1) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->write_at(m->fs, name, offset, data, len);
+    op_end(FS_OP_WRITE, &mark);
+    pc_invalidate(filename);
+    unlock_all(&h);
+    return r;
+}
 
-    uint16_t first_cluster = 0;
-    uint16_t prev_cluster = 0;
+int fs_preallocate(const char *filename, uint32_t size) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || !m->ops->preallocate || lock_file(&h, m, name, 1) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->preallocate(m->fs, name, size);
+    op_end(FS_OP_PREALLOC, &mark);
+    unlock_all(&h);
+    return r;
+}
 
-    const uint8_t *p = data;
+int fs_delete(const char *filename) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    if (!m) return -1;
+    held_t h = { .n = 0 };
+    hold_parent(&h, m, name, 1);
+    hold_file(&h, m, name, 1);
+    if (lock_all(&h) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->remove(m->fs, name);
+    op_end(FS_OP_DELETE, &mark);
+    pc_invalidate(filename);
+    unlock_all(&h);
+    return r;
+}
 
-    while (remaining > 0) {
-        uint16_t c = alloc_cluster();
-        if (c == 0) {
-            /* out of space, cleanup */
-            if (first_cluster) free_cluster_chain(first_cluster);
-            return -1;
-        }
-        if (!first_cluster) first_cluster = c;
-        if (prev_cluster) fat_set(prev_cluster, c);
-        prev_cluster = c;
-
-        /* write this cluster */
-        uint32_t lba = info.data_start + (c - 2) * info.sectors_per_cluster;
-        for (int s = 0; s < info.sectors_per_cluster; s++) {
-            uint8_t sector_buf[SECTOR_SIZE];
-            uint32_t tocopy = (remaining < SECTOR_SIZE) ? remaining : SECTOR_SIZE;
-            memcpy(sector_buf, p, tocopy);
-            if (tocopy < SECTOR_SIZE) memset(sector_buf + tocopy, 0, SECTOR_SIZE - tocopy);
-            write_sector(lba + s, sector_buf);
-            if (remaining > SECTOR_SIZE) {
-                remaining -= SECTOR_SIZE;
-                p += SECTOR_SIZE;
-            } else {
-                p += remaining;
-                remaining = 0;
-                break;
-            }
-        }
-    }
+/* "PREFIX/name" for `name` in mount `m`, as the page cache knows it;
+ * "" if it does not fit (no cached file has such a path) */
+static void mount_path(const fs_mount_t *m, const char *name, char *out, uint32_t size) {
+    uint32_t n = 0;
+    for (const char *p = m->prefix; *p && n + 1 < size; ) out[n++] = *p++;
+    if (m->prefix[0] && n + 1 < size) out[n++] = '/';
+    while (*name && n + 1 < size) out[n++] = *name++;
+    out[*name ? 0 : n] = '\0';
+}
 
-    /* mark last cluster EOC */
-    fat_set(prev_cluster, 0xFFF);
+int fs_rename(const char *oldname, const char *newname) {
+    const char *from, *to;
+    fs_mount_t *m = resolve(oldname, &from);
+    if (!m) return -1;
+    /* a bare new name stays in the mount of the old one */
+    const char *p = newname;
+    while (*p && *p != '/') p++;
+    if (*p == '\0') to = newname;
+    else if (resolve(newname, &to) != m) return -1;
+    held_t h = { .n = 0 };
+    hold_parent(&h, m, from, 1);
+    hold_parent(&h, m, to, 1);
+    hold_file(&h, m, from, 1);
+    hold_file(&h, m, to, 1);
+    if (lock_all(&h) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->rename(m->fs, from, to);
+    op_end(FS_OP_RENAME, &mark);
+    /* a bare new name is in the old one's mount, not the root */
+    char dest[FS_PREFIX_LEN + PC_PATH_LEN];
+    mount_path(m, to, dest, sizeof(dest));
+    pc_invalidate(oldname);
+    if (dest[0]) pc_invalidate(dest);
+    unlock_all(&h);
+    return r;
+}
 
-    /* directory entry */
-    if (create_dir_entry(fatname, first_cluster, len) < 0) {
-        free_cluster_chain(first_cluster);
-        return -1;
+/* Copy through a kernel buffer between mounts, or within a mount that
+ * has no copy op: truncate, reserve the full size, then append. */
+static uint8_t copy_buf[4096];
+static kmutex_t copy_lock = KMUTEX_INIT;      /* guards copy_buf */
+
+static int stream_copy(fs_mount_t *ms, const char *from, fs_mount_t *md, const char *to,
+                       uint32_t size) {
+    if (ms == md) {
+        const char *a = from, *b = to;
+        while (*a && upper(*a) == upper(*b)) { a++; b++; }
+        if (*a == *b) return -1;                    /* same file */
     }
-    return 0;
+    if (md->ops->write(md->fs, to, NULL, 0) < 0) return -1;
+    if (md->ops->preallocate && md->ops->preallocate(md->fs, to, size) < 0) return -1;
+    int r = 0;
+    kmutex_lock(&copy_lock);
+    for (uint32_t pos = 0; pos < size && r == 0; ) {
+        uint32_t n = (size - pos < sizeof(copy_buf)) ? size - pos : sizeof(copy_buf);
+        if (ms->ops->read_at(ms->fs, from, pos, copy_buf, n) != (int)n) r = -1;
+        else if (md->ops->append(md->fs, to, copy_buf, n) < 0) r = -1;
+        pos += n;
+    }
+    kmutex_unlock(&copy_lock);
+    return r;
 }
 
-/* Append support: naive – reload old content and re-write completely. */
-int fs_append(const char *filename, const uint8_t *data, uint32_t len) {
-    /* read existing size */
-    uint32_t old_size = 0;
-    char fatname[11];
-    make_fat_name(filename, fatname);
-    uint32_t lba; uint16_t off;
-    if (find_dir_entry(fatname, &lba, &off) == 0) {
-        SECTOR_BUF();
-        read_sector(lba, sector);
-        old_size = sector[off+28] | (sector[off+29]<<8) | (sector[off+30]<<16) | (sector[off+31]<<24);
+int fs_copy(const char *src, const char *dst) {
+    const char *from, *to;
+    fs_mount_t *ms = resolve(src, &from);
+    fs_mount_t *md = resolve(dst, &to);
+    if (!ms || !md) return -1;
+    held_t h = { .n = 0 };
+    hold_parent(&h, ms, from, 0);
+    hold_parent(&h, md, to, 0);
+    hold_file(&h, ms, from, 0);
+    hold_file(&h, md, to, 1);
+    if (lock_all(&h) < 0) return -1;
+    uint32_t size;
+    int r = -1;
+    if (ms->ops->stat(ms->fs, from, &size) == 0) {
+        io_mark_t mark;
+        op_begin(&mark);
+        r = (ms == md && ms->ops->copy) ? ms->ops->copy(ms->fs, from, to)
+                                        : stream_copy(ms, from, md, to, size);
+        op_end(FS_OP_COPY, &mark);
+        pc_invalidate(dst);
     }
+    unlock_all(&h);
+    return r;
+}
 
-    uint32_t new_size = old_size + len;
-    uint8_t *buf = kmalloc(new_size);
-    if (!buf) return -1;
-    if (old_size) {
-        if (fs_read(filename, buf, old_size) != (int)old_size) {
-            return -1;
-        }
+void fs_ls(fs_ls_callback cb) {
+    fs_ls_dir("", cb);
+}
+
+int fs_ls_dir(const char *dir, fs_ls_callback cb) {
+    if (*dir == '/') dir++;
+    uint32_t n = strlen(dir);
+    if (n && dir[n - 1] == '/') n--;
+    fs_mount_t *m = find_mount(dir, n);
+    const char *name = "";
+    if (!m) {
+        /* not a mount: a directory inside one */
+        m = resolve(dir, &name);
+        if (!m || !m->ops->ls_dir) return -1;
     }
-    memcpy(buf + old_size, data, len);
-    int res = fs_write(filename, buf, new_size);
-    // Note: no free; simple bump allocator
-    return res;
+    held_t h = { .n = 0 };
+    hold_dir(&h, m, name, 0);
+    if (lock_all(&h) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = 0;
+    if (*name) r = m->ops->ls_dir(m->fs, name, cb);
+    else m->ops->ls(m->fs, cb);
+    op_end(FS_OP_LS, &mark);
+    unlock_all(&h);
+    return r;
 }
 
-int fs_rename(const char *oldname, const char *newname) {
-    char fat_old[11]; char fat_new[11];
-    make_fat_name(oldname, fat_old);
-    make_fat_name(newname, fat_new);
+int fs_mkdir(const char *dir) {
+    const char *name;
+    fs_mount_t *m = resolve(dir, &name);
+    if (!m || !m->ops->mkdir) return -1;
+    held_t h = { .n = 0 };
+    hold_parent(&h, m, name, 1);
+    hold_file(&h, m, name, 1);
+    if (lock_all(&h) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->mkdir(m->fs, name);
+    op_end(FS_OP_MKDIR, &mark);
+    unlock_all(&h);
+    return r;
+}
 
-    /* ensure destination does not exist */
-    if (find_dir_entry(fat_new, NULL, NULL) == 0) return -1;
+void fs_frag_stats(fs_frag_stats_t *out) {
+    fs_mount_t *m = find_mount("", 0);
+    memset(out, 0, sizeof(*out));
+    if (!m || !m->ops->frag_stats || fs_enter() < 0) return;
+    m->ops->frag_stats(m->fs, out);
+    fs_leave();
+}
 
-    uint32_t lba; uint16_t off;
-    if (find_dir_entry(fat_old, &lba, &off) < 0) return -1;
+int fs_defrag(fs_frag_stats_t *before, fs_frag_stats_t *after) {
+    fs_mount_t *m = find_mount("", 0);
+    if (!m || !m->ops->defrag || fs_enter() < 0) return -1;
+    /* every file may move: hold all file locks, in table order */
+    for (int i = FS_LOCKS; i < 2 * FS_LOCKS; i++) take(i, 1);
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->defrag(m->fs, before, after);
+    op_end(FS_OP_DEFRAG, &mark);
+    for (int i = 2 * FS_LOCKS - 1; i >= FS_LOCKS; i--) drop(i, 1);
+    fs_leave();
+    return r;
+}
 
-    SECTOR_BUF();
-    read_sector(lba, sector);
-    memcpy(&sector[off], fat_new, 11);
-    write_sector(lba, sector);
-    return 0;
+int fs_bmap(const char *filename, uint32_t offset, uint32_t len, blkdev_t **dev, uint32_t *lba) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || lock_file(&h, m, name, 0) < 0) return -1;
+    int r;
+    if (!m->ops->bmap) r = m->ops->stat(m->fs, name, &len) < 0 ? -1 : 0;
+    else r = m->ops->bmap(m->fs, name, offset, len, dev, lba);
+    unlock_all(&h);
+    return r;
+}
+
+int fs_sync(const char *filename) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    if (!m) return -1;
+    if (!m->ops->sync) return 0;
+    if (fs_enter() < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->sync(m->fs);
+    op_end(FS_OP_SYNC, &mark);
+    fs_leave();
+    return r;
+}
+
+int fs_compress(const char *filename, uint32_t *stored) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || !m->ops->compress || lock_file(&h, m, name, 1) < 0) return -1;
+    io_mark_t mark;
+    op_begin(&mark);
+    int r = m->ops->compress(m->fs, name, stored);
+    op_end(FS_OP_COMPRESS, &mark);
+    unlock_all(&h);
+    return r;   /* same bytes to readers: cached pages stay valid */
+}
+
+int fs_map(const char *filename, const uint8_t **data, uint32_t *size) {
+    const char *name;
+    fs_mount_t *m = resolve(filename, &name);
+    held_t h;
+    if (!m || !m->ops->map || lock_file(&h, m, name, 0) < 0) return -1;
+    int r = m->ops->map(m->fs, name, data, size);
+    unlock_all(&h);
+    return r;
 }
 
 uint32_t fs_free_space(void) {
-    uint16_t max = max_clusters();
-    uint32_t free_clusters = 0;
-    for (uint16_t c = 2; c < max; c++) {
-        if (fat_get(c) == 0x000) free_clusters++;
-    }
-    return free_clusters * info.sectors_per_cluster * SECTOR_SIZE;
+    fs_mount_t *m = find_mount("", 0);
+    if (!m || fs_enter() < 0) return 0;
+    uint32_t r = m->ops->free_space(m->fs);
+    fs_leave();
+    return r;
+}
+
+const char *fs_op_name(fs_op_t op) {
+    return op < FS_OP_COUNT ? op_names[op] : "?";
+}
+
+void fs_get_op_stats(fs_op_t op, fs_op_stats_t *out) {
+    if (op < FS_OP_COUNT) *out = op_stats[op];
+    else memset(out, 0, sizeof(*out));
 }
@@ -2,32 +2,178 @@
 #define FS_H
 
 #include <stdint.h>
+#include "blkdev.h"
 
-// Initialize FS internals (reads BPB, computes offsets)
-void fs_init(void);
+// List callback, invoked once per file with its name and size in bytes.
+typedef void (*fs_ls_callback)(const char *name, uint32_t size);
+
+// Fragmentation summary of the files in the root directory.
+typedef struct {
+    uint32_t files;        // files that own at least one cluster
+    uint32_t fragmented;   // files stored in more than one run
+    uint32_t extents;      // contiguous runs summed over all files
+} fs_frag_stats_t;
+
+// Operations a mounted filesystem provides. `fs` is the instance pointer
+// given to fs_mount(); names arrive with the mount prefix stripped.
+// Optional operations may be NULL, the fs_* wrapper then fails with –1.
+typedef struct {
+    int      (*read_at)(void *fs, const char *name, uint32_t offset, uint8_t *buf, uint32_t len);
+    int      (*stat)(void *fs, const char *name, uint32_t *size);
+    int      (*write)(void *fs, const char *name, const uint8_t *data, uint32_t len);
+    int      (*append)(void *fs, const char *name, const uint8_t *data, uint32_t len);
+    int      (*remove)(void *fs, const char *name);
+    int      (*rename)(void *fs, const char *oldname, const char *newname);
+    void     (*ls)(void *fs, fs_ls_callback cb);
+    uint32_t (*free_space)(void *fs);
+    const char *(*type_name)(void *fs);
+    /* optional */
+    int      (*preallocate)(void *fs, const char *name, uint32_t size);
+    void     (*frag_stats)(void *fs, fs_frag_stats_t *out);
+    int      (*defrag)(void *fs, fs_frag_stats_t *before, fs_frag_stats_t *after);
+    int      (*write_at)(void *fs, const char *name, uint32_t offset, const uint8_t *data, uint32_t len);
+    int      (*bmap)(void *fs, const char *name, uint32_t offset, uint32_t len,
+                     blkdev_t **dev, uint32_t *lba);
+    int      (*sync)(void *fs);
+    int      (*compress)(void *fs, const char *name, uint32_t *stored);
+    int      (*copy)(void *fs, const char *src, const char *dst);
+    int      (*mkdir)(void *fs, const char *name);
+    int      (*ls_dir)(void *fs, const char *name, fs_ls_callback cb);
+    int      (*map)(void *fs, const char *name, const uint8_t **data, uint32_t *size);
+} fs_ops_t;
+
+#define FS_MAX_MOUNTS   4
+#define FS_PREFIX_LEN   8
+
+// Reset the mount table and mount the volume on block device `root_dev`
+// (e.g. "hda") as root: FAT if it carries one, otherwise ext2. When GRUB
+// loaded an initrd, that becomes the root instead and the disk volume is
+// mounted as "HD".
+void fs_init(const char *root_dev);
+
+// Mount `fs` under `prefix` (e.g. "TMP"); "" is the root mount. Paths
+// of the form "TMP/NAME" or "/TMP/NAME" go to the mount, anything else
+// to root. Returns 0 on success, –1 if the table is full or the prefix
+// is taken.
+int fs_mount(const char *prefix, const fs_ops_t *ops, void *fs);
 
-// Read up to `maxlen` bytes of `filename` (8.3, uppercase, no path) into `buffer`.
+// Walk the mount table: returns 0 and fills the outputs for slot `i`,
+// –1 past the last mount.
+int fs_mount_info(int i, const char **prefix, const char **type, uint32_t *free_bytes);
+
+// Read up to `maxlen` bytes of `filename` (8.3 on FAT, optionally with a
+// mount prefix) into `buffer`.
 // Returns number of bytes read, or –1 on error/not found.
 int fs_read(const char *filename, uint8_t *buffer, uint32_t maxlen);
 
-// Write `len` bytes from buffer into `filename`. Creates or overwrites.
+// Read up to `len` bytes starting at byte `offset`. Seeks use a cached
+// per-file extent map, so random access costs no FAT walk once warm.
+// Returns bytes read (0 at/after EOF), or –1 if the file is not found.
+int fs_read_at(const char *filename, uint32_t offset, uint8_t *buffer, uint32_t len);
+
+// Size of `filename` in bytes. Returns 0, or –1 if it does not exist.
+int fs_stat(const char *filename, uint32_t *size);
+
+// Write `len` bytes from buffer into `filename`. Creates or overwrites;
+// new clusters come from the first free run long enough for the write.
 // Returns 0 on success, –1 on failure (e.g. no space).
 int fs_write(const char *filename, const uint8_t *data, uint32_t len);
 
+// Overwrite `len` bytes at `offset`, growing the file if the write runs
+// past its end. `offset` may be at most the current size (no holes); a
+// missing file is created by a write at offset 0. Returns 0 or –1.
+int fs_write_at(const char *filename, uint32_t offset, const uint8_t *data, uint32_t len);
+
+// Reserve space for `size` bytes up front, in as few contiguous runs as
+// the free space allows. Creates the file (size 0) if it does not exist.
+// The file's size is unchanged; later writes and appends reuse the
+// reserved clusters. A `size` at or below the current size releases the
+// reservation. Returns 0 on success, –1 if the volume is full.
+int fs_preallocate(const char *filename, uint32_t size);
+
 // Delete a file. Returns 0 on success, –1 if not found.
 int fs_delete(const char *filename);
 
 // List root directory; the callback is invoked for every 8.3 filename.
-typedef void (*fs_ls_callback)(const char *name, uint32_t size);
 void fs_ls(fs_ls_callback cb);
 
-// Append data to existing file (creates if not present).
+// List the mount named `dir` ("" or "/" for root), or a directory inside
+// a mount whose filesystem has them ("DOCS", "MNT/SRC"). Returns –1 if
+// there is no such mount or directory.
+int fs_ls_dir(const char *dir, fs_ls_callback cb);
+
+// Create directory `dir` on a filesystem that has directories (ext2).
+// Returns 0, or –1 if it exists, its parent is missing or the mount
+// has flat namespaces only.
+int fs_mkdir(const char *dir);
+
+// Append data to existing file (creates if not present). Only the new
+// bytes are written; the chain grows from its tail, contiguously if the
+// clusters behind it are free.
 int fs_append(const char *filename, const uint8_t *data, uint32_t len);
 
-// Rename file; newname must be 8.3 format. Returns 0 on success.
+// Rename file; newname must be 8.3 format on FAT. A newname without a
+// path stays in oldname's mount, otherwise both must resolve to the same
+// mount. Returns 0 on success.
 int fs_rename(const char *oldname, const char *newname);
 
-// Return free disk space (bytes) based on unused clusters.
+// Fragmentation summary of the root mount (zeroed if unsupported).
+void fs_frag_stats(fs_frag_stats_t *out);
+
+// Relocate every fragmented file into a single contiguous run where a
+// large enough hole exists. `before`/`after` (optional) receive the
+// fragmentation summary around the pass. Returns files moved, –1 if no
+// volume is mounted.
+int fs_defrag(fs_frag_stats_t *before, fs_frag_stats_t *after);
+
+// Map the file bytes [offset, offset+len) to device blocks for direct
+// transfers: returns how many whole blocks from `offset` (block aligned)
+// are inside the file and contiguous on `*dev` from `*lba`. 0 when the
+// range cannot be moved that way (unaligned, EOF, RAM-backed mount),
+// –1 if the file does not exist.
+int fs_bmap(const char *filename, uint32_t offset, uint32_t len, blkdev_t **dev, uint32_t *lba);
+
+// Make everything written to `filename`'s mount durable. Returns 0 or –1.
+int fs_sync(const char *filename);
+
+// Convert `filename` to compressed storage (independent LZ4 chunks, so
+// random reads expand only what they touch). Reads and fs_stat still see
+// the original bytes; the next modification stores it plain again.
+// `stored` (optional) receives the bytes it occupies on disk. Returns 0,
+// 1 if compression would not save space (file left as is), or –1.
+int fs_compress(const char *filename, uint32_t *stored);
+
+// Copy `src` to `dst` (created or overwritten). Within one FAT mount the
+// sectors stream from chain to chain in multi-sector bursts into space
+// claimed up front; across mounts the data goes through a small kernel
+// buffer. No size limit. Returns 0, or –1 (source missing, no space).
+int fs_copy(const char *src, const char *dst);
+
+// Point `*data` at the `*size` bytes of `filename` when its mount keeps
+// whole files in memory (initrd), so callers can use them without a
+// copy. Returns 0, or –1 if the file is missing or its mount has no
+// such mapping (read it with fs_read_at() instead).
+int fs_map(const char *filename, const uint8_t **data, uint32_t *size);
+
+// Return free space (bytes) of the root mount.
 uint32_t fs_free_space(void);
 
+// Per-call I/O accounting: every fs_* entry point charges the device
+// sectors moved while it ran (read-ahead included) to its operation.
+typedef enum {
+    FS_OP_READ, FS_OP_WRITE, FS_OP_APPEND, FS_OP_DELETE,
+    FS_OP_RENAME, FS_OP_LS, FS_OP_PREALLOC, FS_OP_DEFRAG,
+    FS_OP_SYNC, FS_OP_COMPRESS, FS_OP_COPY, FS_OP_MKDIR,
+    FS_OP_COUNT
+} fs_op_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t rd_sectors;
+    uint32_t wr_sectors;
+} fs_op_stats_t;
+
+const char *fs_op_name(fs_op_t op);
+void fs_get_op_stats(fs_op_t op, fs_op_stats_t *out);
+
 #endif /* FS_H */
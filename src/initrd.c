@@ -0,0 +1,194 @@
+#include "initrd.h"
+#include "kheap.h"
+#include "util.h"
+#include <stddef.h>
+
+#define MB2_BOOT_MAGIC  0x36D76289
+#define MB2_TAG_END     0
+#define MB2_TAG_MODULE  3
+
+#define TAR_BLOCK       512
+#define TAR_NAME_LEN    100
+
+typedef struct {
+    const char    *name;      /* inside the archive, not NUL-terminated at 100 */
+    uint32_t       len;
+    const uint8_t *data;
+    uint32_t       size;
+} initrd_file_t;
+
+struct initrd {
+    initrd_file_t *files;
+    uint32_t       count;
+};
+
+/* Module bounds, captured before the multiboot information can be
+ * overwritten; 0/0 when GRUB loaded none */
+static uint32_t mod_start, mod_end;
+
+void initrd_init(uint32_t magic, uint32_t mbi) {
+    if (magic != MB2_BOOT_MAGIC || !mbi) return;
+    uint32_t total = *(const uint32_t *)(uintptr_t)mbi;
+    /* tags follow the 8-byte fixed part, each padded to 8 bytes */
+    for (uint32_t off = 8; off + 8 <= total; ) {
+        const uint32_t *tag = (const uint32_t *)(uintptr_t)(mbi + off);
+        uint32_t type = tag[0], size = tag[1];
+        if (type == MB2_TAG_END || size < 8) break;
+        if (type == MB2_TAG_MODULE && size >= 16 && tag[2] < tag[3]) {
+            mod_start = tag[2];
+            mod_end = tag[3];
+            return;
+        }
+        off += (size + 7) & ~7u;
+    }
+}
+
+int initrd_range(uint32_t *start, uint32_t *end) {
+    if (mod_start == mod_end) return -1;
+    *start = mod_start;
+    *end = mod_end;
+    return 0;
+}
+
+/* Octal header field of up to `n` characters; –1 if malformed */
+static int64_t octal(const char *s, int n) {
+    int64_t v = 0;
+    int i = 0;
+    while (i < n && s[i] == ' ') i++;
+    for (; i < n && s[i] >= '0' && s[i] <= '7'; i++) v = v * 8 + (s[i] - '0');
+    if (i < n && s[i] != ' ' && s[i] != '\0') return -1;
+    return v;
+}
+
+/* Walk the archive once; with `files` set, fill it in. Returns the
+ * number of regular files, –1 if the archive is malformed. Names longer
+ * than the 100-byte name field (ustar prefix) are skipped. */
+static int scan(const uint8_t *base, uint32_t len, initrd_file_t *files) {
+    int count = 0;
+    for (uint32_t off = 0; off + TAR_BLOCK <= len; ) {
+        const char *h = (const char *)base + off;
+        if (!h[0]) break;                                  /* end-of-archive block */
+        if (memcmp(h + 257, "ustar", 5)) return -1;
+        int64_t size = octal(h + 124, 12);
+        if (size < 0 || (uint64_t)off + TAR_BLOCK + (uint64_t)size > len) return -1;
+        char type = h[156];
+        if ((type == '0' || type == '\0') && !h[345]) {
+            const char *n = h;
+            uint32_t nlen = 0;
+            while (nlen < TAR_NAME_LEN && n[nlen]) nlen++;
+            while (nlen >= 2 && n[0] == '.' && n[1] == '/') n += 2, nlen -= 2;
+            while (nlen && n[0] == '/') n++, nlen--;
+            if (nlen) {
+                if (files) {
+                    files[count].name = n;
+                    files[count].len = nlen;
+                    files[count].data = base + off + TAR_BLOCK;
+                    files[count].size = (uint32_t)size;
+                }
+                count++;
+            }
+        }
+        off += TAR_BLOCK + ((uint32_t)size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+    return count;
+}
+
+initrd_t *initrd_create(void) {
+    if (mod_start == mod_end) return NULL;
+    const uint8_t *base = (const uint8_t *)(uintptr_t)mod_start;
+    int n = scan(base, mod_end - mod_start, NULL);
+    if (n < 0) return NULL;
+    initrd_t *rd = kmalloc(sizeof(initrd_t));
+    if (!rd) return NULL;
+    rd->files = n ? kmalloc(n * sizeof(initrd_file_t)) : NULL;
+    if (n && !rd->files) return NULL;
+    rd->count = (uint32_t)scan(base, mod_end - mod_start, rd->files);
+    return rd;
+}
+
+static char upper(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 32 : c;
+}
+
+static const initrd_file_t *lookup(initrd_t *rd, const char *name) {
+    while (*name == '/') name++;
+    for (uint32_t i = 0; i < rd->count; i++) {
+        const initrd_file_t *f = &rd->files[i];
+        uint32_t j = 0;
+        while (j < f->len && upper(f->name[j]) == upper(name[j])) j++;
+        if (j == f->len && !name[j]) return f;
+    }
+    return NULL;
+}
+
+static int initrd_read_at(void *fs, const char *name, uint32_t offset, uint8_t *buf, uint32_t len) {
+    const initrd_file_t *f = lookup(fs, name);
+    if (!f) return -1;
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+    memcpy(buf, f->data + offset, len);
+    return (int)len;
+}
+
+static int initrd_stat(void *fs, const char *name, uint32_t *size) {
+    const initrd_file_t *f = lookup(fs, name);
+    if (!f) return -1;
+    *size = f->size;
+    return 0;
+}
+
+static int initrd_map(void *fs, const char *name, const uint8_t **data, uint32_t *size) {
+    const initrd_file_t *f = lookup(fs, name);
+    if (!f) return -1;
+    *data = f->data;
+    *size = f->size;
+    return 0;
+}
+
+static int initrd_write(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    (void)fs; (void)name; (void)data; (void)len;
+    return -1;
+}
+
+static int initrd_remove(void *fs, const char *name) {
+    (void)fs; (void)name;
+    return -1;
+}
+
+static int initrd_rename(void *fs, const char *oldname, const char *newname) {
+    (void)fs; (void)oldname; (void)newname;
+    return -1;
+}
+
+static void initrd_ls(void *fs, fs_ls_callback cb) {
+    initrd_t *rd = fs;
+    char name[TAR_NAME_LEN + 1];
+    for (uint32_t i = 0; i < rd->count; i++) {
+        memcpy(name, rd->files[i].name, rd->files[i].len);
+        name[rd->files[i].len] = '\0';
+        cb(name, rd->files[i].size);
+    }
+}
+
+static uint32_t initrd_free_space(void *fs) {
+    (void)fs;
+    return 0;
+}
+
+static const char *initrd_type_name(void *fs) {
+    (void)fs;
+    return "initrd";
+}
+
+const fs_ops_t initrd_ops = {
+    .read_at    = initrd_read_at,
+    .stat       = initrd_stat,
+    .write      = initrd_write,
+    .append     = initrd_write,
+    .remove     = initrd_remove,
+    .rename     = initrd_rename,
+    .ls         = initrd_ls,
+    .free_space = initrd_free_space,
+    .type_name  = initrd_type_name,
+    .map        = initrd_map,
+};
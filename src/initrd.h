@@ -0,0 +1,31 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include "fs.h"
+
+// Initial RAM disk: a tar archive (ustar, e.g. `tar --format=ustar`)
+// that GRUB loads as a multiboot2 module. It is used in place: reads
+// copy straight out of the module and fs_map() hands out pointers into
+// it, so nothing goes through the block layer. File data starts on a
+// 512-byte boundary of the module. Read-only; names compare
+// case-insensitively, "DIR/NAME" paths are kept as in the archive.
+typedef struct initrd initrd_t;
+
+// Record the first boot module from the multiboot2 information at
+// `mbi` (`magic` is what the loader left in EAX). Call before anything
+// allocates memory: the module usually sits right behind the kernel
+// image, where the heap would otherwise start.
+void initrd_init(uint32_t magic, uint32_t mbi);
+
+// Physical bytes [*start, *end) the module occupies. –1 if there is none.
+int initrd_range(uint32_t *start, uint32_t *end);
+
+// Index the archive (table from the kernel heap). NULL if no module was
+// loaded or it is not a tar archive. Mount it with
+// fs_mount(prefix, &initrd_ops, instance).
+initrd_t *initrd_create(void);
+
+extern const fs_ops_t initrd_ops;
+
+#endif /* INITRD_H */
@@ -3,8 +3,13 @@
 
 #include <stdint.h>
 
-/* CPU register state pushed by ISR/IRQ stubs */
+/* CPU register state pushed by the ISR/IRQ/syscall stubs: a task's
+ * complete user-mode context, saved on its kernel stack */
 typedef struct regs {
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
     uint32_t edi;
     uint32_t esi;
     uint32_t ebp;
@@ -15,6 +20,12 @@ typedef struct regs {
     uint32_t eax;
     uint32_t int_no;
     uint32_t err;
+    /* pushed by the CPU */
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t useresp;   /* only when entered from ring 3 */
+    uint32_t ss;
 } regs_t;
 
 #endif /* INTERRUPTS_H */
@@ -5,7 +5,7 @@
 #include "util.h"     // inb(), outb()
 #include "idt.h"      // idt_init(), idt_flush()
 #include "pit.h"      // pit_handler()
-#include "task.h"     // schedule()
+#include "task.h"     // schedule(), task_return()
 #include "keyboard.h" // keyboard_handler()
 #include "irq.h"
 
@@ -19,8 +19,29 @@
 #define ICW1_INIT  0x11
 #define ICW4_8086  0x01
 
-// IRQ handlers array
-static irq_handler_t irq_handlers[16] = {0};
+// IRQ handlers array; PCI devices may share a line, so each line has a
+// few slots and every handler on it runs (they check their own device)
+#define IRQ_MAX_SHARED 4
+static irq_handler_t irq_handlers[16][IRQ_MAX_SHARED] = {{0}};
+
+// Masked lines, slave in the high byte. Timer (IRQ0), keyboard (IRQ1),
+// cascade (IRQ2), PS/2 mouse (IRQ12) and primary ATA (IRQ14) start
+// open; installing a handler opens its line too (PCI devices).
+static uint16_t irq_mask = 0xAFF8;
+static int      pic_ready;
+
+// Nesting depth of device handlers. The timer leaves it before
+// schedule(): a switch there belongs to the interrupted task.
+static volatile int irq_depth;
+
+int irq_context(void) {
+    return irq_depth > 0;
+}
+
+static void write_mask(void) {
+    outb(0x21, irq_mask & 0xFF);
+    outb(0xA1, irq_mask >> 8);
+}
 
 // A 100 ns plus delay: out to port 0x80 is guaranteed ~150 ns on PC.
 static inline void io_wait(void) {
@@ -34,9 +55,8 @@ void irq_install(void) {
     outb(0x21, 0x04); outb(0xA1, 0x02);
     outb(0x21, 0x01); outb(0xA1, 0x01);
 
-    // mask all but timer (IRQ0), keyboard (IRQ1), and PS/2 mouse (IRQ12)
-    outb(0x21, 0xF8);  // Enable IRQ0, IRQ1, IRQ2 (cascade)
-    outb(0xA1, 0xEF);  // Enable IRQ12 (PS/2 mouse)
+    write_mask();
+    pic_ready = 1;
 
     // enable PS/2 keyboard port
     while (inb(0x64) & 0x02) { }
@@ -48,17 +68,22 @@ void irq_install(void) {
 
 void irq_install_handler(int irq, irq_handler_t handler) {
     if (irq >= 0 && irq < 16) {
-        irq_handlers[irq] = handler;
+        for (int i = 0; i < IRQ_MAX_SHARED; i++) {
+            if (irq_handlers[irq][i] == handler) break;
+            if (!irq_handlers[irq][i]) { irq_handlers[irq][i] = handler; break; }
+        }
+        irq_mask &= ~(1u << irq);
+        if (pic_ready) write_mask();
     }
 }
 
 void irq_uninstall_handler(int irq) {
     if (irq >= 0 && irq < 16) {
-        irq_handlers[irq] = NULL;
+        for (int i = 0; i < IRQ_MAX_SHARED; i++) irq_handlers[irq][i] = NULL;
     }
 }
 
-void irq_handler(regs_t *r) {
+regs_t *irq_handler(regs_t *r) {
     // acknowledge PIC
     if (r->int_no >= 0x28) outb(0xA0, 0x20);
     outb(0x20, 0x20);
@@ -68,13 +93,19 @@ void irq_handler(regs_t *r) {
     
     if (irq == 0) {
         pit_handler(r);
-        schedule();
+        return schedule(r);
     }
     else if (irq == 1) {
+        irq_depth++;
         keyboard_handler(r);
+        irq_depth--;
     }
-    else if (irq >= 0 && irq < 16 && irq_handlers[irq]) {
-        // Call custom handler if installed
-        irq_handlers[irq]();
+    else if (irq >= 0 && irq < 16) {
+        // Call the custom handlers installed on this line
+        irq_depth++;
+        for (int i = 0; i < IRQ_MAX_SHARED && irq_handlers[irq][i]; i++)
+            irq_handlers[irq][i]();
+        irq_depth--;
     }
+    return task_return(r);
 }
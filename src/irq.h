@@ -10,11 +10,16 @@ typedef void (*irq_handler_t)(void);
 /* Remap PIC, enable IRQs, and sti */
 void irq_install(void);
 
-/* Install/uninstall IRQ handlers */
+/* Install/uninstall IRQ handlers. A line can carry a few handlers
+ * (shared PCI interrupts); uninstall removes all of them. */
 void irq_install_handler(int irq, irq_handler_t handler);
 void irq_uninstall_handler(int irq);
 
-/* Main IRQ handler (called from assembly) */
-void irq_handler(regs_t *r);
+/* Nonzero while a device handler (keyboard, disk, ...) is running.
+ * Code reachable from one must not wait on a kmutex/krwlock. */
+int irq_context(void);
+
+/* Main IRQ handler (called from assembly); returns the frame to resume */
+regs_t *irq_handler(regs_t *r);
 
 #endif /* IRQ_H */
@@ -19,15 +19,29 @@ IRQ i, 32+i
 %assign i i+1
 %endrep
 
+; The handler returns the frame to resume: the interrupted one, or the
+; frame another task saved on its own kernel stack when it was switched
+; out. IRET restores that task's EFLAGS, and with them IF.
 irq_common:
     pusha
-    mov eax, esp
-    push eax
+    push ds
+    push es
+    push fs
+    push gs
+    mov  ax, 0x10           ; kernel data segments
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
+    push esp                ; regs_t *
     call irq_handler
-    add esp, 4
+    mov  esp, eax           ; switch stacks (or not)
+    pop  gs
+    pop  fs
+    pop  es
+    pop  ds
     popa
-    add esp, 8
-    sti
+    add  esp, 8
     iretd
 
 SECTION .rodata
@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include "interrupts.h"
+#include "task.h"
 #include "util.h"
+#include "vm.h"
 
 /* Human‑readable names for CPU exceptions 0–31 */
 static const char *exception_msg[] = {
@@ -38,12 +40,28 @@ static const char *exception_msg[] = {
     "Triple fault"
 };
 
-void isr_handler(regs_t *r) {
+/* Returns the frame to resume: `r`, or the next task's when the
+ * faulting user task was killed */
+regs_t *isr_handler(regs_t *r) {
+    uint32_t cr2 = 0;
+    if (r->int_no == 14) {
+        asm volatile("mov %%cr2, %0" : "=r"(cr2));
+        if (vm_handle_fault(cr2, r->err)) return r;   /* demand fill / COW */
+    }
     puts("\n*** CPU Exception ");
     char num[4]; itoa(r->int_no, num, 10);
     puts(num);
     puts(": ");
     puts(exception_msg[r->int_no]);
+    if (r->int_no == 14) {
+        char addr[12]; utohex(cr2, addr);
+        puts(" at "); puts(addr);
+    }
     puts(" ***\n");
+    /* a user program only takes itself down */
+    if ((r->cs & 3) && current_task >= 0) {
+        task_kill(current_task);
+        return task_return(r);
+    }
     while (1) asm volatile("hlt");
 }
@@ -74,16 +74,27 @@ ISR_ERRCODE 30   ; Security Exception
 ; ── common tail shared by every stub ───────────────────────────────
 isr_common:
     pusha                   ; Save general registers (eax, ecx, edx, ebx, esp, ebp, esi, edi)
-    mov eax, esp            ; Get current stack pointer
+    push ds                 ; ...and the data segments, for a full task frame
+    push es
+    push fs
+    push gs
+    mov  ax, 0x10           ; Kernel data segments
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
 
-    push eax                ; Pass &regs_t struct pointer to the handler
-    call isr_handler        ; Call the C handler
-    add esp, 4              ; Remove the struct pointer from the stack
+    push esp                ; Pass &regs_t struct pointer to the handler
+    call isr_handler        ; Returns the frame to resume (another task's
+    mov  esp, eax           ; if this one was killed)
 
+    pop  gs
+    pop  fs
+    pop  es
+    pop  ds
     popa                    ; Restore general registers
     add esp, 8              ; Discard interrupt number and error code (pushed by CPU or stub)
-    sti                     ; Re-enable interrupts
-    iretd                   ; Return from interrupt
+    iretd                   ; Return from interrupt (restores IF with EFLAGS)
 
 ; ── jump table used by idt_init() ─────────────────────────────────
 ; Note: This table might not be strictly necessary if idt_init() uses the
@@ -1,10 +1,16 @@
 #include "util.h"
 #include "serial.h"
 #include "ata.h"
+#include "pci.h"
+#include "virtio_blk.h"
+#include "ahci.h"
 #include "fs.h"
+#include "bcache.h"
+#include "tmpfs.h"
 #include "paging.h"
 #include "pmm.h"
 #include "kheap.h"
+#include "initrd.h"
 #include "idt.h"
 #include "pit.h"
 #include "task.h"
@@ -14,19 +20,39 @@
 #include "gdt.h"
 #include "tss.h"
 
-void kernel_main(void) {
+/* First disk present: IDE, then SATA, then virtio */
+static const char *root_device(void) {
+    static const char *const names[] = { "hda", "sda", "vda" };
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (blkdev_find(names[i])) return names[i];
+    return "hda";
+}
+
+void kernel_main(uint32_t magic, uint32_t mbi) {
+    uint32_t rd_start = 0, rd_end = 0;
+    initrd_init(magic, mbi);   // before anything can land on the module
+    initrd_range(&rd_start, &rd_end);
+
     gdt_init();
     tss_init();
     idt_init();
     clear_screen();
     serial_init();
+    kheap_init();    // init kernel heap (an ext2 root allocates at mount)
+    kheap_reserve(rd_start, rd_end);
 
-    ata_init();      // initialize PIO interface
-    fs_init();       // read BPB & compute root/data offsets
+    ata_init();      // probe drives, register hda/hdb
+    pci_init();      // enumerate the PCI bus
+    virtio_blk_init();  // register virtio disks as vda/vdb
+    ahci_init();     // register SATA disks as sda..sdd
+    bcache_init();   // empty sector cache
+    fs_init(root_device());  // initrd and/or the FAT or ext2 disk volume
 
     paging_init();   // turn on paging
     pmm_init();      // init physical memory manager
-    kheap_init();    // init kernel heap
+    pmm_reserve(rd_start, rd_end);
+    tmpfs_t *tmp = tmpfs_create();
+    if (tmp) fs_mount("TMP", &tmpfs_ops, tmp);   // scratch files in RAM
 
     pit_init();
     irq_install();
@@ -4,17 +4,32 @@
 /* Provided by the linker script, just after the end of .bss */
 extern uint8_t _end;  
 static uintptr_t heap_end;
+static uintptr_t last_alloc;   /* start of the latest allocation, 0 = none */
 
 /* Kick off the heap right at &_end */
 void kheap_init(void) {
     heap_end = (uintptr_t)&_end;
 }
 
+void kheap_reserve(uintptr_t start, uintptr_t end) {
+    if (end > heap_end && start < KHEAP_END) heap_end = end;
+}
+
 /* Simple bump allocator with 8‑byte alignment */
 void *kmalloc(uint32_t size) {
     uintptr_t addr = heap_end;
     /* Round up to the next multiple of 8 */
     uintptr_t next = (addr + size + 7) & ~(uintptr_t)7;
+    if (next > KHEAP_END || next < addr) return 0;
     heap_end = next;
+    last_alloc = addr;
     return (void*)addr;
 }
+
+/* Only the top of a bump heap can be given back */
+void kfree(void *p) {
+    if (p && (uintptr_t)p == last_alloc) {
+        heap_end = last_alloc;
+        last_alloc = 0;
+    }
+}
@@ -3,10 +3,22 @@
 
 #include <stdint.h>
 
+/* The bump heap never grows past this address; frames above it belong
+ * to the physical memory manager. */
+#define KHEAP_END 0x800000
+
 /* Initialise the kernel heap to start right after the kernel image */
 void kheap_init(void);
 
-/* Allocate `size` bytes from the kernel’s bump heap */
+/* Keep the heap clear of [start, end), e.g. a boot module loaded behind
+ * the kernel image: a range at or above the current break moves the
+ * break past it. Call before the first kmalloc that could reach it. */
+void kheap_reserve(uintptr_t start, uintptr_t end);
+
+/* Allocate `size` bytes from the kernel’s bump heap; NULL once exhausted */
 void *kmalloc(uint32_t size);
 
+/* Undo the latest kmalloc (error paths); any other pointer is kept */
+void kfree(void *p);
+
 #endif /* KHEAP_H */
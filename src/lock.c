@@ -0,0 +1,123 @@
+#include "lock.h"
+#include "irq.h"
+#include "task.h"
+#include "util.h"
+
+/* Holder checks and updates run with interrupts off, so the timer can
+ * not switch tasks between the test and the claim */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+/* IRQ handlers run on behalf of nobody: give them an id no task has, so
+ * they never mistake a lock held by the interrupted task for their own */
+#define LOCK_IRQ  (-2)
+
+static int self(void) {
+    return irq_context() ? LOCK_IRQ : task_current_pid();
+}
+
+/* Let the holder run: idle until the next interrupt, which gives the
+ * scheduler a chance to switch. With interrupts off nothing could ever
+ * release the lock, so getting here breaks the rule in lock.h; it is
+ * reported rather than spun on silently. */
+static void wait(uint32_t flags) {
+    if (flags & 0x200) {
+        asm volatile("hlt");
+        return;
+    }
+    puts("\n*** lock: wait with interrupts off, holder can never run ***\n");
+    for (;;) asm volatile("cli; hlt");
+}
+
+void kmutex_init(kmutex_t *m) {
+    m->owner = LOCK_FREE;
+    m->depth = 0;
+}
+
+int kmutex_trylock(kmutex_t *m) {
+    int me = self();
+    uint32_t flags = irq_save();
+    int ok = (m->owner == LOCK_FREE || m->owner == me);
+    if (ok) {
+        m->owner = me;
+        m->depth++;
+    }
+    irq_restore(flags);
+    return ok ? 0 : -1;
+}
+
+void kmutex_lock(kmutex_t *m) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0" : "=r"(flags));
+    while (kmutex_trylock(m) < 0) wait(flags);
+}
+
+void kmutex_unlock(kmutex_t *m) {
+    uint32_t flags = irq_save();
+    if (m->depth && --m->depth == 0) m->owner = LOCK_FREE;
+    irq_restore(flags);
+}
+
+void krw_init(krwlock_t *l) {
+    l->readers = 0;
+    l->writer = LOCK_FREE;
+    l->depth = 0;
+}
+
+static int read_trylock(krwlock_t *l) {
+    int me = self();
+    uint32_t flags = irq_save();
+    int ok = 1;
+    if (l->writer == me) l->depth++;
+    else if (l->writer == LOCK_FREE) l->readers++;
+    else ok = 0;
+    irq_restore(flags);
+    return ok;
+}
+
+void krw_read_lock(krwlock_t *l) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0" : "=r"(flags));
+    while (!read_trylock(l)) wait(flags);
+}
+
+void krw_read_unlock(krwlock_t *l) {
+    uint32_t flags = irq_save();
+    if (l->writer == self()) {
+        if (l->depth && --l->depth == 0) l->writer = LOCK_FREE;
+    } else if (l->readers) {
+        l->readers--;
+    }
+    irq_restore(flags);
+}
+
+static int write_trylock(krwlock_t *l) {
+    int me = self();
+    uint32_t flags = irq_save();
+    int ok = (l->writer == me || (l->writer == LOCK_FREE && !l->readers));
+    if (ok) {
+        l->writer = me;
+        l->depth++;
+    }
+    irq_restore(flags);
+    return ok;
+}
+
+void krw_write_lock(krwlock_t *l) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0" : "=r"(flags));
+    while (!write_trylock(l)) wait(flags);
+}
+
+void krw_write_unlock(krwlock_t *l) {
+    uint32_t flags = irq_save();
+    if (l->depth && --l->depth == 0) l->writer = LOCK_FREE;
+    irq_restore(flags);
+}
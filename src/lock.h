@@ -0,0 +1,53 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <stdint.h>
+
+/* Sleeping locks for kernel code that runs on behalf of a task (syscalls,
+ * the GUI loop). Owners are task pids, so a holder may take the same
+ * lock again; IRQ handlers must not wait on these (see irq_context()).
+ *
+ * A wait only ends if the holder gets to run, which needs interrupts
+ * on. Today every caller runs with them off -- the shell and GUI inside
+ * the keyboard IRQ, syscalls and page faults behind their cli stubs --
+ * and is never preempted, so kernel code runs one call at a time and
+ * these locks are never contended. They are what keeps the code correct
+ * once calls overlap: the host tools run the FS from several threads
+ * (host_stubs.c maps these calls onto pthreads), and a kernel that lets
+ * syscalls run with interrupts on gets the same guarantees. Until then
+ * a wait with interrupts off means that rule was broken; it halts with
+ * a message instead of hanging. */
+
+#define LOCK_FREE  (-1)
+
+/* Recursive mutex */
+typedef struct {
+    volatile int owner;         /* pid, LOCK_FREE when unlocked */
+    uint32_t     depth;
+} kmutex_t;
+
+#define KMUTEX_INIT { LOCK_FREE, 0 }
+
+void kmutex_init(kmutex_t *m);
+void kmutex_lock(kmutex_t *m);
+int  kmutex_trylock(kmutex_t *m);      /* 0 on success, -1 if held elsewhere */
+
+void kmutex_unlock(kmutex_t *m);
+
+/* Reader/writer lock: any number of readers or one writer. The writer
+ * may re-enter for writing or reading; readers may not upgrade. */
+typedef struct {
+    volatile uint32_t readers;
+    volatile int      writer;   /* pid, LOCK_FREE when none */
+    uint32_t          depth;    /* writer recursion, reads inside it included */
+} krwlock_t;
+
+#define KRWLOCK_INIT { 0, LOCK_FREE, 0 }
+
+void krw_init(krwlock_t *l);
+void krw_read_lock(krwlock_t *l);
+void krw_read_unlock(krwlock_t *l);
+void krw_write_lock(krwlock_t *l);
+void krw_write_unlock(krwlock_t *l);
+
+#endif /* LOCK_H */
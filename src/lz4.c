@@ -0,0 +1,112 @@
+#include "lz4.h"
+#include "util.h"
+
+#define HASH_BITS   12
+#define MIN_MATCH   4
+#define LAST_LITS   5     /* the block must end in this many literals */
+#define MF_LIMIT    12    /* no match may start closer than this to the end */
+
+static uint16_t hash_table[1 << HASH_BITS];
+
+static inline uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Length continuation bytes: 255, 255, ..., rest */
+static uint32_t put_len(uint8_t *dst, uint32_t len) {
+    uint32_t n = 0;
+    while (len >= 255) { dst[n++] = 255; len -= 255; }
+    dst[n++] = (uint8_t)len;
+    return n;
+}
+
+/* One sequence: literals, then a match of `mlen` at distance `dist`
+ * (mlen 0 = final literal-only sequence). Returns 0 if `cap` is hit. */
+static int emit(uint8_t *dst, uint32_t *op, uint32_t cap, const uint8_t *lit,
+                uint32_t nlit, uint32_t dist, uint32_t mlen) {
+    uint32_t need = 1 + nlit + nlit / 255 + 1 + (mlen ? 2 + (mlen - MIN_MATCH) / 255 + 1 : 0);
+    if (*op + need > cap) return 0;
+    uint8_t *token = &dst[(*op)++];
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) *op += put_len(&dst[*op], nlit - 15);
+    memcpy(&dst[*op], lit, nlit);
+    *op += nlit;
+    if (!mlen) return 1;
+    dst[(*op)++] = dist & 0xFF;
+    dst[(*op)++] = dist >> 8;
+    uint32_t m = mlen - MIN_MATCH;
+    *token |= (uint8_t)(m < 15 ? m : 15);
+    if (m >= 15) *op += put_len(&dst[*op], m - 15);
+    return 1;
+}
+
+uint32_t lz4_compress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap) {
+    if (n > LZ4_MAX_INPUT) return 0;
+    memset(hash_table, 0, sizeof(hash_table));
+    uint32_t ip = 0, anchor = 0, op = 0;
+    if (n > MF_LIMIT) {
+        uint32_t limit = n - MF_LIMIT;
+        while (ip < limit) {
+            uint32_t seq = rd32(&src[ip]);
+            uint32_t h = hash(seq);
+            uint32_t ref = hash_table[h];
+            hash_table[h] = (uint16_t)ip;
+            if (ref >= ip || ip - ref > 0xFFFF || rd32(&src[ref]) != seq) {
+                ip++;
+                continue;
+            }
+            uint32_t mlen = MIN_MATCH;
+            uint32_t max = n - LAST_LITS - ip;
+            while (mlen < max && src[ref + mlen] == src[ip + mlen]) mlen++;
+            if (!emit(dst, &op, cap, &src[anchor], ip - anchor, ip - ref, mlen)) return 0;
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+    if (!emit(dst, &op, cap, &src[anchor], n - anchor, 0, 0)) return 0;
+    return op;
+}
+
+int lz4_decompress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap) {
+    uint32_t ip = 0, op = 0;
+    while (ip < n) {
+        uint8_t token = src[ip++];
+        uint32_t nlit = token >> 4;
+        if (nlit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                nlit += b;
+            } while (b == 255);
+        }
+        if (nlit > n - ip || nlit > cap - op) return -1;
+        memcpy(&dst[op], &src[ip], nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == n) break;                 /* last sequence has no match */
+
+        if (n - ip < 2) return -1;
+        uint32_t dist = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (!dist || dist > op) return -1;
+        uint32_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += MIN_MATCH;
+        if (mlen > cap - op) return -1;
+        /* byte by byte: the source may overlap what is being written */
+        for (uint32_t i = 0; i < mlen; i++, op++) dst[op] = dst[op - dist];
+    }
+    return (int)op;
+}
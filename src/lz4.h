@@ -0,0 +1,22 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+// LZ4 block format (no frame header): greedy single-probe compressor
+// and a bounds-checked decompressor. Inputs are limited to 64 KiB.
+
+#define LZ4_MAX_INPUT  0x10000
+
+// Worst-case compressed size of `n` input bytes.
+#define LZ4_BOUND(n)   ((n) + (n) / 255 + 16)
+
+// Compress `n` bytes of `src` into at most `cap` bytes of `dst`.
+// Returns the compressed size, or 0 if it does not fit.
+uint32_t lz4_compress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap);
+
+// Expand `n` bytes of `src` into at most `cap` bytes of `dst`.
+// Returns the decompressed size, or –1 on malformed input.
+int lz4_decompress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap);
+
+#endif /* LZ4_H */
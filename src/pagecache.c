@@ -0,0 +1,217 @@
+#include "pagecache.h"
+#include "fs.h"
+#include "lock.h"
+#include "pmm.h"
+#include "util.h"
+#include <stddef.h>
+
+#define PAGE_SIZE        PMM_FRAME_SIZE
+#define PAGES_PER_FRAME  (PAGE_SIZE / sizeof(uint32_t))
+
+struct pc_file {
+    char      path[PC_PATH_LEN];   /* normalised; "" = free slot */
+    char      name[PC_PATH_LEN];   /* as first asked for: reads use it */
+    uint32_t  size;
+    uint32_t  refs;
+    uint32_t  last_use;
+    uint8_t   stale;               /* detached by pc_invalidate() */
+    uint32_t *dir[PC_DIR_FRAMES];  /* frames of page addresses, 0 = not read */
+    uint16_t  log[PC_LOG_MAX];     /* pages read on demand, first need first */
+    uint32_t  nlog;
+};
+
+static pc_file_t files[PC_MAX_FILES];
+static uint32_t  use_clock;
+
+/* pc_prefetch() reads runs of pages here and copies them out */
+static uint8_t   batch_buf[PC_BATCH_PAGES * PAGE_SIZE];
+static kmutex_t  batch_lock = KMUTEX_INIT;
+
+/* "/tmp/a.txt" and "TMP/A.TXT" name the same file */
+static int norm_path(const char *path, char out[PC_PATH_LEN]) {
+    if (*path == '/') path++;
+    uint32_t i = 0;
+    for (; path[i]; i++) {
+        if (i + 1 >= PC_PATH_LEN) return -1;
+        char c = path[i];
+        out[i] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+    }
+    out[i] = '\0';
+    return i ? 0 : -1;
+}
+
+static void release(pc_file_t *f) {
+    for (int d = 0; d < PC_DIR_FRAMES; d++) {
+        uint32_t *pages = f->dir[d];
+        if (!pages) continue;
+        for (uint32_t i = 0; i < PAGES_PER_FRAME; i++) {
+            if (pages[i]) pmm_free_frame(pages[i] / PAGE_SIZE);
+        }
+        pmm_free_frame((uint32_t)(uintptr_t)pages / PAGE_SIZE);
+    }
+    memset(f, 0, sizeof(*f));
+}
+
+static pc_file_t *find(const char *key) {
+    for (int i = 0; i < PC_MAX_FILES; i++) {
+        if (files[i].path[0] && !files[i].stale && strcmp(files[i].path, key) == 0)
+            return &files[i];
+    }
+    return NULL;
+}
+
+pc_file_t *pc_get(const char *path) {
+    char key[PC_PATH_LEN];
+    if (norm_path(path, key) < 0) return NULL;
+    pc_file_t *f = find(key);
+    if (!f) {
+        uint32_t size;
+        if (fs_stat(path, &size) < 0) return NULL;
+        /* a free slot, else the least recently used unreferenced file */
+        for (int i = 0; i < PC_MAX_FILES; i++) {
+            pc_file_t *c = &files[i];
+            if (!c->path[0]) { f = c; break; }
+            if (!c->refs && (!f || c->last_use < f->last_use)) f = c;
+        }
+        if (!f) return NULL;
+        if (f->path[0]) release(f);
+        strcpy(f->path, key);
+        strcpy(f->name, *path == '/' ? path + 1 : path);
+        f->size = size;
+    }
+    f->refs++;
+    f->last_use = ++use_clock;
+    return f;
+}
+
+pc_file_t *pc_ref(pc_file_t *f) {
+    f->refs++;
+    return f;
+}
+
+void pc_put(pc_file_t *f) {
+    if (!f || !f->refs) return;
+    if (--f->refs == 0 && f->stale) release(f);
+}
+
+int pc_stale(const pc_file_t *f) {
+    return f->stale;
+}
+
+uint32_t pc_size(const pc_file_t *f) {
+    return f->size;
+}
+
+static uint32_t npages(const pc_file_t *f) {
+    return (f->size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/* Where page `index` goes, its directory frame allocated; NULL if out
+ * of range or memory */
+static uint32_t *slot_of(pc_file_t *f, uint32_t index) {
+    if (index >= npages(f)) return NULL;
+    uint32_t d = index / PAGES_PER_FRAME;
+    if (d >= PC_DIR_FRAMES) return NULL;
+    if (!f->dir[d]) {
+        uint32_t fr = pmm_alloc_frame();
+        if (fr == (uint32_t)-1) return NULL;
+        f->dir[d] = (uint32_t *)(uintptr_t)(fr * PAGE_SIZE);
+        memset(f->dir[d], 0, PAGE_SIZE);
+    }
+    return &f->dir[d][index % PAGES_PER_FRAME];
+}
+
+/* A frame holding `n` bytes of `data`, zero-filled after them */
+static uint32_t new_page(const uint8_t *data, uint32_t n) {
+    uint32_t fr = pmm_alloc_frame();
+    if (fr == (uint32_t)-1) return 0;
+    uint8_t *page = (uint8_t *)(uintptr_t)(fr * PAGE_SIZE);
+    memcpy(page, data, n);
+    if (n < PAGE_SIZE) memset(page + n, 0, PAGE_SIZE - n);
+    return fr * PAGE_SIZE;
+}
+
+uint32_t pc_page(pc_file_t *f, uint32_t index) {
+    uint32_t *slot = slot_of(f, index);
+    if (!slot) return 0;
+    if (!*slot) {
+        uint32_t fr = pmm_alloc_frame();
+        if (fr == (uint32_t)-1) return 0;
+        uint8_t *page = (uint8_t *)(uintptr_t)(fr * PAGE_SIZE);
+        int n = fs_read_at(f->name, index * PAGE_SIZE, page, PAGE_SIZE);
+        if (n < 0) {
+            pmm_free_frame(fr);
+            return 0;
+        }
+        if (n < PAGE_SIZE) memset(page + n, 0, PAGE_SIZE - n);
+        *slot = fr * PAGE_SIZE;
+        if (f->nlog < PC_LOG_MAX) f->log[f->nlog++] = (uint16_t)index;
+    }
+    f->last_use = ++use_clock;
+    return *slot;
+}
+
+uint32_t pc_fill_log(const pc_file_t *f, uint16_t *pages, uint32_t max) {
+    uint32_t n = f->nlog < max ? f->nlog : max;
+    memcpy(pages, f->log, n * sizeof(uint16_t));
+    return n;
+}
+
+static int cached(pc_file_t *f, uint32_t index) {
+    uint32_t d = index / PAGES_PER_FRAME;
+    return d < PC_DIR_FRAMES && f->dir[d] && f->dir[d][index % PAGES_PER_FRAME];
+}
+
+/* Read pages [first, last] with one call and keep the ones not cached */
+static uint32_t read_batch(pc_file_t *f, uint32_t first, uint32_t last) {
+    uint32_t len = (last - first + 1) * PAGE_SIZE;
+    int n = fs_read_at(f->name, first * PAGE_SIZE, batch_buf, len);
+    if (n <= 0) return 0;
+    uint32_t done = 0;
+    for (uint32_t i = first; i <= last && (i - first) * PAGE_SIZE < (uint32_t)n; i++) {
+        uint32_t *slot = slot_of(f, i);
+        if (!slot || *slot) continue;
+        uint32_t off = (i - first) * PAGE_SIZE;
+        uint32_t avail = (uint32_t)n - off < PAGE_SIZE ? (uint32_t)n - off : PAGE_SIZE;
+        if (!(*slot = new_page(batch_buf + off, avail))) break;
+        done++;
+    }
+    return done;
+}
+
+uint32_t pc_prefetch(pc_file_t *f, const uint16_t *pages, uint32_t n) {
+    /* the wanted pages, ascending, without duplicates or cached ones */
+    uint16_t want[PC_LOG_MAX];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n && count < PC_LOG_MAX; i++) {
+        uint16_t p = pages[i];
+        if (p >= npages(f) || cached(f, p)) continue;
+        uint32_t j = count;
+        while (j && want[j - 1] > p) j--;
+        if (j && want[j - 1] == p) continue;
+        for (uint32_t k = count++; k > j; k--) want[k] = want[k - 1];
+        want[j] = p;
+    }
+    if (!count || kmutex_trylock(&batch_lock) < 0) return 0;
+    /* neighbours share a read, small holes are read through */
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < count; ) {
+        uint32_t first = want[i], last = first;
+        for (i++; i < count && want[i] - last <= PC_BATCH_GAP + 1u
+                             && want[i] - first < PC_BATCH_PAGES; i++)
+            last = want[i];
+        done += read_batch(f, first, last);
+    }
+    kmutex_unlock(&batch_lock);
+    f->last_use = ++use_clock;
+    return done;
+}
+
+void pc_invalidate(const char *path) {
+    char key[PC_PATH_LEN];
+    if (norm_path(path, key) < 0) return;
+    pc_file_t *f = find(key);
+    if (!f) return;
+    if (f->refs) f->stale = 1;
+    else release(f);
+}
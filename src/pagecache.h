@@ -0,0 +1,51 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+
+// File page cache: 4 KiB pages of whole files, filled from the fs_*
+// layer on first use and shared by every mapping of the file.
+
+#define PC_MAX_FILES    16
+#define PC_PATH_LEN     40
+#define PC_DIR_FRAMES   16     /* x 1024 pages = 64 MiB per file */
+#define PC_LOG_MAX      32     /* demand reads remembered per file */
+#define PC_BATCH_PAGES  16     /* largest single read of pc_prefetch() */
+#define PC_BATCH_GAP    4      /* uncached pages it reads through to merge */
+
+typedef struct pc_file pc_file_t;
+
+// Reference the cached copy of `path`, creating it if needed. Returns
+// NULL if the file does not exist or every slot is in use.
+pc_file_t *pc_get(const char *path);
+
+// Take another reference to `f`.
+pc_file_t *pc_ref(pc_file_t *f);
+
+// Drop a reference; an invalidated file is freed with its last one.
+void pc_put(pc_file_t *f);
+
+// 1 once the file changed on disk and `f` only serves old references.
+int pc_stale(const pc_file_t *f);
+
+uint32_t pc_size(const pc_file_t *f);
+
+// Physical address of page `index`, read in on first use. 0 if the
+// page lies past EOF or memory runs out.
+uint32_t pc_page(pc_file_t *f, uint32_t index);
+
+// The first pages pc_page() had to read, in the order they were needed
+// (at most `max`, up to PC_LOG_MAX). Returns how many were stored.
+uint32_t pc_fill_log(const pc_file_t *f, uint16_t *pages, uint32_t max);
+
+// Read in those of `pages` that are not cached yet, sorted and merged
+// into as few reads as possible (runs of PC_BATCH_PAGES, holes of up to
+// PC_BATCH_GAP pages read through). These reads are not logged. Returns
+// the number of pages read in; 0 also when another prefetch is running.
+uint32_t pc_prefetch(pc_file_t *f, const uint16_t *pages, uint32_t n);
+
+// Forget the cached copy of `path` after it changed on disk. Files
+// still referenced keep their pages until the last pc_put().
+void pc_invalidate(const char *path);
+
+#endif /* PAGECACHE_H */
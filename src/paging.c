@@ -1,17 +1,32 @@
 // src/paging.c
 #include <stdint.h>
+#include <stddef.h>
 #include "paging.h"
+#include "pmm.h"
+#include "util.h"
 
 #define ENTRIES 1024
 #define FLAGS   (1 | 2 | 4)  /* P=1,RW=1,US=1 */
 
+#define WINDOW_PDES ((PAGING_WINDOW_END - PAGING_WINDOW_BASE) >> 22)
+
 static uint32_t pgdir[ENTRIES] __attribute__((aligned(4096)));
-static uint32_t pgtab[ENTRIES] __attribute__((aligned(4096)));
+/* The window's page tables exist from the start, so every address
+ * space copies the same PDEs and sees the same mmap pages. */
+static uint32_t window_pt[WINDOW_PDES][ENTRIES] __attribute__((aligned(4096)));
+static int      built;
 
 void paging_init(void) {
-    // Identity-map entire 4GB using 4MB pages
-    for (int i = 0; i < ENTRIES; i++) {
-        pgdir[i] = (i << 22) | FLAGS | 0x80; /* P=1,RW=1,US=1,PS=1 */
+    // Identity-map entire 4GB using 4MB pages; the mmap window starts
+    // out as empty 4 KiB page tables.
+    if (!built) {
+        for (int i = 0; i < ENTRIES; i++) {
+            uint32_t va = (uint32_t)i << 22;
+            if (va >= PAGING_WINDOW_BASE && va < PAGING_WINDOW_END)
+                pgdir[i] = (uint32_t)(uintptr_t)window_pt[(va - PAGING_WINDOW_BASE) >> 22] | FLAGS;
+            else pgdir[i] = (i << 22) | FLAGS | 0x80; /* P=1,RW=1,US=1,PS=1 */
+        }
+        built = 1;
     }
     asm volatile("mov %0, %%cr3" :: "r"(pgdir));
     // Enable Page Size Extensions (PSE) for 4MB pages
@@ -19,8 +34,107 @@ void paging_init(void) {
     asm volatile("mov %%cr4, %0" : "=r"(cr4));
     cr4 |= 1 << 4;
     asm volatile("mov %0, %%cr4" :: "r"(cr4));
+    // PG, plus WP so kernel writes to read-only user pages fault too
     uint32_t cr0;
     asm volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80000000 | (1 << 16);
     asm volatile("mov %0, %%cr0" :: "r"(cr0));
 }
+
+static inline void invlpg(uint32_t va) {
+    asm volatile("invlpg (%0)" :: "r"(va) : "memory");
+}
+
+static uint32_t *dir_of(uint32_t space) {
+    return space ? (uint32_t *)(uintptr_t)space : pgdir;
+}
+
+uint32_t paging_space_current(void) {
+    if (!built) return 0;
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3 == (uint32_t)(uintptr_t)pgdir ? 0 : cr3;
+}
+
+uint32_t paging_space_create(void) {
+    uint32_t f = pmm_alloc_frame();
+    if (f == (uint32_t)-1) return 0;
+    uint32_t *dir = (uint32_t *)(uintptr_t)(f * PMM_FRAME_SIZE);
+    memcpy(dir, pgdir, sizeof(pgdir));
+    return (uint32_t)(uintptr_t)dir;
+}
+
+void paging_space_destroy(uint32_t space) {
+    if (!space) return;
+    uint32_t *dir = dir_of(space);
+    /* page tables the space does not share with the kernel are its own */
+    for (int i = 0; i < ENTRIES; i++) {
+        if (dir[i] != pgdir[i] && (dir[i] & PG_PRESENT) && !(dir[i] & PG_LARGE))
+            pmm_free_frame(dir[i] / PMM_FRAME_SIZE);
+    }
+    pmm_free_frame(space / PMM_FRAME_SIZE);
+}
+
+void paging_space_switch(uint32_t space) {
+    asm volatile("mov %0, %%cr3" :: "r"(dir_of(space)) : "memory");
+}
+
+uint32_t *paging_pte_in(uint32_t space, uint32_t va, int create) {
+    uint32_t *pde = &dir_of(space)[va >> 22];
+    if (!(*pde & PG_PRESENT) || (*pde & PG_LARGE)) {
+        if (!create) return NULL;
+        uint32_t f = pmm_alloc_frame();
+        if (f == (uint32_t)-1) return NULL;
+        uint32_t *pt = (uint32_t *)(uintptr_t)(f * PMM_FRAME_SIZE);
+        if (*pde & PG_PRESENT) {
+            /* split a 4 MiB page into the same 1024 small mappings */
+            uint32_t base = *pde & 0xFFC00000, fl = *pde & 0xFFF & ~PG_LARGE;
+            for (int i = 0; i < ENTRIES; i++) pt[i] = (base + ((uint32_t)i << 12)) | fl;
+        } else {
+            memset(pt, 0, PMM_FRAME_SIZE);
+        }
+        *pde = (uint32_t)(uintptr_t)pt | FLAGS;
+        if (space == paging_space_current()) {
+            for (int i = 0; i < ENTRIES; i++) invlpg((va & 0xFFC00000) + ((uint32_t)i << 12));
+        }
+    }
+    uint32_t *pt = (uint32_t *)(uintptr_t)(*pde & 0xFFFFF000);
+    return &pt[(va >> 12) & 0x3FF];
+}
+
+int paging_map_in(uint32_t space, uint32_t va, uint32_t pa, uint32_t flags) {
+    uint32_t *pte = paging_pte_in(space, va, 1);
+    if (!pte) return -1;
+    *pte = (pa & 0xFFFFF000) | (flags & 0xFFF) | PG_PRESENT;
+    if (space == paging_space_current()) invlpg(va);
+    return 0;
+}
+
+void paging_unmap_in(uint32_t space, uint32_t va) {
+    uint32_t *pte = paging_pte_in(space, va, 0);
+    if (!pte) return;
+    *pte = 0;
+    if (space == paging_space_current()) invlpg(va);
+}
+
+uint32_t *paging_pte(uint32_t va, int create) {
+    return paging_pte_in(paging_space_current(), va, create);
+}
+
+int paging_map(uint32_t va, uint32_t pa, uint32_t flags) {
+    return paging_map_in(paging_space_current(), va, pa, flags);
+}
+
+void paging_unmap(uint32_t va) {
+    paging_unmap_in(paging_space_current(), va);
+}
+
+uint32_t paging_phys(uint32_t va) {
+    if (!built) return va;
+    uint32_t pde = dir_of(paging_space_current())[va >> 22];
+    if (!(pde & PG_PRESENT)) return (uint32_t)-1;
+    if (pde & PG_LARGE) return (pde & 0xFFC00000) | (va & 0x3FFFFF);
+    uint32_t pte = ((uint32_t *)(uintptr_t)(pde & 0xFFFFF000))[(va >> 12) & 0x3FF];
+    if (!(pte & PG_PRESENT)) return (uint32_t)-1;
+    return (pte & 0xFFFFF000) | (va & 0xFFF);
+}
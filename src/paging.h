@@ -1,7 +1,48 @@
 #ifndef PAGING_H
 #define PAGING_H
 
-/* Identity‑map 0‑4 MiB with user‑accessible pages */
+#include <stdint.h>
+
+#define PG_PRESENT  0x001
+#define PG_RW       0x002
+#define PG_USER     0x004
+#define PG_LARGE    0x080
+#define PG_PRIVATE  0x200   /* available bit: the frame belongs to the mapping */
+
+/* Virtual range for demand-paged user mappings, empty at boot; its page
+ * tables are shared by every address space */
+#define PAGING_WINDOW_BASE  0x40000000u
+#define PAGING_WINDOW_END   0x50000000u
+
+/* Identity‑map 4 GiB with user‑accessible 4 MiB pages (except the
+ * window above). Safe to call again: later calls only reload CR3. */
 void paging_init(void);
 
+/* Address spaces. A space is a page directory of its own (named by its
+ * address; 0 is the kernel's), a copy of the kernel directory: the
+ * identity map and the mmap window are shared, but a page table the
+ * space creates for itself (e.g. where a program is mapped) is private.
+ * The calls without a space argument work on the current one. */
+uint32_t paging_space_create(void);           /* 0 if out of memory */
+void     paging_space_destroy(uint32_t space);  /* mapped frames stay the caller's */
+void     paging_space_switch(uint32_t space);   /* load CR3 */
+uint32_t paging_space_current(void);
+
+uint32_t *paging_pte_in(uint32_t space, uint32_t va, int create);
+int       paging_map_in(uint32_t space, uint32_t va, uint32_t pa, uint32_t flags);
+void      paging_unmap_in(uint32_t space, uint32_t va);
+
+/* Page-table entry for `va`. With `create`, a missing page table is
+ * allocated (or a 4 MiB page split into 4 KiB ones); otherwise NULL
+ * is returned when `va` has no 4 KiB entry. */
+uint32_t *paging_pte(uint32_t va, int create);
+
+/* Map / unmap one 4 KiB page and flush its TLB entry */
+int  paging_map(uint32_t va, uint32_t pa, uint32_t flags);
+void paging_unmap(uint32_t va);
+
+/* Physical address behind `va` (for DMA), or (uint32_t)-1 if `va` is
+ * not mapped. Before paging_init() every address is its own. */
+uint32_t paging_phys(uint32_t va);
+
 #endif /* PAGING_H */
@@ -0,0 +1,99 @@
+#include "pci.h"
+#include "util.h"
+#include <stddef.h>
+
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_VENDOR_ID   0x00
+#define PCI_DEVICE_ID   0x02
+#define PCI_PROG_IF     0x09
+#define PCI_SUBCLASS    0x0A
+#define PCI_CLASS       0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+
+static pci_dev_t devices[PCI_MAX_DEVICES];
+static int       ndevices;
+
+static uint32_t config_addr(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (off & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    outl(PCI_CONFIG_ADDR, config_addr(bus, slot, func, off));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const pci_dev_t *d, uint8_t off) {
+    return config_read(d->bus, d->slot, d->func, off);
+}
+
+uint16_t pci_read16(const pci_dev_t *d, uint8_t off) {
+    return (uint16_t)(pci_read32(d, off) >> ((off & 2) * 8));
+}
+
+uint8_t pci_read8(const pci_dev_t *d, uint8_t off) {
+    return (uint8_t)(pci_read32(d, off) >> ((off & 3) * 8));
+}
+
+void pci_write16(const pci_dev_t *d, uint8_t off, uint16_t value) {
+    outl(PCI_CONFIG_ADDR, config_addr(d->bus, d->slot, d->func, off));
+    outw(PCI_CONFIG_DATA + (off & 2), value);
+}
+
+void pci_enable(const pci_dev_t *d) {
+    uint16_t cmd = pci_read16(d, PCI_COMMAND);
+    pci_write16(d, PCI_COMMAND, cmd | PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_MASTER);
+}
+
+uint16_t pci_io_base(const pci_dev_t *d, int n) {
+    if (n < 0 || n > 5 || !(d->bar[n] & 1)) return 0;
+    return (uint16_t)(d->bar[n] & 0xFFFC);
+}
+
+static void add_function(uint8_t bus, uint8_t slot, uint8_t func) {
+    if (ndevices >= PCI_MAX_DEVICES) return;
+    pci_dev_t *d = &devices[ndevices++];
+    d->bus  = bus;
+    d->slot = slot;
+    d->func = func;
+    d->vendor     = pci_read16(d, PCI_VENDOR_ID);
+    d->device     = pci_read16(d, PCI_DEVICE_ID);
+    d->class_code = pci_read8(d, PCI_CLASS);
+    d->subclass   = pci_read8(d, PCI_SUBCLASS);
+    d->prog_if    = pci_read8(d, PCI_PROG_IF);
+    d->irq        = pci_read8(d, PCI_INTERRUPT_LINE);
+    /* only ordinary (type 0) headers have six BARs */
+    int bars = (pci_read8(d, PCI_HEADER_TYPE) & 0x7F) == 0 ? 6 : 0;
+    for (int i = 0; i < 6; i++) d->bar[i] = (i < bars) ? pci_read32(d, PCI_BAR0 + 4 * i) : 0;
+}
+
+void pci_init(void) {
+    ndevices = 0;
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            uint32_t id = config_read((uint8_t)bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) continue;
+            uint8_t header = (uint8_t)(config_read((uint8_t)bus, slot, 0, PCI_HEADER_TYPE) >> 16);
+            uint8_t funcs = (header & 0x80) ? 8 : 1;
+            for (uint8_t f = 0; f < funcs; f++) {
+                id = config_read((uint8_t)bus, slot, f, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) != 0xFFFF) add_function((uint8_t)bus, slot, f);
+            }
+        }
+    }
+}
+
+pci_dev_t *pci_get(int i) {
+    return (i >= 0 && i < ndevices) ? &devices[i] : NULL;
+}
+
+pci_dev_t *pci_find(uint16_t vendor, uint16_t device, int index) {
+    for (int i = 0; i < ndevices; i++) {
+        if (devices[i].vendor == vendor && devices[i].device == device && index-- == 0)
+            return &devices[i];
+    }
+    return NULL;
+}
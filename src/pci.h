@@ -0,0 +1,49 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// PCI configuration space through configuration mechanism #1 (ports
+// 0xCF8/0xCFC). pci_init() walks every bus, slot and function once and
+// keeps what it finds; drivers then look their devices up here.
+
+#define PCI_MAX_DEVICES 32
+
+// Config space offsets used by drivers
+#define PCI_COMMAND        0x04
+#define PCI_INTERRUPT_LINE 0x3C
+
+// PCI_COMMAND bits
+#define PCI_CMD_IO         0x0001
+#define PCI_CMD_MEMORY     0x0002
+#define PCI_CMD_MASTER     0x0004
+
+typedef struct {
+    uint8_t  bus, slot, func;
+    uint16_t vendor, device;
+    uint8_t  class_code, subclass, prog_if;
+    uint8_t  irq;            // interrupt line set up by the firmware, 0xFF = none
+    uint32_t bar[6];         // raw BARs (bit 0 set = I/O port range)
+} pci_dev_t;
+
+// Enumerate the bus. Call once at boot, before any PCI driver.
+void pci_init(void);
+
+// Device number `i` in discovery order, NULL past the last one.
+pci_dev_t *pci_get(int i);
+
+// The `index`-th device with this vendor/device ID, NULL if none.
+pci_dev_t *pci_find(uint16_t vendor, uint16_t device, int index);
+
+uint32_t pci_read32(const pci_dev_t *d, uint8_t off);
+uint16_t pci_read16(const pci_dev_t *d, uint8_t off);
+uint8_t  pci_read8(const pci_dev_t *d, uint8_t off);
+void     pci_write16(const pci_dev_t *d, uint8_t off, uint16_t value);
+
+// Turn on I/O and memory decoding and bus mastering (DMA).
+void pci_enable(const pci_dev_t *d);
+
+// I/O port base of BAR `n`, 0 if it is not an I/O BAR.
+uint16_t pci_io_base(const pci_dev_t *d, int n);
+
+#endif /* PCI_H */
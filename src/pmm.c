@@ -1,29 +1,72 @@
 #include "pmm.h"
+#include "kheap.h"
 #include <stddef.h>
 
-#define MAX_FRAMES   (16 * 1024 * 1024 / 0x1000)  // first 16 MiB
+#define MAX_FRAMES   (16 * 1024 * 1024 / 0x1000)  // first 16 MiB
+#define FIRST_FREE   (KHEAP_END / 0x1000)         // kernel image + bump heap below
 static uint8_t frame_bitmap[MAX_FRAMES/8];
 static uint32_t last_frame = 0;
+static uint32_t free_frames = 0;
+
+/* Frames are taken from syscalls, page faults and the filesystems */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
 
 void pmm_init(void) {
     for (size_t i = 0; i < sizeof(frame_bitmap); i++)
         frame_bitmap[i] = 0;
+    for (uint32_t i = 0; i < FIRST_FREE; i++)
+        frame_bitmap[i / 8] |= 1 << (i % 8);
+    last_frame = FIRST_FREE;
+    free_frames = MAX_FRAMES - FIRST_FREE;
 }
 
 uint32_t pmm_alloc_frame(void) {
+    uint32_t flags = irq_save();
     for (uint32_t i = last_frame; i < MAX_FRAMES; i++) {
         uint32_t idx = i / 8, bit = i % 8;
         if (!(frame_bitmap[idx] & (1 << bit))) {
             frame_bitmap[idx] |= (1 << bit);
             last_frame = i + 1;
+            free_frames--;
+            irq_restore(flags);
             return i;
         }
     }
+    irq_restore(flags);
     return (uint32_t)-1;
 }
 
 void pmm_free_frame(uint32_t frame) {
+    if (frame < FIRST_FREE || frame >= MAX_FRAMES) return;
     uint32_t idx = frame / 8, bit = frame % 8;
-    frame_bitmap[idx] &= ~(1 << bit);
-    if (frame < last_frame) last_frame = frame;
+    uint32_t flags = irq_save();
+    if (frame_bitmap[idx] & (1 << bit)) {
+        frame_bitmap[idx] &= ~(1 << bit);
+        free_frames++;
+        if (frame < last_frame) last_frame = frame;
+    }
+    irq_restore(flags);
+}
+
+/* Frames holding something that must survive (boot modules) */
+void pmm_reserve(uint32_t start, uint32_t end) {
+    uint32_t last = (end + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+    if (last > MAX_FRAMES) last = MAX_FRAMES;
+    for (uint32_t i = start / PMM_FRAME_SIZE; i < last; i++) {
+        if (i < FIRST_FREE || (frame_bitmap[i / 8] & (1 << (i % 8)))) continue;
+        frame_bitmap[i / 8] |= 1 << (i % 8);
+        free_frames--;
+    }
+}
+
+uint32_t pmm_free_count(void) {
+    return free_frames;
 }
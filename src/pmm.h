@@ -1,8 +1,11 @@
 #ifndef PMM_H
 #define PMM_H
 #include <stdint.h>
-/* Initialize frame bitmap, allocate/free 4 KiB frames */
+/* Initialize frame bitmap, allocate/free 4 KiB frames */
+#define PMM_FRAME_SIZE 0x1000
 void pmm_init(void);
 uint32_t pmm_alloc_frame(void);
 void     pmm_free_frame(uint32_t frame);
+uint32_t pmm_free_count(void);          /* frames still available */
+void     pmm_reserve(uint32_t start, uint32_t end);  /* mark bytes [start, end) in use */
 #endif
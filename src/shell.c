@@ -2,9 +2,17 @@
 #include "util.h"
 #include "pit.h"
 #include "fs.h"
+#include "bcache.h"
+#include "blkdev.h"
+#include "pci.h"
+#include "stripe.h"
+#include "ext2.h"
 #include "shell.h"
 #include "memory.h"
 #include "elf.h"
+#include "execcache.h"
+#include "paging.h"
+#include "vm.h"
 #include "task.h"
 #include "serial.h"
 #include "syscall.h"
@@ -64,6 +72,91 @@ static void ls_callback(const char *name, uint32_t size) {
     puts(" bytes\n");
 }
 
+/* ── iostat ────────────────────────────────────────────────────── */
+
+typedef struct {
+    uint32_t       ticks;
+    bcache_stats_t cache;
+    blkdev_stats_t dev[BLKDEV_MAX];
+    fs_op_stats_t  op[FS_OP_COUNT];
+} iostat_snap_t;
+
+static void iostat_take(iostat_snap_t *s) {
+    blkdev_t *dev;
+    memset(s, 0, sizeof(*s));
+    s->ticks = pit_get_ticks();
+    bcache_get_stats(&s->cache);
+    for (int i = 0; (dev = blkdev_get(i)) != NULL; i++) s->dev[i] = dev->stats;
+    for (int i = 0; i < FS_OP_COUNT; i++) fs_get_op_stats(i, &s->op[i]);
+}
+
+/* Write "key=value" to the screen or, with `serial`, to COM1 */
+static void kv(int serial, const char *key, uint32_t value) {
+    char num[12];
+    itoa(value, num, 10);
+    if (serial) {
+        serial_putc(' '); serial_puts(key); serial_putc('='); serial_puts(num);
+    } else {
+        puts("  "); puts(key); puts(" "); puts(num);
+    }
+}
+
+static void line_start(int serial, uint32_t ticks, const char *what) {
+    if (serial) {
+        char num[12];
+        itoa(ticks, num, 10);
+        serial_puts("iostat t="); serial_puts(num); serial_putc(' '); serial_puts(what);
+    } else {
+        puts(what);
+    }
+}
+
+static void line_end(int serial) {
+    if (serial) serial_putc('\n'); else putc('\n', 7);
+}
+
+/* Print `cur`, minus `prev` when given (iostat -d). One line per
+ * cache, device and active fs_* operation; the serial form is
+ * "iostat t=TICKS <kind>[=name] key=value ..." per line. */
+static void iostat_report(const iostat_snap_t *cur, const iostat_snap_t *prev, int serial) {
+    static const iostat_snap_t zero;
+    if (!prev) prev = &zero;
+    blkdev_t *dev;
+
+    line_start(serial, cur->ticks, "cache");
+    kv(serial, "hits", cur->cache.hits - prev->cache.hits);
+    kv(serial, "misses", cur->cache.misses - prev->cache.misses);
+    kv(serial, "ra", cur->cache.ra_sectors - prev->cache.ra_sectors);
+    kv(serial, "ra_hits", cur->cache.ra_hits - prev->cache.ra_hits);
+    kv(serial, "ra_wasted", cur->cache.ra_wasted - prev->cache.ra_wasted);
+    line_end(serial);
+
+    for (int i = 0; (dev = blkdev_get(i)) != NULL; i++) {
+        const blkdev_stats_t *c = &cur->dev[i], *p = &prev->dev[i];
+        if (serial) { line_start(1, cur->ticks, "dev="); serial_puts(dev->name); }
+        else        { puts(dev->name); }
+        kv(serial, "rd_sec", c->rd_sectors - p->rd_sectors);
+        kv(serial, "wr_sec", c->wr_sectors - p->wr_sectors);
+        kv(serial, "rd_cmd", c->rd_cmds - p->rd_cmds);
+        kv(serial, "wr_cmd", c->wr_cmds - p->wr_cmds);
+        kv(serial, "flush", c->flushes - p->flushes);
+        kv(serial, "err", c->errors - p->errors);
+        kv(serial, "busy_kcyc", (uint32_t)((c->busy_cycles - p->busy_cycles) >> 10));
+        line_end(serial);
+    }
+
+    for (int i = 0; i < FS_OP_COUNT; i++) {
+        const fs_op_stats_t *c = &cur->op[i], *p = &prev->op[i];
+        if (c->calls == p->calls) continue;
+        if (serial) { line_start(1, cur->ticks, "op="); serial_puts(fs_op_name(i)); }
+        else        { puts("fs_"); puts(fs_op_name(i)); }
+        kv(serial, "calls", c->calls - p->calls);
+        kv(serial, "rd_sec", c->rd_sectors - p->rd_sectors);
+        kv(serial, "wr_sec", c->wr_sectors - p->wr_sectors);
+        line_end(serial);
+    }
+}
+
 void shell_init(void) {
     idx = 0;
     /* Display MOTD if present */
@@ -100,7 +193,8 @@ static void execute(void) {
     else if (strcmp(linebuf, "help") == 0) {
         puts("Built-ins: echo, help, clear, reboot, halt, uptime, history, !n,\n");
         puts("           ls, cat, write, append, rm, rename, cp, df, ps, kill, cls, rand, malloc,\n");
-        puts("           gui, sleep, free, run\n");
+        puts("           gui, sleep, free, run, iostat, defrag, lsblk, compress,\n");
+        puts("           lspci, stripe, rdbench, mount, mkdir\n");
     }
     else if (strcmp(linebuf, "clear") == 0) {
         clear_screen();
@@ -137,21 +231,24 @@ static void execute(void) {
     }
     else if (strncmp(linebuf, "run ", 4) == 0) {
         const char *fname = &linebuf[4];
-        // read entire file into heap
-        uint8_t *img = kmalloc(64 * 1024);       // reserve 64 KiB
-        int sz = fs_read(fname, img, 64*1024);
-        if (sz < 0) {
-            puts("File not found\n"); return;
+        // each task gets an address space of its own; the exec image
+        // cache maps the program's segments into it
+        uint32_t space = paging_space_create();
+        if (!space) {
+            puts("Out of memory\n"); return;
         }
-        // attempt to load ELF; returns entrypoint or 0
-        uint32_t eip = load_elf((void*)img);
-        if (!eip) {
-            puts("Invalid ELF\n"); return;
+        uint32_t eip;
+        int r = exec_load(fname, space, &eip);
+        if (r < 0) {
+            paging_space_destroy(space);
+            puts(r == -1 ? "File not found\n" : "Invalid ELF\n"); return;
         }
         // spawn a user‑mode task
         uint32_t stack_top = (uint32_t)kmalloc(USER_STACK_SIZE) + USER_STACK_SIZE;
-        int tid = task_create_user(eip, stack_top);
+        int tid = task_create_user(eip, stack_top, space);
         if (tid < 0) {
+            vm_release_space(space);
+            paging_space_destroy(space);
             puts("Too many tasks\n"); return;
         }
         puts("Started "); puts(fname); putc('\n',7);
@@ -189,6 +286,9 @@ static void execute(void) {
     else if (strcmp(linebuf, "ls") == 0) {
         fs_ls(ls_callback);
     }
+    else if (strncmp(linebuf, "ls ", 3) == 0) {
+        if (fs_ls_dir(&linebuf[3], ls_callback) < 0) puts("No such directory\n");
+    }
     else if (strncmp(linebuf, "cat ", 4) == 0) {
     	const char *fname = &linebuf[4];
     	// allocate a temporary buffer
@@ -196,15 +296,20 @@ static void execute(void) {
     	if (!filebuf) {
             puts("Out of memory\n");
     	} else {
-        	int len = fs_read(fname, filebuf, MAX_FILE_SIZE);
-        	if (len < 0) {
-            	    puts("File not found\n");
-        	} else {
-            	    for (int i = 0; i < len; i++) {
-                	putc(filebuf[i], 7);
-            	    }
-            	    putc('\n', 7);
-        	}
+            // stream the file in buffer-sized chunks so large files are not truncated
+            uint32_t pos = 0;
+            int len;
+            while ((len = fs_read_at(fname, pos, filebuf, MAX_FILE_SIZE)) > 0) {
+                for (int i = 0; i < len; i++) {
+                    putc(filebuf[i], 7);
+                }
+                pos += len;
+            }
+            if (len < 0) {
+                puts("File not found\n");
+            } else {
+                putc('\n', 7);
+            }
     	}
     }	
     else if (strncmp(linebuf, "rm ", 3) == 0) {
@@ -279,17 +384,202 @@ static void execute(void) {
             char src[32]; int len1 = space-args; if(len1>=31) len1=31; memcpy(src,args,len1); src[len1]='\0';
             const char *dstptr = space+1;
             char dst[32]; int len2 = strlen(dstptr); if(len2>=31) len2=31; memcpy(dst,dstptr,len2); dst[len2]='\0';
-            uint8_t *buf = kmalloc(MAX_FILE_SIZE);
-            int sz = fs_read(src, buf, MAX_FILE_SIZE);
-            if (sz<0) { puts("Source not found\n"); }
-            else if (fs_write(dst, buf, sz)==0) puts("Copied\n"); else puts("Copy failed\n");
+            uint32_t sz;
+            if (fs_stat(src, &sz) < 0) puts("Source not found\n");
+            else if (fs_copy(src, dst) == 0) puts("Copied\n"); else puts("Copy failed\n");
         }
     }
 
     else if (strcmp(linebuf, "df") == 0) {
-        uint32_t freeb = fs_free_space();
-        char num[16]; itoa(freeb, num, 10);
-        puts("Free space: "); puts(num); puts(" bytes\n");
+        const char *prefix, *type;
+        uint32_t freeb;
+        for (int i = 0; fs_mount_info(i, &prefix, &type, &freeb) == 0; i++) {
+            char num[16]; itoa(freeb, num, 10);
+            puts("/"); puts(prefix); puts(": "); puts(num); puts(" bytes free (");
+            puts(type); puts(")\n");
+        }
+    }
+    else if (strcmp(linebuf, "defrag") == 0) {
+        fs_frag_stats_t before, after;
+        int moved = fs_defrag(&before, &after);
+        if (moved < 0) {
+            puts("No volume\n");
+        } else {
+            char num[12];
+            puts("before: "); itoa(before.fragmented, num, 10); puts(num);
+            puts("/"); itoa(before.files, num, 10); puts(num);
+            puts(" files fragmented, "); itoa(before.extents, num, 10); puts(num);
+            puts(" extents\n");
+            puts("after:  "); itoa(after.fragmented, num, 10); puts(num);
+            puts("/"); itoa(after.files, num, 10); puts(num);
+            puts(" files fragmented, "); itoa(after.extents, num, 10); puts(num);
+            puts(" extents\n");
+            itoa(moved, num, 10); puts(num); puts(" files moved\n");
+        }
+    }
+    else if (strncmp(linebuf, "compress ", 9) == 0) {
+        const char *fname = &linebuf[9];
+        uint32_t size, stored;
+        if (fs_stat(fname, &size) < 0) {
+            puts("File not found\n");
+        } else {
+            int r = fs_compress(fname, &stored);
+            char num[12];
+            if (r < 0) {
+                puts("Cannot compress (too large or unsupported mount)\n");
+            } else if (r > 0) {
+                puts("Not compressible, left as is\n");
+            } else {
+                itoa(size, num, 10); puts(num); puts(" bytes stored in ");
+                itoa(stored, num, 10); puts(num); puts("\n");
+            }
+        }
+    }
+    else if (strcmp(linebuf, "iostat") == 0) {
+        iostat_snap_t cur;
+        iostat_take(&cur);
+        iostat_report(&cur, NULL, 0);
+        if (cur.cache.ra_sectors) {
+            char num[12];
+            puts("read-ahead hit rate ");
+            itoa(cur.cache.ra_hits * 100 / cur.cache.ra_sectors, num, 10); puts(num);
+            puts("%\n");
+        }
+    }
+    else if (strcmp(linebuf, "iostat -s") == 0) {
+        iostat_snap_t cur;
+        iostat_take(&cur);
+        iostat_report(&cur, NULL, 1);
+        puts("Dumped to serial\n");
+    }
+    else if (strcmp(linebuf, "iostat -d") == 0) {
+        /* deltas since the last "iostat -d", also on serial. The shell
+         * runs in the keyboard IRQ and cannot wait out an interval: no
+         * tick or I/O would happen while it did. */
+        static iostat_snap_t prev, cur;
+        static int have_prev;
+        iostat_take(&cur);
+        iostat_report(&cur, have_prev ? &prev : NULL, 0);
+        iostat_report(&cur, have_prev ? &prev : NULL, 1);
+        prev = cur;
+        have_prev = 1;
+    }
+    else if (strcmp(linebuf, "lsblk") == 0) {
+        blkdev_t *dev;
+        for (int i = 0; (dev = blkdev_get(i)) != NULL; i++) {
+            char num[12];
+            puts(dev->name); puts("  "); itoa(dev->blocks, num, 10); puts(num);
+            puts(" sectors ("); itoa(dev->blocks / 2048, num, 10); puts(num);
+            puts(" MiB)\n");
+        }
+    }
+    else if (strcmp(linebuf, "lspci") == 0) {
+        pci_dev_t *d;
+        for (int i = 0; (d = pci_get(i)) != NULL; i++) {
+            char num[12];
+            itoa(d->bus, num, 10); puts(num); puts(":");
+            itoa(d->slot, num, 10); puts(num); puts(".");
+            itoa(d->func, num, 10); puts(num); puts("  ");
+            utohex(d->vendor, num); puts(&num[4]); puts(":");
+            utohex(d->device, num); puts(&num[4]);
+            puts("  class "); utohex(((uint32_t)d->class_code << 8) | d->subclass, num); puts(&num[4]);
+            if (d->irq < 16) { puts("  irq "); itoa(d->irq, num, 10); puts(num); }
+            puts("\n");
+        }
+    }
+    else if (strncmp(linebuf, "stripe ", 7) == 0) {
+        /* syntax: stripe UNIT DEV DEV [DEV [DEV]] – UNIT in sectors, 0 = default */
+        const char *args = &linebuf[7];
+        uint32_t unit = atoi(args);
+        if (!unit) unit = STRIPE_DEFAULT_UNIT;
+        blkdev_t *members[STRIPE_MAX_MEMBERS];
+        int n = 0, bad = 0;
+        while (*args && *args != ' ') args++;
+        while (*args == ' ') {
+            while (*args == ' ') args++;
+            if (!*args) break;
+            char name[BLKDEV_NAME_LEN];
+            int len = 0;
+            while (*args && *args != ' ') {
+                if (len < BLKDEV_NAME_LEN - 1) name[len++] = *args;
+                args++;
+            }
+            name[len] = 0;
+            if (n == STRIPE_MAX_MEMBERS || !(members[n] = blkdev_find(name))) bad = 1;
+            else n++;
+        }
+        char name[] = "md0";
+        while (blkdev_find(name)) name[2]++;
+        blkdev_t *md = (!bad && n >= 2) ? stripe_create(name, members, n, unit) : NULL;
+        if (!md) {
+            puts("Usage: stripe UNIT DEV DEV [DEV [DEV]]\n");
+        } else {
+            char num[12];
+            puts(md->name); puts("  "); itoa(md->blocks, num, 10); puts(num);
+            puts(" sectors over "); itoa(n, num, 10); puts(num);
+            puts(" disks, unit "); itoa(unit, num, 10); puts(num); puts("\n");
+        }
+    }
+    else if (strncmp(linebuf, "rdbench ", 8) == 0) {
+        /* syntax: rdbench DEV [MiB] – sequential raw reads, bypassing the cache */
+        static uint8_t bench_buf[128 * BLKDEV_BLOCK_SIZE];
+        const char *args = &linebuf[8];
+        char name[BLKDEV_NAME_LEN];
+        int len = 0;
+        while (*args && *args != ' ') {
+            if (len < BLKDEV_NAME_LEN - 1) name[len++] = *args;
+            args++;
+        }
+        name[len] = 0;
+        uint32_t mib = *args ? atoi(args + 1) : 8;
+        blkdev_t *dev = blkdev_find(name);
+        if (!dev || !mib) {
+            puts("Usage: rdbench DEV [MiB]\n");
+        } else {
+            uint32_t total = mib * 2048;
+            if (total > dev->blocks) total = dev->blocks;
+            /* the shell runs in the keyboard IRQ, so PIT ticks stand still: time in TSC cycles */
+            uint32_t lo, hi, lba = 0;
+            asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+            uint64_t start = ((uint64_t)hi << 32) | lo;
+            int err = 0;
+            while (lba < total && !err) {
+                uint32_t n = total - lba;
+                if (n > 128) n = 128;
+                err = blkdev_read(dev, lba, n, bench_buf) < 0;
+                lba += n;
+            }
+            asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+            /* 2^20-cycle units: a shift, as the kernel has no libgcc for 64-bit division */
+            uint32_t mcyc = (uint32_t)(((((uint64_t)hi << 32) | lo) - start) >> 20);
+            char num[12];
+            if (err) puts("Read error after ");
+            itoa(lba / 2, num, 10); puts(num); puts(" KiB in ");
+            itoa(mcyc, num, 10); puts(num); puts(" Mi cycles");
+            if (mcyc) { puts(", "); itoa(lba / 2 / mcyc, num, 10); puts(num); puts(" KiB/Mi cycles"); }
+            puts("\n");
+        }
+    }
+    else if (strncmp(linebuf, "mount ", 6) == 0) {
+        /* syntax: mount DEV PREFIX – an ext2 volume, e.g. "mount hdb MNT" */
+        const char *args = &linebuf[6];
+        char name[BLKDEV_NAME_LEN];
+        int len = 0;
+        while (*args && *args != ' ') {
+            if (len < BLKDEV_NAME_LEN - 1) name[len++] = *args;
+            args++;
+        }
+        name[len] = 0;
+        while (*args == ' ') args++;
+        blkdev_t *dev = blkdev_find(name);
+        ext2_t *x = (dev && *args) ? ext2_create(dev) : NULL;
+        if (!dev || !*args) puts("Usage: mount DEV PREFIX\n");
+        else if (!x) puts("No ext2 volume on device\n");
+        else if (fs_mount(args, &ext2_ops, x) < 0) puts("Mount failed\n");
+        else { puts(ext2_ops.type_name(x)); puts(" mounted\n"); }
+    }
+    else if (strncmp(linebuf, "mkdir ", 6) == 0) {
+        if (fs_mkdir(&linebuf[6]) < 0) puts("mkdir failed\n");
     }
     else if (strncmp(linebuf, "rand", 4) == 0) {
         int max = 32768;
@@ -301,12 +591,17 @@ static void execute(void) {
     }
 
     else if (strcmp(linebuf, "ps") == 0) {
-        puts("TID   EIP      ESP\n");
-        for (int i = 0; i < task_count; i++) {
+        static const char *state[] = {
+            [TASK_READY] = "ready", [TASK_RUNNING] = "run", [TASK_BLOCKED] = "wait" };
+        puts("TID   EIP      ESP         PRI STATE\n");
+        for (int i = 0; i < MAX_TASKS; i++) {
+            if (tasks[i].state == TASK_FREE || tasks[i].state == TASK_DEAD) continue;
             char num[4]; itoa(i, num, 10);
             puts(num); puts("  0x");
             char hex[9]; utohex(tasks[i].entry_point, hex); puts(hex);
             puts("  0x"); utohex(tasks[i].esp, hex); puts(hex);
+            puts("  "); itoa(tasks[i].prio, num, 10); puts(num);
+            puts("   "); puts(state[tasks[i].state]);
             if (i == current_task) puts("  *\n"); else putc('\n',7);
         }
     }
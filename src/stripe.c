@@ -0,0 +1,143 @@
+#include "stripe.h"
+#include "util.h"
+#include <stddef.h>
+
+/* Pieces a transfer keeps in flight before it waits */
+#define STRIPE_BATCH 32
+
+typedef struct {
+    blkdev_t *members[STRIPE_MAX_MEMBERS];
+    int       n;
+    uint32_t  unit;
+} stripe_t;
+
+/* One synchronous transfer: pieces outstanding, per member and in total */
+typedef struct {
+    volatile uint32_t pending;
+    volatile uint32_t inflight[STRIPE_MAX_MEMBERS];
+    volatile int      status;
+} stripe_wait_t;
+
+typedef struct {
+    blk_request_t  req;
+    stripe_wait_t *w;
+    int            member;
+} stripe_piece_t;
+
+static stripe_t sets[STRIPE_MAX_SETS];
+static int      nsets;
+
+static void piece_done(blk_request_t *req) {
+    stripe_piece_t *p = req->ctx;
+    if (req->status < 0) p->w->status = -1;
+    p->w->inflight[p->member]--;
+    p->w->pending--;
+}
+
+static void poll_members(const stripe_t *st) {
+    for (int i = 0; i < st->n; i++) blkdev_poll(st->members[i]);
+}
+
+/* Cut [lba, lba+count) at stripe-unit boundaries and submit the pieces
+ * to their members, up to STRIPE_BATCH at a time; members with a queue
+ * work on theirs in parallel. Waiting polls the members, so it also
+ * works with interrupts off. */
+static int stripe_transfer(blkdev_t *dev, int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    stripe_t *st = dev->priv;
+    stripe_piece_t pieces[STRIPE_BATCH];
+    stripe_wait_t w;
+    memset(&w, 0, sizeof(w));
+    while (count && w.status == 0) {
+        uint32_t n = 0;
+        while (n < STRIPE_BATCH && count && w.status == 0) {
+            uint32_t unit_no = lba / st->unit;
+            uint32_t within  = lba % st->unit;
+            uint32_t k = st->unit - within;
+            if (k > count) k = count;
+            stripe_piece_t *p = &pieces[n];
+            p->w      = &w;
+            p->member = (int)(unit_no % (uint32_t)st->n);
+            p->req.write = (uint8_t)write;
+            p->req.lba   = (unit_no / (uint32_t)st->n) * st->unit + within;
+            p->req.count = k;
+            p->req.buf   = buf;
+            p->req.done  = piece_done;
+            p->req.ctx   = p;
+            blkdev_t *m = st->members[p->member];
+            w.pending++;
+            w.inflight[p->member]++;
+            /* A refused piece waits for the member's queue to drain. With
+             * none of ours in flight there, the queue is full of other
+             * callers' work (or the buffer cannot be queued at all): the
+             * member's own synchronous path waits that out and reports
+             * real errors. */
+            while (blkdev_submit(m, &p->req) < 0) {
+                if (w.inflight[p->member] == 1) {
+                    w.inflight[p->member]--;
+                    w.pending--;
+                    int r = write ? blkdev_write(m, p->req.lba, k, buf)
+                                  : blkdev_read(m, p->req.lba, k, buf);
+                    if (r < 0) w.status = -1;
+                    break;
+                }
+                poll_members(st);
+            }
+            n++;
+            lba += k;
+            count -= k;
+            buf += k * BLKDEV_BLOCK_SIZE;
+        }
+        while (w.pending) poll_members(st);
+    }
+    return w.status;
+}
+
+static int stripe_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    return stripe_transfer(dev, 0, lba, count, buf);
+}
+
+static int stripe_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    return stripe_transfer(dev, 1, lba, count, (uint8_t *)buf);
+}
+
+static int stripe_flush(blkdev_t *dev) {
+    stripe_t *st = dev->priv;
+    int r = 0;
+    for (int i = 0; i < st->n; i++)
+        if (blkdev_flush(st->members[i]) < 0) r = -1;
+    return r;
+}
+
+static void stripe_poll(blkdev_t *dev) {
+    poll_members(dev->priv);
+}
+
+static const blkdev_ops_t stripe_ops = {
+    .read_blocks  = stripe_read,
+    .write_blocks = stripe_write,
+    .flush        = stripe_flush,
+    .poll         = stripe_poll,
+};
+
+blkdev_t *stripe_create(const char *name, blkdev_t **members, int n, uint32_t unit) {
+    if (nsets == STRIPE_MAX_SETS || n < 2 || n > STRIPE_MAX_MEMBERS || !unit) return NULL;
+    uint32_t smallest = 0xFFFFFFFFu;
+    for (int i = 0; i < n; i++) {
+        if (!members[i] || !members[i]->blocks) return NULL;
+        for (int j = 0; j < i; j++)
+            if (members[j] == members[i]) return NULL;
+        if (members[i]->blocks < smallest) smallest = members[i]->blocks;
+    }
+    uint32_t units = smallest / unit;
+    if (!units || units > 0xFFFFFFFFu / unit / (uint32_t)n) return NULL;
+
+    stripe_t *st = &sets[nsets];
+    for (int i = 0; i < n; i++) st->members[i] = members[i];
+    st->n    = n;
+    st->unit = unit;
+    blkdev_t *dev = blkdev_register(name, &stripe_ops, st, units * unit * (uint32_t)n);
+    if (!dev) return NULL;
+    dev->stacked = 1;
+    nsets++;
+    return dev;
+}
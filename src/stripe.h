@@ -0,0 +1,23 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+// RAID-0 block device striped over 2-4 member devices. The address
+// space is cut into stripe units of `unit` blocks dealt round-robin to
+// the members, so a long transfer keeps every member busy at once: the
+// pieces are submitted to all members before waiting on any of them.
+// There is no redundancy; losing one member loses the set.
+
+#define STRIPE_MAX_MEMBERS     4
+#define STRIPE_MAX_SETS        2
+#define STRIPE_DEFAULT_UNIT  128     /* blocks per stripe unit: 64 KiB */
+
+// Register `name` (e.g. "md0") over `members`, which must be distinct.
+// Capacity is `n` times the smallest member, rounded down to whole
+// stripe units. Member contents are not touched. Returns the new
+// device, or NULL on bad arguments or a full table.
+blkdev_t *stripe_create(const char *name, blkdev_t **members, int n, uint32_t unit);
+
+#endif /* STRIPE_H */
@@ -2,15 +2,18 @@
 
 #include <stdint.h>
 #include "util.h"     // for putc(), puts()
-#include "serial.h"   // for serial_putc()
 #include "syscall.h"  // for SYS_WRITE, SYS_EXIT
+#include "task.h"     // task_current_pid(), task_kill()
+#include "vm.h"       // vm_mmap(), vm_munmap()
+#include "aio.h"      // aio_setup(), aio_enter()
+#include "vfs.h"      // per-task file descriptors
 
 /*
  * Kernel entry point for int 0x80 syscalls.
- *  esp points at [eax, ebx, ecx, edx, ...] pushed by syscall_stub.
- *  We dispatch on eax and return a value in eax.
+ *  r is the task's frame built by syscall_stub; esp below points at
+ *  its pushad block. We dispatch on eax and return a value in eax.
  */
-/* The stack layout produced by the syscall stub (pushad) is:
+/* The pushad block in the frame is:
  *   esp[0] : EDI
  *   esp[1] : ESI
  *   esp[2] : EBP
@@ -32,25 +35,52 @@
 #define REG_ECX 6
 #define REG_EAX 7
 
-void syscall_handler(uint32_t *esp) {
+regs_t *syscall_handler(regs_t *r) {
+    uint32_t *esp = &r->edi;
     uint32_t num = esp[REG_EAX];
 
     switch (num) {
 
       case SYS_WRITE: {
         int fd            = (int)esp[REG_EBX];
-        const char *buf   = (const char*)esp[REG_ECX];
+        const uint8_t *buf = (const uint8_t*)esp[REG_ECX];
         uint32_t len      =  esp[REG_EDX];
-        uint32_t written  = 0;
-        (void)fd;  // for now we ignore fd and always write to screen+serial
-
-        for (uint32_t i = 0; i < len; i++) {
-            char c = buf[i];
-            putc(c, 7);
-            serial_putc(c);
-            written++;
-        }
-        esp[REG_EAX] = written;
+        // fds 0-2 are the screen+serial console unless closed
+        esp[REG_EAX] = (uint32_t)vfs_write(task_current_pid(), fd, buf, len);
+        break;
+      }
+
+      case SYS_READ: {
+        esp[REG_EAX] = (uint32_t)vfs_read(task_current_pid(), (int)esp[REG_EBX],
+                                          (uint8_t*)esp[REG_ECX], esp[REG_EDX]);
+        break;
+      }
+
+      case SYS_OPEN: {
+        esp[REG_EAX] = (uint32_t)vfs_open(task_current_pid(), (const char*)esp[REG_EBX],
+                                          (int)esp[REG_ECX]);
+        break;
+      }
+
+      case SYS_CLOSE: {
+        esp[REG_EAX] = (uint32_t)vfs_close(task_current_pid(), (int)esp[REG_EBX]);
+        break;
+      }
+
+      case SYS_LSEEK: {
+        esp[REG_EAX] = (uint32_t)vfs_lseek(task_current_pid(), (int)esp[REG_EBX],
+                                           (int32_t)esp[REG_ECX], (int)esp[REG_EDX]);
+        break;
+      }
+
+      case SYS_FSTAT: {
+        esp[REG_EAX] = (uint32_t)vfs_fstat(task_current_pid(), (int)esp[REG_EBX],
+                                           (vfs_stat_t*)esp[REG_ECX]);
+        break;
+      }
+
+      case SYS_DUP: {
+        esp[REG_EAX] = (uint32_t)vfs_dup(task_current_pid(), (int)esp[REG_EBX]);
         break;
       }
 
@@ -59,10 +89,37 @@ void syscall_handler(uint32_t *esp) {
         putc('\n', 7);
         puts("[process exited]\n");
         (void)code;
-        // kill the task (in a real scheduler you'd remove it). Here we halt.
-        while (1) {
-            asm volatile("hlt");
-        }
+        // the next task resumes in its place
+        task_kill(current_task);
+        break;
+      }
+
+      case SYS_MMAP: {
+        const char *path = (const char*)esp[REG_EBX];
+        uint32_t len     = esp[REG_ECX];
+        int flags        = (int)esp[REG_EDX];
+        uint32_t offset  = esp[REG_ESI];
+        uint32_t addr    = vm_mmap(task_current_pid(), path, len, offset, flags);
+        esp[REG_EAX] = addr ? addr : (uint32_t)-1;
+        break;
+      }
+
+      case SYS_MUNMAP: {
+        esp[REG_EAX] = (uint32_t)vm_munmap(task_current_pid(), esp[REG_EBX]);
+        break;
+      }
+
+      case SYS_AIO_SETUP: {
+        uint32_t ring = aio_setup(task_current_pid());
+        esp[REG_EAX] = ring ? ring : (uint32_t)-1;
+        break;
+      }
+
+      case SYS_AIO_ENTER: {
+        int n = aio_enter(task_current_pid(), esp[REG_EBX], esp[REG_ECX], esp[REG_EDX]);
+        // asleep: back to the int 0x80 (2 bytes), issued again on wakeup
+        if (n == AIO_RESTART) r->eip -= 2;
+        else esp[REG_EAX] = (uint32_t)n;
         break;
       }
 
@@ -71,6 +128,7 @@ void syscall_handler(uint32_t *esp) {
         esp[REG_EAX] = (uint32_t)-1;
         break;
     }
+    return task_return(r);
 }
 
 /*
@@ -110,3 +168,160 @@ void exit(int code) {
     // should never get here
     for (;;) asm volatile("hlt");
 }
+
+/*
+ * Userspace stub for open(path, flags).
+ *   eax = SYS_OPEN, ebx = path, ecx = flags
+ * Returns: fd, or -1.
+ */
+int open(const char *path, int flags) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_OPEN), "b"(path), "c"(flags)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for read(fd, buf, len).
+ *   eax = SYS_READ, ebx = fd, ecx = buf, edx = len
+ * Returns: bytes read (0 at EOF), or -1.
+ */
+int read(int fd, void *buf, uint32_t len) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_READ), "b"(fd), "c"(buf), "d"(len)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for close(fd).
+ *   eax = SYS_CLOSE, ebx = fd
+ */
+int close(int fd) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_CLOSE), "b"(fd)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for lseek(fd, off, whence).
+ *   eax = SYS_LSEEK, ebx = fd, ecx = off, edx = whence
+ * Returns: new position, or -1.
+ */
+int lseek(int fd, int32_t off, int whence) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_LSEEK), "b"(fd), "c"(off), "d"(whence)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for fstat(fd, st).
+ *   eax = SYS_FSTAT, ebx = fd, ecx = st (vfs_stat_t *)
+ */
+int fstat(int fd, void *st) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_FSTAT), "b"(fd), "c"(st)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for dup(fd).
+ *   eax = SYS_DUP, ebx = fd
+ * Returns: new fd sharing the open file, or -1.
+ */
+int dup(int fd) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_DUP), "b"(fd)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for mmap(path, len, flags, offset).
+ *   eax = SYS_MMAP, ebx = path, ecx = len, edx = flags, esi = offset
+ * Returns: mapped address, or (void*)-1.
+ */
+void *mmap(const char *path, uint32_t len, int flags, uint32_t offset) {
+    void *ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_MMAP), "b"(path), "c"(len), "d"(flags), "S"(offset)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for munmap(addr).
+ *   eax = SYS_MUNMAP, ebx = addr
+ */
+int munmap(void *addr) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_MUNMAP), "b"(addr)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for io_ring_setup().
+ *   eax = SYS_AIO_SETUP
+ * Returns: address of the shared aio_ring_t, or (void*)-1.
+ */
+void *io_ring_setup(void) {
+    void *ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_AIO_SETUP)
+        : "memory"
+    );
+    return ret;
+}
+
+/*
+ * Userspace stub for io_ring_enter(ring, to_submit, min_complete).
+ *   eax = SYS_AIO_ENTER, ebx = ring, ecx = to_submit, edx = min_complete
+ * Returns: entries submitted, or -1.
+ */
+int io_ring_enter(void *ring, uint32_t to_submit, uint32_t min_complete) {
+    int ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_AIO_ENTER), "b"(ring), "c"(to_submit), "d"(min_complete)
+        : "memory"
+    );
+    return ret;
+}
@@ -2,14 +2,39 @@
 #define SYSCALL_H
 
 #include <stdint.h>
+#include "interrupts.h"
 #define SYS_WRITE 1
 #define SYS_EXIT  2
+#define SYS_MMAP  3
+#define SYS_MUNMAP 4
+#define SYS_AIO_SETUP 5
+#define SYS_AIO_ENTER 6
+#define SYS_OPEN  7
+#define SYS_READ  8
+#define SYS_CLOSE 9
+#define SYS_LSEEK 10
+#define SYS_FSTAT 11
+#define SYS_DUP   12
 
 // C stubs (link in user programs)
 int write(int fd, const char *buf, uint32_t len);
 void exit(int code);
+// Files (O_* / SEEK_* / vfs_stat_t from vfs.h); -1 on error
+int open(const char *path, int flags);
+int read(int fd, void *buf, uint32_t len);
+int close(int fd);
+int lseek(int fd, int32_t off, int whence);
+int fstat(int fd, void *st);
+int dup(int fd);
+// Map a file (MAP_SHARED / MAP_PRIVATE from vm.h); returns address or -1
+void *mmap(const char *path, uint32_t len, int flags, uint32_t offset);
+int munmap(void *addr);
+// Asynchronous I/O ring (aio.h): setup returns the ring or -1; enter
+// submits queued entries and waits for `min_complete` completions
+void *io_ring_setup(void);
+int io_ring_enter(void *ring, uint32_t to_submit, uint32_t min_complete);
 
-// Kernel internal entry point
-void syscall_handler(uint32_t *esp);
+// Kernel internal entry point; returns the frame to resume
+regs_t *syscall_handler(regs_t *r);
 
 #endif /* SYSCALL_H */
@@ -1,17 +1,34 @@
-; syscall_stub.S – trampoline for user int 0x80 syscalls
+; syscall_stub.S – trampoline for user int 0x80 syscalls
 
 [BITS 32]
 section .text
 global syscall_stub
 extern syscall_handler
 
+; Builds the same regs_t frame as the interrupt stubs, so a task that
+; entered through here can be resumed through any of them and the
+; other way round.
 syscall_stub:
     cli
+    push dword 0            ; no error code
+    push dword 0x80         ; interrupt number
     pusha
-    mov  eax, esp
-    push eax
-    call syscall_handler
-    add  esp, 4
+    push ds
+    push es
+    push fs
+    push gs
+    mov  ax, 0x10           ; kernel data segments
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
+    push esp                ; regs_t *
+    call syscall_handler    ; returns the frame to resume
+    mov  esp, eax
+    pop  gs
+    pop  fs
+    pop  es
+    pop  ds
     popa
-    sti
+    add  esp, 8
     iretd
@@ -1,11 +1,22 @@
 // src/task.c
 
 #include "task.h"
+#include "irq.h"
+#include "paging.h"
+#include "tss.h"
+#include "util.h"
+#include "vm.h"
+#include "aio.h"
+#include "vfs.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+#define USER_CS  0x1B      /* GDT user code, RPL 3 */
+#define USER_DS  0x23      /* GDT user data, RPL 3 */
 
 /*
- * Globals for our simple round‑robin scheduler
+ * Globals for the scheduler
  * Declared in task.h:
  *
  *   extern task_t tasks[MAX_TASKS];
@@ -13,90 +24,272 @@
  *   extern int    task_count;
  */
 task_t tasks[MAX_TASKS];
-int    current_task = 0;
+int    current_task = -1;
 int    task_count   = 0;
+static int next_pid = 1;
 
 /*
- * Helper to grab the current kernel ESP so we can save it
- * before switching away from the current task.
+ * Every task enters the kernel on a stack of its own (tss.esp0), where
+ * the stubs leave its register frame; switching tasks is resuming a
+ * different frame. The kernel's idle loop keeps the boot stack. A
+ * task's stack is the one of its TID.
  */
-static inline uint32_t get_current_esp(void) {
-    uint32_t esp;
-    __asm__ volatile("movl %%esp, %0" : "=r"(esp));
-    return esp;
+static uint8_t kstacks[MAX_TASKS][KSTACK_SIZE] __attribute__((aligned(16)));
+
+static regs_t *kernel_frame;       /* the idle loop, while a task runs */
+
+/*
+ * Run queues: a FIFO of TASK_READY tasks per level, linked through
+ * task_t.next, and a bitmap of the levels that have any. The next task
+ * is the head of the lowest set bit, whatever the number of tasks.
+ */
+static int      rq_head[SCHED_LEVELS], rq_tail[SCHED_LEVELS];
+static uint32_t rq_ready;          /* bit n: level n queue not empty */
+static bool     need_resched;      /* a woken task outranks the running one */
+static uint32_t boost_clock;
+
+/* Wakeups come from IRQ handlers, which may nest in the GUI loop */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+static uint32_t kstack_top(int tid) {
+    return (uint32_t)(uintptr_t)&kstacks[tid][KSTACK_SIZE];
+}
+
+static void rq_push(int tid) {
+    task_t *t = &tasks[tid];
+    uint32_t bit = 1u << t->prio;
+    t->state = TASK_READY;
+    t->next = -1;
+    if (rq_ready & bit) tasks[rq_tail[t->prio]].next = tid;
+    else rq_head[t->prio] = tid;
+    rq_tail[t->prio] = tid;
+    rq_ready |= bit;
+}
+
+/* Highest-priority ready task, taken off its queue; -1 if none */
+static int rq_pop(void) {
+    if (!rq_ready) return -1;
+    int lvl = __builtin_ctz(rq_ready);
+    int tid = rq_head[lvl];
+    rq_head[lvl] = tasks[tid].next;
+    if (rq_head[lvl] < 0) rq_ready &= ~(1u << lvl);
+    return tid;
+}
+
+static void rq_remove(int tid) {
+    int lvl = tasks[tid].prio, prev = -1;
+    if (!(rq_ready & (1u << lvl))) return;
+    for (int i = rq_head[lvl]; i >= 0; prev = i, i = tasks[i].next) {
+        if (i != tid) continue;
+        if (prev < 0) rq_head[lvl] = tasks[i].next;
+        else tasks[prev].next = tasks[i].next;
+        if (rq_tail[lvl] == tid) rq_tail[lvl] = prev;
+        if (rq_head[lvl] < 0) rq_ready &= ~(1u << lvl);
+        return;
+    }
+}
+
+/* Everyone back to level 0, ready tasks keeping their order */
+static void boost(void) {
+    int order[MAX_TASKS], n = 0;
+    while (rq_ready) order[n++] = rq_pop();
+    for (int i = 0; i < MAX_TASKS; i++) {
+        tasks[i].prio = 0;
+        tasks[i].ticks = 0;
+    }
+    for (int i = 0; i < n; i++) rq_push(order[i]);
+}
+
+/* A killed task's slot is freed from the timer, by then nobody runs on
+ * its stack */
+static void reap(void) {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].state == TASK_DEAD && i != current_task) tasks[i].state = TASK_FREE;
+    }
 }
 
 /*
  * Create a new user‐mode task:
  *   entry_point   = the EIP where the user code begins (e.g. ELF e_entry)
  *   user_stack_top= the top of that task’s stack (must be in identity map)
+ *   space         = its address space, freed when the task is killed
  *
- * Returns the new task ID (0..MAX_TASKS‑1), or ‑1 on overflow.
+ * Its first frame is built on its kernel stack as if it had been
+ * interrupted just before `entry_point`, so the scheduler starts it
+ * exactly as it resumes the others. It starts at level 0.
+ *
+ * Returns the new task ID (0..MAX_TASKS‑1), or ‑1 if no slot is free.
  */
-int task_create_user(uint32_t entry_point, uint32_t user_stack_top) {
-    if (task_count >= MAX_TASKS) {
+int task_create_user(uint32_t entry_point, uint32_t user_stack_top, uint32_t space) {
+    int tid = 0;
+    while (tid < MAX_TASKS && tasks[tid].state != TASK_FREE) tid++;
+    if (tid == MAX_TASKS) {
         return -1;
     }
-    tasks[task_count].entry_point = entry_point;
-    tasks[task_count].esp         = user_stack_top;
-    return task_count++;
-}
-
-/*
- * schedule(): Round‑robin between tasks[0..task_count‑1].
- * Saves the current kernel ESP, picks the next task,
- * and switches into it via context_switch_user().
- */
-void schedule(void) {
-    if (task_count <= 1) {
-        return;  // nothing to switch to
-    }
 
-    /* Save outgoing task’s kernel ESP */
-    tasks[current_task].esp = get_current_esp();
+    regs_t *f = (regs_t *)(uintptr_t)(kstack_top(tid) - sizeof(regs_t));
+    memset(f, 0, sizeof(*f));
+    f->gs = f->fs = f->es = f->ds = USER_DS;
+    f->eip     = entry_point;
+    f->cs      = USER_CS;
+    f->eflags  = 0x202;     /* IF */
+    f->useresp = user_stack_top;
+    f->ss      = USER_DS;
 
-    /* Pick next, wrap around */
-    int next = (current_task + 1) % task_count;
+    task_t *t = &tasks[tid];
+    memset(t, 0, sizeof(*t));
+    t->entry_point = entry_point;
+    t->esp         = user_stack_top;
+    t->pid         = next_pid++;
+    t->space       = space;
+    t->frame       = f;
 
-    /* Grab its entry & stack */
-    uint32_t entry = tasks[next].entry_point;
-    uint32_t sp    = tasks[next].esp;
+    uint32_t flags = irq_save();
+    rq_push(tid);
+    task_count++;
+    irq_restore(flags);
+    return tid;
+}
 
-    /* Update current_task before switching */
+/* Make `next` (-1: the kernel) current and return the frame to resume */
+static regs_t *switch_to(int next) {
+    need_resched = false;
     current_task = next;
+    if (next < 0) {
+        paging_space_switch(0);
+        return kernel_frame;
+    }
+    tasks[next].state = TASK_RUNNING;
+    tss.esp0 = kstack_top(next);
+    paging_space_switch(tasks[next].space);
+    return tasks[next].frame;
+}
 
-    /* Ring‑change via call‑gate into user mode */
-    context_switch_user(entry, sp);
+/* Put the current context `r` away (a running task goes to the back of
+ * its queue, a blocked one to no queue) and resume the best ready one */
+static regs_t *reschedule(regs_t *r) {
+    if (current_task < 0) {
+        kernel_frame = r;
+    } else {
+        task_t *t = &tasks[current_task];
+        if (t->state != TASK_DEAD) t->frame = r;
+        if (t->state == TASK_RUNNING) rq_push(current_task);
+    }
+    return switch_to(rq_pop());
 }
 
 /*
- * task_yield(): voluntary yield for the current task.
+ * schedule(): timer tick. The running task keeps the CPU until its
+ * slice is used up, and then drops a level, or until something at a
+ * higher level is ready. Device handlers may let the timer in (the GUI
+ * loop does); their context is not a task's, so nothing switches under
+ * them.
  */
-void task_yield(void) {
-    schedule();
+regs_t *schedule(regs_t *r) {
+    if (irq_context()) {
+        return r;
+    }
+    reap();
+    if (++boost_clock >= SCHED_BOOST_TICKS) {
+        boost_clock = 0;
+        boost();
+    }
+    if (current_task < 0) {
+        if (!rq_ready) return r;        /* idle */
+    } else if (tasks[current_task].state == TASK_RUNNING) {
+        task_t *t = &tasks[current_task];
+        if (++t->ticks >= SCHED_SLICE(t->prio)) {
+            /* a CPU hog sinks */
+            if (t->prio < SCHED_LEVELS - 1) t->prio++;
+            t->ticks = 0;
+        } else if (!(rq_ready & ((1u << t->prio) - 1))) {
+            return r;                   /* nothing ranks above it */
+        }
+    }
+    return reschedule(r);
 }
 
-/* Remove task `tid` from the task list. Very simple – shifts array. */
-void task_kill(int tid) {
-    if (tid < 0 || tid >= task_count) {
+regs_t *task_return(regs_t *r) {
+    if (irq_context()) {
+        return r;
+    }
+    if (need_resched || (current_task >= 0 && tasks[current_task].state != TASK_RUNNING)) {
+        return reschedule(r);
+    }
+    return r;
+}
+
+int task_current_pid(void) {
+    if (current_task < 0 || tasks[current_task].state == TASK_DEAD) return 0;
+    return tasks[current_task].pid;
+}
+
+void task_sleep(void *chan) {
+    if (current_task < 0) {
         return;
     }
+    uint32_t flags = irq_save();
+    task_t *t = &tasks[current_task];
+    /* gave up the CPU before its slice ran out: interactive, rises */
+    if (t->prio > 0) t->prio--;
+    t->ticks = 0;
+    t->state = TASK_BLOCKED;
+    t->chan  = chan;
+    irq_restore(flags);
+}
 
-    /* If killing the currently running task, mark for switch */
-    bool need_switch = (tid == current_task);
+void task_wakeup(void *chan) {
+    uint32_t flags = irq_save();
+    for (int i = 0; i < MAX_TASKS; i++) {
+        task_t *t = &tasks[i];
+        if (t->state != TASK_BLOCKED || t->chan != chan) continue;
+        t->chan = NULL;
+        if (i == current_task) {
+            t->state = TASK_RUNNING;    /* has not left the CPU yet */
+            continue;
+        }
+        rq_push(i);
+        if (current_task < 0 || t->prio < tasks[current_task].prio) need_resched = true;
+    }
+    irq_restore(flags);
+}
 
-    /* Shift entries left to fill the gap */
-    for (int i = tid; i < task_count - 1; i++) {
-        tasks[i] = tasks[i + 1];
+/* Free task `tid`'s slot. Other tasks keep their TIDs. */
+void task_kill(int tid) {
+    if (tid < 0 || tid >= MAX_TASKS) {
+        return;
     }
-    task_count--;
-    if (task_count == 0) {
-        current_task = 0;
-    } else if (current_task >= task_count) {
-        current_task = 0;
+    task_t *t = &tasks[tid];
+    if (t->state == TASK_FREE || t->state == TASK_DEAD) {
+        return;
     }
 
-    if (need_switch) {
-        schedule();
+    /* Its file mappings, I/O rings and descriptors go with it */
+    vm_release(t->pid);
+    aio_release(t->pid);
+    vfs_release(t->pid);
+
+    /* ...and its address space, left first if it is the one loaded */
+    if (t->space) {
+        if (paging_space_current() == t->space) paging_space_switch(0);
+        vm_release_space(t->space);
+        paging_space_destroy(t->space);
     }
+
+    /* The running task's stack holds the frame we are in: the handler
+     * returns through task_return() to another task and the timer frees
+     * the slot. Any other task's stack is idle. */
+    uint32_t flags = irq_save();
+    if (t->state == TASK_READY) rq_remove(tid);
+    t->state = (tid == current_task) ? TASK_DEAD : TASK_FREE;
+    task_count--;
+    irq_restore(flags);
 }
@@ -3,30 +3,71 @@
 #define TASK_H
 
 #include <stdint.h>
+#include "interrupts.h"
 
-#define MAX_TASKS 16
+#define MAX_TASKS   16
+#define KSTACK_SIZE 0x4000   /* per-task kernel stack: interrupts, syscalls */
+
+/* Multi-level feedback queue. Level 0 runs first and gets the shortest
+ * slice (SCHED_SLICE ticks); a task that uses up its slice drops a
+ * level, one that blocks before it does rises one. Every
+ * SCHED_BOOST_TICKS everything returns to level 0, so nothing starves. */
+#define SCHED_LEVELS       8
+#define SCHED_SLICE(lvl)   ((uint32_t)(lvl) + 1)
+#define SCHED_BOOST_TICKS  100
+
+enum {
+    TASK_FREE,        /* slot unused */
+    TASK_READY,       /* in its level's run queue */
+    TASK_RUNNING,     /* current_task */
+    TASK_BLOCKED,     /* waiting in task_sleep(), on no queue */
+    TASK_DEAD,        /* killed while running; slot freed by the next tick */
+};
 
 typedef struct {
-    uint32_t entry_point;  /* user EIP */
-    uint32_t esp;          /* user stack pointer */
-    /* …other fields… */
+    uint32_t entry_point;  /* user EIP it started at */
+    uint32_t esp;          /* top of its user stack */
+    int      pid;          /* unique id; the TID (slot) is reused */
+    uint32_t space;        /* address space (page directory), 0 = kernel's */
+    regs_t  *frame;        /* saved context, on its kernel stack, while switched out */
+    int      state;        /* TASK_* */
+    int      prio;         /* run queue level, 0 = highest */
+    uint32_t ticks;        /* of the current slice used */
+    int      next;         /* run queue link, -1 = last */
+    void    *chan;         /* what a TASK_BLOCKED task waits for */
 } task_t;
 
+/* Indexed by TID, which stays the same for a task's whole life */
 extern task_t tasks[MAX_TASKS];
-extern int    current_task;
-extern int    task_count;
+extern int    current_task;    /* -1 while the kernel idle loop runs */
+extern int    task_count;      /* live tasks */
+
+/* Timer tick: save the interrupted context `r` and return the frame of
+ * the task to run next, which the IRQ stub resumes */
+regs_t *schedule(regs_t *r);
+
+/* End of any other interrupt or syscall: `r`, unless the handler killed
+ * or put to sleep the current task, or woke one that ranks above it, in
+ * which case the frame of the task to run */
+regs_t *task_return(regs_t *r);
+
+/* create a new user task running in address space `space` (which it
+ * then owns), returns its TID */
+int task_create_user(uint32_t entry_point, uint32_t user_stack, uint32_t space);
 
-/* scheduler */
-void schedule(void);
-void task_yield(void);
+/* pid of the running task, 0 when only the kernel is running */
+int task_current_pid(void);
 
-/* context switch into Ring 3 via call‑gate */
-void context_switch_user(uint32_t entry_point, uint32_t user_stack);
+/* Block the current task until task_wakeup(chan). Syscalls only: the
+ * task leaves the CPU when the syscall returns, and resumes with that
+ * syscall issued again, which finds what it waited for. */
+void task_sleep(void *chan);
 
-/* create a new user task, returns its TID */
-int task_create_user(uint32_t entry_point, uint32_t user_stack);
+/* Make every task sleeping on `chan` runnable (safe from IRQ handlers) */
+void task_wakeup(void *chan);
 
-/* Terminate a task by TID (no-op for invalid or kernel task) */
+/* Terminate a task by TID (no-op for invalid or kernel task). Killing
+ * the current one takes effect when the handler returns (task_return). */
 void task_kill(int tid);
 
 #endif /* TASK_H */
@@ -0,0 +1,235 @@
+#include "tmpfs.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "lock.h"
+#include "util.h"
+#include <stddef.h>
+
+typedef struct {
+    char      name[TMPFS_NAME_LEN];   /* uppercase; "" = unused slot */
+    uint32_t  size;                   /* bytes */
+    uint32_t  npages;                 /* frames owned, may exceed size */
+    uint8_t **pages;                  /* one frame of frame pointers */
+} tmpfs_node_t;
+
+/* fs.c keeps calls on one file apart; `lock` covers the names, which
+ * every lookup scans */
+struct tmpfs {
+    tmpfs_node_t nodes[TMPFS_MAX_FILES];
+    kmutex_t     lock;
+};
+
+static void *frame_alloc(void) {
+    uint32_t f = pmm_alloc_frame();
+    if (f == (uint32_t)-1) return NULL;
+    return (void *)(uintptr_t)(f * PMM_FRAME_SIZE);
+}
+
+static void frame_free(void *p) {
+    pmm_free_frame((uint32_t)((uintptr_t)p / PMM_FRAME_SIZE));
+}
+
+/* Copy `name` uppercased into `out`; –1 if empty, too long or a path. */
+static int norm_name(const char *name, char out[TMPFS_NAME_LEN]) {
+    uint32_t i = 0;
+    for (; name[i]; i++) {
+        char c = name[i];
+        if (i + 1 >= TMPFS_NAME_LEN || c == '/') return -1;
+        out[i] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+    }
+    out[i] = '\0';
+    return i ? 0 : -1;
+}
+
+static tmpfs_node_t *lookup(tmpfs_t *t, const char *name) {
+    char key[TMPFS_NAME_LEN];
+    if (norm_name(name, key) < 0) return NULL;
+    tmpfs_node_t *found = NULL;
+    kmutex_lock(&t->lock);
+    for (int i = 0; i < TMPFS_MAX_FILES && !found; i++) {
+        if (t->nodes[i].name[0] && strcmp(t->nodes[i].name, key) == 0) found = &t->nodes[i];
+    }
+    kmutex_unlock(&t->lock);
+    return found;
+}
+
+static tmpfs_node_t *create(tmpfs_t *t, const char *name) {
+    char key[TMPFS_NAME_LEN];
+    if (norm_name(name, key) < 0) return NULL;
+    tmpfs_node_t *found = NULL;
+    kmutex_lock(&t->lock);
+    for (int i = 0; i < TMPFS_MAX_FILES && !found; i++) {
+        tmpfs_node_t *n = &t->nodes[i];
+        if (n->name[0]) continue;
+        memset(n, 0, sizeof(*n));
+        strcpy(n->name, key);
+        found = n;
+    }
+    kmutex_unlock(&t->lock);
+    return found;
+}
+
+/* Own exactly enough frames for `bytes`. Growing stops at the first
+ * failed allocation (the frames gained so far are kept); shrinking
+ * returns the surplus, and the page table itself once it is empty. */
+static int reserve(tmpfs_node_t *n, uint32_t bytes) {
+    uint32_t want = bytes / PMM_FRAME_SIZE + (bytes % PMM_FRAME_SIZE != 0);
+    if (want > TMPFS_MAX_PAGES) return -1;
+    if (want && !n->pages) {
+        n->pages = frame_alloc();
+        if (!n->pages) return -1;
+    }
+    while (n->npages < want) {
+        uint8_t *p = frame_alloc();
+        if (!p) return -1;
+        n->pages[n->npages++] = p;
+    }
+    while (n->npages > want) frame_free(n->pages[--n->npages]);
+    if (!n->npages && n->pages) {
+        frame_free(n->pages);
+        n->pages = NULL;
+    }
+    return 0;
+}
+
+static void copy_in(tmpfs_node_t *n, uint32_t offset, const uint8_t *data, uint32_t len) {
+    while (len) {
+        uint32_t in = offset % PMM_FRAME_SIZE;
+        uint32_t chunk = PMM_FRAME_SIZE - in;
+        if (chunk > len) chunk = len;
+        memcpy(n->pages[offset / PMM_FRAME_SIZE] + in, data, chunk);
+        offset += chunk; data += chunk; len -= chunk;
+    }
+}
+
+tmpfs_t *tmpfs_create(void) {
+    tmpfs_t *t = kmalloc(sizeof(tmpfs_t));
+    if (t) {
+        memset(t, 0, sizeof(*t));
+        kmutex_init(&t->lock);
+    }
+    return t;
+}
+
+static int tmpfs_read_at(void *fs, const char *name, uint32_t offset, uint8_t *buf, uint32_t len) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n) return -1;
+    if (offset >= n->size) return 0;
+    if (len > n->size - offset) len = n->size - offset;
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t in = offset % PMM_FRAME_SIZE;
+        uint32_t chunk = PMM_FRAME_SIZE - in;
+        if (chunk > len - done) chunk = len - done;
+        memcpy(buf + done, n->pages[offset / PMM_FRAME_SIZE] + in, chunk);
+        offset += chunk; done += chunk;
+    }
+    return (int)len;
+}
+
+static int tmpfs_stat(void *fs, const char *name, uint32_t *size) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n) return -1;
+    *size = n->size;
+    return 0;
+}
+
+/* Overwrite keeps the frames the file already owns and only allocates
+ * or frees the difference. */
+static int tmpfs_write(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n && !(n = create(fs, name))) return -1;
+    if (reserve(n, len) < 0) {
+        reserve(n, n->size);
+        return -1;
+    }
+    copy_in(n, 0, data, len);
+    n->size = len;
+    return 0;
+}
+
+static int tmpfs_write_at(void *fs, const char *name, uint32_t offset,
+                          const uint8_t *data, uint32_t len) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n) return offset ? -1 : tmpfs_write(fs, name, data, len);
+    if (offset > n->size || offset + len < offset) return -1;
+    uint32_t end = offset + len;
+    if (end > n->npages * PMM_FRAME_SIZE && reserve(n, end) < 0) {
+        reserve(n, n->size);
+        return -1;
+    }
+    copy_in(n, offset, data, len);
+    if (end > n->size) n->size = end;
+    return 0;
+}
+
+static int tmpfs_append(void *fs, const char *name, const uint8_t *data, uint32_t len) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n) return tmpfs_write(fs, name, data, len);
+    return tmpfs_write_at(fs, name, n->size, data, len);
+}
+
+static int tmpfs_preallocate(void *fs, const char *name, uint32_t size) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n && !(n = create(fs, name))) return -1;
+    if (reserve(n, size > n->size ? size : n->size) < 0) {
+        reserve(n, n->size);
+        return -1;
+    }
+    return 0;
+}
+
+static int tmpfs_remove(void *fs, const char *name) {
+    tmpfs_node_t *n = lookup(fs, name);
+    if (!n) return -1;
+    reserve(n, 0);
+    n->name[0] = '\0';
+    return 0;
+}
+
+static int tmpfs_rename(void *fs, const char *oldname, const char *newname) {
+    tmpfs_t *t = fs;
+    char key[TMPFS_NAME_LEN];
+    int r = -1;
+    kmutex_lock(&t->lock);
+    tmpfs_node_t *n = lookup(t, oldname);
+    if (n && norm_name(newname, key) == 0 && !lookup(t, newname)) {
+        strcpy(n->name, key);
+        r = 0;
+    }
+    kmutex_unlock(&t->lock);
+    return r;
+}
+
+static void tmpfs_ls(void *fs, fs_ls_callback cb) {
+    tmpfs_t *t = fs;
+    kmutex_lock(&t->lock);
+    for (int i = 0; i < TMPFS_MAX_FILES; i++) {
+        if (t->nodes[i].name[0]) cb(t->nodes[i].name, t->nodes[i].size);
+    }
+    kmutex_unlock(&t->lock);
+}
+
+static uint32_t tmpfs_free_space(void *fs) {
+    (void)fs;
+    return pmm_free_count() * PMM_FRAME_SIZE;
+}
+
+static const char *tmpfs_type_name(void *fs) {
+    (void)fs;
+    return "tmpfs";
+}
+
+const fs_ops_t tmpfs_ops = {
+    .read_at     = tmpfs_read_at,
+    .stat        = tmpfs_stat,
+    .write       = tmpfs_write,
+    .append      = tmpfs_append,
+    .remove      = tmpfs_remove,
+    .rename      = tmpfs_rename,
+    .ls          = tmpfs_ls,
+    .free_space  = tmpfs_free_space,
+    .type_name   = tmpfs_type_name,
+    .preallocate = tmpfs_preallocate,
+    .write_at    = tmpfs_write_at,
+};
@@ -0,0 +1,24 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include "fs.h"
+#include "pmm.h"
+
+#define TMPFS_MAX_FILES  64
+#define TMPFS_NAME_LEN   32
+/* One frame of page pointers per file caps a file at 4 MiB */
+#define TMPFS_MAX_PAGES  (PMM_FRAME_SIZE / sizeof(uint8_t *))
+
+// In-memory filesystem: file data lives in 4 KiB frames taken from the
+// physical memory manager one at a time as the file grows and returned
+// as it shrinks or is deleted. Nothing touches a disk.
+typedef struct tmpfs tmpfs_t;
+
+// Create an empty instance (from the kernel heap). Mount it with
+// fs_mount(prefix, &tmpfs_ops, instance). Returns NULL if out of heap.
+tmpfs_t *tmpfs_create(void);
+
+extern const fs_ops_t tmpfs_ops;
+
+#endif /* TMPFS_H */
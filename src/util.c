@@ -137,6 +137,20 @@ uint16_t inw(uint16_t p) {
     return r;
 }
 
+void outw(uint16_t p, uint16_t v) {
+    asm volatile("outw %0,%1" :: "a"(v), "Nd"(p));
+}
+
+uint32_t inl(uint16_t p) {
+    uint32_t r;
+    asm volatile("inl %1,%0" : "=a"(r) : "Nd"(p));
+    return r;
+}
+
+void outl(uint16_t p, uint32_t v) {
+    asm volatile("outl %0,%1" :: "a"(v), "Nd"(p));
+}
+
 int memcmp(const void *a, const void *b, uint32_t n) {
     const uint8_t* p=a; const uint8_t* q=b;
     for(uint32_t i=0;i<n;i++) if(p[i]!=q[i]) return p[i]-q[i];
@@ -28,6 +28,9 @@ char   *strrchr(const char *s, int c);
 void    utohex(uint32_t val, char *buf);
 
 uint16_t inw(uint16_t port);
+void     outw(uint16_t port, uint16_t value);
+uint32_t inl(uint16_t port);
+void     outl(uint16_t port, uint32_t value);
 
 int memcmp(const void *a, const void *b, uint32_t n);
 
@@ -0,0 +1,238 @@
+#include "vfs.h"
+#include "fs.h"
+#include "serial.h"
+#include "task.h"
+#include "util.h"
+#include <stddef.h>
+
+typedef struct {
+    uint32_t refs;                 /* 0 = free slot */
+    uint8_t  type;
+    int      flags;                /* O_* given to open */
+    uint32_t pos;
+    char     path[VFS_PATH_LEN];
+} vfs_file_t;
+
+typedef struct {
+    uint8_t     used;
+    int         pid;
+    vfs_file_t *fd[VFS_MAX_FDS];
+} fd_table_t;
+
+/* File data goes between the task's buffer and the FS in chunks of
+ * this size. The drivers never see a user address: one that is not
+ * mapped yet would fault in the middle of a transfer, and the fault
+ * fills the page through the FS, starting a second disk command inside
+ * the first; DMA drivers cannot translate it at all. The copies fault
+ * pages in while no FS call is running. Callers are serialised (they
+ * all run with interrupts off), so one buffer serves everyone. */
+#define VFS_BOUNCE 4096
+static uint8_t bounce[VFS_BOUNCE];
+
+static vfs_file_t files[VFS_MAX_FILES];
+static fd_table_t tables[MAX_TASKS];
+
+/* Shared by every task's fds 0-2; never freed */
+static vfs_file_t console = { .refs = 1, .type = VFS_TYPE_CONSOLE, .flags = O_RDWR };
+
+static void file_put(vfs_file_t *f) {
+    if (f == &console) return;
+    if (--f->refs == 0) memset(f, 0, sizeof(*f));
+}
+
+/* The task's table, created with the console on fds 0-2 on first use */
+static fd_table_t *table(int pid, int create) {
+    fd_table_t *free_slot = NULL;
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tables[i].used && tables[i].pid == pid) return &tables[i];
+        if (!tables[i].used && !free_slot) free_slot = &tables[i];
+    }
+    if (!create || !free_slot) return NULL;
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->used = 1;
+    free_slot->pid  = pid;
+    for (int fd = 0; fd < 3; fd++) free_slot->fd[fd] = &console;
+    return free_slot;
+}
+
+static vfs_file_t *lookup(int pid, int fd) {
+    if (fd < 0 || fd >= VFS_MAX_FDS) return NULL;
+    fd_table_t *t = table(pid, 1);
+    return t ? t->fd[fd] : NULL;
+}
+
+static int readable(const vfs_file_t *f) {
+    return (f->flags & O_ACCMODE) != O_WRONLY;
+}
+
+static int writable(const vfs_file_t *f) {
+    return (f->flags & O_ACCMODE) != O_RDONLY;
+}
+
+int vfs_open(int pid, const char *path, int flags) {
+    fd_table_t *t = table(pid, 1);
+    if (!t || !path || strlen(path) >= VFS_PATH_LEN) return -1;
+    int fd = 0;
+    while (fd < VFS_MAX_FDS && t->fd[fd]) fd++;
+    if (fd == VFS_MAX_FDS) return -1;
+    vfs_file_t *f = NULL;
+    for (int i = 0; i < VFS_MAX_FILES && !f; i++) {
+        if (!files[i].refs) f = &files[i];
+    }
+    if (!f) return -1;
+
+    uint32_t size;
+    int exists = fs_stat(path, &size) == 0;
+    if (!exists && !(flags & O_CREAT)) return -1;
+    if (!exists || ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)) {
+        if (fs_write(path, NULL, 0) < 0) return -1;
+    }
+
+    f->refs  = 1;
+    f->type  = VFS_TYPE_FILE;
+    f->flags = flags;
+    f->pos   = 0;
+    strcpy(f->path, path);
+    t->fd[fd] = f;
+    return fd;
+}
+
+static int console_write(const uint8_t *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        putc((char)buf[i], 7);
+        serial_putc((char)buf[i]);
+    }
+    return (int)len;
+}
+
+int vfs_pread(int pid, int fd, uint32_t off, uint8_t *buf, uint32_t len) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f || !readable(f)) return -1;
+    if (f->type == VFS_TYPE_CONSOLE) return 0;     /* no input queue for tasks */
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t n = (len - done < VFS_BOUNCE) ? len - done : VFS_BOUNCE;
+        int got = fs_read_at(f->path, off + done, bounce, n);
+        if (got < 0) return done ? (int)done : -1;
+        memcpy(buf + done, bounce, (uint32_t)got);
+        done += (uint32_t)got;
+        if ((uint32_t)got < n) break;              /* end of file */
+    }
+    return (int)done;
+}
+
+int vfs_read(int pid, int fd, uint8_t *buf, uint32_t len) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f) return -1;
+    int n = vfs_pread(pid, fd, f->pos, buf, len);
+    if (n > 0) f->pos += (uint32_t)n;
+    return n;
+}
+
+/* Bring the file up to `off` bytes with zeros (write after a far seek) */
+static int zero_fill(const char *path, uint32_t size, uint32_t off) {
+    static const uint8_t zeros[512];
+    while (size < off) {
+        uint32_t n = (off - size < sizeof(zeros)) ? off - size : sizeof(zeros);
+        if (fs_write_at(path, size, zeros, n) < 0) return -1;
+        size += n;
+    }
+    return 0;
+}
+
+int vfs_pwrite(int pid, int fd, uint32_t off, const uint8_t *buf, uint32_t len) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f || !writable(f)) return -1;
+    if (f->type == VFS_TYPE_CONSOLE) return console_write(buf, len);
+    uint32_t size;
+    if (fs_stat(f->path, &size) < 0) return -1;
+    if (off > size && zero_fill(f->path, size, off) < 0) return -1;
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t n = (len - done < VFS_BOUNCE) ? len - done : VFS_BOUNCE;
+        memcpy(bounce, buf + done, n);
+        if (fs_write_at(f->path, off + done, bounce, n) < 0) return done ? (int)done : -1;
+        done += n;
+    }
+    return (int)len;
+}
+
+int vfs_write(int pid, int fd, const uint8_t *buf, uint32_t len) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f) return -1;
+    if ((f->flags & O_APPEND) && f->type == VFS_TYPE_FILE && fs_stat(f->path, &f->pos) < 0)
+        return -1;
+    int n = vfs_pwrite(pid, fd, f->pos, buf, len);
+    if (n > 0 && f->type == VFS_TYPE_FILE) f->pos += (uint32_t)n;
+    return n;
+}
+
+int vfs_lseek(int pid, int fd, int32_t off, int whence) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f || f->type != VFS_TYPE_FILE) return -1;
+    int32_t base;
+    uint32_t size;
+    switch (whence) {
+    case SEEK_SET: base = 0; break;
+    case SEEK_CUR: base = (int32_t)f->pos; break;
+    case SEEK_END:
+        if (fs_stat(f->path, &size) < 0) return -1;
+        base = (int32_t)size;
+        break;
+    default: return -1;
+    }
+    if (base + off < 0) return -1;
+    f->pos = (uint32_t)(base + off);
+    return (int)f->pos;
+}
+
+int vfs_fstat(int pid, int fd, vfs_stat_t *st) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f) return -1;
+    st->type = f->type;
+    st->size = 0;
+    if (f->type == VFS_TYPE_FILE && fs_stat(f->path, &st->size) < 0) return -1;
+    return 0;
+}
+
+int vfs_fsync(int pid, int fd) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f) return -1;
+    return f->type == VFS_TYPE_FILE ? fs_sync(f->path) : 0;
+}
+
+int vfs_close(int pid, int fd) {
+    fd_table_t *t = table(pid, 0);
+    if (!t || fd < 0 || fd >= VFS_MAX_FDS || !t->fd[fd]) return -1;
+    file_put(t->fd[fd]);
+    t->fd[fd] = NULL;
+    return 0;
+}
+
+int vfs_dup(int pid, int fd) {
+    vfs_file_t *f = lookup(pid, fd);
+    fd_table_t *t = table(pid, 0);
+    if (!f || !t) return -1;
+    int nfd = 0;
+    while (nfd < VFS_MAX_FDS && t->fd[nfd]) nfd++;
+    if (nfd == VFS_MAX_FDS) return -1;
+    if (f != &console) f->refs++;
+    t->fd[nfd] = f;
+    return nfd;
+}
+
+const char *vfs_path(int pid, int fd, int write) {
+    vfs_file_t *f = lookup(pid, fd);
+    if (!f || f->type != VFS_TYPE_FILE) return NULL;
+    if (write ? !writable(f) : !readable(f)) return NULL;
+    return f->path;
+}
+
+void vfs_release(int pid) {
+    fd_table_t *t = table(pid, 0);
+    if (!t) return;
+    for (int fd = 0; fd < VFS_MAX_FDS; fd++) {
+        if (t->fd[fd]) file_put(t->fd[fd]);
+    }
+    memset(t, 0, sizeof(*t));
+}
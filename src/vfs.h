@@ -0,0 +1,67 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+
+// File descriptors for user tasks. Each task (by pid) has its own table
+// of descriptors pointing at reference-counted open-file objects, which
+// carry the path, access mode and position. fds 0-2 start out on the
+// console. File data moves through fs_read_at / fs_write_at via a
+// kernel bounce buffer, so the drivers never touch a user address.
+
+#define VFS_MAX_FDS    16      /* per task */
+#define VFS_MAX_FILES  64      /* open-file objects, system wide */
+#define VFS_PATH_LEN   40
+
+// open() flags
+#define O_RDONLY   0x000
+#define O_WRONLY   0x001
+#define O_RDWR     0x002
+#define O_ACCMODE  0x003
+#define O_CREAT    0x040
+#define O_TRUNC    0x200
+#define O_APPEND   0x400
+
+// lseek() whence
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+#define VFS_TYPE_FILE     1
+#define VFS_TYPE_CONSOLE  2
+
+typedef struct {
+    uint32_t size;     // bytes; 0 for the console
+    uint32_t type;     // VFS_TYPE_*
+} vfs_stat_t;
+
+// Open `path` for task `pid`. Returns the lowest free fd, or –1.
+int vfs_open(int pid, const char *path, int flags);
+
+// Read/write at the descriptor's position and advance it. A write past
+// EOF (after lseek) zero-fills the gap. Return bytes moved or –1.
+int vfs_read(int pid, int fd, uint8_t *buf, uint32_t len);
+int vfs_write(int pid, int fd, const uint8_t *buf, uint32_t len);
+
+// Positional variants: `off` instead of the position, which stays put.
+int vfs_pread(int pid, int fd, uint32_t off, uint8_t *buf, uint32_t len);
+int vfs_pwrite(int pid, int fd, uint32_t off, const uint8_t *buf, uint32_t len);
+
+// Returns the new position, or –1 (console, negative result).
+int vfs_lseek(int pid, int fd, int32_t off, int whence);
+
+int vfs_fstat(int pid, int fd, vfs_stat_t *st);
+int vfs_fsync(int pid, int fd);
+int vfs_close(int pid, int fd);
+
+// New fd sharing `fd`'s open file (and so its position). Returns it or –1.
+int vfs_dup(int pid, int fd);
+
+// Path behind `fd` if it is a file opened for reading (`write` = 0) or
+// writing (`write` = 1); NULL otherwise. Valid while the fd stays open.
+const char *vfs_path(int pid, int fd, int write);
+
+// Close every descriptor of `pid` (task exit).
+void vfs_release(int pid);
+
+#endif /* VFS_H */
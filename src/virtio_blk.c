@@ -0,0 +1,387 @@
+#include "virtio_blk.h"
+#include "blkdev.h"
+#include "irq.h"
+#include "paging.h"
+#include "pci.h"
+#include "util.h"
+#include <stddef.h>
+
+#define VIRTIO_VENDOR          0x1AF4
+#define VIRTIO_DEV_BLK         0x1001   /* transitional (legacy-capable) block device */
+
+/* Legacy register block in BAR0 I/O space (no MSI-X) */
+#define VIO_DEV_FEATURES       0x00
+#define VIO_GUEST_FEATURES     0x04
+#define VIO_QUEUE_PFN          0x08
+#define VIO_QUEUE_SIZE         0x0C
+#define VIO_QUEUE_SEL          0x0E
+#define VIO_QUEUE_NOTIFY       0x10
+#define VIO_STATUS             0x12
+#define VIO_ISR                0x13
+#define VIO_BLK_CAPACITY       0x14     /* 64-bit, in 512-byte sectors */
+
+#define VIO_S_ACK              0x01
+#define VIO_S_DRIVER           0x02
+#define VIO_S_DRIVER_OK        0x04
+#define VIO_S_FAILED           0x80
+
+#define VIRTIO_BLK_F_FLUSH     (1u << 9)
+
+#define VRING_DESC_F_NEXT      1
+#define VRING_DESC_F_WRITE     2        /* device writes this buffer */
+#define VRING_USED_F_NO_NOTIFY 1
+#define VRING_ALIGN            4096
+
+#define VBLK_T_IN              0
+#define VBLK_T_OUT             1
+#define VBLK_T_FLUSH           4
+#define VBLK_S_OK              0
+
+#define VBLK_MAX_DEVS          4
+#define VBLK_QUEUE_MAX         256      /* legacy queues cannot be resized */
+#define VBLK_MAX_SEGS          64       /* data descriptors per chain */
+#define VBLK_CHAIN_SECTORS     256      /* synchronous transfers: sectors per chain */
+#define VBLK_BATCH             8        /* chains posted per notify */
+
+#define VRING_ALIGN_UP(x)      (((x) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1))
+#define VRING_BYTES(q)         (VRING_ALIGN_UP(16 * (q) + 6 + 2 * (q)) + VRING_ALIGN_UP(6 + 8 * (q)))
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed)) vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) vring_used_elem_t;
+
+typedef struct {
+    uint16_t          flags;
+    uint16_t          idx;
+    vring_used_elem_t ring[];
+} __attribute__((packed)) vring_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) vblk_hdr_t;
+
+/* Per chain, indexed by its head descriptor */
+typedef struct {
+    blk_request_t    *req;
+    vblk_hdr_t        hdr;
+    volatile uint8_t  status;
+} vblk_slot_t;
+
+typedef struct {
+    uint16_t                iobase;
+    uint16_t                qsize;
+    uint32_t                features;
+    volatile vring_desc_t  *desc;
+    volatile vring_avail_t *avail;
+    volatile vring_used_t  *used;
+    uint16_t                free_head;   /* free descriptors, linked by .next */
+    uint16_t                num_free;
+    uint16_t                last_used;   /* used-ring entries consumed */
+    blkdev_t               *dev;
+    vblk_slot_t             slots[VBLK_QUEUE_MAX];
+} vblk_t;
+
+typedef struct {
+    uint32_t addr, len;
+} vblk_seg_t;
+
+/* Waiter for the chains of one synchronous transfer */
+typedef struct {
+    volatile uint32_t pending;
+    volatile int      status;
+} vblk_wait_t;
+
+static vblk_t  vdevs[VBLK_MAX_DEVS];
+static int     nvdevs;
+static uint8_t rings[VBLK_MAX_DEVS][VRING_BYTES(VBLK_QUEUE_MAX)] __attribute__((aligned(VRING_ALIGN)));
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* x86 keeps stores in order; only the notify check needs a full fence */
+static inline void barrier(void) { asm volatile("" ::: "memory"); }
+static inline void mb(void) { asm volatile("lock; addl $0,(%%esp)" ::: "memory"); }
+
+/* The rings are also touched from the device's IRQ */
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+/* Split [buf, buf+len) into physically contiguous pieces. Returns the
+ * count, or –1 if part of it is unmapped or too scattered. */
+static int map_segments(const uint8_t *buf, uint32_t len, vblk_seg_t *segs) {
+    int n = 0;
+    uint32_t va = (uint32_t)(uintptr_t)buf;
+    while (len) {
+        uint32_t chunk = 4096 - (va & 0xFFF);
+        if (chunk > len) chunk = len;
+        uint32_t pa = paging_phys(va);
+        if (pa == (uint32_t)-1) return -1;
+        if (n && segs[n - 1].addr + segs[n - 1].len == pa) {
+            segs[n - 1].len += chunk;
+        } else {
+            if (n == VBLK_MAX_SEGS) return -1;
+            segs[n].addr = pa;
+            segs[n].len  = chunk;
+            n++;
+        }
+        va += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+static uint16_t take_desc(vblk_t *v, uint32_t addr, uint32_t len, uint16_t flags) {
+    uint16_t d = v->free_head;
+    v->desc[d].addr  = addr;
+    v->desc[d].len   = len;
+    v->desc[d].flags = flags;
+    v->free_head = v->desc[d].next;
+    v->num_free--;
+    return d;
+}
+
+/* Put `req` on the available ring as header + data + status. Descriptors
+ * come off the free list in order, so each one's .next already names
+ * the following one. The device is not notified. Returns 0, or –1 if
+ * the ring is too full or the buffer cannot be mapped. IRQs off. */
+static int post(vblk_t *v, blk_request_t *req, uint32_t type) {
+    vblk_seg_t segs[VBLK_MAX_SEGS];
+    int n = 0;
+    if (type != VBLK_T_FLUSH) {
+        n = map_segments(req->buf, req->count * BLKDEV_BLOCK_SIZE, segs);
+        if (n < 0) return -1;
+    }
+    if (v->num_free < n + 2) return -1;
+
+    uint16_t head = v->free_head;
+    vblk_slot_t *s = &v->slots[head];
+    s->req = req;
+    s->hdr.type     = type;
+    s->hdr.reserved = 0;
+    s->hdr.sector   = req->lba;
+    s->status       = 0xFF;
+
+    take_desc(v, paging_phys((uint32_t)(uintptr_t)&s->hdr), sizeof(s->hdr), VRING_DESC_F_NEXT);
+    uint16_t data_flags = VRING_DESC_F_NEXT | (type == VBLK_T_IN ? VRING_DESC_F_WRITE : 0);
+    for (int i = 0; i < n; i++) take_desc(v, segs[i].addr, segs[i].len, data_flags);
+    take_desc(v, paging_phys((uint32_t)(uintptr_t)&s->status), 1, VRING_DESC_F_WRITE);
+
+    v->avail->ring[v->avail->idx % v->qsize] = head;
+    barrier();
+    v->avail->idx++;
+    return 0;
+}
+
+static void kick(vblk_t *v) {
+    mb();
+    if (!(v->used->flags & VRING_USED_F_NO_NOTIFY)) outw(v->iobase + VIO_QUEUE_NOTIFY, 0);
+}
+
+/* Return a finished chain to the free list */
+static void free_chain(vblk_t *v, uint16_t head) {
+    uint16_t d = head, n = 1;
+    while (v->desc[d].flags & VRING_DESC_F_NEXT) {
+        d = v->desc[d].next;
+        n++;
+    }
+    v->desc[d].next = v->free_head;
+    v->free_head = head;
+    v->num_free += n;
+}
+
+/* Complete everything the device has put on the used ring. IRQs off. */
+static void service(vblk_t *v) {
+    while (v->last_used != v->used->idx) {
+        barrier();
+        uint16_t head = (uint16_t)v->used->ring[v->last_used % v->qsize].id;
+        v->last_used++;
+        vblk_slot_t *s = &v->slots[head];
+        blk_request_t *req = s->req;
+        free_chain(v, head);
+        req->status = (s->status == VBLK_S_OK) ? 0 : -1;
+        if (req->status < 0) v->dev->stats.errors++;
+        if (req->done) req->done(req);   /* may post more work */
+    }
+}
+
+static void vblk_irq(void) {
+    for (int i = 0; i < nvdevs; i++) {
+        (void)inb(vdevs[i].iobase + VIO_ISR);   /* acknowledges the interrupt */
+        service(&vdevs[i]);
+    }
+}
+
+static void sync_done(blk_request_t *req) {
+    vblk_wait_t *w = req->ctx;
+    if (req->status < 0) w->status = -1;
+    w->pending--;
+}
+
+/* Synchronous transfer: post up to VBLK_BATCH chains, notify once, then
+ * poll the used ring with interrupts off (the shell calls in from the
+ * keyboard IRQ). Queued asynchronous requests are completed on the way. */
+static int vblk_transfer(blkdev_t *dev, uint32_t type, uint32_t lba, uint32_t count, uint8_t *buf) {
+    vblk_t *v = dev->priv;
+    blk_request_t reqs[VBLK_BATCH];
+    vblk_wait_t w = { 0, 0 };
+    uint64_t start = rdtsc();
+    uint32_t flags = irq_save();
+    do {
+        /* a flush is a single chain without data */
+        uint32_t n = 0;
+        do {
+            blk_request_t *r = &reqs[n];
+            uint32_t k = (count < VBLK_CHAIN_SECTORS) ? count : VBLK_CHAIN_SECTORS;
+            r->write = (type == VBLK_T_OUT);
+            r->lba   = lba;
+            r->count = k;
+            r->buf   = buf;
+            r->done  = sync_done;
+            r->ctx   = &w;
+            if (post(v, r, type) < 0) break;
+            w.pending++;
+            n++;
+            lba += k;
+            count -= k;
+            buf += k * BLKDEV_BLOCK_SIZE;
+        } while (n < VBLK_BATCH && count);
+        if (!n) {
+            /* ring full of other work: wait for it; empty ring: unmappable buffer */
+            if (v->num_free == v->qsize) w.status = -1;
+            else service(v);
+            continue;
+        }
+        kick(v);
+        while (w.pending) {
+            service(v);
+            asm volatile("pause");
+        }
+    } while (count && w.status == 0);
+    irq_restore(flags);
+    dev->stats.busy_cycles += rdtsc() - start;
+    return w.status;
+}
+
+static int vblk_read(blkdev_t *dev, uint32_t lba, uint32_t count, uint8_t *buf) {
+    if (!count) return 0;
+    return vblk_transfer(dev, VBLK_T_IN, lba, count, buf);
+}
+
+static int vblk_write(blkdev_t *dev, uint32_t lba, uint32_t count, const uint8_t *buf) {
+    if (!count) return 0;
+    return vblk_transfer(dev, VBLK_T_OUT, lba, count, (uint8_t *)buf);
+}
+
+static int vblk_flush(blkdev_t *dev) {
+    vblk_t *v = dev->priv;
+    if (!(v->features & VIRTIO_BLK_F_FLUSH)) return 0;   /* no volatile write cache */
+    return vblk_transfer(dev, VBLK_T_FLUSH, 0, 0, NULL);
+}
+
+static int vblk_submit(blkdev_t *dev, blk_request_t *req) {
+    vblk_t *v = dev->priv;
+    if (!req->count) {
+        req->status = 0;
+        if (req->done) req->done(req);
+        return 0;
+    }
+    uint32_t flags = irq_save();
+    int r = post(v, req, req->write ? VBLK_T_OUT : VBLK_T_IN);
+    if (r == 0) kick(v);
+    irq_restore(flags);
+    return r;
+}
+
+static void vblk_poll(blkdev_t *dev) {
+    uint32_t flags = irq_save();
+    service(dev->priv);
+    irq_restore(flags);
+}
+
+static const blkdev_ops_t vblk_ops = {
+    .read_blocks  = vblk_read,
+    .write_blocks = vblk_write,
+    .flush        = vblk_flush,
+    .submit       = vblk_submit,
+    .poll         = vblk_poll,
+};
+
+/* Legacy initialisation sequence; leaves queue 0 live. Returns the
+ * capacity in sectors (clamped to 32 bits), 0 if the device is unusable. */
+static uint32_t vblk_setup(vblk_t *v, const pci_dev_t *p, uint8_t *ring) {
+    uint16_t io = pci_io_base(p, 0);
+    if (!io) return 0;
+    pci_enable(p);
+    v->iobase = io;
+
+    outb(io + VIO_STATUS, 0);                               /* reset */
+    outb(io + VIO_STATUS, VIO_S_ACK);
+    outb(io + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER);
+    v->features = inl(io + VIO_DEV_FEATURES) & VIRTIO_BLK_F_FLUSH;
+    outl(io + VIO_GUEST_FEATURES, v->features);
+
+    outw(io + VIO_QUEUE_SEL, 0);
+    uint16_t q = inw(io + VIO_QUEUE_SIZE);
+    if (!q || q > VBLK_QUEUE_MAX) {
+        outb(io + VIO_STATUS, VIO_S_FAILED);
+        return 0;
+    }
+    memset(ring, 0, VRING_BYTES(q));
+    v->qsize = q;
+    v->desc  = (volatile vring_desc_t *)ring;
+    v->avail = (volatile vring_avail_t *)(ring + 16 * q);
+    v->used  = (volatile vring_used_t *)(ring + VRING_ALIGN_UP(16 * q + 6 + 2 * q));
+    for (uint16_t i = 0; i < q; i++) v->desc[i].next = (uint16_t)(i + 1);
+    v->free_head = 0;
+    v->num_free  = q;
+    v->last_used = 0;
+    outl(io + VIO_QUEUE_PFN, paging_phys((uint32_t)(uintptr_t)ring) / VRING_ALIGN);
+
+    outb(io + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER | VIO_S_DRIVER_OK);
+    uint32_t lo = inl(io + VIO_BLK_CAPACITY);
+    uint32_t hi = inl(io + VIO_BLK_CAPACITY + 4);
+    return hi ? 0xFFFFFFFFu : lo;
+}
+
+void virtio_blk_init(void) {
+    static const char *names[VBLK_MAX_DEVS] = { "vda", "vdb", "vdc", "vdd" };
+    const pci_dev_t *p;
+    for (int i = 0; nvdevs < VBLK_MAX_DEVS && (p = pci_find(VIRTIO_VENDOR, VIRTIO_DEV_BLK, i)); i++) {
+        vblk_t *v = &vdevs[nvdevs];
+        uint32_t sectors = vblk_setup(v, p, rings[nvdevs]);
+        if (!sectors) continue;
+        v->dev = blkdev_register(names[nvdevs], &vblk_ops, v, sectors);
+        if (!v->dev) {
+            outb(v->iobase + VIO_STATUS, 0);
+            continue;
+        }
+        nvdevs++;
+        if (p->irq < 16) irq_install_handler(p->irq, vblk_irq);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+// virtio-blk over the legacy virtio PCI transport (I/O BAR0), as QEMU
+// presents `-drive if=virtio`. Each request is one descriptor chain in
+// the device's virtqueue (header, one descriptor per physically
+// contiguous piece of the buffer, status byte) and completes from the
+// device's interrupt; synchronous transfers post all their chains with
+// a single notify and then poll the used ring.
+
+// Must be called once at boot, after pci_init(). Registers every disk
+// found as block device "vda", "vdb", ...
+void virtio_blk_init(void);
+
+#endif /* VIRTIO_BLK_H */
@@ -0,0 +1,169 @@
+#include "vm.h"
+#include "paging.h"
+#include "pagecache.h"
+#include "pmm.h"
+#include "util.h"
+#include <stddef.h>
+
+#define PAGE_SIZE  PMM_FRAME_SIZE
+
+/* Page-fault error code bits */
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+
+typedef struct {
+    uint32_t   start, end;     /* [start, end), page aligned; end 0 = free */
+    uint32_t   offset;         /* file offset of `start` */
+    uint32_t   filesz;         /* file bytes behind `start`, zeros after */
+    int        flags;
+    int        pid;
+    uint32_t   space;          /* 0 = the shared window */
+    pc_file_t *file;
+} vm_area_t;
+
+static vm_area_t areas[VM_MAX_AREAS];
+
+/* Window mappings are visible everywhere, fixed ones only in their space */
+static vm_area_t *area_at(uint32_t addr) {
+    uint32_t space = paging_space_current();
+    for (int i = 0; i < VM_MAX_AREAS; i++) {
+        const vm_area_t *a = &areas[i];
+        if (a->end && addr >= a->start && addr < a->end && (!a->space || a->space == space))
+            return &areas[i];
+    }
+    return NULL;
+}
+
+static vm_area_t *free_area(void) {
+    for (int i = 0; i < VM_MAX_AREAS; i++) {
+        if (!areas[i].end) return &areas[i];
+    }
+    return NULL;
+}
+
+/* First fit: lowest gap in the window that holds `len` bytes */
+static uint32_t find_gap(uint32_t len) {
+    uint32_t addr = PAGING_WINDOW_BASE;
+    for (;;) {
+        if (addr + len > PAGING_WINDOW_END || addr + len < addr) return 0;
+        uint32_t next = 0;
+        for (int i = 0; i < VM_MAX_AREAS; i++) {
+            const vm_area_t *a = &areas[i];
+            if (a->end && !a->space && a->start < addr + len && a->end > addr && a->end > next) next = a->end;
+        }
+        if (!next) return addr;
+        addr = next;
+    }
+}
+
+uint32_t vm_mmap(int pid, const char *path, uint32_t len, uint32_t offset, int flags) {
+    if (!len || (offset & (PAGE_SIZE - 1))) return 0;
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE) return 0;
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    vm_area_t *a = free_area();
+    if (!a) return 0;
+    uint32_t addr = find_gap(len);
+    if (!addr) return 0;
+    pc_file_t *f = pc_get(path);
+    if (!f) return 0;
+
+    a->start  = addr;
+    a->end    = addr + len;
+    a->offset = offset;
+    a->filesz = len;
+    a->flags  = flags;
+    a->pid    = pid;
+    a->file   = f;
+    return addr;
+}
+
+int vm_map_fixed(uint32_t space, pc_file_t *file, uint32_t addr, uint32_t len,
+                 uint32_t offset, uint32_t filesz, int flags) {
+    if (!space || !len || ((addr | offset) & (PAGE_SIZE - 1))) return -1;
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE) return -1;
+    /* with nothing to zero, the last page can be the page-cache one too */
+    if (filesz >= len) filesz = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (addr + len < addr) return -1;
+    for (int i = 0; i < VM_MAX_AREAS; i++) {
+        const vm_area_t *a = &areas[i];
+        if (a->end && a->space == space && a->start < addr + len && a->end > addr) return -1;
+    }
+    vm_area_t *a = free_area();
+    if (!a) return -1;
+    a->start  = addr;
+    a->end    = addr + len;
+    a->offset = offset;
+    a->filesz = filesz;
+    a->flags  = flags;
+    a->space  = space;
+    a->file   = pc_ref(file);
+    return 0;
+}
+
+static void unmap_area(vm_area_t *a) {
+    for (uint32_t va = a->start; va < a->end; va += PAGE_SIZE) {
+        uint32_t *pte = paging_pte_in(a->space, va, 0);
+        if (!pte || !(*pte & PG_PRESENT)) continue;
+        /* copies and zero-filled pages belong to the mapping */
+        if (*pte & PG_PRIVATE) pmm_free_frame((*pte & 0xFFFFF000) / PAGE_SIZE);
+        paging_unmap_in(a->space, va);
+    }
+    pc_put(a->file);
+    memset(a, 0, sizeof(*a));
+}
+
+int vm_munmap(int pid, uint32_t addr) {
+    vm_area_t *a = area_at(addr);
+    if (!a || a->space || a->start != addr || a->pid != pid) return -1;
+    unmap_area(a);
+    return 0;
+}
+
+void vm_release(int pid) {
+    for (int i = 0; i < VM_MAX_AREAS; i++) {
+        if (areas[i].end && !areas[i].space && areas[i].pid == pid) unmap_area(&areas[i]);
+    }
+}
+
+void vm_release_space(uint32_t space) {
+    for (int i = 0; i < VM_MAX_AREAS; i++) {
+        if (areas[i].end && space && areas[i].space == space) unmap_area(&areas[i]);
+    }
+}
+
+int vm_handle_fault(uint32_t addr, uint32_t err) {
+    vm_area_t *a = area_at(addr);
+    if (!a) return 0;
+    uint32_t va = addr & ~(PAGE_SIZE - 1);
+    uint32_t rel = va - a->start;
+    uint32_t index = (a->offset + rel) / PAGE_SIZE;
+
+    /* a page wholly inside the file is the page-cache page itself */
+    if (!(err & PF_WRITE) && rel + PAGE_SIZE <= a->filesz) {
+        if (err & PF_PRESENT) return 0;               /* protection fault on a read */
+        uint32_t pa = pc_page(a->file, index);
+        if (!pa) return 0;                            /* past EOF */
+        return paging_map_in(a->space, va, pa, PG_USER) == 0;
+    }
+    if ((err & PF_WRITE) && a->flags != MAP_PRIVATE) return 0;   /* shared maps are read-only */
+
+    /* otherwise a frame of its own: a COW break, or the page holding the
+     * end of the file data, zero-filled past it */
+    uint32_t n = a->filesz > rel ? a->filesz - rel : 0;
+    if (n > PAGE_SIZE) n = PAGE_SIZE;
+    uint32_t src = 0;
+    if (n && !(src = pc_page(a->file, index))) return 0;
+    uint32_t fr = pmm_alloc_frame();
+    if (fr == (uint32_t)-1) return 0;
+    uint8_t *page = (uint8_t *)(uintptr_t)(fr * PAGE_SIZE);
+    if (n) memcpy(page, (const void *)(uintptr_t)src, n);
+    if (n < PAGE_SIZE) memset(page + n, 0, PAGE_SIZE - n);
+    uint32_t fl = PG_USER | PG_PRIVATE | (a->flags == MAP_PRIVATE ? PG_RW : 0);
+    if (paging_map_in(a->space, va, fr * PAGE_SIZE, fl) < 0) {
+        pmm_free_frame(fr);
+        return 0;
+    }
+    return 1;
+}
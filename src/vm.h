@@ -0,0 +1,43 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include "pagecache.h"
+
+// File mappings in the demand-paged window (PAGING_WINDOW_BASE..END).
+// Pages are not touched until first access; the page-fault handler
+// then maps the page-cache page itself.
+
+#define MAP_SHARED   1   /* read-only view of the page-cache pages */
+#define MAP_PRIVATE  2   /* copy-on-write: first store copies the page */
+
+#define VM_MAX_AREAS 32
+
+// Map `len` bytes of `path` starting at byte `offset` (page aligned)
+// for task `pid`. Returns the user address, or 0 on failure.
+uint32_t vm_mmap(int pid, const char *path, uint32_t len, uint32_t offset, int flags);
+
+// Map `len` bytes at the fixed, page-aligned `addr` of address space
+// `space` (a program segment): the first `filesz` bytes are `file` from
+// byte `offset` on, the rest reads as zeros. MAP_SHARED pages are the
+// page-cache pages, read-only; MAP_PRIVATE ones share them until the
+// first store. Returns 0, or –1 if the range is taken or no area is free.
+int vm_map_fixed(uint32_t space, pc_file_t *file, uint32_t addr, uint32_t len,
+                 uint32_t offset, uint32_t filesz, int flags);
+
+// Remove the mapping that starts at `addr`. Private copies are freed,
+// page-cache pages stay cached. Returns 0, or –1 if `addr` is not the
+// start of one of `pid`'s mappings.
+int vm_munmap(int pid, uint32_t addr);
+
+// Drop every window mapping owned by `pid` (task exit).
+void vm_release(int pid);
+
+// Drop every fixed mapping in address space `space`.
+void vm_release_space(uint32_t space);
+
+// Page-fault hook: returns 1 if the fault at `addr` (error code `err`)
+// was a demand fill or COW break and the access can be retried.
+int vm_handle_fault(uint32_t addr, uint32_t err);
+
+#endif /* VM_H */